@@ -28,6 +28,7 @@
 #include <gsl/gsl_math.h>
 
 #include "msprime.h"
+#include "rng.h"
 
 #if PY_MAJOR_VERSION >= 3
 #define IS_PY3K
@@ -611,11 +612,14 @@ static int
 RandomGenerator_init(RandomGenerator *self, PyObject *args, PyObject *kwds)
 {
     int ret = -1;
-    static char *kwlist[] = {"seed", NULL};
+    static char *kwlist[] = {"seed", "algorithm", NULL};
     unsigned long long seed = 0;
+    const char *algorithm = NULL;
+    const gsl_rng_type *rng_type = gsl_rng_default;
 
     self->rng  = NULL;
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "K", kwlist, &seed)) {
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "K|z", kwlist, &seed,
+                &algorithm)) {
         goto out;
     }
     if (seed == 0 || seed >= (1ULL<<32)) {
@@ -623,8 +627,21 @@ RandomGenerator_init(RandomGenerator *self, PyObject *args, PyObject *kwds)
             "seeds must be greater than 0 and less than 2^32");
         goto out;
     }
+    if (algorithm != NULL) {
+        if (strcmp(algorithm, "philox") == 0) {
+            rng_type = rng_philox;
+        } else {
+            PyErr_Format(PyExc_ValueError, "Unknown algorithm '%s'",
+                    algorithm);
+            goto out;
+        }
+    }
     self->seed = seed;
-    self->rng = gsl_rng_alloc(gsl_rng_default);
+    self->rng = gsl_rng_alloc(rng_type);
+    if (self->rng == NULL) {
+        PyErr_NoMemory();
+        goto out;
+    }
     gsl_rng_set(self->rng, self->seed);
     ret = 0;
 out:
@@ -644,6 +661,55 @@ out:
     return ret;
 }
 
+static PyObject *
+RandomGenerator_set_stream(RandomGenerator *self, PyObject *args)
+{
+    int err;
+    PyObject *ret = NULL;
+    Py_ssize_t replicate = 0;
+    Py_ssize_t chunk = 0;
+
+    if (RandomGenerator_check_state(self) != 0) {
+        goto out;
+    }
+    if (!PyArg_ParseTuple(args, "n|n", &replicate, &chunk)) {
+        goto out;
+    }
+    if (replicate < 0 || (unsigned long long) replicate > UINT32_MAX
+            || chunk < 0 || (unsigned long long) chunk > UINT32_MAX) {
+        PyErr_SetString(PyExc_ValueError,
+            "replicate and chunk must be between 0 and 2^32 - 1");
+        goto out;
+    }
+    if (self->rng->type != rng_philox) {
+        PyErr_SetString(PyExc_ValueError,
+            "Streams are only supported by the philox algorithm");
+        goto out;
+    }
+    err = rng_set_stream(self->rng, self->seed, (uint32_t) replicate,
+            (uint32_t) chunk);
+    if (err != 0) {
+        handle_library_error(err);
+        goto out;
+    }
+    ret = Py_BuildValue("");
+out:
+    return ret;
+}
+
+static PyObject *
+RandomGenerator_get_algorithm(RandomGenerator *self)
+{
+    PyObject *ret = NULL;
+
+    if (RandomGenerator_check_state(self) != 0) {
+        goto out;
+    }
+    ret = Py_BuildValue("s", gsl_rng_name(self->rng));
+out:
+    return ret;
+}
+
 static PyMemberDef RandomGenerator_members[] = {
     {NULL}  /* Sentinel */
 };
@@ -651,6 +717,11 @@ static PyMemberDef RandomGenerator_members[] = {
 static PyMethodDef RandomGenerator_methods[] = {
     {"get_seed", (PyCFunction) RandomGenerator_get_seed,
         METH_NOARGS, "Returns the random seed for this generator."},
+    {"set_stream", (PyCFunction) RandomGenerator_set_stream,
+        METH_VARARGS,
+        "Moves to the start of the specified (replicate, chunk) stream."},
+    {"get_algorithm", (PyCFunction) RandomGenerator_get_algorithm,
+        METH_NOARGS, "Returns the name of the generator algorithm."},
     {NULL}  /* Sentinel */
 };
 
@@ -761,6 +832,89 @@ out:
     return ret;
 }
 
+static int
+Simulator_parse_sparse_migration_matrix(Simulator *self,
+        PyObject *py_migration_matrix)
+{
+    int ret = -1;
+    int err;
+    long tmp_long;
+    Py_ssize_t j, k, size;
+    PyObject *entry, *value;
+    uint32_t *source = NULL;
+    uint32_t *dest = NULL;
+    double *rate = NULL;
+    uint32_t *pops[2];
+
+    size = PyList_Size(py_migration_matrix);
+    source = PyMem_Malloc((size + 1) * sizeof(uint32_t));
+    dest = PyMem_Malloc((size + 1) * sizeof(uint32_t));
+    rate = PyMem_Malloc((size + 1) * sizeof(double));
+    if (source == NULL || dest == NULL || rate == NULL) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    if (Simulator_check_sim(self) != 0) {
+        goto out;
+    }
+    pops[0] = source;
+    pops[1] = dest;
+    for (j = 0; j < size; j++) {
+        entry = PyList_GetItem(py_migration_matrix, j);
+        if (!PyTuple_Check(entry)) {
+            PyErr_SetString(PyExc_TypeError, "not a tuple");
+            goto out;
+        }
+        if (PyTuple_Size(entry) != 3) {
+            PyErr_SetString(PyExc_ValueError,
+                    "migration matrix entry must be (source,dest,rate) tuple");
+            goto out;
+        }
+        for (k = 0; k < 2; k++) {
+            value = PyTuple_GetItem(entry, k);
+            if (!PyNumber_Check(value)) {
+                PyErr_Format(PyExc_TypeError, "Population ID not a number");
+                goto out;
+            }
+            tmp_long = PyLong_AsLong(value);
+            if (tmp_long < 0) {
+                PyErr_SetString(PyExc_ValueError,
+                        "negative population IDs not valid");
+                goto out;
+            }
+            pops[k][j] = (uint32_t) tmp_long;
+        }
+        value = PyTuple_GetItem(entry, 2);
+        if (!PyNumber_Check(value)) {
+            PyErr_Format(PyExc_TypeError, "Migration rate not a number");
+            goto out;
+        }
+        rate[j] = PyFloat_AsDouble(value);
+        if (rate[j] < 0.0) {
+            PyErr_Format(PyExc_ValueError, "Negative values not permitted");
+            goto out;
+        }
+    }
+    err = msp_set_sparse_migration_matrix(self->sim, (size_t) size, source,
+            dest, rate);
+    if (err != 0) {
+        handle_input_error(err);
+        goto out;
+    }
+    ret = 0;
+out:
+    if (source != NULL) {
+        PyMem_Free(source);
+    }
+    if (dest != NULL) {
+        PyMem_Free(dest);
+    }
+    if (rate != NULL) {
+        PyMem_Free(rate);
+    }
+    return ret;
+}
+
 static int
 Simulator_parse_migration_matrix(Simulator *self,
         PyObject *py_migration_matrix)
@@ -1038,9 +1192,11 @@ Simulator_init(Simulator *self, PyObject *args, PyObject *kwds)
         "population_configuration", "migration_matrix", "demographic_events",
         "model", "max_memory", "avl_node_block_size", "segment_block_size",
         "node_mapping_block_size", "coalescence_record_block_size",
-        "migration_record_block_size", "store_migration_records", NULL};
+        "migration_record_block_size", "store_migration_records",
+        "sparse_migration_matrix", "sequential", NULL};
     PyObject *py_samples = NULL;
     PyObject *migration_matrix = NULL;
+    PyObject *sparse_migration_matrix = NULL;
     PyObject *population_configuration = NULL;
     PyObject *demographic_events = NULL;
     char *model_str = NULL;
@@ -1058,10 +1214,11 @@ Simulator_init(Simulator *self, PyObject *args, PyObject *kwds)
     Py_ssize_t coalescence_record_block_size = 10;
     Py_ssize_t migration_record_block_size = 10;
     int store_migration_records = 0;
+    int sequential = 0;
 
     self->sim = NULL;
     self->random_generator = NULL;
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O!|ndO!O!O!snnnnnni", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O!|ndO!O!O!snnnnnniO!i", kwlist,
             &PyList_Type, &py_samples,
             &RandomGeneratorType, &random_generator,
             &num_loci, &scaled_recombination_rate,
@@ -1070,7 +1227,8 @@ Simulator_init(Simulator *self, PyObject *args, PyObject *kwds)
             &PyList_Type, &demographic_events,
             &model_str, &max_memory, &avl_node_block_size, &segment_block_size,
             &node_mapping_block_size, &coalescence_record_block_size,
-            &migration_record_block_size, &store_migration_records)) {
+            &migration_record_block_size, &store_migration_records,
+            &PyList_Type, &sparse_migration_matrix, &sequential)) {
         goto out;
     }
     self->random_generator = random_generator;
@@ -1107,6 +1265,11 @@ Simulator_init(Simulator *self, PyObject *args, PyObject *kwds)
         handle_input_error(sim_ret);
         goto out;
     }
+    sim_ret = msp_set_sequential(self->sim, (bool) sequential);
+    if (sim_ret != 0) {
+        handle_input_error(sim_ret);
+        goto out;
+    }
     sim_ret = msp_set_num_loci(self->sim, (size_t) num_loci);
     if (sim_ret != 0) {
         handle_input_error(sim_ret);
@@ -1158,17 +1321,30 @@ Simulator_init(Simulator *self, PyObject *args, PyObject *kwds)
                 population_configuration) != 0) {
             goto out;
         }
-        if (migration_matrix == NULL) {
+        if (migration_matrix != NULL && sparse_migration_matrix != NULL) {
             PyErr_SetString(PyExc_ValueError,
-                "A migration matrix must be provided when a non-default "
-                "population configuration is used.");
+                "Cannot supply both migration_matrix and "
+                "sparse_migration_matrix.");
             goto out;
         }
-        if (Simulator_parse_migration_matrix(self,
-                migration_matrix) != 0) {
-            goto out;
+        if (sparse_migration_matrix != NULL) {
+            if (Simulator_parse_sparse_migration_matrix(self,
+                    sparse_migration_matrix) != 0) {
+                goto out;
+            }
+        } else {
+            if (migration_matrix == NULL) {
+                PyErr_SetString(PyExc_ValueError,
+                    "A migration matrix must be provided when a non-default "
+                    "population configuration is used.");
+                goto out;
+            }
+            if (Simulator_parse_migration_matrix(self,
+                    migration_matrix) != 0) {
+                goto out;
+            }
         }
-    } else if (migration_matrix != NULL) {
+    } else if (migration_matrix != NULL || sparse_migration_matrix != NULL) {
         PyErr_SetString(PyExc_ValueError,
             "Cannot supply migration_matrix without "
             "population_configuration.");
@@ -1234,6 +1410,18 @@ out:
     return ret;
 }
 
+static PyObject *
+Simulator_get_sequential(Simulator *self)
+{
+    PyObject *ret = NULL;
+    if (Simulator_check_sim(self) != 0) {
+        goto out;
+    }
+    ret = Py_BuildValue("i", (int) msp_get_sequential(self->sim));
+out:
+    return ret;
+}
+
 static PyObject *
 Simulator_get_sample_size(Simulator *self)
 {
@@ -1515,6 +1703,55 @@ out:
     return ret;
 }
 
+static PyObject *
+Simulator_get_num_transient_allocations(Simulator  *self)
+{
+    PyObject *ret = NULL;
+    if (Simulator_check_sim(self) != 0) {
+        goto out;
+    }
+    ret = Py_BuildValue("n",
+            (Py_ssize_t) msp_get_num_transient_allocations(self->sim));
+out:
+    return ret;
+}
+
+static PyObject *
+Simulator_get_profile(Simulator  *self)
+{
+    PyObject *ret = NULL;
+    int err;
+    msp_profile_t profile;
+
+    if (Simulator_check_sim(self) != 0) {
+        goto out;
+    }
+    err = msp_get_profile(self->sim, &profile);
+    if (err != 0) {
+        handle_library_error(err);
+        goto out;
+    }
+    ret = Py_BuildValue(
+            "{s:O,s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:n,s:n,s:L,s:n,s:d}",
+            "enabled", profile.enabled ? Py_True : Py_False,
+            "recombination_time", profile.recombination_time,
+            "common_ancestor_time", profile.common_ancestor_time,
+            "migration_time", profile.migration_time,
+            "demographic_time", profile.demographic_time,
+            "sampling_time", profile.sampling_time,
+            "merge_overlap_count_time", profile.merge_overlap_count_time,
+            "merge_compress_time", profile.merge_compress_time,
+            "merge_defrag_time", profile.merge_defrag_time,
+            "max_num_ancestors", (Py_ssize_t) profile.max_num_ancestors,
+            "max_num_segments", (Py_ssize_t) profile.max_num_segments,
+            "max_num_links", (PY_LONG_LONG) profile.max_num_links,
+            "max_num_overlap_nodes", (Py_ssize_t) profile.max_num_overlap_nodes,
+            "overlap_node_heap_fragmentation",
+            profile.overlap_node_heap_fragmentation);
+out:
+    return ret;
+}
+
 static PyObject *
 Simulator_get_used_memory(Simulator  *self)
 {
@@ -1579,7 +1816,7 @@ Simulator_individual_to_python(Simulator *self, segment_t *ind)
     u = ind;
     while (u != NULL) {
         num_segments++;
-        u = u->next;
+        u = msp_get_next_segment(self->sim, u);
     }
     l = PyList_New(num_segments);
     if (l == NULL) {
@@ -1596,7 +1833,7 @@ Simulator_individual_to_python(Simulator *self, segment_t *ind)
         }
         PyList_SET_ITEM(l, j, t);
         j++;
-        u = u->next;
+        u = msp_get_next_segment(self->sim, u);
     }
     ret = l;
 out:
@@ -1973,6 +2210,8 @@ static PyMethodDef Simulator_methods[] = {
     {"get_store_migration_records",
             (PyCFunction) Simulator_get_store_migration_records, METH_NOARGS,
             "Returns True if the simulator should store migration records." },
+    {"get_sequential", (PyCFunction) Simulator_get_sequential, METH_NOARGS,
+            "Returns True if the simulator moves along the sequence." },
     {"get_sample_size", (PyCFunction) Simulator_get_sample_size, METH_NOARGS,
             "Returns the sample size" },
     {"get_num_populations", (PyCFunction) Simulator_get_num_populations, METH_NOARGS,
@@ -2033,6 +2272,9 @@ static PyMethodDef Simulator_methods[] = {
     {"get_num_migration_record_blocks",
             (PyCFunction) Simulator_get_num_migration_record_blocks, METH_NOARGS,
             "Returns the number of coalescence record memory blocks"},
+    {"get_num_transient_allocations",
+            (PyCFunction) Simulator_get_num_transient_allocations, METH_NOARGS,
+            "Returns the number of allocations of per-event scratch memory"},
     {"get_num_breakpoints", (PyCFunction) Simulator_get_num_breakpoints,
             METH_NOARGS, "Returns the number of recombination breakpoints" },
     {"get_num_coalescence_records",
@@ -2043,6 +2285,9 @@ static PyMethodDef Simulator_methods[] = {
             METH_NOARGS, "Returns the number of migration records" },
     {"get_used_memory", (PyCFunction) Simulator_get_used_memory,
             METH_NOARGS, "Returns the approximate amount of memory used." },
+    {"get_profile", (PyCFunction) Simulator_get_profile, METH_NOARGS,
+            "Returns the time spent on each type of event and the peak "
+            "sizes of the simulation state, if profiling is compiled in." },
     {"get_ancestors", (PyCFunction) Simulator_get_ancestors, METH_NOARGS,
             "Returns the ancestors" },
     {"get_breakpoints", (PyCFunction) Simulator_get_breakpoints,
@@ -2476,21 +2721,24 @@ TreeSequence_init(TreeSequence *self, PyObject *args, PyObject *kwds)
 }
 
 static PyObject *
-TreeSequence_create(TreeSequence *self, PyObject *args)
+TreeSequence_create(TreeSequence *self, PyObject *args, PyObject *kwds)
 {
     int err;
     PyObject *ret = NULL;
     Simulator *sim = NULL;
     RecombinationMap *recomb_map = NULL;
     double Ne = 0.25; /* default to 1/4 for coalescent time units. */
+    int adopt = 0;
+    static char *kwlist[] = {"simulator", "recombination_map", "Ne", "adopt",
+        NULL};
 
     if (self->tree_sequence != NULL) {
         PyErr_SetString(PyExc_ValueError, "tree_sequence already created");
         goto out;
     }
-    if (!PyArg_ParseTuple(args, "O!O!|d",
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O!|di", kwlist,
                 &SimulatorType, &sim,
-                &RecombinationMapType, &recomb_map, &Ne)) {
+                &RecombinationMapType, &recomb_map, &Ne, &adopt)) {
         goto out;
     }
     if (Simulator_check_sim(sim) != 0) {
@@ -2509,8 +2757,17 @@ TreeSequence_create(TreeSequence *self, PyObject *args)
         goto out;
     }
     memset(self->tree_sequence, 0, sizeof(tree_sequence_t));
-    err = tree_sequence_create(self->tree_sequence, sim->sim,
-            recomb_map->recomb_map, Ne);
+    Py_BEGIN_ALLOW_THREADS
+    if (adopt) {
+        /* The simulator's records are handed over rather than copied, so
+         * it has none left until it is reset and run again. */
+        err = tree_sequence_adopt_simulation(self->tree_sequence, sim->sim,
+                recomb_map->recomb_map, Ne);
+    } else {
+        err = tree_sequence_create(self->tree_sequence, sim->sim,
+                recomb_map->recomb_map, Ne);
+    }
+    Py_END_ALLOW_THREADS
     if (err != 0) {
         PyMem_Free(self->tree_sequence);
         self->tree_sequence = NULL;
@@ -2529,18 +2786,27 @@ TreeSequence_dump(TreeSequence *self, PyObject *args, PyObject *kwds)
     char *path;
     PyObject *ret = NULL;
     int zlib_compression = 0;
+    int native_format = 0;
+    int varint_encoding = 0;
     int flags = 0;
-    static char *kwlist[] = {"path", "zlib_compression", NULL};
+    static char *kwlist[] = {"path", "zlib_compression", "native_format",
+        "varint_encoding", NULL};
 
     if (TreeSequence_check_tree_sequence(self) != 0) {
         goto out;
     }
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|i", kwlist,
-                &path, &zlib_compression)) {
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|iii", kwlist,
+                &path, &zlib_compression, &native_format, &varint_encoding)) {
         goto out;
     }
     if (zlib_compression) {
-        flags = MSP_ZLIB_COMPRESSION;
+        flags |= MSP_ZLIB_COMPRESSION;
+    }
+    if (native_format) {
+        flags |= MSP_NATIVE_FORMAT;
+    }
+    if (varint_encoding) {
+        flags |= MSP_VARINT_ENCODING;
     }
     /* Silence the low-level error reporting HDF5 */
     if (H5Eset_auto(H5E_DEFAULT, NULL, NULL) < 0) {
@@ -2643,17 +2909,21 @@ TreeSequence_load(TreeSequence *self, PyObject *args, PyObject *kwds)
     int err;
     char *path;
     int flags = 0;
+    int lazy = 0;
     PyObject *ret = NULL;
-    static char *kwlist[] = {"path", NULL};
+    static char *kwlist[] = {"path", "lazy", NULL};
 
     if (self->tree_sequence != NULL) {
         PyErr_SetString(PyExc_ValueError, "TreeSequence already initialised");
         goto out;
     }
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist,
-                &path)) {
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|i", kwlist,
+                &path, &lazy)) {
         goto out;
     }
+    if (lazy) {
+        flags |= MSP_LOAD_LAZY;
+    }
     self->tree_sequence = PyMem_Malloc(sizeof(tree_sequence_t));
     if (self->tree_sequence == NULL) {
         PyErr_NoMemory();
@@ -2709,7 +2979,9 @@ TreeSequence_generate_mutations(TreeSequence *self,
         handle_library_error(err);
         goto out;
     }
+    Py_BEGIN_ALLOW_THREADS
     err = mutgen_generate(mutgen);
+    Py_END_ALLOW_THREADS
     if (err != 0) {
         handle_library_error(err);
         goto out;
@@ -3155,12 +3427,27 @@ out:
     return ret;
 }
 
+static PyObject *
+TreeSequence_get_loaded_columns(TreeSequence  *self)
+{
+    PyObject *ret = NULL;
+    int columns;
+
+    if (TreeSequence_check_tree_sequence(self) != 0) {
+        goto out;
+    }
+    columns = tree_sequence_get_loaded_columns(self->tree_sequence);
+    ret = Py_BuildValue("i", columns);
+out:
+    return ret;
+}
+
 static PyMemberDef TreeSequence_members[] = {
     {NULL}  /* Sentinel */
 };
 
 static PyMethodDef TreeSequence_methods[] = {
-    {"create", (PyCFunction) TreeSequence_create, METH_VARARGS,
+    {"create", (PyCFunction) TreeSequence_create, METH_VARARGS|METH_KEYWORDS,
         "Creates a new TreeSequence from the specified simulator."},
     {"dump", (PyCFunction) TreeSequence_dump,
         METH_VARARGS|METH_KEYWORDS,
@@ -3183,6 +3470,9 @@ static PyMethodDef TreeSequence_methods[] = {
         METH_NOARGS, "Returns the list of provenance strings."},
     {"get_mutations", (PyCFunction) TreeSequence_get_mutations,
         METH_NOARGS, "Returns the list of mutations"},
+    {"get_loaded_columns", (PyCFunction) TreeSequence_get_loaded_columns,
+        METH_NOARGS,
+        "Returns the groups of columns that have been read from file."},
     {"get_record", (PyCFunction) TreeSequence_get_record, METH_VARARGS,
         "Returns the record at the specified index."},
     {"get_migration_record",
@@ -3688,12 +3978,20 @@ static PyObject *
 SparseTree_get_mutations(SparseTree *self, PyObject *args)
 {
     PyObject *ret = NULL;
+    int err;
+    mutation_t *mutations;
+    size_t num_mutations;
 
     if (SparseTree_check_sparse_tree(self) != 0) {
         goto out;
     }
-    ret = convert_mutations(self->sparse_tree->mutations,
-            self->sparse_tree->num_mutations);
+    err = sparse_tree_get_mutations(self->sparse_tree, &num_mutations,
+            &mutations);
+    if (err != 0) {
+        handle_library_error(err);
+        goto out;
+    }
+    ret = convert_mutations(mutations, num_mutations);
 out:
     return ret;
 }
@@ -3702,11 +4000,20 @@ static PyObject *
 SparseTree_get_num_mutations(SparseTree  *self)
 {
     PyObject *ret = NULL;
+    int err;
+    mutation_t *mutations;
+    size_t num_mutations;
 
     if (SparseTree_check_sparse_tree(self) != 0) {
         goto out;
     }
-    ret = Py_BuildValue("n", (Py_ssize_t) self->sparse_tree->num_mutations);
+    err = sparse_tree_get_mutations(self->sparse_tree, &num_mutations,
+            &mutations);
+    if (err != 0) {
+        handle_library_error(err);
+        goto out;
+    }
+    ret = Py_BuildValue("n", (Py_ssize_t) num_mutations);
 out:
     return ret;
 }
@@ -5268,6 +5575,12 @@ init_msprime(void)
     /* Tree flags */
     PyModule_AddIntConstant(module, "LEAF_COUNTS", MSP_LEAF_COUNTS);
     PyModule_AddIntConstant(module, "LEAF_LISTS", MSP_LEAF_LISTS);
+    /* Column groups */
+    PyModule_AddIntConstant(module, "COLUMNS_NODES", MSP_COLUMNS_NODES);
+    PyModule_AddIntConstant(module, "COLUMNS_RECORDS", MSP_COLUMNS_RECORDS);
+    PyModule_AddIntConstant(module, "COLUMNS_MUTATIONS", MSP_COLUMNS_MUTATIONS);
+    PyModule_AddIntConstant(module, "COLUMNS_PROVENANCE", MSP_COLUMNS_PROVENANCE);
+    PyModule_AddIntConstant(module, "COLUMNS_ALL", MSP_COLUMNS_ALL);
     /* Directions */
     PyModule_AddIntConstant(module, "FORWARD", MSP_DIR_FORWARD);
     PyModule_AddIntConstant(module, "REVERSE", MSP_DIR_REVERSE);
@@ -0,0 +1,796 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* We need clock_gettime to measure the wall time of ms. */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <time.h>
+#include <float.h>
+#include <limits.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_randist.h>
+
+#include "msprime.h"
+#include "object_heap.h"
+#include "err.h"
+
+/* Micro-benchmarks for the internal data structures used by the
+ * simulator. This is intended for development use only.
+ */
+
+static void
+fatal_error(const char *msg, ...)
+{
+    va_list argp;
+    fprintf(stderr, "benchmark:");
+    va_start(argp, msg);
+    vfprintf(stderr, msg, argp);
+    va_end(argp);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+static double
+get_cpu_time(clock_t start)
+{
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double
+get_wall_time(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) t.tv_sec + 1e-9 * (double) t.tv_nsec;
+}
+
+static int
+cmp_pointer(const void *a, const void *b) {
+    return (a > b) - (a < b);
+}
+
+/* Lineage selection. We simulate the pattern of accesses made by common
+ * ancestor events on a population of n lineages: pick two lineages
+ * uniformly, remove them, and insert a new lineage in their place. We
+ * compare the AVL tree that was originally used to store the population
+ * with the array-backed lineage_set_t.
+ */
+
+static double
+benchmark_avl_lineages(gsl_rng *rng, size_t n, size_t num_events)
+{
+    size_t j, k, e;
+    avl_tree_t tree;
+    avl_node_t *nodes = malloc(n * sizeof(avl_node_t));
+    avl_node_t *x, *y, *node;
+    char *items = malloc(n + num_events);
+    clock_t start;
+
+    if (nodes == NULL || items == NULL) {
+        fatal_error("no memory");
+    }
+    avl_init_tree(&tree, cmp_pointer, NULL);
+    for (j = 0; j < n; j++) {
+        avl_init_node(&nodes[j], items + j);
+        node = avl_insert_node(&tree, &nodes[j]);
+        assert(node != NULL);
+    }
+    start = clock();
+    for (e = 0; e < num_events; e++) {
+        j = gsl_rng_uniform_int(rng, n);
+        x = avl_at(&tree, (unsigned int) j);
+        avl_unlink_node(&tree, x);
+        k = gsl_rng_uniform_int(rng, n - 1);
+        y = avl_at(&tree, (unsigned int) k);
+        avl_unlink_node(&tree, y);
+        /* Insert a new lineage and put y back so that the population
+         * size stays at n. */
+        avl_init_node(x, items + n + e);
+        node = avl_insert_node(&tree, x);
+        assert(node != NULL);
+        avl_init_node(y, y->item);
+        node = avl_insert_node(&tree, y);
+        assert(node != NULL);
+    }
+    free(nodes);
+    free(items);
+    return get_cpu_time(start);
+}
+
+static double
+benchmark_lineage_set_lineages(gsl_rng *rng, size_t n, size_t num_events)
+{
+    int ret;
+    size_t j, k, e;
+    lineage_set_t set;
+    uint32_t y;
+    clock_t start;
+
+    ret = lineage_set_alloc(&set, n);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    for (j = 0; j < n; j++) {
+        lineage_set_insert(&set, (uint32_t) j);
+    }
+    start = clock();
+    for (e = 0; e < num_events; e++) {
+        j = gsl_rng_uniform_int(rng, n);
+        k = gsl_rng_uniform_int(rng, n - 1);
+        if (k >= j) {
+            k++;
+        }
+        y = lineage_set_get_item(&set, k);
+        lineage_set_remove(&set, GSL_MAX(j, k));
+        lineage_set_remove(&set, GSL_MIN(j, k));
+        lineage_set_insert(&set, (uint32_t) (n + e));
+        lineage_set_insert(&set, y);
+    }
+    lineage_set_free(&set);
+    return get_cpu_time(start);
+}
+
+static void
+run_lineage_set_benchmark(size_t max_n, size_t num_events)
+{
+    size_t n;
+    double avl_time, set_time;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    if (rng == NULL) {
+        fatal_error("no memory");
+    }
+    printf("n\tavl\tlineage_set\tspeedup\n");
+    for (n = 1000; n <= max_n; n *= 10) {
+        gsl_rng_set(rng, 1);
+        avl_time = benchmark_avl_lineages(rng, n, num_events);
+        gsl_rng_set(rng, 1);
+        set_time = benchmark_lineage_set_lineages(rng, n, num_events);
+        printf("%d\t%.3f\t%.3f\t%.1f\n", (int) n, avl_time, set_time,
+                avl_time / set_time);
+    }
+    gsl_rng_free(rng);
+}
+
+/* Ordered maps. We simulate the pattern of accesses made to the overlap
+ * counts by common ancestor events on a map with n entries: find the entry
+ * to the left of a random locus, insert a copy of it at that locus, update
+ * the values of the entries that follow and remove one of them, as
+ * msp_compress_overlap_counts does. We compare the AVL tree of node
+ * mappings that was originally used with the B-tree.
+ */
+
+#define ORDERED_MAP_SCAN 8
+
+static int
+cmp_node_mapping(const void *a, const void *b) {
+    const node_mapping_t *ia = (const node_mapping_t *) a;
+    const node_mapping_t *ib = (const node_mapping_t *) b;
+    return (ia->left > ib->left) - (ia->left < ib->left);
+}
+
+static double
+benchmark_avl_map(gsl_rng *rng, size_t n, size_t num_events)
+{
+    size_t j, e, num_nodes;
+    uint32_t k;
+    avl_tree_t tree;
+    avl_node_t *nodes = malloc((n + num_events) * sizeof(avl_node_t));
+    node_mapping_t *mappings = malloc(
+            (n + num_events) * sizeof(node_mapping_t));
+    avl_node_t *node, *next;
+    node_mapping_t search, *nm;
+    clock_t start;
+
+    if (nodes == NULL || mappings == NULL) {
+        fatal_error("no memory");
+    }
+    avl_init_tree(&tree, cmp_node_mapping, NULL);
+    /* Key 0 is always present, so every locus has an entry to its left. */
+    num_nodes = 0;
+    while (num_nodes < n) {
+        mappings[num_nodes].left = num_nodes == 0 ? 0
+            : (uint32_t) gsl_rng_get(rng);
+        mappings[num_nodes].value = 0;
+        avl_init_node(&nodes[num_nodes], &mappings[num_nodes]);
+        if (avl_insert_node(&tree, &nodes[num_nodes]) != NULL) {
+            num_nodes++;
+        }
+    }
+    start = clock();
+    for (e = 0; e < num_events; e++) {
+        k = (uint32_t) gsl_rng_get(rng);
+        search.left = k;
+        avl_search_closest(&tree, &search, &node);
+        nm = (node_mapping_t *) node->item;
+        if (nm->left > k) {
+            node = node->prev;
+            nm = (node_mapping_t *) node->item;
+        }
+        if (nm->left != k) {
+            mappings[num_nodes].left = k;
+            mappings[num_nodes].value = nm->value;
+            avl_init_node(&nodes[num_nodes], &mappings[num_nodes]);
+            node = avl_insert_node(&tree, &nodes[num_nodes]);
+            assert(node != NULL);
+            num_nodes++;
+        }
+        for (j = 0; j < ORDERED_MAP_SCAN && node->next != NULL; j++) {
+            node = node->next;
+            ((node_mapping_t *) node->item)->value++;
+        }
+        next = node->next;
+        if (next != NULL) {
+            avl_unlink_node(&tree, next);
+        }
+    }
+    free(nodes);
+    free(mappings);
+    return get_cpu_time(start);
+}
+
+static double
+benchmark_btree_map(gsl_rng *rng, size_t n, size_t num_events)
+{
+    int ret;
+    size_t j, e;
+    uint32_t k;
+    btree_t tree;
+    btree_position_t pos;
+    bool valid;
+    clock_t start;
+
+    ret = btree_alloc(&tree, 1);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    while (btree_get_size(&tree) < n) {
+        k = btree_get_size(&tree) == 0 ? 0 : (uint32_t) gsl_rng_get(rng);
+        if (!btree_search(&tree, k, &pos)) {
+            ret = btree_insert(&tree, k, 0);
+            if (ret != 0) {
+                fatal_error(msp_strerror(ret));
+            }
+        }
+    }
+    start = clock();
+    for (e = 0; e < num_events; e++) {
+        k = (uint32_t) gsl_rng_get(rng);
+        btree_search_floor(&tree, k, &pos);
+        if (btree_get_key(&tree, &pos) != k) {
+            ret = btree_insert(&tree, k, btree_get_value(&tree, &pos));
+            if (ret != 0) {
+                fatal_error(msp_strerror(ret));
+            }
+            btree_search(&tree, k, &pos);
+        }
+        valid = true;
+        for (j = 0; j < ORDERED_MAP_SCAN && valid; j++) {
+            valid = btree_next(&tree, &pos);
+            if (valid) {
+                btree_set_value(&tree, &pos,
+                        btree_get_value(&tree, &pos) + 1);
+            }
+        }
+        if (valid && btree_next(&tree, &pos)) {
+            btree_remove(&tree, &pos);
+        }
+    }
+    btree_free(&tree);
+    return get_cpu_time(start);
+}
+
+static void
+run_ordered_map_benchmark(size_t max_n, size_t num_events)
+{
+    size_t n;
+    double avl_time, btree_time;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    if (rng == NULL) {
+        fatal_error("no memory");
+    }
+    printf("n\tavl\tbtree\tspeedup\n");
+    for (n = 1000; n <= max_n; n *= 10) {
+        gsl_rng_set(rng, 1);
+        avl_time = benchmark_avl_map(rng, n, num_events);
+        gsl_rng_set(rng, 1);
+        btree_time = benchmark_btree_map(rng, n, num_events);
+        printf("%d\t%.3f\t%.3f\t%.1f\n", (int) n, avl_time, btree_time,
+                avl_time / btree_time);
+    }
+    gsl_rng_free(rng);
+}
+
+/* Segment queues. We simulate the pattern of accesses made to the segment
+ * queue by msp_merge_ancestors when n lineages merge: repeatedly pop the
+ * segment with the smallest left coordinate and push the segment that
+ * follows it in its chain. We compare the AVL tree of node mappings that
+ * was originally used, with nodes taken from object heaps, against the
+ * d-ary heap.
+ */
+
+static int
+cmp_segment_queue(const void *a, const void *b) {
+    const node_mapping_t *ia = (const node_mapping_t *) a;
+    const node_mapping_t *ib = (const node_mapping_t *) b;
+    int ret = (ia->left > ib->left) - (ia->left < ib->left);
+    if (ret == 0)  {
+        ret = (ia->value > ib->value) - (ia->value < ib->value);
+    }
+    return ret;
+}
+
+static double
+benchmark_avl_queue(gsl_rng *rng, size_t n, size_t num_events)
+{
+    int ret;
+    size_t j, e;
+    avl_tree_t Q;
+    avl_node_t *node;
+    node_mapping_t search, *nm;
+    object_heap_t node_heap, mapping_heap;
+    clock_t start;
+
+    ret = object_heap_init(&node_heap, sizeof(avl_node_t), n, NULL);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    ret = object_heap_init(&mapping_heap, sizeof(node_mapping_t), n, NULL);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    avl_init_tree(&Q, cmp_segment_queue, NULL);
+    start = clock();
+    for (j = 0; j < n; j++) {
+        node = object_heap_alloc_object(&node_heap);
+        nm = object_heap_alloc_object(&mapping_heap);
+        nm->left = (uint32_t) gsl_rng_uniform_int(rng, 1000);
+        nm->value = (uint32_t) j;
+        avl_init_node(node, nm);
+        node = avl_insert_node(&Q, node);
+        assert(node != NULL);
+    }
+    for (e = 0; e < num_events; e++) {
+        node = Q.head;
+        nm = (node_mapping_t *) node->item;
+        search = *nm;
+        avl_unlink_node(&Q, node);
+        object_heap_free_object(&node_heap, node);
+        object_heap_free_object(&mapping_heap, nm);
+        node = object_heap_alloc_object(&node_heap);
+        nm = object_heap_alloc_object(&mapping_heap);
+        nm->left = search.left + (uint32_t) gsl_rng_uniform_int(rng, 1000);
+        nm->value = search.value;
+        avl_init_node(node, nm);
+        node = avl_insert_node(&Q, node);
+        assert(node != NULL);
+    }
+    object_heap_free(&node_heap);
+    object_heap_free(&mapping_heap);
+    return get_cpu_time(start);
+}
+
+static double
+benchmark_priority_queue(gsl_rng *rng, size_t n, size_t num_events)
+{
+    int ret;
+    size_t j, e;
+    uint64_t key, left;
+    priority_queue_t Q;
+    clock_t start;
+
+    ret = priority_queue_alloc(&Q, n);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    start = clock();
+    for (j = 0; j < n; j++) {
+        left = gsl_rng_uniform_int(rng, 1000);
+        priority_queue_push(&Q, (left << 32) | j);
+    }
+    for (e = 0; e < num_events; e++) {
+        key = priority_queue_pop(&Q);
+        key += (uint64_t) gsl_rng_uniform_int(rng, 1000) << 32;
+        priority_queue_push(&Q, key);
+    }
+    priority_queue_free(&Q);
+    return get_cpu_time(start);
+}
+
+static void
+run_segment_queue_benchmark(size_t max_n, size_t num_events)
+{
+    size_t n;
+    double avl_time, heap_time;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    if (rng == NULL) {
+        fatal_error("no memory");
+    }
+    printf("n\tavl\tpriority_queue\tspeedup\n");
+    for (n = 10; n <= max_n; n *= 10) {
+        gsl_rng_set(rng, 1);
+        avl_time = benchmark_avl_queue(rng, n, num_events);
+        gsl_rng_set(rng, 1);
+        heap_time = benchmark_priority_queue(rng, n, num_events);
+        printf("%d\t%.3f\t%.3f\t%.1f\n", (int) n, avl_time, heap_time,
+                avl_time / heap_time);
+    }
+    gsl_rng_free(rng);
+}
+
+/* Replicate throughput. ms-style workloads run very large numbers of
+ * replicates of a small sample without recombination, so the cost of
+ * each replicate is dominated by fixed overheads rather than by the
+ * number of events. We run the replicates through msp_reset and msp_run,
+ * and optionally compare against the same number of replicates of the
+ * modified ms in data/ms (the ms_summary_stats binary, which does not
+ * print trees).
+ */
+
+static double
+benchmark_msprime_replicates(size_t n, size_t num_replicates)
+{
+    int ret;
+    size_t j;
+    double start;
+    msp_t msp;
+    sample_t *samples = calloc(n, sizeof(sample_t));
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    if (samples == NULL || rng == NULL) {
+        fatal_error("no memory");
+    }
+    gsl_rng_set(rng, 1);
+    ret = msp_alloc(&msp, n, samples, rng);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    ret = msp_initialise(&msp);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    start = get_wall_time();
+    for (j = 0; j < num_replicates; j++) {
+        ret = msp_reset(&msp);
+        if (ret != 0) {
+            fatal_error(msp_strerror(ret));
+        }
+        ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+        if (ret != 0) {
+            fatal_error(msp_strerror(ret));
+        }
+        assert(msp_get_num_coalescence_records(&msp) == n - 1);
+    }
+    start = get_wall_time() - start;
+    msp_free(&msp);
+    gsl_rng_free(rng);
+    free(samples);
+    return start;
+}
+
+static double
+benchmark_ms_replicates(const char *ms, size_t n, size_t num_replicates)
+{
+    char cmd[8192];
+    double start;
+
+    snprintf(cmd, sizeof(cmd), "%s %d %d -T > /dev/null", ms, (int) n,
+            (int) num_replicates);
+    start = get_wall_time();
+    if (system(cmd) != 0) {
+        fatal_error("error running '%s'", cmd);
+    }
+    return get_wall_time() - start;
+}
+
+static void
+run_replicates_benchmark(size_t n, size_t num_replicates, const char *ms)
+{
+    double msp_time, ms_time;
+
+    printf("program\tn\treplicates\ttime\treplicates_per_second\n");
+    msp_time = benchmark_msprime_replicates(n, num_replicates);
+    printf("msprime\t%d\t%d\t%.3f\t%.0f\n", (int) n, (int) num_replicates,
+            msp_time, (double) num_replicates / msp_time);
+    if (ms != NULL) {
+        ms_time = benchmark_ms_replicates(ms, n, num_replicates);
+        printf("ms\t%d\t%d\t%.3f\t%.0f\n", (int) n, (int) num_replicates,
+                ms_time, (double) num_replicates / ms_time);
+    }
+}
+
+/* A single large simulation with recombination, where most of the time is
+ * spent walking and merging segment chains. Optionally, a series of
+ * instantaneous bottlenecks merges many lineages at once early in the
+ * simulation.
+ */
+
+static void
+run_simulation_benchmark(size_t n, size_t num_loci, double rho,
+        size_t num_bottlenecks)
+{
+    int ret;
+    size_t j;
+    clock_t start;
+    double cpu_time;
+    msp_t msp;
+    sample_t *samples = calloc(n, sizeof(sample_t));
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    if (samples == NULL || rng == NULL) {
+        fatal_error("no memory");
+    }
+    gsl_rng_set(rng, 1);
+    ret = msp_alloc(&msp, n, samples, rng);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    ret = msp_set_num_loci(&msp, num_loci);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    ret = msp_set_scaled_recombination_rate(&msp, rho);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    ret = msp_set_max_memory(&msp, (size_t) 1 << 40);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    for (j = 0; j < num_bottlenecks; j++) {
+        ret = msp_add_instantaneous_bottleneck(&msp, 1e-3 * (double) (j + 1),
+                0, 1e-3);
+        if (ret != 0) {
+            fatal_error(msp_strerror(ret));
+        }
+    }
+    ret = msp_initialise(&msp);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    start = clock();
+    ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    cpu_time = get_cpu_time(start);
+    printf("n\tnum_loci\trho\ttime\tused_memory_MiB\tsegment_blocks\n");
+    printf("%d\t%d\t%g\t%.3f\t%.2f\t%d\n", (int) n, (int) num_loci, rho,
+            cpu_time, (double) msp_get_used_memory(&msp) / (1024 * 1024),
+            (int) msp_get_num_segment_blocks(&msp));
+    msp_free(&msp);
+    gsl_rng_free(rng);
+    free(samples);
+}
+
+/* SMC' simulation with the back-in-time engine, which rejects common
+ * ancestor events between lineages that do not overlap, and with the
+ * sequential engine, which moves along the sequence.
+ */
+
+static void
+benchmark_smc_engine(size_t n, size_t num_loci, double rho, bool sequential)
+{
+    int ret;
+    clock_t start;
+    double cpu_time;
+    msp_t msp;
+    sample_t *samples = calloc(n, sizeof(sample_t));
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    if (samples == NULL || rng == NULL) {
+        fatal_error("no memory");
+    }
+    gsl_rng_set(rng, 1);
+    ret = msp_alloc(&msp, n, samples, rng);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    ret = msp_set_model(&msp, MSP_MODEL_SMC_PRIME);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    ret = msp_set_sequential(&msp, sequential);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    ret = msp_set_num_loci(&msp, num_loci);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    ret = msp_set_scaled_recombination_rate(&msp, rho);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    ret = msp_set_max_memory(&msp, (size_t) 1 << 40);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    ret = msp_initialise(&msp);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    start = clock();
+    ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    cpu_time = get_cpu_time(start);
+    printf("%s\t%d\t%d\t%g\t%.3f\t%.2f\t%d\t%d\n",
+            sequential ? "sequential" : "hudson", (int) n, (int) num_loci,
+            rho, cpu_time,
+            (double) msp_get_used_memory(&msp) / (1024 * 1024),
+            (int) msp_get_num_breakpoints(&msp),
+            (int) msp_get_num_coalescence_records(&msp));
+    msp_free(&msp);
+    gsl_rng_free(rng);
+    free(samples);
+}
+
+static void
+run_smc_benchmark(size_t n, size_t num_loci, double rho)
+{
+    printf("engine\tn\tnum_loci\trho\ttime\tused_memory_MiB\t"
+            "breakpoints\trecords\n");
+    benchmark_smc_engine(n, num_loci, rho, false);
+    benchmark_smc_engine(n, num_loci, rho, true);
+}
+
+/* Random variate throughput. Each event in msp_run draws an exponential
+ * waiting time and a few uniforms. We compare drawing these one at a time
+ * from the rng with taking them from an rng_buffer_t, which generates them
+ * in blocks.
+ */
+
+static double
+benchmark_direct_variates(gsl_rng *rng, size_t num_events)
+{
+    size_t j;
+    double sum = 0;
+    clock_t start = clock();
+
+    for (j = 0; j < num_events; j++) {
+        sum += gsl_ran_exponential(rng, 0.5);
+        sum += gsl_rng_uniform(rng);
+        sum += gsl_rng_uniform(rng);
+    }
+    /* Stop the compiler from removing the loop */
+    if (sum <= 0) {
+        fatal_error("bad variates");
+    }
+    return get_cpu_time(start);
+}
+
+static double
+benchmark_buffered_variates(gsl_rng *rng, size_t num_events)
+{
+    int ret;
+    size_t j;
+    double sum = 0;
+    clock_t start;
+    rng_buffer_t buffer;
+
+    ret = rng_buffer_alloc(&buffer, rng, 256);
+    if (ret != 0) {
+        fatal_error(msp_strerror(ret));
+    }
+    start = clock();
+    for (j = 0; j < num_events; j++) {
+        sum += rng_buffer_exponential(&buffer, 0.5);
+        sum += rng_buffer_uniform(&buffer);
+        sum += rng_buffer_uniform(&buffer);
+    }
+    if (sum <= 0) {
+        fatal_error("bad variates");
+    }
+    rng_buffer_free(&buffer);
+    return get_cpu_time(start);
+}
+
+static void
+run_variates_benchmark(size_t num_events)
+{
+    size_t j;
+    double direct_time, buffered_time;
+    const gsl_rng_type *types[] = {gsl_rng_default, rng_philox};
+    gsl_rng *rng;
+
+    printf("rng\tevents\tdirect_ns\tbuffered_ns\tspeedup\n");
+    for (j = 0; j < sizeof(types) / sizeof(*types); j++) {
+        rng = gsl_rng_alloc(types[j]);
+        if (rng == NULL) {
+            fatal_error("no memory");
+        }
+        gsl_rng_set(rng, 1);
+        direct_time = benchmark_direct_variates(rng, num_events);
+        buffered_time = benchmark_buffered_variates(rng, num_events);
+        printf("%s\t%d\t%.2f\t%.2f\t%.2f\n", gsl_rng_name(rng),
+                (int) num_events, 1e9 * direct_time / (double) num_events,
+                1e9 * buffered_time / (double) num_events,
+                direct_time / buffered_time);
+        gsl_rng_free(rng);
+    }
+}
+
+int
+main(int argc, char** argv)
+{
+    char *cmd;
+    if (argc < 2) {
+        fatal_error("usage: %s <cmd>", argv[0]);
+    }
+    cmd = argv[1];
+    if (strncmp(cmd, "lineage_set", strlen(cmd)) == 0) {
+        if (argc < 4) {
+            fatal_error("usage: %s lineage_set MAX_N NUM_EVENTS", argv[0]);
+        }
+        run_lineage_set_benchmark((size_t) atol(argv[2]),
+                (size_t) atol(argv[3]));
+    } else if (strncmp(cmd, "ordered_map", strlen(cmd)) == 0) {
+        if (argc < 4) {
+            fatal_error("usage: %s ordered_map MAX_N NUM_EVENTS", argv[0]);
+        }
+        run_ordered_map_benchmark((size_t) atol(argv[2]),
+                (size_t) atol(argv[3]));
+    } else if (strncmp(cmd, "segment_queue", strlen(cmd)) == 0) {
+        if (argc < 4) {
+            fatal_error("usage: %s segment_queue MAX_N NUM_EVENTS", argv[0]);
+        }
+        run_segment_queue_benchmark((size_t) atol(argv[2]),
+                (size_t) atol(argv[3]));
+    } else if (strncmp(cmd, "replicates", strlen(cmd)) == 0) {
+        if (argc < 4) {
+            fatal_error("usage: %s replicates N NUM_REPLICATES [MS_SUMMARY_STATS]",
+                    argv[0]);
+        }
+        run_replicates_benchmark((size_t) atol(argv[2]),
+                (size_t) atol(argv[3]), argc > 4 ? argv[4]: NULL);
+    } else if (strncmp(cmd, "simulation", strlen(cmd)) == 0) {
+        if (argc < 5) {
+            fatal_error("usage: %s simulation N NUM_LOCI RHO [NUM_BOTTLENECKS]",
+                    argv[0]);
+        }
+        run_simulation_benchmark((size_t) atol(argv[2]),
+                (size_t) atol(argv[3]), atof(argv[4]),
+                argc > 5 ? (size_t) atol(argv[5]) : 0);
+    } else if (strncmp(cmd, "smc", strlen(cmd)) == 0) {
+        if (argc < 5) {
+            fatal_error("usage: %s smc N NUM_LOCI RHO", argv[0]);
+        }
+        run_smc_benchmark((size_t) atol(argv[2]), (size_t) atol(argv[3]),
+                atof(argv[4]));
+    } else if (strncmp(cmd, "variates", strlen(cmd)) == 0) {
+        if (argc < 3) {
+            fatal_error("usage: %s variates NUM_EVENTS", argv[0]);
+        }
+        run_variates_benchmark((size_t) atol(argv[2]));
+    } else {
+        fatal_error("Unknown command '%s'", cmd);
+    }
+    return EXIT_SUCCESS;
+}
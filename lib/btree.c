@@ -0,0 +1,618 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * B+tree with uint32_t keys and values. All entries are stored in the
+ * leaves, which are linked so that the entries can be iterated over in key
+ * order. In an internal node with keys k_0, ..., k_{n-1} and children
+ * c_0, ..., c_n, every key in c_j is less than k_j and every key in c_{j+1}
+ * is greater than or equal to k_j.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "err.h"
+#include "btree.h"
+
+static inline btree_node_t *
+btree_get_node(btree_t *self, uint32_t u)
+{
+    assert(u != BTREE_NULL_NODE && u < self->max_nodes);
+    return self->nodes + u;
+}
+
+/* Returns the number of keys in the specified node that are less than or
+ * equal to key. This is the index of the child to follow in an internal
+ * node.
+ */
+static inline uint16_t
+btree_node_upper_bound(btree_node_t *node, uint32_t key)
+{
+    uint16_t j = 0;
+
+    while (j < node->num_keys && node->keys[j] <= key) {
+        j++;
+    }
+    return j;
+}
+
+/* Adds the nodes max_nodes, ..., max_nodes + increment - 1 to the free list
+ * so that the lowest index is allocated first. */
+static int WARN_UNUSED
+btree_expand(btree_t *self, size_t increment)
+{
+    int ret = 0;
+    size_t j;
+    size_t size = self->max_nodes + increment;
+    btree_node_t *p;
+
+    if (size > UINT32_MAX) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    p = realloc(self->nodes, size * sizeof(btree_node_t));
+    if (p == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    self->nodes = p;
+    for (j = size - 1; j >= self->max_nodes; j--) {
+        self->nodes[j].next = self->free_node;
+        self->free_node = (uint32_t) j;
+    }
+    self->max_nodes = size;
+out:
+    return ret;
+}
+
+/* Ensures that at least the specified number of nodes can be allocated
+ * without moving the node array. */
+static int WARN_UNUSED
+btree_reserve(btree_t *self, size_t num_nodes)
+{
+    int ret = 0;
+
+    while (self->max_nodes - 1 - self->num_nodes < num_nodes) {
+        ret = btree_expand(self, self->max_nodes);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+out:
+    return ret;
+}
+
+static uint32_t
+btree_alloc_node(btree_t *self, uint16_t leaf)
+{
+    uint32_t u = self->free_node;
+    btree_node_t *node = btree_get_node(self, u);
+
+    self->free_node = node->next;
+    self->num_nodes++;
+    node->num_keys = 0;
+    node->leaf = leaf;
+    node->prev = BTREE_NULL_NODE;
+    node->next = BTREE_NULL_NODE;
+    return u;
+}
+
+static void
+btree_free_node(btree_t *self, uint32_t u)
+{
+    btree_node_t *node = btree_get_node(self, u);
+
+    node->next = self->free_node;
+    self->free_node = u;
+    self->num_nodes--;
+}
+
+int WARN_UNUSED
+btree_alloc(btree_t *self, size_t initial_size)
+{
+    int ret = 0;
+
+    self->nodes = NULL;
+    self->max_nodes = 1;
+    self->free_node = BTREE_NULL_NODE;
+    ret = btree_expand(self, initial_size < 1 ? 1 : initial_size);
+    if (ret != 0) {
+        goto out;
+    }
+    btree_clear(self);
+out:
+    return ret;
+}
+
+int
+btree_free(btree_t *self)
+{
+    if (self->nodes != NULL) {
+        free(self->nodes);
+        self->nodes = NULL;
+    }
+    return 0;
+}
+
+/* Removes all entries, leaving the tree with an empty leaf as its root. */
+void
+btree_clear(btree_t *self)
+{
+    size_t j;
+
+    self->free_node = BTREE_NULL_NODE;
+    for (j = self->max_nodes - 1; j > 0; j--) {
+        self->nodes[j].next = self->free_node;
+        self->free_node = (uint32_t) j;
+    }
+    self->num_nodes = 0;
+    self->size = 0;
+    self->height = 1;
+    self->root = btree_alloc_node(self, 1);
+}
+
+size_t
+btree_get_size(btree_t *self)
+{
+    return self->size;
+}
+
+size_t
+btree_get_memory_size(btree_t *self)
+{
+    return self->max_nodes * sizeof(btree_node_t);
+}
+
+/* Returns the leaf in which key is or would be stored. If path is not
+ * NULL, the internal nodes visited are stored in path and the indexes of
+ * the children followed in slots. */
+static uint32_t
+btree_find_leaf(btree_t *self, uint32_t key, uint32_t *path, uint16_t *slots)
+{
+    uint32_t u = self->root;
+    btree_node_t *node = btree_get_node(self, u);
+    uint16_t c;
+    size_t h = 0;
+
+    while (!node->leaf) {
+        c = btree_node_upper_bound(node, key);
+        if (path != NULL) {
+            path[h] = u;
+            slots[h] = c;
+        }
+        h++;
+        u = node->items[c];
+        node = btree_get_node(self, u);
+    }
+    assert(h == self->height - 1);
+    return u;
+}
+
+/* Inserts key and child into the specified internal node, which has
+ * room for them, so that child follows key. */
+static void
+btree_node_insert(btree_node_t *node, uint16_t slot, uint32_t key,
+        uint32_t child)
+{
+    uint16_t n = node->num_keys;
+
+    assert(n < BTREE_MAX_KEYS);
+    memmove(node->keys + slot + 1, node->keys + slot,
+            (size_t) (n - slot) * sizeof(uint32_t));
+    memmove(node->items + slot + 2, node->items + slot + 1,
+            (size_t) (n - slot) * sizeof(uint32_t));
+    node->keys[slot] = key;
+    node->items[slot + 1] = child;
+    node->num_keys++;
+}
+
+/* Inserts the specified key, which must not already be in the tree. Any
+ * positions in the tree are invalidated. */
+int WARN_UNUSED
+btree_insert(btree_t *self, uint32_t key, uint32_t value)
+{
+    int ret = 0;
+    uint32_t path[BTREE_MAX_HEIGHT];
+    uint16_t slots[BTREE_MAX_HEIGHT];
+    uint32_t keys[BTREE_MAX_KEYS + 1];
+    uint32_t items[BTREE_MAX_KEYS + 2];
+    uint32_t u, v, sep;
+    btree_node_t *node, *new_node;
+    uint16_t j, n, split;
+    size_t h;
+
+    /* A split can allocate at most one node per level plus a new root. */
+    assert(self->height < BTREE_MAX_HEIGHT);
+    ret = btree_reserve(self, self->height + 1);
+    if (ret != 0) {
+        goto out;
+    }
+    u = btree_find_leaf(self, key, path, slots);
+    node = btree_get_node(self, u);
+    n = node->num_keys;
+    j = 0;
+    while (j < n && node->keys[j] < key) {
+        j++;
+    }
+    assert(j == n || node->keys[j] != key);
+    self->size++;
+    if (n < BTREE_MAX_KEYS) {
+        memmove(node->keys + j + 1, node->keys + j,
+                (size_t) (n - j) * sizeof(uint32_t));
+        memmove(node->items + j + 1, node->items + j,
+                (size_t) (n - j) * sizeof(uint32_t));
+        node->keys[j] = key;
+        node->items[j] = value;
+        node->num_keys++;
+        goto out;
+    }
+    /* Split the leaf, moving the upper half of the entries to v. */
+    memcpy(keys, node->keys, j * sizeof(uint32_t));
+    memcpy(items, node->items, j * sizeof(uint32_t));
+    keys[j] = key;
+    items[j] = value;
+    memcpy(keys + j + 1, node->keys + j, (size_t) (n - j) * sizeof(uint32_t));
+    memcpy(items + j + 1, node->items + j, (size_t) (n - j) * sizeof(uint32_t));
+    split = (BTREE_MAX_KEYS + 1) / 2;
+    v = btree_alloc_node(self, 1);
+    new_node = btree_get_node(self, v);
+    memcpy(node->keys, keys, split * sizeof(uint32_t));
+    memcpy(node->items, items, split * sizeof(uint32_t));
+    node->num_keys = split;
+    new_node->num_keys = (uint16_t) (BTREE_MAX_KEYS + 1 - split);
+    memcpy(new_node->keys, keys + split, new_node->num_keys * sizeof(uint32_t));
+    memcpy(new_node->items, items + split,
+            new_node->num_keys * sizeof(uint32_t));
+    new_node->prev = u;
+    new_node->next = node->next;
+    if (node->next != BTREE_NULL_NODE) {
+        btree_get_node(self, node->next)->prev = v;
+    }
+    node->next = v;
+    sep = new_node->keys[0];
+
+    /* Insert the separator into the parents, splitting them as needed. */
+    for (h = self->height - 1; h > 0; h--) {
+        u = path[h - 1];
+        j = slots[h - 1];
+        node = btree_get_node(self, u);
+        n = node->num_keys;
+        if (n < BTREE_MAX_KEYS) {
+            btree_node_insert(node, j, sep, v);
+            goto out;
+        }
+        memcpy(keys, node->keys, j * sizeof(uint32_t));
+        keys[j] = sep;
+        memcpy(keys + j + 1, node->keys + j,
+                (size_t) (n - j) * sizeof(uint32_t));
+        memcpy(items, node->items, (size_t) (j + 1) * sizeof(uint32_t));
+        items[j + 1] = v;
+        memcpy(items + j + 2, node->items + j + 1,
+                (size_t) (n - j) * sizeof(uint32_t));
+        /* The key at split moves up to the parent. */
+        split = BTREE_MAX_KEYS / 2;
+        v = btree_alloc_node(self, 0);
+        new_node = btree_get_node(self, v);
+        memcpy(node->keys, keys, split * sizeof(uint32_t));
+        memcpy(node->items, items, (size_t) (split + 1) * sizeof(uint32_t));
+        node->num_keys = split;
+        new_node->num_keys = (uint16_t) (BTREE_MAX_KEYS - split);
+        memcpy(new_node->keys, keys + split + 1,
+                new_node->num_keys * sizeof(uint32_t));
+        memcpy(new_node->items, items + split + 1,
+                (size_t) (new_node->num_keys + 1) * sizeof(uint32_t));
+        sep = keys[split];
+    }
+    /* The root was split, so the tree grows by one level. */
+    u = btree_alloc_node(self, 0);
+    node = btree_get_node(self, u);
+    node->num_keys = 1;
+    node->keys[0] = sep;
+    node->items[0] = self->root;
+    node->items[1] = v;
+    self->root = u;
+    self->height++;
+out:
+    return ret;
+}
+
+/* Finds the entry with the largest key less than or equal to the specified
+ * key. Returns false if there is no such entry.
+ */
+bool
+btree_search_floor(btree_t *self, uint32_t key, btree_position_t *position)
+{
+    bool ret = true;
+    uint32_t u = btree_find_leaf(self, key, NULL, NULL);
+    btree_node_t *node = btree_get_node(self, u);
+    uint16_t j = btree_node_upper_bound(node, key);
+
+    if (j > 0) {
+        position->node = u;
+        position->index = (uint32_t) (j - 1);
+    } else {
+        /* All keys in the previous leaf are less than key. */
+        position->node = node->prev;
+        position->index = 0;
+        if (node->prev == BTREE_NULL_NODE) {
+            ret = false;
+        } else {
+            node = btree_get_node(self, node->prev);
+            assert(node->num_keys > 0);
+            position->index = (uint32_t) (node->num_keys - 1);
+        }
+    }
+    return ret;
+}
+
+/* Finds the entry with the specified key. Returns false if there is no such
+ * entry.
+ */
+bool
+btree_search(btree_t *self, uint32_t key, btree_position_t *position)
+{
+    return btree_search_floor(self, key, position)
+        && btree_get_key(self, position) == key;
+}
+
+bool
+btree_first(btree_t *self, btree_position_t *position)
+{
+    uint32_t u = self->root;
+    btree_node_t *node = btree_get_node(self, u);
+
+    while (!node->leaf) {
+        u = node->items[0];
+        node = btree_get_node(self, u);
+    }
+    position->node = u;
+    position->index = 0;
+    return node->num_keys > 0;
+}
+
+/* Moves to the next entry in key order. Returns false if there is none. */
+bool
+btree_next(btree_t *self, btree_position_t *position)
+{
+    btree_node_t *node = btree_get_node(self, position->node);
+
+    position->index++;
+    if (position->index == node->num_keys) {
+        position->node = node->next;
+        position->index = 0;
+    }
+    return position->node != BTREE_NULL_NODE;
+}
+
+/* Moves to the previous entry in key order. Returns false if there is
+ * none. */
+bool
+btree_prev(btree_t *self, btree_position_t *position)
+{
+    btree_node_t *node = btree_get_node(self, position->node);
+
+    if (position->index > 0) {
+        position->index--;
+    } else {
+        position->node = node->prev;
+        if (node->prev != BTREE_NULL_NODE) {
+            node = btree_get_node(self, node->prev);
+            position->index = (uint32_t) (node->num_keys - 1);
+        }
+    }
+    return position->node != BTREE_NULL_NODE;
+}
+
+/* Removes the specified leaf, which is empty, from the tree. Any internal
+ * nodes left without children are also removed. */
+static void
+btree_remove_leaf(btree_t *self, uint32_t leaf, uint32_t key)
+{
+    uint32_t path[BTREE_MAX_HEIGHT];
+    uint16_t slots[BTREE_MAX_HEIGHT];
+    uint32_t u;
+    uint16_t j, k, n;
+    btree_node_t *node = btree_get_node(self, leaf);
+    size_t h;
+
+    assert(node->num_keys == 0);
+    if (node->prev != BTREE_NULL_NODE) {
+        btree_get_node(self, node->prev)->next = node->next;
+    }
+    if (node->next != BTREE_NULL_NODE) {
+        btree_get_node(self, node->next)->prev = node->prev;
+    }
+    /* The keys of the internal nodes have not changed, so searching for key
+     * takes us back to this leaf. */
+    u = btree_find_leaf(self, key, path, slots);
+    assert(u == leaf);
+    btree_free_node(self, u);
+    for (h = self->height - 1; h > 0; h--) {
+        u = path[h - 1];
+        j = slots[h - 1];
+        node = btree_get_node(self, u);
+        n = node->num_keys;
+        if (n > 0) {
+            /* Remove the child along with the key on one side of it. */
+            k = j > 0 ? (uint16_t) (j - 1) : 0;
+            memmove(node->keys + k, node->keys + k + 1,
+                    (size_t) (n - k - 1) * sizeof(uint32_t));
+            memmove(node->items + j, node->items + j + 1,
+                    (size_t) (n - j) * sizeof(uint32_t));
+            node->num_keys--;
+            break;
+        }
+        btree_free_node(self, u);
+    }
+    /* Remove internal roots that have a single child. */
+    node = btree_get_node(self, self->root);
+    while (!node->leaf && node->num_keys == 0) {
+        u = self->root;
+        self->root = node->items[0];
+        btree_free_node(self, u);
+        self->height--;
+        node = btree_get_node(self, self->root);
+    }
+}
+
+/* Removes the entry at the specified position, and moves the position on
+ * to the following entry. Returns false if there is no following entry.
+ * Positions of entries later in the same leaf are invalidated; positions of
+ * other entries remain valid.
+ */
+bool
+btree_remove(btree_t *self, btree_position_t *position)
+{
+    uint32_t u = position->node;
+    btree_node_t *node = btree_get_node(self, u);
+    uint32_t j = position->index;
+    uint32_t key = node->keys[j];
+    uint16_t n = node->num_keys;
+
+    assert(j < n);
+    memmove(node->keys + j, node->keys + j + 1,
+            (n - j - 1) * sizeof(uint32_t));
+    memmove(node->items + j, node->items + j + 1,
+            (n - j - 1) * sizeof(uint32_t));
+    node->num_keys--;
+    self->size--;
+    if (j == node->num_keys) {
+        position->node = node->next;
+        position->index = 0;
+    }
+    if (node->num_keys == 0) {
+        if (self->size == 0) {
+            btree_clear(self);
+        } else {
+            btree_remove_leaf(self, u, key);
+        }
+    }
+    return position->node != BTREE_NULL_NODE;
+}
+
+uint32_t
+btree_get_key(btree_t *self, btree_position_t *position)
+{
+    btree_node_t *node = btree_get_node(self, position->node);
+
+    assert(position->index < node->num_keys);
+    return node->keys[position->index];
+}
+
+uint32_t
+btree_get_value(btree_t *self, btree_position_t *position)
+{
+    btree_node_t *node = btree_get_node(self, position->node);
+
+    assert(position->index < node->num_keys);
+    return node->items[position->index];
+}
+
+void
+btree_set_value(btree_t *self, btree_position_t *position, uint32_t value)
+{
+    btree_node_t *node = btree_get_node(self, position->node);
+
+    assert(position->index < node->num_keys);
+    node->items[position->index] = value;
+}
+
+void
+btree_print_state(btree_t *self, FILE *out)
+{
+    btree_position_t pos;
+    bool valid;
+
+    fprintf(out, "size = %d height = %d nodes = %d/%d root = %d\n",
+            (int) self->size, (int) self->height, (int) self->num_nodes,
+            (int) self->max_nodes, (int) self->root);
+    for (valid = btree_first(self, &pos); valid;
+            valid = btree_next(self, &pos)) {
+        fprintf(out, "\t(%d:%d)\t%d -> %d\n", (int) pos.node, (int) pos.index,
+                (int) btree_get_key(self, &pos),
+                (int) btree_get_value(self, &pos));
+    }
+}
+
+/* Checks the subtree rooted at u, in which all keys must be in [lo, hi),
+ * and returns the number of nodes in it. */
+static size_t
+btree_verify_node(btree_t *self, uint32_t u, size_t depth, int64_t lo,
+        int64_t hi, size_t *num_entries)
+{
+    btree_node_t *node = btree_get_node(self, u);
+    size_t j;
+    size_t num_nodes = 1;
+
+    assert(node->num_keys <= BTREE_MAX_KEYS);
+    for (j = 0; j < node->num_keys; j++) {
+        assert(node->keys[j] >= lo && node->keys[j] < hi);
+        if (j > 0) {
+            assert(node->keys[j - 1] < node->keys[j]);
+        }
+    }
+    if (node->leaf) {
+        assert(depth == self->height);
+        assert(node->num_keys > 0 || u == self->root);
+        *num_entries += node->num_keys;
+    } else {
+        for (j = 0; j <= node->num_keys; j++) {
+            num_nodes += btree_verify_node(self, node->items[j], depth + 1,
+                    j == 0 ? lo: node->keys[j - 1],
+                    j == node->num_keys ? hi: node->keys[j], num_entries);
+        }
+    }
+    return num_nodes;
+}
+
+void
+btree_verify(btree_t *self)
+{
+    size_t num_entries = 0;
+    size_t num_free = 0;
+    size_t num_nodes;
+    uint32_t u;
+    btree_position_t pos;
+    bool valid;
+    int64_t last_key = -1;
+
+    num_nodes = btree_verify_node(self, self->root, 1, 0,
+            (int64_t) UINT32_MAX + 1, &num_entries);
+    assert(num_nodes == self->num_nodes);
+    assert(num_entries == self->size);
+    for (u = self->free_node; u != BTREE_NULL_NODE;
+            u = self->nodes[u].next) {
+        num_free++;
+    }
+    assert(num_free + self->num_nodes == self->max_nodes - 1);
+    num_entries = 0;
+    for (valid = btree_first(self, &pos); valid;
+            valid = btree_next(self, &pos)) {
+        assert(btree_get_key(self, &pos) > last_key);
+        last_key = btree_get_key(self, &pos);
+        num_entries++;
+    }
+    assert(num_entries == self->size);
+}
@@ -0,0 +1,89 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __BTREE_H__
+#define __BTREE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BTREE_MAX_KEYS 14
+#define BTREE_MAX_HEIGHT 32
+#define BTREE_NULL_NODE 0
+
+/* A node occupies two 64 byte cache lines: the first holds the keys, which
+ * is all we need to look at while searching, and the second holds the
+ * values (in a leaf) or the child node indexes (in an internal node).
+ * Leaves are linked in key order through prev and next.
+ */
+typedef struct {
+    uint16_t num_keys;
+    uint16_t leaf;
+    uint32_t keys[BTREE_MAX_KEYS];
+    uint32_t prev;
+    uint32_t items[BTREE_MAX_KEYS + 1];
+    uint32_t next;
+} btree_node_t;
+
+/* A B+tree mapping distinct uint32_t keys to uint32_t values. Nodes are
+ * stored in a single array and refer to each other by index; index 0 is
+ * never used. Removing entries never merges nodes, but leaves that become
+ * empty are returned to the free list.
+ */
+typedef struct {
+    size_t size;
+    size_t height;
+    size_t num_nodes;
+    size_t max_nodes;
+    uint32_t root;
+    uint32_t free_node;
+    btree_node_t *nodes;
+} btree_t;
+
+/* The position of an entry in the tree. Removing an entry shifts the
+ * entries that follow it in the same leaf down by one slot, so only the
+ * positions of entries in other leaves, or earlier in the same leaf, remain
+ * valid. No positions remain valid after an insertion.
+ */
+typedef struct {
+    uint32_t node;
+    uint32_t index;
+} btree_position_t;
+
+int btree_alloc(btree_t *, size_t);
+int btree_free(btree_t *);
+void btree_clear(btree_t *);
+size_t btree_get_size(btree_t *);
+size_t btree_get_memory_size(btree_t *);
+int btree_insert(btree_t *, uint32_t, uint32_t);
+bool btree_search(btree_t *, uint32_t, btree_position_t *);
+bool btree_search_floor(btree_t *, uint32_t, btree_position_t *);
+bool btree_first(btree_t *, btree_position_t *);
+bool btree_next(btree_t *, btree_position_t *);
+bool btree_prev(btree_t *, btree_position_t *);
+bool btree_remove(btree_t *, btree_position_t *);
+uint32_t btree_get_key(btree_t *, btree_position_t *);
+uint32_t btree_get_value(btree_t *, btree_position_t *);
+void btree_set_value(btree_t *, btree_position_t *, uint32_t);
+void btree_print_state(btree_t *, FILE *);
+void btree_verify(btree_t *);
+
+#endif /*__BTREE_H__*/
@@ -0,0 +1,376 @@
+/*
+** Copyright (C) 2017 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* Needed for sysconf */
+#define _DEFAULT_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "err.h"
+#include "codec.h"
+
+#define CODEC_CHECKSUM_SIZE 4
+
+typedef struct {
+    codec_chunk_t *chunks;
+    size_t num_chunks;
+    size_t next_chunk;
+    int (*func)(codec_chunk_t *);
+    int error;
+    pthread_mutex_t mutex;
+} codec_pool_t;
+
+/* The Fletcher checksum used by HDF5's fletcher32 filter, which treats
+ * the data as a sequence of big-endian 16 bit words. */
+uint32_t
+codec_fletcher32(const unsigned char *data, size_t size)
+{
+    size_t len = size / 2;
+    size_t block;
+    uint32_t sum1 = 0;
+    uint32_t sum2 = 0;
+
+    while (len > 0) {
+        /* Reduce the sums often enough that they cannot overflow */
+        block = len > 360 ? 360 : len;
+        len -= block;
+        do {
+            sum1 += (uint32_t) ((data[0] << 8) | data[1]);
+            data += 2;
+            sum2 += sum1;
+        } while (--block);
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+    if (size % 2) {
+        sum1 += (uint32_t) (data[0] << 8);
+        sum2 += sum1;
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+    sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+    sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    return (sum2 << 16) | sum1;
+}
+
+/* Encodes the chunk: the bytes of the items are shuffled so that byte j of
+ * every item is stored together, then compressed with zlib and followed
+ * by the little-endian checksum of the compressed bytes. */
+int WARN_UNUSED
+codec_encode_chunk(codec_chunk_t *self)
+{
+    int ret = MSP_ERR_NO_MEMORY;
+    const unsigned char *src = self->data;
+    unsigned char *shuffled = NULL;
+    size_t j, k, n, size;
+    uLongf encoded_size;
+    uint32_t checksum;
+
+    n = self->chunk_items;
+    size = n * self->item_size;
+    /* Items beyond the end of the column are encoded as zeros */
+    shuffled = calloc(size, 1);
+    encoded_size = compressBound((uLong) size);
+    self->encoded = malloc(encoded_size + CODEC_CHECKSUM_SIZE);
+    if (shuffled == NULL || self->encoded == NULL) {
+        goto out;
+    }
+    for (j = 0; j < self->num_items; j++) {
+        for (k = 0; k < self->item_size; k++) {
+            shuffled[k * n + j] = src[j * self->item_size + k];
+        }
+    }
+    if (compress2(self->encoded, &encoded_size, shuffled, (uLong) size,
+                self->level) != Z_OK) {
+        goto out;
+    }
+    checksum = codec_fletcher32(self->encoded, encoded_size);
+    for (k = 0; k < CODEC_CHECKSUM_SIZE; k++) {
+        self->encoded[encoded_size + k] = (unsigned char) (checksum >> (8 * k));
+    }
+    self->encoded_size = encoded_size + CODEC_CHECKSUM_SIZE;
+    ret = 0;
+out:
+    if (shuffled != NULL) {
+        free(shuffled);
+    }
+    return ret;
+}
+
+/* Verifies and decodes an encoded chunk into its data. */
+int WARN_UNUSED
+codec_decode_chunk(codec_chunk_t *self)
+{
+    int ret = MSP_ERR_FILE_FORMAT;
+    unsigned char *dest = self->data;
+    unsigned char *shuffled = NULL;
+    size_t j, k, n, size, compressed_size;
+    uLongf decoded_size;
+    uint32_t checksum, stored;
+
+    if (self->encoded_size < CODEC_CHECKSUM_SIZE) {
+        goto out;
+    }
+    compressed_size = self->encoded_size - CODEC_CHECKSUM_SIZE;
+    stored = 0;
+    for (k = 0; k < CODEC_CHECKSUM_SIZE; k++) {
+        stored |= (uint32_t) self->encoded[compressed_size + k] << (8 * k);
+    }
+    checksum = codec_fletcher32(self->encoded, compressed_size);
+    if (checksum != stored) {
+        goto out;
+    }
+    n = self->chunk_items;
+    size = n * self->item_size;
+    shuffled = malloc(size);
+    if (shuffled == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    decoded_size = (uLongf) size;
+    if (uncompress(shuffled, &decoded_size, self->encoded,
+                (uLong) compressed_size) != Z_OK || decoded_size != size) {
+        goto out;
+    }
+    for (j = 0; j < self->num_items; j++) {
+        for (k = 0; k < self->item_size; k++) {
+            dest[j * self->item_size + k] = shuffled[k * n + j];
+        }
+    }
+    ret = 0;
+out:
+    if (shuffled != NULL) {
+        free(shuffled);
+    }
+    return ret;
+}
+
+void
+codec_chunk_free(codec_chunk_t *self)
+{
+    if (self->encoded != NULL) {
+        free(self->encoded);
+        self->encoded = NULL;
+    }
+}
+
+static void *
+codec_worker(void *arg)
+{
+    codec_pool_t *self = (codec_pool_t *) arg;
+    size_t chunk;
+    int err;
+
+    pthread_mutex_lock(&self->mutex);
+    while (self->error == 0 && self->next_chunk < self->num_chunks) {
+        chunk = self->next_chunk;
+        self->next_chunk++;
+        pthread_mutex_unlock(&self->mutex);
+
+        err = self->func(&self->chunks[chunk]);
+
+        pthread_mutex_lock(&self->mutex);
+        if (err != 0 && self->error == 0) {
+            self->error = err;
+        }
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return NULL;
+}
+
+/* Applies func to each of the chunks, using up to num_threads threads.
+ * The chunks are independent, so they are handed out one at a time to
+ * whichever thread is free. */
+int WARN_UNUSED
+codec_run(codec_chunk_t *chunks, size_t num_chunks,
+        int (*func)(codec_chunk_t *), size_t num_threads)
+{
+    int ret = 0;
+    size_t j, num_started;
+    pthread_t *threads = NULL;
+    codec_pool_t pool;
+
+    if (num_threads > num_chunks) {
+        num_threads = num_chunks;
+    }
+    if (num_threads <= 1) {
+        for (j = 0; j < num_chunks && ret == 0; j++) {
+            ret = func(&chunks[j]);
+        }
+        goto out;
+    }
+    threads = malloc(num_threads * sizeof(pthread_t));
+    if (threads == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    pool.chunks = chunks;
+    pool.num_chunks = num_chunks;
+    pool.next_chunk = 0;
+    pool.func = func;
+    pool.error = 0;
+    if (pthread_mutex_init(&pool.mutex, NULL) != 0) {
+        ret = MSP_ERR_THREAD;
+        goto out;
+    }
+    for (num_started = 0; num_started < num_threads; num_started++) {
+        if (pthread_create(&threads[num_started], NULL, codec_worker,
+                    &pool) != 0) {
+            /* The running threads stop when they see the error */
+            pthread_mutex_lock(&pool.mutex);
+            pool.error = MSP_ERR_THREAD;
+            pthread_mutex_unlock(&pool.mutex);
+            break;
+        }
+    }
+    for (j = 0; j < num_started; j++) {
+        if (pthread_join(threads[j], NULL) != 0) {
+            pool.error = MSP_ERR_THREAD;
+        }
+    }
+    pthread_mutex_destroy(&pool.mutex);
+    ret = pool.error;
+out:
+    if (threads != NULL) {
+        free(threads);
+    }
+    return ret;
+}
+
+/* Returns the number of threads to encode and decode chunks with, which
+ * is the number of online processors. */
+size_t
+codec_get_num_threads(void)
+{
+    long num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return num_processors < 1 ? 1 : (size_t) num_processors;
+}
+
+/* Integer columns such as the record nodes and children are stored as the
+ * differences between successive values, zigzag encoded so that small
+ * negative differences are small too. The differences are packed four at
+ * a time behind a control byte holding the number of bytes (1 to 4) used
+ * for each, least significant byte first.
+ */
+
+static const uint32_t codec_varint_masks[] = {
+    0xff, 0xffff, 0xffffff, 0xffffffff};
+
+/* Returns the maximum number of bytes needed to encode num_items values. */
+size_t
+codec_varint_bound(size_t num_items)
+{
+    return 4 * num_items + (num_items + 3) / 4;
+}
+
+/* Encodes the values into dest, which must have room for at least
+ * codec_varint_bound(num_items) bytes, and returns the number of bytes
+ * used. */
+size_t
+codec_varint_encode(const uint32_t *values, size_t num_items,
+        unsigned char *dest)
+{
+    unsigned char *p = dest;
+    unsigned char *control;
+    uint32_t previous = 0;
+    uint32_t delta, v;
+    size_t j, k, b, n;
+
+    for (j = 0; j < num_items; j += 4) {
+        control = p;
+        *control = 0;
+        p++;
+        for (k = 0; k < 4 && j + k < num_items; k++) {
+            delta = values[j + k] - previous;
+            previous = values[j + k];
+            v = (delta << 1) ^ (0u - (delta >> 31));
+            n = 1;
+            while (n < 4 && v > codec_varint_masks[n - 1]) {
+                n++;
+            }
+            *control = (unsigned char) (*control | ((n - 1) << (2 * k)));
+            for (b = 0; b < n; b++) {
+                *p = (unsigned char) (v >> (8 * b));
+                p++;
+            }
+        }
+    }
+    return (size_t) (p - dest);
+}
+
+/* Decodes num_items values from the size bytes at src. Returns
+ * MSP_ERR_FILE_FORMAT unless src holds exactly num_items values. */
+int WARN_UNUSED
+codec_varint_decode(const unsigned char *src, size_t size,
+        uint32_t *values, size_t num_items)
+{
+    int ret = MSP_ERR_FILE_FORMAT;
+    const unsigned char *end = src + size;
+    uint32_t previous = 0;
+    uint32_t v;
+    unsigned int control;
+    size_t j, k, b, n, m;
+
+    for (j = 0; j < num_items; j += 4) {
+        if (src == end) {
+            goto out;
+        }
+        control = *src;
+        src++;
+        m = num_items - j < 4 ? num_items - j : 4;
+        for (k = 0; k < m; k++) {
+            n = ((control >> (2 * k)) & 3) + 1;
+            if (end - src >= 4) {
+                /* Read a whole word and mask off the bytes we need, which
+                 * compilers reduce to a single load */
+                v = (uint32_t) src[0] | ((uint32_t) src[1] << 8)
+                    | ((uint32_t) src[2] << 16) | ((uint32_t) src[3] << 24);
+                v &= codec_varint_masks[n - 1];
+            } else {
+                if ((size_t) (end - src) < n) {
+                    goto out;
+                }
+                v = 0;
+                for (b = 0; b < n; b++) {
+                    v |= (uint32_t) src[b] << (8 * b);
+                }
+            }
+            src += n;
+            previous += (v >> 1) ^ (0u - (v & 1));
+            values[j + k] = previous;
+        }
+    }
+    if (src != end) {
+        goto out;
+    }
+    ret = 0;
+out:
+    return ret;
+}
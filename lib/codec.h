@@ -0,0 +1,56 @@
+/*
+** Copyright (C) 2017 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* A chunk of a column, encoded exactly as HDF5's shuffle, deflate and
+ * fletcher32 filters would encode it, so that it can be written to or
+ * read from a dataset with that filter pipeline directly. Chunks are
+ * always chunk_items long when encoded; only the first num_items are
+ * read from or written to data.
+ */
+typedef struct {
+    void *data;
+    size_t item_size;
+    size_t num_items;
+    size_t chunk_items;
+    int level;
+    unsigned char *encoded;
+    size_t encoded_size;
+} codec_chunk_t;
+
+int codec_encode_chunk(codec_chunk_t *self);
+int codec_decode_chunk(codec_chunk_t *self);
+void codec_chunk_free(codec_chunk_t *self);
+int codec_run(codec_chunk_t *chunks, size_t num_chunks,
+        int (*func)(codec_chunk_t *), size_t num_threads);
+size_t codec_get_num_threads(void);
+uint32_t codec_fletcher32(const unsigned char *data, size_t size);
+
+size_t codec_varint_bound(size_t num_items);
+size_t codec_varint_encode(const uint32_t *values, size_t num_items,
+        unsigned char *dest);
+int codec_varint_decode(const unsigned char *src, size_t size,
+        uint32_t *values, size_t num_items);
+
+#endif /*__CODEC_H__*/
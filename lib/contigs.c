@@ -0,0 +1,261 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+#include <assert.h>
+
+#include <gsl/gsl_math.h>
+
+#include "err.h"
+#include "contigs.h"
+
+/* Simulates the specified contig and stores its tree sequence, with
+ * mutations, in the driver. */
+static int WARN_UNUSED
+contig_driver_simulate(contig_driver_t *self, size_t contig, gsl_rng *rng)
+{
+    int ret = 0;
+    msp_t msp;
+    mutgen_t mutgen;
+    bool mutgen_allocated = false;
+    recomb_map_t *recomb_map = &self->recomb_maps[contig];
+    tree_sequence_t *tree_sequence = &self->contigs[contig];
+
+    memset(&msp, 0, sizeof(msp));
+    ret = rng_set_stream(rng, self->seed, 0, (uint32_t) contig);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = self->configure(&msp, contig, recomb_map, rng, self->arg);
+    if (ret != 0) {
+        goto out;
+    }
+    if (msp_get_num_loci(&msp) != recomb_map_get_num_loci(recomb_map)) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    ret = msp_initialise(&msp);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = 1;
+    while (ret == 1) {
+        ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+    }
+    if (ret != 0) {
+        goto out;
+    }
+    memset(tree_sequence, 0, sizeof(tree_sequence_t));
+    ret = tree_sequence_adopt_simulation(tree_sequence, &msp, recomb_map,
+            self->Ne);
+    if (ret != 0) {
+        goto out;
+    }
+    self->created[contig] = true;
+    ret = mutgen_alloc(&mutgen, tree_sequence, self->mutation_rate, rng);
+    mutgen_allocated = true;
+    if (ret != 0) {
+        goto out;
+    }
+    ret = mutgen_generate(&mutgen);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = tree_sequence_set_mutations(tree_sequence, mutgen.num_mutations,
+            mutgen.mutations);
+out:
+    if (mutgen_allocated) {
+        mutgen_free(&mutgen);
+    }
+    msp_free(&msp);
+    return ret;
+}
+
+static void *
+contig_driver_worker(void *arg)
+{
+    contig_driver_t *self = (contig_driver_t *) arg;
+    gsl_rng *rng = gsl_rng_alloc(rng_philox);
+    size_t contig;
+    int err = 0;
+
+    pthread_mutex_lock(&self->mutex);
+    if (rng == NULL) {
+        self->error = MSP_ERR_NO_MEMORY;
+    }
+    while (self->error == 0 && self->next_contig < self->num_contigs) {
+        contig = self->next_contig;
+        self->next_contig++;
+        pthread_mutex_unlock(&self->mutex);
+
+        err = contig_driver_simulate(self, contig, rng);
+
+        pthread_mutex_lock(&self->mutex);
+        if (err != 0 && self->error == 0) {
+            self->error = err;
+        }
+    }
+    pthread_mutex_unlock(&self->mutex);
+    if (rng != NULL) {
+        gsl_rng_free(rng);
+    }
+    return NULL;
+}
+
+int WARN_UNUSED
+contig_driver_alloc(contig_driver_t *self, size_t num_contigs,
+        recomb_map_t *recomb_maps, size_t num_threads, unsigned long seed,
+        double mutation_rate, double Ne, contig_configure_func configure,
+        void *arg)
+{
+    int ret = 0;
+
+    memset(self, 0, sizeof(contig_driver_t));
+    /* Contig indexes select 32 bit Philox streams */
+    if (num_contigs < 1 || num_contigs > UINT32_MAX || recomb_maps == NULL
+            || num_threads < 1 || configure == NULL || mutation_rate < 0
+            || Ne <= 0) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    self->num_contigs = num_contigs;
+    self->recomb_maps = recomb_maps;
+    /* There is no point in having more threads than contigs */
+    self->num_threads = GSL_MIN(num_threads, num_contigs);
+    self->seed = seed;
+    self->mutation_rate = mutation_rate;
+    self->Ne = Ne;
+    self->configure = configure;
+    self->arg = arg;
+    self->contigs = calloc(num_contigs, sizeof(tree_sequence_t));
+    self->created = calloc(num_contigs, sizeof(bool));
+    if (self->contigs == NULL || self->created == NULL) {
+        free(self->contigs);
+        free(self->created);
+        self->contigs = NULL;
+        self->created = NULL;
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    if (pthread_mutex_init(&self->mutex, NULL) != 0) {
+        free(self->contigs);
+        free(self->created);
+        self->contigs = NULL;
+        self->created = NULL;
+        ret = MSP_ERR_THREAD;
+        goto out;
+    }
+out:
+    return ret;
+}
+
+static void
+contig_driver_free_contigs(contig_driver_t *self)
+{
+    size_t j;
+
+    for (j = 0; j < self->num_contigs; j++) {
+        if (self->created[j]) {
+            tree_sequence_free(&self->contigs[j]);
+            self->created[j] = false;
+        }
+    }
+}
+
+int
+contig_driver_free(contig_driver_t *self)
+{
+    /* The contigs are only kept by contig_driver_alloc once the mutex
+     * has been initialised. */
+    if (self->contigs != NULL) {
+        contig_driver_free_contigs(self);
+        free(self->contigs);
+        free(self->created);
+        self->contigs = NULL;
+        self->created = NULL;
+        pthread_mutex_destroy(&self->mutex);
+    }
+    return 0;
+}
+
+/* Simulates all of the contigs and joins them into tree_sequence, which
+ * must be freed with tree_sequence_free afterwards, even on error. */
+int WARN_UNUSED
+contig_driver_run(contig_driver_t *self, tree_sequence_t *tree_sequence)
+{
+    int ret = 0;
+    size_t j, num_started;
+    pthread_t *threads = NULL;
+    tree_sequence_t **contigs = NULL;
+
+    memset(tree_sequence, 0, sizeof(tree_sequence_t));
+    threads = malloc(self->num_threads * sizeof(pthread_t));
+    contigs = malloc(self->num_contigs * sizeof(tree_sequence_t *));
+    if (threads == NULL || contigs == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    contig_driver_free_contigs(self);
+    self->next_contig = 0;
+    self->error = 0;
+    for (num_started = 0; num_started < self->num_threads; num_started++) {
+        if (pthread_create(&threads[num_started], NULL, contig_driver_worker,
+                    self) != 0) {
+            /* The running threads stop when they see the error */
+            pthread_mutex_lock(&self->mutex);
+            self->error = MSP_ERR_THREAD;
+            pthread_mutex_unlock(&self->mutex);
+            break;
+        }
+    }
+    for (j = 0; j < num_started; j++) {
+        if (pthread_join(threads[j], NULL) != 0) {
+            self->error = MSP_ERR_THREAD;
+        }
+    }
+    ret = self->error;
+    if (ret != 0) {
+        goto out;
+    }
+    for (j = 0; j < self->num_contigs; j++) {
+        assert(self->created[j]);
+        contigs[j] = &self->contigs[j];
+    }
+    ret = tree_sequence_join(tree_sequence, self->num_contigs, contigs);
+out:
+    /* The per-contig tree sequences are not needed once joined */
+    if (self->created != NULL) {
+        contig_driver_free_contigs(self);
+    }
+    if (threads != NULL) {
+        free(threads);
+    }
+    if (contigs != NULL) {
+        free(contigs);
+    }
+    return ret;
+}
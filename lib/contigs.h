@@ -0,0 +1,69 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CONTIGS_H__
+#define __CONTIGS_H__
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <gsl/gsl_rng.h>
+
+#include "msprime.h"
+#include "rng.h"
+
+/* Allocates and configures the simulator for the specified contig. The
+ * simulator must be allocated with the specified rng and the same samples
+ * for every contig, and its number of loci and recombination rate must be
+ * set from recomb_map. It is initialised by the driver afterwards. Called
+ * concurrently from the worker threads. */
+typedef int (*contig_configure_func)(msp_t *msp, size_t contig,
+        recomb_map_t *recomb_map, gsl_rng *rng, void *arg);
+
+/* Simulates a set of independent contigs, such as the chromosomes of a
+ * genome, on a pool of threads and joins the results end to end into a
+ * single tree sequence with tree_sequence_join. Contig j is simulated
+ * using stream (seed, 0, j) of a Philox generator, so the result does not
+ * depend on the number of threads.
+ */
+typedef struct contig_driver_t_t {
+    size_t num_threads;
+    size_t num_contigs;
+    recomb_map_t *recomb_maps;
+    unsigned long seed;
+    double mutation_rate;
+    double Ne;
+    contig_configure_func configure;
+    void *arg;
+    tree_sequence_t *contigs;
+    bool *created;
+    /* The following are protected by mutex */
+    pthread_mutex_t mutex;
+    size_t next_contig;
+    int error;
+} contig_driver_t;
+
+int contig_driver_alloc(contig_driver_t *self, size_t num_contigs,
+        recomb_map_t *recomb_maps, size_t num_threads, unsigned long seed,
+        double mutation_rate, double Ne, contig_configure_func configure,
+        void *arg);
+int contig_driver_free(contig_driver_t *self);
+int contig_driver_run(contig_driver_t *self, tree_sequence_t *tree_sequence);
+
+#endif /*__CONTIGS_H__*/
@@ -71,5 +71,9 @@
 #define MSP_ERR_INCONSISTENT_POPULATION_IDS                         -40
 #define MSP_ERR_BAD_RECORD_INTERVAL                                 -41
 #define MSP_ERR_ZERO_RECORDS                                        -42
+#define MSP_ERR_RECORDS_FLUSHED                                     -43
+#define MSP_ERR_BAD_CHECKPOINT                                      -44
+#define MSP_ERR_THREAD                                              -45
+#define MSP_ERR_INCOMPATIBLE_CONTIGS                                -46
 
 #endif /*__ERR_H__*/
@@ -36,6 +36,7 @@ fenwick_set_log_size(fenwick_t *self)
 {
     size_t u = self->size;
 
+    self->log_size = 0;
     while (u != 0) {
         self->log_size = u;
         u -= (u & -u);
@@ -72,37 +73,34 @@ fenwick_alloc(fenwick_t *self, size_t initial_size)
     return fenwick_alloc_buffers(self);
 }
 
+/* Adds increment entries with value zero to the end of the tree. If we
+ * run out of memory the tree is left unchanged. */
 int WARN_UNUSED
 fenwick_expand(fenwick_t *self, size_t increment)
 {
     int ret = -1;
     size_t j;
-    int64_t *values = self->values;
-    size_t old_size = self->size;
+    fenwick_t expanded;
 
     if (self->tree == NULL || self->values == NULL) {
         goto out;
     }
-    self->size += increment;
-    free(self->tree);
-    /* we still need values until we have rebuilt the tree; we need to
-     * make sure we don't double free in an error condition though.
-     */
-    self->values = NULL;
-    ret = fenwick_alloc_buffers(self);
+    expanded.size = self->size + increment;
+    ret = fenwick_alloc_buffers(&expanded);
     if (ret != 0) {
+        fenwick_free(&expanded);
         goto out;
     }
     /* now insert all of the values into the new tree. There is probably a
      * better way to do this...
      */
-    for (j = 1; j <= old_size; j++) {
-        fenwick_set_value(self, j, values[j]);
+    for (j = 1; j <= self->size; j++) {
+        fenwick_set_value(&expanded, j, self->values[j]);
     }
+    free(self->tree);
+    free(self->values);
+    *self = expanded;
 out:
-    if (values != NULL) {
-        free(values);
-    }
     return ret;
 }
 
@@ -119,6 +119,12 @@ hapgen_alloc(hapgen_t *self, tree_sequence_t *tree_sequence)
     self->num_mutations = tree_sequence_get_num_mutations(tree_sequence);
     self->tree_sequence = tree_sequence;
 
+    /* We use the mutations of each tree directly, so read them now if the
+     * tree sequence was loaded lazily. */
+    ret = tree_sequence_load_columns(tree_sequence, MSP_COLUMNS_MUTATIONS);
+    if (ret != 0) {
+        goto out;
+    }
     ret = sparse_tree_alloc(&self->tree, tree_sequence, MSP_LEAF_LISTS);
     if (ret != 0) {
         goto out;
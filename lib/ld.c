@@ -71,6 +71,13 @@ ld_calc_alloc(ld_calc_t *self, tree_sequence_t *tree_sequence)
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
+    /* The trees seek to the mutations, so build the snapshots now. Several
+     * calculators may then seek in the same tree sequence in parallel
+     * without any of them writing to it. */
+    ret = tree_sequence_build_snapshots(self->tree_sequence);
+    if (ret != 0) {
+        goto out;
+    }
     ret = sparse_tree_alloc(self->outer_tree, self->tree_sequence,
             MSP_LEAF_COUNTS|MSP_LEAF_LISTS);
     if (ret != 0) {
@@ -125,25 +132,13 @@ ld_calc_position_trees(ld_calc_t *self, size_t mutation_index)
     sparse_tree_t *tB = self->inner_tree;
 
     assert(tA->index == tB->index);
-    while (x > tA->right) {
-        ret = sparse_tree_next(tA);
-        if (ret < 0) {
-            goto out;
-        }
-        assert(ret == 1);
-        ret = sparse_tree_next(tB);
+    if (x < tA->left || x >= tA->right) {
+        ret = sparse_tree_seek(tA, x);
         if (ret < 0) {
             goto out;
         }
         assert(ret == 1);
-    }
-    while (x < tA->left) {
-        ret = sparse_tree_prev(tA);
-        if (ret < 0) {
-            goto out;
-        }
-        assert(ret == 1);
-        ret = sparse_tree_prev(tB);
+        ret = sparse_tree_seek(tB, x);
         if (ret < 0) {
             goto out;
         }
@@ -0,0 +1,130 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Array backed lineage set. Insertion, removal and access by index are
+ * all O(1), so a uniformly distributed lineage can be chosen by drawing
+ * a uniform index in [0, size).
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "err.h"
+#include "lineage_set.h"
+
+int WARN_UNUSED
+lineage_set_alloc(lineage_set_t *self, size_t initial_size)
+{
+    int ret = 0;
+
+    self->size = 0;
+    self->max_size = initial_size;
+    self->items = NULL;
+    if (initial_size > 0) {
+        self->items = malloc(initial_size * sizeof(uint32_t));
+        if (self->items == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+        }
+    }
+    return ret;
+}
+
+int WARN_UNUSED
+lineage_set_expand(lineage_set_t *self, size_t increment)
+{
+    int ret = 0;
+    void *p;
+
+    p = realloc(self->items, (self->max_size + increment) * sizeof(uint32_t));
+    if (p == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    self->items = p;
+    self->max_size += increment;
+out:
+    return ret;
+}
+
+int
+lineage_set_free(lineage_set_t *self)
+{
+    if (self->items != NULL) {
+        free(self->items);
+        self->items = NULL;
+    }
+    self->size = 0;
+    self->max_size = 0;
+    return 0;
+}
+
+size_t
+lineage_set_get_size(lineage_set_t *self)
+{
+    return self->size;
+}
+
+int
+lineage_set_is_full(lineage_set_t *self)
+{
+    return self->size == self->max_size;
+}
+
+void
+lineage_set_insert(lineage_set_t *self, uint32_t item)
+{
+    assert(self->size < self->max_size);
+    self->items[self->size] = item;
+    self->size++;
+}
+
+uint32_t
+lineage_set_get_item(lineage_set_t *self, size_t index)
+{
+    assert(index < self->size);
+    return self->items[index];
+}
+
+/*
+ * Removes and returns the item at the specified index. The last item in
+ * the set is moved into the vacated position, so items with indexes less
+ * than index are unaffected.
+ */
+uint32_t
+lineage_set_remove(lineage_set_t *self, size_t index)
+{
+    uint32_t ret;
+
+    assert(index < self->size);
+    ret = self->items[index];
+    self->size--;
+    self->items[index] = self->items[self->size];
+    return ret;
+}
+
+void
+lineage_set_clear(lineage_set_t *self)
+{
+    self->size = 0;
+}
@@ -0,0 +1,47 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __LINEAGE_SET_H__
+#define __LINEAGE_SET_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/* An unordered set of lineages stored in a dense array. Each lineage is
+ * identified by the index of its first segment. Items are addressed by
+ * their position in the array, which is not stable: removing an item moves
+ * the last item into its place.
+ */
+typedef struct {
+    size_t size;
+    size_t max_size;
+    uint32_t *items;
+} lineage_set_t;
+
+int lineage_set_alloc(lineage_set_t *, size_t);
+int lineage_set_expand(lineage_set_t *, size_t);
+int lineage_set_free(lineage_set_t *);
+size_t lineage_set_get_size(lineage_set_t *);
+int lineage_set_is_full(lineage_set_t *);
+void lineage_set_insert(lineage_set_t *, uint32_t);
+uint32_t lineage_set_get_item(lineage_set_t *, size_t);
+uint32_t lineage_set_remove(lineage_set_t *, size_t);
+void lineage_set_clear(lineage_set_t *);
+
+#endif /*__LINEAGE_SET_H__*/
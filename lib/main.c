@@ -27,6 +27,8 @@
 #include <gsl/gsl_math.h>
 
 #include "msprime.h"
+#include "replicates.h"
+#include "contigs.h"
 #include "err.h"
 
 /* This file defines a crude CLI for msprime. It is intended for development
@@ -282,6 +284,65 @@ out:
     return ret;
 }
 
+static int
+read_sparse_migration_matrix(msp_t *msp, config_setting_t *setting)
+{
+    int ret = 0;
+    size_t j, size;
+    uint32_t *source = NULL;
+    uint32_t *dest = NULL;
+    double *rate = NULL;
+    config_setting_t *s, *t;
+
+    if (config_setting_is_list(setting) == CONFIG_FALSE) {
+        fatal_error("sparse_migration_matrix must be a list");
+    }
+    size = (size_t) config_setting_length(setting);
+    source = malloc((size + 1) * sizeof(uint32_t));
+    dest = malloc((size + 1) * sizeof(uint32_t));
+    rate = malloc((size + 1) * sizeof(double));
+    if (source == NULL || dest == NULL || rate == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    for (j = 0; j < size; j++) {
+        s = config_setting_get_elem(setting, (unsigned int) j);
+        if (s == NULL) {
+            fatal_error("error reading sparse_migration_matrix[%d]", j);
+        }
+        if (config_setting_is_group(s) == CONFIG_FALSE) {
+            fatal_error("sparse_migration_matrix[%d] not a group", j);
+        }
+        t = config_setting_get_member(s, "source");
+        if (t == NULL) {
+            fatal_error("source not specified");
+        }
+        source[j] = (uint32_t) config_setting_get_int(t);
+        t = config_setting_get_member(s, "dest");
+        if (t == NULL) {
+            fatal_error("dest not specified");
+        }
+        dest[j] = (uint32_t) config_setting_get_int(t);
+        t = config_setting_get_member(s, "rate");
+        if (t == NULL) {
+            fatal_error("rate not specified");
+        }
+        rate[j] = config_setting_get_float(t);
+    }
+    ret = msp_set_sparse_migration_matrix(msp, size, source, dest, rate);
+out:
+    if (source != NULL) {
+        free(source);
+    }
+    if (dest != NULL) {
+        free(dest);
+    }
+    if (rate != NULL) {
+        free(rate);
+    }
+    return ret;
+}
+
 static int
 read_migration_matrix(msp_t *msp, config_t *config)
 {
@@ -291,6 +352,17 @@ read_migration_matrix(msp_t *msp, config_t *config)
     config_setting_t *s;
     config_setting_t *setting = config_lookup(config, "migration_matrix");
 
+    /* Models with many populations can give the migration matrix as a
+     * list of non-zero entries instead. */
+    s = config_lookup(config, "sparse_migration_matrix");
+    if (s != NULL) {
+        if (setting != NULL) {
+            fatal_error("Cannot specify both migration_matrix and "
+                    "sparse_migration_matrix");
+        }
+        ret = read_sparse_migration_matrix(msp, s);
+        goto out;
+    }
     if (setting == NULL) {
         fatal_error("migration_matrix is a required parameter");
     }
@@ -720,6 +792,87 @@ out:
     }
 }
 
+static void
+print_profile(msp_t *msp, FILE *out)
+{
+    msp_profile_t profile;
+
+    msp_get_profile(msp, &profile);
+    fprintf(out, "{\n");
+    fprintf(out, "    \"enabled\": %s,\n", profile.enabled ? "true" : "false");
+    fprintf(out, "    \"events\": {\n");
+    fprintf(out, "        \"recombination\": {\"count\": %lu, \"time\": %.9f},\n",
+            (unsigned long) msp_get_num_recombination_events(msp),
+            profile.recombination_time);
+    fprintf(out, "        \"common_ancestor\": {\"count\": %lu, \"time\": %.9f},\n",
+            (unsigned long) msp_get_num_common_ancestor_events(msp),
+            profile.common_ancestor_time);
+    fprintf(out, "        \"migration\": {\"time\": %.9f},\n",
+            profile.migration_time);
+    fprintf(out, "        \"demographic\": {\"time\": %.9f},\n",
+            profile.demographic_time);
+    fprintf(out, "        \"sampling\": {\"time\": %.9f}\n",
+            profile.sampling_time);
+    fprintf(out, "    },\n");
+    fprintf(out, "    \"merge\": {\"overlap_count_time\": %.9f, "
+            "\"compress_time\": %.9f, \"defrag_time\": %.9f},\n",
+            profile.merge_overlap_count_time, profile.merge_compress_time,
+            profile.merge_defrag_time);
+    fprintf(out, "    \"max_num_ancestors\": %lu,\n",
+            (unsigned long) profile.max_num_ancestors);
+    fprintf(out, "    \"max_num_segments\": %lu,\n",
+            (unsigned long) profile.max_num_segments);
+    fprintf(out, "    \"max_num_links\": %ld,\n", (long) profile.max_num_links);
+    fprintf(out, "    \"overlap_node_heap\": {\"high_water_mark\": %lu, "
+            "\"fragmentation\": %.6f}\n",
+            (unsigned long) profile.max_num_overlap_nodes,
+            profile.overlap_node_heap_fragmentation);
+    fprintf(out, "}\n");
+}
+
+/* Runs the simulation in the config file and prints its profile as JSON */
+static void
+run_profile(char *conf_file)
+{
+    int ret = -1;
+    mutation_params_t mutation_params;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+    msp_t *msp = calloc(1, sizeof(msp_t));
+    recomb_map_t *recomb_map = calloc(1, sizeof(recomb_map_t));
+
+    if (rng == NULL || msp == NULL || recomb_map == NULL) {
+        goto out;
+    }
+    ret = get_configuration(rng, msp, &mutation_params, recomb_map, conf_file);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_initialise(msp);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_run(msp, DBL_MAX, ULONG_MAX);
+    if (ret != 0) {
+        goto out;
+    }
+    print_profile(msp, stdout);
+out:
+    if (msp != NULL) {
+        msp_free(msp);
+        free(msp);
+    }
+    if (recomb_map != NULL) {
+        recomb_map_free(recomb_map);
+        free(recomb_map);
+    }
+    if (rng != NULL) {
+        gsl_rng_free(rng);
+    }
+    if (ret != 0) {
+        fatal_library_error(ret, "profile");
+    }
+}
+
 static void
 run_simulate(char *conf_file, char *output_file)
 {
@@ -788,7 +941,7 @@ run_simulate(char *conf_file, char *output_file)
     /* Create the tree_sequence from the state of the simulator.
      * We want to use coalescent time here, so use an Ne of 1/4
      * to cancel scaling factor. */
-    ret = tree_sequence_create(tree_seq, msp, recomb_map, 0.25);
+    ret = tree_sequence_adopt_simulation(tree_seq, msp, recomb_map, 0.25);
     if (ret != 0) {
         goto out;
     }
@@ -840,6 +993,191 @@ out:
     }
 }
 
+static int
+configure_replicate(msp_t *msp, recomb_map_t *recomb_map, gsl_rng *rng,
+        void *arg)
+{
+    mutation_params_t mutation_params;
+
+    return get_configuration(rng, msp, &mutation_params, recomb_map,
+            (const char *) arg);
+}
+
+/* Writes the replicate in ms format. */
+static int
+summarise_replicate(tree_sequence_t *ts, size_t replicate, FILE *out,
+        void *arg)
+{
+    int ret = 0;
+    size_t j;
+    size_t num_mutations = tree_sequence_get_num_mutations(ts);
+    double sequence_length = tree_sequence_get_sequence_length(ts);
+    mutation_t *mutations;
+    hapgen_t hg;
+    char *haplotype;
+
+    fprintf(out, "\n//\nsegsites: %d\n", (int) num_mutations);
+    if (num_mutations > 0) {
+        ret = tree_sequence_get_mutations(ts, &mutations);
+        if (ret != 0) {
+            goto out;
+        }
+        fprintf(out, "positions:");
+        for (j = 0; j < num_mutations; j++) {
+            fprintf(out, " %.4f", mutations[j].position / sequence_length);
+        }
+        fprintf(out, "\n");
+        ret = hapgen_alloc(&hg, ts);
+        if (ret != 0) {
+            goto out;
+        }
+        for (j = 0; j < tree_sequence_get_sample_size(ts); j++) {
+            ret = hapgen_get_haplotype(&hg, (uint32_t) j, &haplotype);
+            if (ret < 0) {
+                break;
+            }
+            fprintf(out, "%s\n", haplotype);
+        }
+        hapgen_free(&hg);
+    }
+out:
+    return ret;
+}
+
+static void
+run_replicates(char *conf_file, char *num_replicates, char *num_threads)
+{
+    int ret;
+    int int_tmp;
+    config_t config;
+    replicate_driver_t driver;
+    mutation_params_t mutation_params;
+    msp_t msp;
+    recomb_map_t recomb_map;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    if (rng == NULL) {
+        fatal_error("no memory");
+    }
+    /* Read the random seed and the mutation rate. The workers read the
+     * remainder of the configuration for themselves. */
+    config_init(&config);
+    if (config_read_file(&config, conf_file) == CONFIG_FALSE) {
+        fatal_error("configuration error:%s at line %d in file %s\n",
+                config_error_text(&config), config_error_line(&config),
+                conf_file);
+    }
+    if (config_lookup_int(&config, "random_seed", &int_tmp) == CONFIG_FALSE) {
+        fatal_error("random_seed is a required parameter");
+    }
+    config_destroy(&config);
+    ret = get_configuration(rng, &msp, &mutation_params, &recomb_map,
+            conf_file);
+    if (ret != 0) {
+        fatal_library_error(ret, "get_configuration");
+    }
+    msp_free(&msp);
+    recomb_map_free(&recomb_map);
+    gsl_rng_free(rng);
+
+    /* We use an Ne of 0.25 to get coalescent time units, as ms does. */
+    ret = replicate_driver_alloc(&driver, (size_t) atoi(num_threads),
+            (unsigned long) int_tmp, mutation_params.mutation_rate, 0.25,
+            configure_replicate, summarise_replicate, conf_file);
+    if (ret != 0) {
+        fatal_library_error(ret, "replicate_driver_alloc");
+    }
+    ret = replicate_driver_run(&driver, (size_t) atoi(num_replicates),
+            stdout);
+    if (ret != 0) {
+        fatal_library_error(ret, "replicate_driver_run");
+    }
+    replicate_driver_free(&driver);
+}
+
+static int
+configure_contig(msp_t *msp, size_t contig, recomb_map_t *recomb_map,
+        gsl_rng *rng, void *arg)
+{
+    int ret;
+    mutation_params_t mutation_params;
+    recomb_map_t config_recomb_map;
+
+    /* Every contig uses the configuration's recombination map, which
+     * the driver's recomb_map was built from */
+    ret = get_configuration(rng, msp, &mutation_params, &config_recomb_map,
+            (const char *) arg);
+    if (ret == 0) {
+        recomb_map_free(&config_recomb_map);
+    }
+    return ret;
+}
+
+static void
+run_contigs(char *conf_file, char *num_contigs_str, char *num_threads,
+        char *output_file)
+{
+    int ret;
+    int int_tmp;
+    size_t j;
+    size_t num_contigs = (size_t) atoi(num_contigs_str);
+    config_t config;
+    contig_driver_t driver;
+    mutation_params_t mutation_params;
+    msp_t msp;
+    recomb_map_t *recomb_maps = NULL;
+    tree_sequence_t ts;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    if (num_contigs < 1) {
+        fatal_error("at least one contig is required");
+    }
+    recomb_maps = malloc(num_contigs * sizeof(recomb_map_t));
+    if (rng == NULL || recomb_maps == NULL) {
+        fatal_error("no memory");
+    }
+    config_init(&config);
+    if (config_read_file(&config, conf_file) == CONFIG_FALSE) {
+        fatal_error("configuration error:%s at line %d in file %s\n",
+                config_error_text(&config), config_error_line(&config),
+                conf_file);
+    }
+    if (config_lookup_int(&config, "random_seed", &int_tmp) == CONFIG_FALSE) {
+        fatal_error("random_seed is a required parameter");
+    }
+    config_destroy(&config);
+    for (j = 0; j < num_contigs; j++) {
+        ret = get_configuration(rng, &msp, &mutation_params, &recomb_maps[j],
+                conf_file);
+        if (ret != 0) {
+            fatal_library_error(ret, "get_configuration");
+        }
+        msp_free(&msp);
+    }
+    gsl_rng_free(rng);
+
+    ret = contig_driver_alloc(&driver, num_contigs, recomb_maps,
+            (size_t) atoi(num_threads), (unsigned long) int_tmp,
+            mutation_params.mutation_rate, 0.25, configure_contig, conf_file);
+    if (ret != 0) {
+        fatal_library_error(ret, "contig_driver_alloc");
+    }
+    ret = contig_driver_run(&driver, &ts);
+    if (ret != 0) {
+        fatal_library_error(ret, "contig_driver_run");
+    }
+    ret = tree_sequence_dump(&ts, output_file, 0);
+    if (ret != 0) {
+        fatal_library_error(ret, "Write error");
+    }
+    tree_sequence_free(&ts);
+    contig_driver_free(&driver);
+    for (j = 0; j < num_contigs; j++) {
+        recomb_map_free(&recomb_maps[j]);
+    }
+    free(recomb_maps);
+}
+
 static void
 load_tree_sequence(tree_sequence_t *ts, char *filename)
 {
@@ -963,6 +1301,25 @@ main(int argc, char** argv)
             fatal_error("usage: %s simulate CONFIG_FILE OUTPUT_FILE", argv[0]);
         }
         run_simulate(argv[2], argv[3]);
+    } else if (strncmp(cmd, "profile", strlen(cmd)) == 0) {
+        if (argc < 3) {
+            fatal_error("usage: %s profile CONFIG_FILE", argv[0]);
+        }
+        run_profile(argv[2]);
+    } else if (strncmp(cmd, "replicates", strlen(cmd)) == 0) {
+        if (argc < 5) {
+            fatal_error(
+                "usage: %s replicates CONFIG_FILE NUM_REPLICATES NUM_THREADS",
+                argv[0]);
+        }
+        run_replicates(argv[2], argv[3], argv[4]);
+    } else if (strncmp(cmd, "contigs", strlen(cmd)) == 0) {
+        if (argc < 6) {
+            fatal_error(
+                "usage: %s contigs CONFIG_FILE NUM_CONTIGS NUM_THREADS "
+                "OUTPUT_FILE", argv[0]);
+        }
+        run_contigs(argv[2], argv[3], argv[4], argv[5]);
     } else if (strncmp(cmd, "ld", strlen(cmd)) == 0) {
         if (argc < 3) {
             fatal_error("usage: %s ld INPUT_FILE", argv[0]);
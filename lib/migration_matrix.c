@@ -0,0 +1,325 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Sparse migration matrix, stored so that the cost of choosing and
+ * updating migration rates scales with the number of neighbours of a
+ * population rather than the total number of populations.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "err.h"
+#include "migration_matrix.h"
+
+typedef struct {
+    uint32_t source;
+    uint32_t dest;
+    double rate;
+} migration_matrix_entry_t;
+
+static int
+cmp_migration_matrix_entry(const void *a, const void *b) {
+    const migration_matrix_entry_t *ia = (const migration_matrix_entry_t *) a;
+    const migration_matrix_entry_t *ib = (const migration_matrix_entry_t *) b;
+    int ret = (ia->source > ib->source) - (ia->source < ib->source);
+    if (ret == 0) {
+        ret = (ia->dest > ib->dest) - (ia->dest < ib->dest);
+    }
+    return ret;
+}
+
+static void
+migration_matrix_update_row(migration_matrix_t *self, uint32_t source)
+{
+    size_t j;
+    double sum = 0.0;
+
+    for (j = self->row_start[source]; j < self->row_start[source + 1]; j++) {
+        sum += self->rate[j];
+        self->cumulative_rate[j] = sum;
+    }
+    self->row_sum[source] = sum;
+}
+
+/*
+ * Allocates a migration matrix for the specified number of populations
+ * with the specified entries, which do not need to be sorted. Repeated
+ * entries for the same pair of populations are merged, and their rates
+ * summed.
+ */
+int WARN_UNUSED
+migration_matrix_alloc(migration_matrix_t *self, size_t num_populations,
+        size_t num_entries, uint32_t *source, uint32_t *dest, double *rate)
+{
+    int ret = 0;
+    size_t j, k;
+    uint32_t pop;
+    migration_matrix_entry_t *entries = NULL;
+
+    memset(self, 0, sizeof(migration_matrix_t));
+    self->num_populations = num_populations;
+    /* Avoid zero sized allocations when the matrix is empty */
+    entries = malloc((num_entries + 1) * sizeof(migration_matrix_entry_t));
+    self->row_start = calloc(num_populations + 1, sizeof(size_t));
+    self->row_sum = calloc(num_populations, sizeof(double));
+    if (entries == NULL || self->row_start == NULL || self->row_sum == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    for (j = 0; j < num_entries; j++) {
+        if (source[j] >= num_populations || dest[j] >= num_populations
+                || source[j] == dest[j] || !(rate[j] >= 0.0)) {
+            ret = MSP_ERR_BAD_MIGRATION_MATRIX;
+            goto out;
+        }
+        entries[j].source = source[j];
+        entries[j].dest = dest[j];
+        entries[j].rate = rate[j];
+    }
+    qsort(entries, num_entries, sizeof(migration_matrix_entry_t),
+            cmp_migration_matrix_entry);
+    /* Merge repeated entries in place */
+    k = 0;
+    for (j = 0; j < num_entries; j++) {
+        if (k > 0 && cmp_migration_matrix_entry(&entries[k - 1],
+                    &entries[j]) == 0) {
+            entries[k - 1].rate += entries[j].rate;
+        } else {
+            entries[k] = entries[j];
+            k++;
+        }
+    }
+    self->num_entries = k;
+    k = self->num_entries + 1;
+    self->source = malloc(k * sizeof(uint32_t));
+    self->dest = malloc(k * sizeof(uint32_t));
+    self->rate = malloc(k * sizeof(double));
+    self->cumulative_rate = malloc(k * sizeof(double));
+    if (self->source == NULL || self->dest == NULL || self->rate == NULL
+            || self->cumulative_rate == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    for (j = 0; j < self->num_entries; j++) {
+        self->source[j] = entries[j].source;
+        self->dest[j] = entries[j].dest;
+        self->rate[j] = entries[j].rate;
+        self->row_start[entries[j].source + 1]++;
+    }
+    for (pop = 0; pop < num_populations; pop++) {
+        self->row_start[pop + 1] += self->row_start[pop];
+        migration_matrix_update_row(self, pop);
+    }
+out:
+    if (entries != NULL) {
+        free(entries);
+    }
+    return ret;
+}
+
+int
+migration_matrix_free(migration_matrix_t *self)
+{
+    if (self->row_start != NULL) {
+        free(self->row_start);
+    }
+    if (self->source != NULL) {
+        free(self->source);
+    }
+    if (self->dest != NULL) {
+        free(self->dest);
+    }
+    if (self->rate != NULL) {
+        free(self->rate);
+    }
+    if (self->cumulative_rate != NULL) {
+        free(self->cumulative_rate);
+    }
+    if (self->row_sum != NULL) {
+        free(self->row_sum);
+    }
+    memset(self, 0, sizeof(migration_matrix_t));
+    return 0;
+}
+
+size_t
+migration_matrix_get_num_entries(migration_matrix_t *self)
+{
+    return self->num_entries;
+}
+
+double
+migration_matrix_get_row_sum(migration_matrix_t *self, uint32_t source)
+{
+    assert(source < self->num_populations);
+    return self->row_sum[source];
+}
+
+/*
+ * Sets index to the position of the entry for the specified source and
+ * destination populations, or returns an error if the entry is not in
+ * the sparsity pattern.
+ */
+int WARN_UNUSED
+migration_matrix_get_index(migration_matrix_t *self, uint32_t source,
+        uint32_t dest, size_t *index)
+{
+    int ret = MSP_ERR_BAD_MIGRATION_MATRIX_INDEX;
+    size_t lo, hi, mid;
+
+    if (source >= self->num_populations) {
+        goto out;
+    }
+    lo = self->row_start[source];
+    hi = self->row_start[source + 1];
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (self->dest[mid] < dest) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < self->row_start[source + 1] && self->dest[lo] == dest) {
+        *index = lo;
+        ret = 0;
+    }
+out:
+    return ret;
+}
+
+/*
+ * Sets the rate of the specified entry. This takes time proportional to
+ * the number of entries in the same row.
+ */
+void
+migration_matrix_set_rate(migration_matrix_t *self, size_t index, double rate)
+{
+    assert(index < self->num_entries);
+    assert(rate >= 0.0);
+    self->rate[index] = rate;
+    migration_matrix_update_row(self, self->source[index]);
+}
+
+void
+migration_matrix_set_all_rates(migration_matrix_t *self, double rate)
+{
+    size_t j;
+    uint32_t pop;
+
+    assert(rate >= 0.0);
+    for (j = 0; j < self->num_entries; j++) {
+        self->rate[j] = rate;
+    }
+    for (pop = 0; pop < self->num_populations; pop++) {
+        migration_matrix_update_row(self, pop);
+    }
+}
+
+/*
+ * Sets the rates of this matrix to those in the specified source matrix.
+ * Every entry in the source must be in the sparsity pattern of this
+ * matrix; any other entries are set to zero.
+ */
+int WARN_UNUSED
+migration_matrix_copy_rates(migration_matrix_t *self,
+        migration_matrix_t *source)
+{
+    int ret = 0;
+    size_t j, k;
+    uint32_t pop;
+
+    assert(self->num_populations == source->num_populations);
+    /* Check the sparsity patterns first so that we don't leave this matrix
+     * partially updated on error. */
+    for (j = 0; j < source->num_entries; j++) {
+        ret = migration_matrix_get_index(self, source->source[j],
+                source->dest[j], &k);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    for (j = 0; j < self->num_entries; j++) {
+        self->rate[j] = 0.0;
+    }
+    for (j = 0; j < source->num_entries; j++) {
+        ret = migration_matrix_get_index(self, source->source[j],
+                source->dest[j], &k);
+        assert(ret == 0);
+        self->rate[k] = source->rate[j];
+    }
+    for (pop = 0; pop < self->num_populations; pop++) {
+        migration_matrix_update_row(self, pop);
+    }
+out:
+    return ret;
+}
+
+/*
+ * Returns the index of the entry in the specified row whose interval in
+ * the running sum of rates contains x, where 0 <= x < row_sum. Entries
+ * with a rate of zero are never returned.
+ */
+size_t
+migration_matrix_find(migration_matrix_t *self, uint32_t source, double x)
+{
+    size_t first = self->row_start[source];
+    size_t lo = first;
+    size_t hi = self->row_start[source + 1] - 1;
+    size_t mid;
+
+    assert(self->row_sum[source] > 0.0);
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (self->cumulative_rate[mid] > x) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    /* Rounding can leave us on a zero rate entry at the end of the row */
+    while (lo > first && self->rate[lo] == 0.0) {
+        lo--;
+    }
+    assert(self->rate[lo] > 0.0);
+    return lo;
+}
+
+/*
+ * Writes the matrix into the specified num_populations * num_populations
+ * array in row-major order.
+ */
+void
+migration_matrix_get_dense(migration_matrix_t *self, double *dense)
+{
+    size_t j;
+    size_t N = self->num_populations;
+
+    memset(dense, 0, N * N * sizeof(double));
+    for (j = 0; j < self->num_entries; j++) {
+        dense[self->source[j] * N + self->dest[j]] = self->rate[j];
+    }
+}
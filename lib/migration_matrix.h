@@ -0,0 +1,57 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MIGRATION_MATRIX_H__
+#define __MIGRATION_MATRIX_H__
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+/* A sparse matrix of migration rates in compressed sparse row format.
+ * The entries for source population j have indexes row_start[j] to
+ * row_start[j + 1] - 1 and are sorted by destination. The sparsity
+ * pattern is fixed when the matrix is allocated; entries within it
+ * may have a rate of zero.
+ */
+typedef struct {
+    size_t num_populations;
+    size_t num_entries;
+    size_t *row_start;
+    uint32_t *source;
+    uint32_t *dest;
+    double *rate;
+    /* Running sum of the rates within each row */
+    double *cumulative_rate;
+    double *row_sum;
+} migration_matrix_t;
+
+int migration_matrix_alloc(migration_matrix_t *, size_t, size_t, uint32_t *,
+        uint32_t *, double *);
+int migration_matrix_free(migration_matrix_t *);
+size_t migration_matrix_get_num_entries(migration_matrix_t *);
+double migration_matrix_get_row_sum(migration_matrix_t *, uint32_t);
+int migration_matrix_get_index(migration_matrix_t *, uint32_t, uint32_t,
+        size_t *);
+void migration_matrix_set_rate(migration_matrix_t *, size_t, double);
+void migration_matrix_set_all_rates(migration_matrix_t *, double);
+int migration_matrix_copy_rates(migration_matrix_t *, migration_matrix_t *);
+size_t migration_matrix_find(migration_matrix_t *, uint32_t, double);
+void migration_matrix_get_dense(migration_matrix_t *, double *);
+
+#endif /*__MIGRATION_MATRIX_H__*/
@@ -16,6 +16,12 @@
 ** You should have received a copy of the GNU General Public License
 ** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
 */
+#ifdef MSP_PROFILE
+/* For clock_gettime */
+#define _POSIX_C_SOURCE 200112L
+#include <time.h>
+#endif
+
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -42,8 +48,40 @@
 #define MSP_STATE_SIMULATING 2
 #define MSP_STATE_DEBUGGING 3
 
+/* The number of uniform and exponential variates drawn at a time */
+#define MSP_VARIATE_BLOCK_SIZE 256
+
+/* A single object heap block may use at most this fraction of max_memory */
+#define MSP_HEAP_BLOCK_MEMORY_FRACTION 16
+
+/* Profiling is compiled out unless MSP_PROFILE is defined. The times are
+ * taken from a monotonic clock around each event and merge phase. */
+#ifdef MSP_PROFILE
+#define MSP_PROFILE_DECLARE(start) double start
+#define MSP_PROFILE_START(start) start = msp_profile_clock()
+#define MSP_PROFILE_STOP(self, field, start) \
+    (self)->profile.field += msp_profile_clock() - (start)
+#define MSP_PROFILE_PEAKS(self) msp_profile_peaks(self)
+#else
+#define MSP_PROFILE_DECLARE(start)
+#define MSP_PROFILE_START(start)
+#define MSP_PROFILE_STOP(self, field, start)
+#define MSP_PROFILE_PEAKS(self)
+#endif
+
 static char _hdf5_error[MSP_HDF5_ERR_MSG_SIZE];
 
+#ifdef MSP_PROFILE
+static double
+msp_profile_clock(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) t.tv_sec + 1e-9 * (double) t.tv_nsec;
+}
+#endif
+
 static herr_t
 hdf5_error_walker(unsigned n, const H5E_error2_t *err_desc, void *client_data)
 {
@@ -156,6 +194,20 @@ msp_strerror(int err)
         case MSP_ERR_INCONSISTENT_POPULATION_IDS:
             ret = "Population associated with nodes not consistent between records";
             break;
+        case MSP_ERR_BAD_CHECKPOINT:
+            ret = "Checkpoint does not match the configuration of the "
+                "simulation.";
+            break;
+        case MSP_ERR_THREAD:
+            ret = "Error creating or synchronising threads.";
+            break;
+        case MSP_ERR_INCOMPATIBLE_CONTIGS:
+            ret = "Contigs must have the same samples.";
+            break;
+        case MSP_ERR_RECORDS_FLUSHED:
+            ret = "Coalescence records have been flushed to a sink and cannot "
+                "be read back.";
+            break;
         case MSP_ERR_BAD_RECORD_INTERVAL:
             ret = "Bad record interval where right <= left";
             break;
@@ -213,37 +265,24 @@ out:
 }
 
 static int
-cmp_individual(const void *a, const void *b) {
-    const segment_t *ia = (const segment_t *) a;
-    const segment_t *ib = (const segment_t *) b;
-    return (ia->id > ib->id) - (ia->id < ib->id);
-}
-
-/* For the segment priority queue we want to sort on the left
- * coordinate and to break ties we arbitrarily use the ID */
-static int
-cmp_segment_queue(const void *a, const void *b) {
-    const segment_t *ia = (const segment_t *) a;
-    const segment_t *ib = (const segment_t *) b;
-    int ret = (ia->left > ib->left) - (ia->left < ib->left);
-    if (ret == 0)  {
-        ret = (ia->id > ib->id) - (ia->id < ib->id);
-    }
-    return ret;
+cmp_sampling_event(const void *a, const void *b) {
+    const sampling_event_t *ia = (const sampling_event_t *) a;
+    const sampling_event_t *ib = (const sampling_event_t *) b;
+    return (ia->time > ib->time) - (ia->time < ib->time);
 }
 
 static int
-cmp_node_mapping(const void *a, const void *b) {
-    const node_mapping_t *ia = (const node_mapping_t *) a;
-    const node_mapping_t *ib = (const node_mapping_t *) b;
-    return (ia->left > ib->left) - (ia->left < ib->left);
+cmp_double(const void *a, const void *b) {
+    const double *ia = (const double *) a;
+    const double *ib = (const double *) b;
+    return (*ia > *ib) - (*ia < *ib);
 }
 
 static int
-cmp_sampling_event(const void *a, const void *b) {
-    const sampling_event_t *ia = (const sampling_event_t *) a;
-    const sampling_event_t *ib = (const sampling_event_t *) b;
-    return (ia->time > ib->time) - (ia->time < ib->time);
+cmp_overlap_node(const void *a, const void *b) {
+    const uint64_t *ia = (const uint64_t *) a;
+    const uint64_t *ib = (const uint64_t *) b;
+    return (*ia > *ib) - (*ia < *ib);
 }
 
 static int
@@ -253,58 +292,46 @@ cmp_uint32_t(const void *a, const void *b) {
     return (*ia > *ib) - (*ia < *ib);
 }
 
-static void
-segment_init(void **obj, size_t id)
-{
-    segment_t *seg = (segment_t *) obj;
-    seg->id = id + 1;
-}
-
-static size_t
-msp_get_avl_node_mem_increment(msp_t *self)
-{
-    return sizeof(void *) + self->avl_node_block_size
-            * (sizeof(avl_node_t) + sizeof(void *));
-}
-
 static size_t
-msp_get_binary_children_mem_increment(msp_t *self)
+msp_get_segment_mem_increment(msp_t *self, size_t num_segments)
 {
-    return sizeof(void *) + self->coalescence_record_block_size
-            * (2 * sizeof(uint32_t) + sizeof(void *));
+    /* we have a segment, an entry in the Fenwick tree and a lineage end */
+    return num_segments * (sizeof(segment_t) + 2 * sizeof(int64_t)
+            + sizeof(uint32_t));
 }
 
 static size_t
-msp_get_segment_mem_increment(msp_t *self)
+msp_get_lineage_set_mem_increment(msp_t *self, population_t *pop)
 {
-    /* we have a segment, a pointer to it and an entry in the Fenwick tree */
-    size_t s = sizeof(segment_t) + sizeof(void *) + 2 * sizeof(int64_t);
-    return sizeof(void *) + self->segment_block_size * s;
+    /* We double the size of the population's lineage set each time,
+     * starting from the segment block size. */
+    return GSL_MAX(pop->ancestors.max_size, self->segment_block_size)
+        * sizeof(uint32_t);
 }
 
 static size_t
 msp_get_node_mapping_mem_increment(msp_t *self)
 {
-    return sizeof(void *) + self->node_mapping_block_size
-            * sizeof(node_mapping_t);
+    return self->node_mapping_block_size * sizeof(uint64_t);
 }
 
+/* The simulator no longer allocates AVL nodes, so this is always zero. */
 size_t
 msp_get_num_avl_node_blocks(msp_t *self)
 {
-    return self->avl_node_heap.num_blocks;
+    return 0;
 }
 
 size_t
 msp_get_num_node_mapping_blocks(msp_t *self)
 {
-    return self->node_mapping_heap.num_blocks;
+    return self->num_node_mapping_blocks;
 }
 
 size_t
 msp_get_num_segment_blocks(msp_t *self)
 {
-    return self->segment_heap.num_blocks;
+    return self->num_segment_blocks;
 }
 
 size_t
@@ -319,6 +346,15 @@ msp_get_num_migration_record_blocks(msp_t *self)
     return self->num_migration_record_blocks;
 }
 
+/* Returns the number of times that memory for use within a single event
+ * has been malloced. Once the scratch space has grown to the largest size
+ * needed this stays constant. */
+size_t
+msp_get_num_transient_allocations(msp_t *self)
+{
+    return scratch_get_num_allocations(&self->scratch);
+}
+
 size_t
 msp_get_used_memory(msp_t *self)
 {
@@ -343,6 +379,22 @@ msp_get_num_recombination_events(msp_t *self)
     return self->num_re_events;
 }
 
+int
+msp_get_profile(msp_t *self, msp_profile_t *profile)
+{
+    *profile = self->profile;
+#ifdef MSP_PROFILE
+    profile->enabled = true;
+#else
+    profile->enabled = false;
+#endif
+    profile->max_num_overlap_nodes = object_heap_get_high_water_mark(
+            &self->overlap_node_heap);
+    profile->overlap_node_heap_fragmentation = object_heap_get_fragmentation(
+            &self->overlap_node_heap);
+    return 0;
+}
+
 int
 msp_set_model(msp_t *self, int model)
 {
@@ -370,6 +422,35 @@ msp_set_store_migration_records(msp_t *self, bool store_migration_records)
     return 0;
 }
 
+/* Sets whether the SMC or SMC' is simulated by the sequential engine. */
+int
+msp_set_sequential(msp_t *self, bool sequential)
+{
+    int ret = 0;
+
+    if (self->state != MSP_STATE_NEW) {
+        ret = MSP_ERR_BAD_STATE;
+        goto out;
+    }
+    self->sequential = sequential;
+out:
+    return ret;
+}
+
+int
+msp_set_hugepages(msp_t *self, bool hugepages)
+{
+    int ret = 0;
+
+    if (self->state != MSP_STATE_NEW) {
+        ret = MSP_ERR_BAD_STATE;
+        goto out;
+    }
+    self->hugepages = hugepages;
+out:
+    return ret;
+}
+
 int
 msp_set_num_loci(msp_t *self, size_t num_loci)
 {
@@ -394,42 +475,32 @@ msp_set_num_populations(msp_t *self, size_t num_populations)
         ret = MSP_ERR_BAD_PARAM_VALUE;
         goto out;
     }
-    self->num_populations = (uint32_t) num_populations;
     /* Free any memory, if it has been allocated */
-    if (self->initial_migration_matrix != NULL) {
-        free(self->initial_migration_matrix);
-    }
-    if (self->migration_matrix != NULL) {
-        free(self->migration_matrix);
-    }
-    if (self->num_migration_events != NULL) {
-        free(self->num_migration_events);
-    }
+    migration_matrix_free(&self->initial_migration_matrix);
     if (self->initial_populations != NULL) {
         free(self->initial_populations);
     }
     if (self->populations != NULL) {
+        for (j = 0; j < self->num_populations; j++) {
+            lineage_set_free(&self->populations[j].ancestors);
+        }
         free(self->populations);
     }
-    /* Allocate storage for new num_populations */
-    self->initial_migration_matrix = calloc(num_populations * num_populations,
-            sizeof(double));
-    self->migration_matrix = calloc(num_populations * num_populations,
-            sizeof(double));
-    self->num_migration_events = calloc(num_populations * num_populations,
-            sizeof(size_t));
+    self->num_populations = (uint32_t) num_populations;
+    /* Allocate storage for new num_populations. There is no migration
+     * by default. */
+    ret = migration_matrix_alloc(&self->initial_migration_matrix,
+            num_populations, 0, NULL, NULL, NULL);
+    if (ret != 0) {
+        goto out;
+    }
     self->initial_populations = calloc(num_populations, sizeof(population_t));
     self->populations = calloc(num_populations, sizeof(population_t));
-    if (self->migration_matrix == NULL
-            || self->initial_migration_matrix == NULL
-            || self->num_migration_events == NULL
-            || self->initial_populations == NULL
-            || self->populations == NULL) {
+    if (self->initial_populations == NULL || self->populations == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
     for (j = 0; j < num_populations; j++) {
-        avl_init_tree(&self->populations[j].ancestors, cmp_individual, NULL);
         /* Set the default sizes and growth rates. */
         self->initial_populations[j].growth_rate = 0.0;
         self->initial_populations[j].initial_size = 1.0;
@@ -475,8 +546,11 @@ int
 msp_set_migration_matrix(msp_t *self, size_t size, double *migration_matrix)
 {
     int ret = MSP_ERR_BAD_MIGRATION_MATRIX;
-    size_t j, k;
+    size_t j, k, num_entries;
     size_t N = self->num_populations;
+    uint32_t *source = NULL;
+    uint32_t *dest = NULL;
+    double *rate = NULL;
 
     if (N * N != size) {
         goto out;
@@ -495,10 +569,72 @@ msp_set_migration_matrix(msp_t *self, size_t size, double *migration_matrix)
             }
         }
     }
+    /* Only the non-zero entries are stored */
+    num_entries = 0;
     for (j = 0; j < N * N; j++) {
-        self->initial_migration_matrix[j] = migration_matrix[j];
+        if (migration_matrix[j] != 0.0) {
+            num_entries++;
+        }
     }
-    ret = 0;
+    source = malloc((num_entries + 1) * sizeof(uint32_t));
+    dest = malloc((num_entries + 1) * sizeof(uint32_t));
+    rate = malloc((num_entries + 1) * sizeof(double));
+    if (source == NULL || dest == NULL || rate == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    num_entries = 0;
+    for (j = 0; j < N; j++) {
+        for (k = 0; k < N; k++) {
+            if (migration_matrix[j * N + k] != 0.0) {
+                source[num_entries] = (uint32_t) j;
+                dest[num_entries] = (uint32_t) k;
+                rate[num_entries] = migration_matrix[j * N + k];
+                num_entries++;
+            }
+        }
+    }
+    ret = msp_set_sparse_migration_matrix(self, num_entries, source, dest,
+            rate);
+out:
+    if (source != NULL) {
+        free(source);
+    }
+    if (dest != NULL) {
+        free(dest);
+    }
+    if (rate != NULL) {
+        free(rate);
+    }
+    return ret;
+}
+
+/*
+ * Sets the initial migration matrix to the specified list of entries,
+ * where rate[j] is the rate at which lineages migrate from source[j] to
+ * dest[j] backwards in time. Entries that are not listed have rate zero.
+ */
+int
+msp_set_sparse_migration_matrix(msp_t *self, size_t num_entries,
+        uint32_t *source, uint32_t *dest, double *rate)
+{
+    int ret = 0;
+    migration_matrix_t matrix;
+
+    ret = migration_matrix_alloc(&matrix, self->num_populations, num_entries,
+            source, dest, rate);
+    if (ret != 0) {
+        migration_matrix_free(&matrix);
+        goto out;
+    }
+    /* Each pair of populations can only be specified once */
+    if (migration_matrix_get_num_entries(&matrix) != num_entries) {
+        migration_matrix_free(&matrix);
+        ret = MSP_ERR_BAD_MIGRATION_MATRIX;
+        goto out;
+    }
+    migration_matrix_free(&self->initial_migration_matrix);
+    self->initial_migration_matrix = matrix;
 out:
     return ret;
 }
@@ -587,6 +723,98 @@ out:
     return ret;
 }
 
+/* Sets the sink that receives finished coalescence records. This must be
+ * done before the simulation is initialised. */
+int
+msp_set_coalescence_record_sink(msp_t *self, msp_record_sink_t sink,
+        void *arg)
+{
+    int ret = 0;
+
+    if (self->state != MSP_STATE_NEW) {
+        ret = MSP_ERR_BAD_STATE;
+        goto out;
+    }
+    self->coalescence_record_sink = sink;
+    self->coalescence_record_sink_arg = arg;
+    self->coalescence_record_spill_file = NULL;
+out:
+    return ret;
+}
+
+static int
+msp_spill_coalescence_records(void *arg, size_t num_records,
+        coalescence_record_t *records)
+{
+    int ret = 0;
+    size_t j;
+
+    for (j = 0; j < num_records; j++) {
+        ret = msp_write_coalescence_record((FILE *) arg, &records[j]);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+out:
+    return ret;
+}
+
+/* Writes finished coalescence records to the specified file, which must
+ * be open for reading and writing. The file is rewound when the simulation
+ * is reset. */
+int
+msp_set_coalescence_record_spill_file(msp_t *self, FILE *file)
+{
+    int ret = 0;
+
+    if (file == NULL) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    ret = msp_set_coalescence_record_sink(self,
+            msp_spill_coalescence_records, file);
+    if (ret != 0) {
+        goto out;
+    }
+    self->coalescence_record_spill_file = file;
+out:
+    return ret;
+}
+
+/* Sets msp_run to checkpoint the simulation to the specified path after
+ * every num_events events or num_seconds seconds. Either can be zero. If
+ * path is NULL, periodic checkpointing is turned off. */
+int
+msp_set_checkpoint_interval(msp_t *self, const char *path,
+        unsigned long num_events, double num_seconds)
+{
+    int ret = 0;
+    char *copy = NULL;
+
+    if (num_seconds < 0) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    if (path != NULL) {
+        copy = malloc(strlen(path) + 1);
+        if (copy == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        strcpy(copy, path);
+    }
+    if (self->checkpoint_path != NULL) {
+        free(self->checkpoint_path);
+    }
+    self->checkpoint_path = copy;
+    self->checkpoint_interval_events = num_events;
+    self->checkpoint_interval_seconds = num_seconds;
+    self->events_since_checkpoint = 0;
+    self->last_checkpoint_time = time(NULL);
+out:
+    return ret;
+}
+
 /* Top level allocators and initialisation */
 
 int
@@ -654,8 +882,6 @@ msp_alloc(msp_t *self, size_t sample_size, sample_t *samples, gsl_rng *rng)
     if (ret != 0) {
         goto out;
     }
-    /* Set sensible defaults for the sample_config and migration matrix */
-    self->initial_migration_matrix[0] = 0.0;
     /* Set the memory defaults */
     self->store_migration_records = false;
     self->avl_node_block_size = 1024;
@@ -664,9 +890,6 @@ msp_alloc(msp_t *self, size_t sample_size, sample_t *samples, gsl_rng *rng)
     self->max_memory = 1024 * 1024 * 1024; /* 1MiB */
     self->coalescence_record_block_size = 1024;
     self->migration_record_block_size = 1024;
-    /* set up the AVL trees */
-    avl_init_tree(&self->breakpoints, cmp_node_mapping, NULL);
-    avl_init_tree(&self->overlap_counts, cmp_node_mapping, NULL);
     /* Set up the demographic events */
     self->demographic_events_head = NULL;
     self->demographic_events_tail = NULL;
@@ -676,1606 +899,4067 @@ out:
     return ret;
 }
 
-static int
-msp_alloc_memory_blocks(msp_t *self)
+static int msp_change_migration_rate(msp_t *self, demographic_event_t *event);
+
+/*
+ * Allocates the migration matrix used during simulation. Its sparsity
+ * pattern includes every entry that a migration rate change event can
+ * set, so that these events can update the matrix in place.
+ */
+static int WARN_UNUSED
+msp_alloc_migration_matrix(msp_t *self)
 {
     int ret = 0;
+    size_t j, k, index, num_entries;
+    size_t N = self->num_populations;
+    bool all_entries = false;
+    uint32_t *source = NULL;
+    uint32_t *dest = NULL;
+    double *rate = NULL;
+    demographic_event_t *de;
+    migration_matrix_t *initial = &self->initial_migration_matrix;
 
-    self->used_memory = msp_get_avl_node_mem_increment(self)
-        + msp_get_segment_mem_increment(self)
-        + msp_get_node_mapping_mem_increment(self);
-    if (self->used_memory > self->max_memory) {
+    num_entries = initial->num_entries;
+    for (de = self->demographic_events_head; de != NULL; de = de->next) {
+        if (de->change_state == msp_change_migration_rate) {
+            if (de->params.migration_rate_change.matrix_index == -1) {
+                all_entries = true;
+            }
+            num_entries++;
+        }
+    }
+    if (all_entries) {
+        num_entries = N * (N - 1);
+    }
+    source = malloc((num_entries + 1) * sizeof(uint32_t));
+    dest = malloc((num_entries + 1) * sizeof(uint32_t));
+    rate = calloc(num_entries + 1, sizeof(double));
+    if (source == NULL || dest == NULL || rate == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    /* Allocate the memory heaps */
-    ret = object_heap_init(&self->avl_node_heap, sizeof(avl_node_t),
-           self->avl_node_block_size, NULL);
-    if (ret != 0) {
-        goto out;
+    k = 0;
+    if (all_entries) {
+        for (j = 0; j < N * N; j++) {
+            if (j % (N + 1) != 0) {
+                source[k] = (uint32_t) (j / N);
+                dest[k] = (uint32_t) (j % N);
+                k++;
+            }
+        }
+    } else {
+        for (j = 0; j < initial->num_entries; j++) {
+            source[k] = initial->source[j];
+            dest[k] = initial->dest[j];
+            k++;
+        }
+        for (de = self->demographic_events_head; de != NULL; de = de->next) {
+            if (de->change_state == msp_change_migration_rate) {
+                index = (size_t) de->params.migration_rate_change.matrix_index;
+                /* Diagonal entries are reported as errors when the event
+                 * is applied. */
+                if (index < N * N && index % (N + 1) != 0) {
+                    source[k] = (uint32_t) (index / N);
+                    dest[k] = (uint32_t) (index % N);
+                    k++;
+                }
+            }
+        }
     }
-    ret = object_heap_init(&self->node_mapping_heap, sizeof(node_mapping_t),
-           self->node_mapping_block_size, NULL);
+    ret = migration_matrix_alloc(&self->migration_matrix, N, k, source, dest,
+            rate);
     if (ret != 0) {
         goto out;
     }
-    ret = object_heap_init(&self->binary_children_heap, 2 * sizeof(uint32_t),
-           self->coalescence_record_block_size, NULL);
-    if (ret != 0) {
+    self->num_migration_events = calloc(
+            migration_matrix_get_num_entries(&self->migration_matrix) + 1,
+            sizeof(size_t));
+    if (self->num_migration_events == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    /* allocate the segments and Fenwick tree */
-    ret = object_heap_init(&self->segment_heap, sizeof(segment_t),
-           self->segment_block_size, segment_init);
-    if (ret != 0) {
-        goto out;
+out:
+    if (source != NULL) {
+        free(source);
     }
-    ret = fenwick_alloc(&self->links, self->segment_block_size);
-    if (ret != 0) {
+    if (dest != NULL) {
+        free(dest);
+    }
+    if (rate != NULL) {
+        free(rate);
+    }
+    return ret;
+}
+
+/*
+ * Adds the specified number of segments to the segment array and the
+ * Fenwick tree of links, and puts them on the free list so that the lowest
+ * index is allocated first. If we run out of memory the segments and the
+ * Fenwick tree are left as they were.
+ */
+static int WARN_UNUSED
+msp_expand_segments(msp_t *self, size_t increment)
+{
+    int ret = 0;
+    size_t j;
+    size_t size = self->max_segments + increment;
+    segment_t *p;
+    uint32_t *q;
+
+    /* Segments are linked by 32 bit indexes */
+    if (size > UINT32_MAX) {
+        ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    /* Allocate the coalescence records */
-    self->coalescence_records = malloc(
-            self->coalescence_record_block_size * sizeof(coalescence_record_t));
-    self->max_coalescence_records = self->coalescence_record_block_size;
-    self->num_coalescence_record_blocks = 1;
-    if (self->coalescence_records == NULL) {
+    p = realloc(self->segments, size * sizeof(segment_t));
+    if (p == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    /* Allocate the migration records */
-    self->migration_records = malloc(
-            self->migration_record_block_size * sizeof(migration_record_t));
-    self->max_migration_records = self->migration_record_block_size;
-    self->num_migration_record_blocks = 1;
-    if (self->migration_records == NULL) {
+    self->segments = p;
+    q = realloc(self->lineage_ends, size * sizeof(uint32_t));
+    if (q == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    ret = 0;
+    self->lineage_ends = q;
+    /* Nothing that can fail may come after this, so that the Fenwick tree
+     * is never a different size to the segment array. */
+    ret = fenwick_expand(&self->links, increment);
+    if (ret != 0) {
+        goto out;
+    }
+    for (j = size - 1; j >= self->max_segments; j--) {
+        self->lineage_ends[j] = 0;
+        self->segments[j].next = self->free_segment;
+        self->free_segment = (uint32_t) j;
+    }
+    self->max_segments = size;
+    self->num_segment_blocks++;
 out:
     return ret;
 }
 
-/*
- * Returns true if the simulation has completed.
- */
-int
-msp_is_completed(msp_t *self)
+/* Grows the segment queue by node_mapping_block_size entries. */
+static int WARN_UNUSED
+msp_expand_segment_queue(msp_t *self)
 {
-    size_t n = msp_get_num_ancestors(self);
+    int ret = 0;
+    size_t mem_increment = msp_get_node_mapping_mem_increment(self);
 
-    return self->state == MSP_STATE_SIMULATING && n == 0;
+    if (self->used_memory + mem_increment > self->max_memory) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    ret = priority_queue_expand(&self->segment_queue,
+            self->node_mapping_block_size);
+    if (ret != 0) {
+        goto out;
+    }
+    self->used_memory += mem_increment;
+    self->num_node_mapping_blocks++;
+out:
+    return ret;
 }
 
-static uint32_t *
-msp_alloc_children(msp_t *self, uint32_t num_children)
+/*
+ * Initialises the specified object heap. Blocks start at block_size objects
+ * and double in size as the heap grows, but no block may use more than a
+ * fixed fraction of max_memory.
+ */
+static int WARN_UNUSED
+msp_init_object_heap(msp_t *self, object_heap_t *heap, size_t object_size,
+        size_t block_size)
 {
-    uint32_t *ret = NULL;
+    int ret = object_heap_init(heap, object_size, block_size, NULL);
 
-    /* Binary children are by far the most common, so we optimise for this
-     * case with a fixed memory heap. We malloc the rest directly. This
-     * means that we must always iterate through the set of coalescence
-     * records when freeing and be careful to always leave the records in
-     * a consistent state. */
-    if (num_children == 2) {
-        if (object_heap_empty(&self->binary_children_heap)) {
-            self->used_memory += msp_get_binary_children_mem_increment(self);
-            if (self->used_memory > self->max_memory) {
-                goto out;
-            }
-            if (object_heap_expand(&self->binary_children_heap) != 0) {
-                goto out;
-            }
-        }
-        ret = (uint32_t *) object_heap_alloc_object(
-                &self->binary_children_heap);
-    } else {
-        ret = malloc(num_children * sizeof(uint32_t));
+    if (ret != 0) {
+        goto out;
+    }
+    self->used_memory += object_heap_get_memory(heap);
+    if (self->used_memory > self->max_memory) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    object_heap_set_max_block_size(heap, self->max_memory
+            / (MSP_HEAP_BLOCK_MEMORY_FRACTION * (object_size + sizeof(void *))));
+    if (self->hugepages) {
+        object_heap_set_flags(heap, OBJECT_HEAP_HUGEPAGES);
     }
 out:
     return ret;
 }
 
-static void
-msp_free_children(msp_t *self, uint32_t num_children, uint32_t *children)
-{
-    if (num_children == 2) {
-        object_heap_free_object(&self->binary_children_heap, children);
-    } else {
-        free(children);
+/*
+ * Adds a block to the specified object heap, if this does not take us
+ * over the memory limit.
+ */
+static int WARN_UNUSED
+msp_expand_object_heap(msp_t *self, object_heap_t *heap)
+{
+    int ret = 0;
+    size_t mem_increment = object_heap_get_next_block_memory(heap);
+
+    if (self->used_memory + mem_increment > self->max_memory) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    ret = object_heap_expand(heap);
+    if (ret != 0) {
+        goto out;
     }
+    self->used_memory += mem_increment;
+out:
+    return ret;
 }
 
-int
-msp_free(msp_t *self)
+/*
+ * Grows the coalescence record columns to hold at least max_records
+ * records with max_children_total children between them.
+ */
+static int WARN_UNUSED
+msp_expand_coalescence_records(msp_t *self, size_t max_records,
+        size_t max_children_total)
 {
-    int ret = -1;
-    demographic_event_t *de = self->demographic_events_head;
-    demographic_event_t *tmp;
-    coalescence_record_t *cr;
-    size_t j;
-
-    /* Because we malloc the children for non-binary records
-     * directly we must free these memory blocks */
-    for (j = 0; j < self->num_coalescence_records; j++) {
-        cr = &self->coalescence_records[j];
-        if (cr->children != NULL) {
-            msp_free_children(self, cr->num_children, cr->children);
+    int ret = MSP_ERR_NO_MEMORY;
+    record_columns_t *records = &self->coalescence_records;
+    size_t increment;
+    void *p;
+
+    if (max_records > records->max_records) {
+        p = realloc(records->left, max_records * sizeof(uint32_t));
+        if (p == NULL) {
+            goto out;
         }
+        records->left = p;
+        p = realloc(records->right, max_records * sizeof(uint32_t));
+        if (p == NULL) {
+            goto out;
+        }
+        records->right = p;
+        p = realloc(records->node, max_records * sizeof(uint32_t));
+        if (p == NULL) {
+            goto out;
+        }
+        records->node = p;
+        p = realloc(records->num_children, max_records * sizeof(uint32_t));
+        if (p == NULL) {
+            goto out;
+        }
+        records->num_children = p;
+        p = realloc(records->population_id, max_records * sizeof(uint32_t));
+        if (p == NULL) {
+            goto out;
+        }
+        records->population_id = p;
+        p = realloc(records->time, max_records * sizeof(double));
+        if (p == NULL) {
+            goto out;
+        }
+        records->time = p;
+        records->max_records = max_records;
+    }
+    if (max_children_total > records->max_children_total) {
+        /* The children were counted in used_memory when they were kept in
+         * a memory heap, so we keep doing so. */
+        increment = (max_children_total - records->max_children_total)
+            * sizeof(uint32_t);
+        if (self->used_memory + increment > self->max_memory) {
+            goto out;
+        }
+        p = realloc(records->children, max_children_total * sizeof(uint32_t));
+        if (p == NULL) {
+            goto out;
+        }
+        self->used_memory += increment;
+        records->children = p;
+        records->max_children_total = max_children_total;
     }
-    while (de != NULL) {
-        tmp = de->next;
-        free(de);
-        de = tmp;
-    }
-    if (self->initial_migration_matrix != NULL) {
-        free(self->initial_migration_matrix);
-    }
-    if (self->migration_matrix != NULL) {
-        free(self->migration_matrix);
-    }
-    if (self->num_migration_events != NULL) {
-        free(self->num_migration_events);
+    ret = 0;
+out:
+    return ret;
+}
+
+static void
+msp_free_record_columns(record_columns_t *records)
+{
+    if (records->left != NULL) {
+        free(records->left);
     }
-    if (self->initial_populations != NULL) {
-        free(self->initial_populations);
+    if (records->right != NULL) {
+        free(records->right);
     }
-    if (self->populations != NULL) {
-        free(self->populations);
+    if (records->node != NULL) {
+        free(records->node);
     }
-    if (self->samples != NULL) {
-        free(self->samples);
+    if (records->num_children != NULL) {
+        free(records->num_children);
     }
-    if (self->sampling_events != NULL) {
-        free(self->sampling_events);
+    if (records->population_id != NULL) {
+        free(records->population_id);
     }
-    /* free the object heaps */
-    object_heap_free(&self->avl_node_heap);
-    object_heap_free(&self->segment_heap);
-    object_heap_free(&self->node_mapping_heap);
-    object_heap_free(&self->binary_children_heap);
-    fenwick_free(&self->links);
-    if (self->coalescence_records != NULL) {
-        free(self->coalescence_records);
+    if (records->time != NULL) {
+        free(records->time);
     }
-    if (self->migration_records != NULL) {
-        free(self->migration_records);
+    if (records->children != NULL) {
+        free(records->children);
     }
-    ret = 0;
-    return ret;
+    memset(records, 0, sizeof(record_columns_t));
 }
 
-
-static inline avl_node_t * WARN_UNUSED
-msp_alloc_avl_node(msp_t *self)
+static void
+msp_free_coalescence_records(msp_t *self)
 {
-    avl_node_t *ret = NULL;
+    msp_free_record_columns(&self->coalescence_records);
+}
 
-    if (object_heap_empty(&self->avl_node_heap)) {
-        self->used_memory += msp_get_avl_node_mem_increment(self);
-        if (self->used_memory > self->max_memory) {
-            goto out;
-        }
-        if (object_heap_expand(&self->avl_node_heap) != 0) {
-            goto out;
-        }
-    }
-    ret = (avl_node_t *) object_heap_alloc_object(&self->avl_node_heap);
-out:
-    return ret;
+/*
+ * Sets up empty coalescence record columns with room for one block of
+ * binary records.
+ */
+static int WARN_UNUSED
+msp_alloc_coalescence_records(msp_t *self)
+{
+    memset(&self->coalescence_records, 0, sizeof(record_columns_t));
+    self->num_coalescence_record_blocks = 1;
+    return msp_expand_coalescence_records(self,
+            self->coalescence_record_block_size,
+            2 * self->coalescence_record_block_size);
 }
 
+/*
+ * Returns the coalescence record with the specified index in the columns,
+ * whose children start at the specified offset in the children column.
+ */
 static inline void
-msp_free_avl_node(msp_t *self, avl_node_t *node)
+msp_get_coalescence_record(msp_t *self, size_t index, size_t offset,
+        coalescence_record_t *record)
 {
-    object_heap_free_object(&self->avl_node_heap, node);
+    record_columns_t *records = &self->coalescence_records;
+
+    record->left = (double) records->left[index];
+    record->right = (double) records->right[index];
+    record->node = records->node[index];
+    record->num_children = records->num_children[index];
+    record->children = records->children + offset;
+    record->time = records->time[index];
+    record->population_id = records->population_id[index];
 }
 
-static inline node_mapping_t *
-msp_alloc_node_mapping(msp_t *self)
+/*
+ * Points the first num_records entries of the coalescence record view at
+ * the first num_records records in the columns. The view is valid until
+ * the columns next change.
+ */
+static int WARN_UNUSED
+msp_update_coalescence_record_view(msp_t *self, size_t num_records)
 {
-    node_mapping_t *ret = NULL;
-
-    if (object_heap_empty(&self->node_mapping_heap)) {
-        self->used_memory += msp_get_node_mapping_mem_increment(self);
-        if (self->used_memory > self->max_memory) {
-            goto out;
-        }
-        if (object_heap_expand(&self->node_mapping_heap) != 0) {
+    int ret = 0;
+    size_t j, offset;
+    coalescence_record_t *p;
+
+    assert(num_records <= self->coalescence_records.num_records);
+    if (num_records > self->max_coalescence_record_view) {
+        p = realloc(self->coalescence_record_view,
+                num_records * sizeof(coalescence_record_t));
+        if (p == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
             goto out;
         }
+        self->coalescence_record_view = p;
+        self->max_coalescence_record_view = num_records;
+    }
+    offset = 0;
+    for (j = 0; j < num_records; j++) {
+        msp_get_coalescence_record(self, j, offset,
+                &self->coalescence_record_view[j]);
+        offset += self->coalescence_records.num_children[j];
     }
-    ret = (node_mapping_t *) object_heap_alloc_object(&self->node_mapping_heap);
 out:
     return ret;
 }
 
-static void
-msp_free_node_mapping(msp_t *self, node_mapping_t *nm)
-{
-    object_heap_free_object(&self->node_mapping_heap, nm);
-}
-
-static segment_t * WARN_UNUSED
-msp_alloc_segment(msp_t *self, uint32_t left, uint32_t right, uint32_t value,
-        uint32_t population_id, segment_t *prev, segment_t *next)
+static int
+msp_alloc_memory_blocks(msp_t *self)
 {
-    segment_t *seg = NULL;
+    int ret = 0;
+    size_t j;
+    size_t N = self->num_populations;
 
-    if (object_heap_empty(&self->segment_heap)) {
-        self->used_memory += msp_get_segment_mem_increment(self);
-        if (self->used_memory > self->max_memory) {
-            goto out;
-        }
-        if (object_heap_expand(&self->segment_heap) != 0) {
-            goto out;
-        }
-        if (fenwick_expand(&self->links, self->segment_block_size) != 0) {
-            goto out;
-        }
+    self->used_memory = msp_get_segment_mem_increment(self,
+            self->segment_block_size);
+    if (self->used_memory > self->max_memory) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
     }
-    seg = (segment_t *) object_heap_alloc_object(&self->segment_heap);
-    if (seg == NULL) {
+    /* Allocate the memory heaps */
+    ret = priority_queue_alloc(&self->segment_queue, 0);
+    if (ret != 0) {
         goto out;
     }
-    seg->prev = prev;
-    seg->next = next;
-    seg->left = left;
-    seg->right = right;
-    seg->value = value;
-    seg->population_id = population_id;
+    self->num_node_mapping_blocks = 0;
+    ret = msp_expand_segment_queue(self);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = scratch_init(&self->scratch,
+            self->node_mapping_block_size * sizeof(uint32_t));
+    if (ret != 0) {
+        goto out;
+    }
+    self->used_memory += scratch_get_memory_size(&self->scratch);
+    ret = rng_buffer_alloc(&self->variates, self->rng, MSP_VARIATE_BLOCK_SIZE);
+    if (ret != 0) {
+        goto out;
+    }
+    self->used_memory += rng_buffer_get_memory_size(&self->variates);
+    ret = msp_init_object_heap(self, &self->overlap_node_heap,
+            sizeof(overlap_node_t), self->segment_block_size);
+    if (ret != 0) {
+        goto out;
+    }
+    for (j = 0; j < N; j++) {
+        avl_init_tree(&self->populations[j].left_index, cmp_overlap_node, NULL);
+        avl_init_tree(&self->populations[j].right_index, cmp_overlap_node,
+                NULL);
+    }
+    ret = btree_alloc(&self->breakpoints, 1);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = btree_alloc(&self->overlap_counts, 1);
+    if (ret != 0) {
+        goto out;
+    }
+    self->used_memory += btree_get_memory_size(&self->breakpoints)
+        + btree_get_memory_size(&self->overlap_counts);
+    /* allocate the segments and Fenwick tree. Index 0 of the segment
+     * array marks the end of a chain and is never allocated. */
+    self->segments = NULL;
+    self->lineage_ends = NULL;
+    self->max_segments = 1;
+    self->num_segments = 0;
+    self->num_segment_blocks = 0;
+    self->free_segment = MSP_NULL_SEGMENT;
+    ret = fenwick_alloc(&self->links, 0);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_expand_segments(self, self->segment_block_size);
+    if (ret != 0) {
+        goto out;
+    }
+    /* Allocate the event scheduling state */
+    ret = rate_tree_alloc(&self->event_rates, 1 + 2 * (size_t) N);
+    if (ret != 0) {
+        goto out;
+    }
+    self->variable_rate_populations = malloc(N * sizeof(uint32_t));
+    if (self->variable_rate_populations == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    ret = msp_alloc_migration_matrix(self);
+    if (ret != 0) {
+        goto out;
+    }
+    /* Allocate the coalescence records */
+    ret = msp_alloc_coalescence_records(self);
+    if (ret != 0) {
+        goto out;
+    }
+    /* Allocate the migration records */
+    self->migration_records = malloc(
+            self->migration_record_block_size * sizeof(migration_record_t));
+    self->max_migration_records = self->migration_record_block_size;
+    self->num_migration_record_blocks = 1;
+    if (self->migration_records == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    ret = 0;
 out:
-    return seg;
+    return ret;
 }
 
 /*
- * Returns the segment with the specified id.
+ * Returns true if the simulation has completed.
  */
-static segment_t *
-msp_get_segment(msp_t *self, size_t id)
+int
+msp_is_completed(msp_t *self)
 {
-    segment_t *u = object_heap_get_object(&self->segment_heap, id - 1);
+    size_t n = msp_get_num_ancestors(self);
 
-    assert(u != NULL);
-    assert(u->id == id);
-    return u;
+    return self->state == MSP_STATE_SIMULATING && n == 0;
 }
 
-static void
-msp_free_segment(msp_t *self, segment_t *seg)
-{
-    object_heap_free_object(&self->segment_heap, seg);
-    fenwick_set_value(&self->links, seg->id, 0);
-}
+/* Memory and queries for the marginal tree of the sequential engine. */
 
-static inline int WARN_UNUSED
-msp_insert_individual(msp_t *self, segment_t *u)
+static int WARN_UNUSED
+msp_sequential_alloc(msp_t *self)
 {
     int ret = 0;
-    avl_node_t *node;
+    sequential_tree_t *tree = &self->sequential_tree;
+    size_t n = self->sample_size;
+    size_t num_slots = 2 * n - 1;
 
-    assert(u != NULL);
-    node = msp_alloc_avl_node(self);
-    if (node == NULL) {
+    if (tree->parent != NULL) {
+        goto out;
+    }
+    self->used_memory += num_slots * (4 * sizeof(uint32_t) + sizeof(double)
+            + sizeof(uint32_t)) + n * (sizeof(double) + sizeof(uint32_t));
+    if (self->used_memory > self->max_memory) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    tree->parent = malloc(num_slots * sizeof(uint32_t));
+    tree->children = malloc(2 * num_slots * sizeof(uint32_t));
+    tree->id = malloc(num_slots * sizeof(uint32_t));
+    tree->left = malloc(num_slots * sizeof(uint32_t));
+    tree->time = malloc(num_slots * sizeof(double));
+    tree->sample_times = malloc(n * sizeof(double));
+    tree->internal_times = malloc(n * sizeof(double));
+    tree->lineages = malloc(n * sizeof(uint32_t));
+    if (tree->parent == NULL || tree->children == NULL || tree->id == NULL
+            || tree->left == NULL || tree->time == NULL
+            || tree->sample_times == NULL || tree->internal_times == NULL
+            || tree->lineages == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    avl_init_node(node, u);
-    node = avl_insert_node(
-        &self->populations[u->population_id].ancestors, node);
-    assert(node != NULL);
 out:
     return ret;
 }
 
 static void
-msp_print_segment_chain(msp_t *self, segment_t *head, FILE *out)
+msp_sequential_free(msp_t *self)
 {
-    segment_t *s = head;
+    sequential_tree_t *tree = &self->sequential_tree;
 
-    fprintf(out, "[%d]", s->population_id);
-    while (s != NULL) {
-        fprintf(out, "[(%d-%d) %d] ", s->left, s->right, s->value);
-        s = s->next;
+    if (tree->parent != NULL) {
+        free(tree->parent);
+    }
+    if (tree->children != NULL) {
+        free(tree->children);
+    }
+    if (tree->id != NULL) {
+        free(tree->id);
+    }
+    if (tree->left != NULL) {
+        free(tree->left);
+    }
+    if (tree->time != NULL) {
+        free(tree->time);
+    }
+    if (tree->sample_times != NULL) {
+        free(tree->sample_times);
+    }
+    if (tree->internal_times != NULL) {
+        free(tree->internal_times);
+    }
+    if (tree->lineages != NULL) {
+        free(tree->lineages);
     }
-    fprintf(out, "\n");
 }
 
-static void
-msp_verify_segments(msp_t *self)
+/* Returns the number of values in the sorted array that are <= value. */
+static size_t
+msp_sequential_bisect(double *values, size_t size, double value)
 {
-    int64_t s, ss, total_links, left, right, alt_total_links;
-    size_t j;
-    size_t total_segments = 0;
-    size_t total_avl_nodes = 0;
-    avl_node_t *node;
-    segment_t *u;
-
-    total_links = 0;
-    alt_total_links = 0;
-    for (j = 0; j < self->num_populations; j++) {
-        node = (&self->populations[j].ancestors)->head;
-        while (node != NULL) {
-            u = (segment_t *) node->item;
-            assert(u->prev == NULL);
-            left = u->left;
-            while (u != NULL) {
-                total_segments++;
-                assert(u->population_id == j);
-                assert(u->left < u->right);
-                assert(u->right <= self->num_loci);
-                if (u->prev != NULL) {
-                    s = u->right - u->prev->right;
-                } else {
-                    s = u->right - u->left - 1;
-                }
-                ss = fenwick_get_value(&self->links, u->id);
-                total_links += ss;
-                assert(s == ss);
-                if (s == ss) {
-                    /* do nothing; just to keep compiler happy - see below also */
-                }
-                right = u->right;
-                u = u->next;
-            }
-            alt_total_links += right - left - 1;
-            node = node->next;
+    size_t lo = 0;
+    size_t hi = size;
+    size_t mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (values[mid] <= value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
-    assert(total_links == fenwick_get_total(&self->links));
-    assert(total_links == alt_total_links);
-    assert(total_segments == object_heap_get_num_allocated(
-                &self->segment_heap));
-    total_avl_nodes = msp_get_num_ancestors(self)
-            + avl_count(&self->breakpoints)
-            + avl_count(&self->overlap_counts);
-    assert(total_avl_nodes == object_heap_get_num_allocated(
-                &self->avl_node_heap));
-    assert(total_avl_nodes - msp_get_num_ancestors(self)
-            == object_heap_get_num_allocated(&self->node_mapping_heap));
-    if (total_avl_nodes == total_segments) {
-        /* do nothing - this is just to keep the compiler happy when
-         * asserts are turned off.
-         */
+    return lo;
+}
+
+/* Returns the number of branches in the tree at time t, setting next to
+ * the time at which this next changes. */
+static uint32_t
+msp_sequential_num_branches(msp_t *self, double t, double *next)
+{
+    sequential_tree_t *tree = &self->sequential_tree;
+    size_t n = self->sample_size;
+    size_t num_samples = msp_sequential_bisect(tree->sample_times, n, t);
+    size_t num_internal = msp_sequential_bisect(tree->internal_times, n - 1, t);
+
+    *next = DBL_MAX;
+    if (num_samples < n) {
+        *next = tree->sample_times[num_samples];
+    }
+    if (num_internal < n - 1) {
+        *next = GSL_MIN(*next, tree->internal_times[num_internal]);
     }
+    return (uint32_t) (num_samples - num_internal);
 }
 
-static void
-msp_verify_overlaps(msp_t *self)
+static double
+msp_sequential_branch_length(msp_t *self)
 {
-    avl_node_t *node;
-    node_mapping_t *nm;
-    segment_t *u;
-    uint32_t j, k, left, right, count;
-    /* We check for every locus, so obviously this rules out large numbers
-     * of loci. This code should never be called except during testing,
-     * so we don't need to recover from malloc failure.
-     */
-    uint32_t *overlaps = calloc(self->num_loci, sizeof(uint32_t));
-
-    assert(overlaps != NULL);
-    /* Add in the counts for any historical samples that haven't been
-     * included yet.
-     */
-    for (j = 0; j < self->sample_size; j++) {
-        if (self->samples[j].time > self->time) {
-            for (k = 0; k < self->num_loci; k++) {
-                overlaps[k]++;
-            }
-        }
-    }
-    for (j = 0; j < self->num_populations; j++) {
-        for (node = (&self->populations[j].ancestors)->head; node != NULL;
-                node = node->next) {
-            u = (segment_t *) node->item;
-            while (u != NULL) {
-                for (k = u->left; k < u->right; k++) {
-                    overlaps[k]++;
-                }
-                u = u->next;
-            }
-        }
-    }
-    for (node = self->overlap_counts.head; node->next != NULL;
-            node = node->next) {
-        nm = (node_mapping_t *) node->item;
-        left = nm->left;
-        right = ((node_mapping_t *) node->next->item)->left;
-        count = nm->value;
-        for (k = left; k < right; k++) {
-            assert(overlaps[k] == count);
-        }
-    }
-    free(overlaps);
-}
-
-void
-msp_verify(msp_t *self)
-{
-    msp_verify_segments(self);
-    msp_verify_overlaps(self);
-}
+    sequential_tree_t *tree = &self->sequential_tree;
+    uint32_t u;
+    uint32_t num_slots = 2 * self->sample_size - 1;
+    double ret = 0.0;
+
+    for (u = 0; u < num_slots; u++) {
+        if (u != tree->root) {
+            ret += tree->time[tree->parent[u]] - tree->time[u];
+        }
+    }
+    return ret;
+}
 
 int
-msp_print_state(msp_t *self, FILE *out)
+msp_free(msp_t *self)
 {
-    int ret = 0;
-    avl_node_t *node;
-    node_mapping_t *nm;
-    segment_t *u;
-    coalescence_record_t *cr;
-    migration_record_t *mr;
-    demographic_event_t *de;
-    sampling_event_t *se;
-    int64_t v;
-    uint32_t j, k;
-    double gig = 1024.0 * 1024;
-    segment_t **ancestors = malloc(msp_get_num_ancestors(self)
-            * sizeof(segment_t *));
+    int ret = -1;
+    demographic_event_t *de = self->demographic_events_head;
+    demographic_event_t *tmp;
+    size_t j;
 
-    if (ancestors == NULL && msp_get_num_ancestors(self) != 0) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
-    }
-    ret = msp_get_ancestors(self, ancestors);
-    if (ret != 0) {
-        goto out;
-    }
-    fprintf(out, "simulation model = '%s' (%d)\n", msp_get_model_str(self),
-            msp_get_model(self));
-    fprintf(out, "used_memory = %f MiB\n", (double) self->used_memory / gig);
-    fprintf(out, "max_memory  = %f MiB\n", (double) self->max_memory / gig);
-    fprintf(out, "n = %d\n", self->sample_size);
-    fprintf(out, "m = %d\n", self->num_loci);
-    fprintf(out, "Samples = \n");
-    for (j = 0; j < self->sample_size; j++) {
-        fprintf(out, "\t%d\tpopulation=%d\ttime=%f\n", j, self->samples[j].population_id,
-                self->samples[j].time);
-    }
-    fprintf(out, "Sampling events:\n");
-    for (j = 0; j < self->num_sampling_events; j++) {
-        if (j == self->next_sampling_event) {
-            fprintf(out, "  ***");
-        }
-        se = &self->sampling_events[j];
-        fprintf(out, "\t");
-        fprintf(out, "%d @ %f in deme %d\n", se->sample, se->time, se->population_id);
-    }
-    fprintf(out, "Demographic events:\n");
-    for (de = self->demographic_events_head; de != NULL; de = de->next) {
-        if (de == self->next_demographic_event) {
-            fprintf(out, "  ***");
-        }
-        fprintf(out, "\t");
-        de->print_state(self, de, out);
-    }
-    fprintf(out, "Migration matrix\n");
-    for (j = 0; j < self->num_populations; j++) {
-        fprintf(out, "\t");
-        for (k = 0; k < self->num_populations; k++) {
-            fprintf(out, "%0.3f ",
-                self->migration_matrix[j * self->num_populations + k]);
-        }
-        fprintf(out, "\n");
+    while (de != NULL) {
+        tmp = de->next;
+        free(de);
+        de = tmp;
     }
-
-    fprintf(out, "num_links = %ld\n", (long) fenwick_get_total(&self->links));
-    for (j = 0; j < self->num_populations; j++) {
-        fprintf(out, "population[%d] = %d\n", j,
-            avl_count(&self->populations[j].ancestors));
-        fprintf(out, "\tstart_time = %f\n", self->populations[j].start_time);
-        fprintf(out, "\tinitial_size = %f\n", self->populations[j].initial_size);
-        fprintf(out, "\tgrowth_rate = %f\n", self->populations[j].growth_rate);
+    migration_matrix_free(&self->initial_migration_matrix);
+    migration_matrix_free(&self->migration_matrix);
+    if (self->num_migration_events != NULL) {
+        free(self->num_migration_events);
     }
-    fprintf(out, "Time = %f\n", self->time);
-    for (j = 0; j < msp_get_num_ancestors(self); j++) {
-        fprintf(out, "\t");
-        msp_print_segment_chain(self, ancestors[j], out);
+    if (self->initial_populations != NULL) {
+        free(self->initial_populations);
     }
-    fprintf(out, "Fenwick tree\n");
-    for (j = 1; j <= (uint32_t) fenwick_get_size(&self->links); j++) {
-        u = msp_get_segment(self, j);
-        v = fenwick_get_value(&self->links, j);
-        if (v != 0) {
-            fprintf(out, "\t%ld\ti=%d l=%d r=%d v=%d prev=%p next=%p\n", (long) v,
-                    (int) u->id, u->left,
-                    u->right, (int) u->value, (void *) u->prev, (void *) u->next);
+    if (self->populations != NULL) {
+        for (j = 0; j < self->num_populations; j++) {
+            lineage_set_free(&self->populations[j].ancestors);
         }
+        free(self->populations);
     }
-    fprintf(out, "Breakpoints = %d\n", avl_count(&self->breakpoints));
-    for (node = self->breakpoints.head; node != NULL; node = node->next) {
-        nm = (node_mapping_t *) node->item;
-        fprintf(out, "\t%d -> %d\n", nm->left, nm->value);
+    if (self->samples != NULL) {
+        free(self->samples);
     }
-    fprintf(out, "Overlap count = %d\n", avl_count(&self->overlap_counts));
-    for (node = self->overlap_counts.head; node != NULL; node = node->next) {
-        nm = (node_mapping_t *) node->item;
-        fprintf(out, "\t%d -> %d\n", nm->left, nm->value);
+    if (self->sampling_events != NULL) {
+        free(self->sampling_events);
     }
-    fprintf(out, "Coalescence records = %ld\n",
-            (long) self->num_coalescence_records);
-    for (j = 0; j < self->num_coalescence_records; j++) {
-        cr = &self->coalescence_records[j];
-        fprintf(out, "\t%f\t%f\t%d\t(", cr->left, cr->right,
-                cr->node);
-        for (k = 0; k < cr->num_children; k++) {
-            fprintf(out, "%d", cr->children[k]);
-            if (k < cr->num_children - 1) {
-                fprintf(out, ", ");
-            }
-        }
-        fprintf(out, ")\t%f\t%d\n", cr->time, cr->population_id);
+    /* free the object heaps */
+    if (self->segments != NULL) {
+        free(self->segments);
+    }
+    if (self->lineage_ends != NULL) {
+        free(self->lineage_ends);
+    }
+    priority_queue_free(&self->segment_queue);
+    scratch_free(&self->scratch);
+    rng_buffer_free(&self->variates);
+    msp_sequential_free(self);
+    if (self->checkpoint_path != NULL) {
+        free(self->checkpoint_path);
+    }
+    object_heap_free(&self->overlap_node_heap);
+    btree_free(&self->breakpoints);
+    btree_free(&self->overlap_counts);
+    fenwick_free(&self->links);
+    rate_tree_free(&self->event_rates);
+    if (self->variable_rate_populations != NULL) {
+        free(self->variable_rate_populations);
     }
-    fprintf(out, "Migration records = %ld\n",
-            (long) self->num_migration_records);
-    for (j = 0; j < self->num_migration_records; j++) {
-        mr = &self->migration_records[j];
-        fprintf(out, "\t%f\t%f\t%d\t%f\t%d\t%d\n", mr->left, mr->right,
-                mr->node, mr->time, mr->source, mr->dest);
+    msp_free_coalescence_records(self);
+    if (self->coalescence_record_view != NULL) {
+        free(self->coalescence_record_view);
     }
-    fprintf(out, "Memory heaps\n");
-    fprintf(out, "avl_node_heap:");
-    object_heap_print_state(&self->avl_node_heap, out);
-    fprintf(out, "segment_heap:");
-    object_heap_print_state(&self->segment_heap, out);
-    fprintf(out, "node_mapping_heap:");
-    object_heap_print_state(&self->node_mapping_heap, out);
-    fprintf(out, "binary_children_heap:");
-    object_heap_print_state(&self->binary_children_heap, out);
-    msp_verify(self);
-out:
-    if (ancestors != NULL) {
-        free(ancestors);
+    if (self->migration_records != NULL) {
+        free(self->migration_records);
     }
+    ret = 0;
     return ret;
 }
 
 
-static int WARN_UNUSED
-msp_record_migration(msp_t *self, uint32_t left, uint32_t right,
-        uint32_t node, uint32_t source_pop, uint32_t dest_pop)
+/*
+ * Allocates a new segment and returns its index, or MSP_NULL_SEGMENT if
+ * we run out of memory. The segment array may move, so any pointers to
+ * segments held by the caller are invalidated.
+ */
+static uint32_t WARN_UNUSED
+msp_alloc_segment(msp_t *self, uint32_t left, uint32_t right, uint32_t value,
+        uint32_t population_id, uint32_t prev, uint32_t next)
 {
-    int ret = 0;
-    migration_record_t *mr;
-
-    if (self->num_migration_records == self->max_migration_records - 1) {
-        /* Grow the array */
-        self->max_migration_records += self->migration_record_block_size;;
-        mr = realloc(self->migration_records,
-                self->max_migration_records * sizeof(migration_record_t));
-        if (mr == NULL) {
-            ret = MSP_ERR_NO_MEMORY;
+    uint32_t ret = MSP_NULL_SEGMENT;
+    size_t increment, mem_increment;
+    segment_t *seg;
+
+    if (self->free_segment == MSP_NULL_SEGMENT) {
+        /* Double the number of segments so that the cost of copying is
+         * amortised, unless this would take us over the memory limit. */
+        increment = GSL_MAX(self->segment_block_size, self->max_segments - 1);
+        if (self->used_memory + msp_get_segment_mem_increment(self, increment)
+                > self->max_memory) {
+            increment = self->segment_block_size;
+        }
+        mem_increment = msp_get_segment_mem_increment(self, increment);
+        if (self->used_memory + mem_increment > self->max_memory) {
             goto out;
         }
-        self->migration_records = mr;
-        self->num_migration_record_blocks++;
+        if (msp_expand_segments(self, increment) != 0) {
+            goto out;
+        }
+        self->used_memory += mem_increment;
     }
-    mr = &self->migration_records[self->num_migration_records];
-    mr->left = (double) left;
-    mr->right = (double) right;
-    mr->node = node;
-    mr->time = self->time;
-    mr->source = source_pop;
-    mr->dest = dest_pop;
-    self->num_migration_records++;
+    ret = self->free_segment;
+    seg = &self->segments[ret];
+    self->free_segment = seg->next;
+    self->num_segments++;
+    seg->prev = prev;
+    seg->next = next;
+    seg->left = left;
+    seg->right = right;
+    seg->value = value;
+    seg->population_id = population_id;
 out:
     return ret;
 }
 
-static int WARN_UNUSED
-msp_move_individual(msp_t *self, avl_node_t *node, avl_tree_t *source,
-        uint32_t dest_pop)
+/*
+ * Returns the segment with the specified index. This pointer is only valid
+ * until the next segment is allocated.
+ */
+static inline segment_t *
+msp_get_segment(msp_t *self, uint32_t index)
 {
-    int ret = 0;
-    segment_t *ind, *x;
+    assert(index != MSP_NULL_SEGMENT && index < self->max_segments);
+    return &self->segments[index];
+}
 
-    ind = (segment_t *) node->item;
-    avl_unlink_node(source, node);
-    msp_free_avl_node(self, node);
-    /* Need to set the population_id for each segment. */
-    x = ind;
-    while (x != NULL) {
-        if (self->store_migration_records) {
-            ret = msp_record_migration(self, x->left, x->right, x->value,
-                    x->population_id, dest_pop);
-            if (ret != 0) {
-                goto out;
-            }
-        }
-        x->population_id = dest_pop;
-        x = x->next;
-    }
-    ret = msp_insert_individual(self, ind);
-out:
-    return ret;
+static void
+msp_free_segment(msp_t *self, uint32_t index)
+{
+    segment_t *seg = msp_get_segment(self, index);
+
+    seg->next = self->free_segment;
+    self->free_segment = index;
+    self->num_segments--;
+    fenwick_set_value(&self->links, index, 0);
+}
+
+/* All random variates used by the simulation are taken from the variates
+ * buffer, which draws them from rng in blocks. */
+static double
+msp_uniform(msp_t *self)
+{
+    return rng_buffer_uniform(&self->variates);
+}
+
+static double
+msp_exponential(msp_t *self, double mean)
+{
+    return rng_buffer_exponential(&self->variates, mean);
+}
+
+/* Returns an integer chosen uniformly from 0 to n - 1. */
+static size_t
+msp_uniform_int(msp_t *self, size_t n)
+{
+    return (size_t) (rng_buffer_uniform(&self->variates) * (double) n);
 }
 
 /*
- * Inserts a new breakpoint at the specified locus left.
+ * Returns true if no recombination can occur. In this case every lineage is
+ * a single segment covering the whole sequence.
  */
-static int WARN_UNUSED
-msp_insert_breakpoint(msp_t *self, uint32_t left)
+static inline bool
+msp_is_single_locus(msp_t *self)
 {
-    int ret = 0;
-    avl_node_t *node = msp_alloc_avl_node(self);
-    node_mapping_t *m = msp_alloc_node_mapping(self);
+    return self->num_loci == 1 || self->scaled_recombination_rate == 0.0;
+}
 
-    if (node == NULL || m == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
-    }
-    m->left = left;
-    m->value = 0;
-    avl_init_node(node, m);
-    node = avl_insert_node(&self->breakpoints, node);
-    assert(node != NULL);
-out:
-    return ret;
+static inline bool
+msp_has_constant_size(population_t *pop)
+{
+    return pop->growth_rate == 0.0 && pop->initial_size > 0.0;
 }
 
+/*
+ * Returns true if we keep track of which pairs of lineages can coalesce.
+ * Under the SMC and SMC' only lineages whose ancestral material overlaps
+ * (or is adjacent, for the SMC') can coalesce, and we sample these pairs
+ * directly rather than rejecting the others. Whole sequence lineages always
+ * overlap, so we don't need the index for a single locus.
+ */
+static inline bool
+msp_has_overlap_index(msp_t *self)
+{
+    return (self->model == MSP_MODEL_SMC || self->model == MSP_MODEL_SMC_PRIME)
+        && !msp_is_single_locus(self);
+}
 
 /*
- * Inserts a new overlap_count at the specified locus left, mapping to the
- * specified number of overlapping segments b.
+ * Returns the right end of the material in the lineage with the specified
+ * head segment.
  */
-static int WARN_UNUSED
-msp_insert_overlap_count(msp_t *self, uint32_t left, uint32_t v)
+static uint32_t
+msp_get_lineage_end(msp_t *self, uint32_t head)
 {
-    int ret = 0;
-    avl_node_t *node = msp_alloc_avl_node(self);
-    node_mapping_t *m = msp_alloc_node_mapping(self);
+    segment_t *S = self->segments;
+    uint32_t x = head;
 
-    if (node == NULL || m == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
+    while (S[x].next != MSP_NULL_SEGMENT) {
+        x = S[x].next;
     }
-    m->left = left;
-    m->value = v;
-    avl_init_node(node, m);
-    node = avl_insert_node(&self->overlap_counts, node);
-    assert(node != NULL);
-out:
-    return ret;
+    return S[x].right;
 }
 
 /*
- * Inserts a new overlap_count at the specified locus, and copies its
- * node mapping from the containing overlap_count.
+ * Under the SMC and SMC' a lineage only has gaps in its material where
+ * the MRCA has been reached, and no other lineage has material there.
+ * Two lineages can therefore coalesce exactly when the intervals between
+ * the ends of their material overlap by at least min_overlap, and so we
+ * can count and choose these pairs by ordering the lineages by their
+ * left and right ends.
  */
-static int WARN_UNUSED
-msp_copy_overlap_count(msp_t *self, uint32_t k)
+static inline int64_t
+msp_get_min_overlap(msp_t *self)
 {
-    int ret;
-    node_mapping_t search, *nm;
+    return self->model == MSP_MODEL_SMC ? 1: 0;
+}
+
+/*
+ * Returns true if the lineages with the specified head segments can
+ * coalesce. Both must be in the overlap index.
+ */
+static inline bool
+msp_lineages_overlap(msp_t *self, uint32_t a, uint32_t b)
+{
+    segment_t *S = self->segments;
+
+    return ((int64_t) GSL_MIN(self->lineage_ends[a], self->lineage_ends[b]))
+        - ((int64_t) GSL_MAX(S[a].left, S[b].left))
+        >= msp_get_min_overlap(self);
+}
+
+/*
+ * Returns the number of entries in the specified index with coordinate
+ * less than x.
+ */
+static uint64_t
+msp_overlap_index_rank(avl_tree_t *index, uint64_t x)
+{
+    uint64_t ret = avl_count(index);
+    /* Keys are never zero in the low 32 bits, as segment 0 is not used */
+    uint64_t key = x << 32;
     avl_node_t *node;
+    int c;
 
-    search.left = k;
-    avl_search_closest(&self->overlap_counts, &search, &node);
-    assert(node != NULL);
-    nm = (node_mapping_t *) node->item;
-    if (nm->left > k) {
-        node = node->prev;
-        assert(node != NULL);
-        nm = (node_mapping_t *) node->item;
+    /* Coordinates go up to UINT32_MAX, so x may be one more than this */
+    if (x <= UINT32_MAX) {
+        ret = 0;
+        c = avl_search_closest(index, &key, &node);
+        if (node != NULL) {
+            ret = avl_index(node) + (c > 0 ? 1: 0);
+        }
     }
-    ret = msp_insert_overlap_count(self, k, nm->value);
     return ret;
 }
 
-static int WARN_UNUSED
-msp_record_coalescence(msp_t *self, uint32_t left, uint32_t right,
-        uint32_t num_children, uint32_t *children, uint32_t node,
-        uint32_t population_id)
+/*
+ * Returns the number of lineages in the overlap index of the specified
+ * population that cannot coalesce with a lineage spanning [left, end).
+ */
+static uint64_t
+msp_get_num_disjoint_lineages(msp_t *self, population_t *pop, uint32_t left,
+        uint32_t end)
 {
-    int ret = 0;
-    int equal;
-    uint32_t j;
-    coalescence_record_t *cr;
-    coalescence_record_t *lcr;
+    int64_t min_overlap = msp_get_min_overlap(self);
+    uint64_t n = avl_count(&pop->left_index);
 
-    if (self->num_coalescence_records == self->max_coalescence_records - 1) {
-        /* Grow the array */
-        self->max_coalescence_records += self->coalescence_record_block_size;;
-        cr = realloc(self->coalescence_records,
-                self->max_coalescence_records * sizeof(coalescence_record_t));
-        if (cr == NULL) {
-            ret = MSP_ERR_NO_MEMORY;
-            goto out;
-        }
-        self->coalescence_records = cr;
-        self->num_coalescence_record_blocks++;
-    }
-    /* Sort the children */
-    qsort(children, num_children, sizeof(uint32_t), cmp_uint32_t);
+    return msp_overlap_index_rank(&pop->right_index,
+                (uint64_t) ((int64_t) left + min_overlap))
+        + n - msp_overlap_index_rank(&pop->left_index,
+                (uint64_t) ((int64_t) end - min_overlap + 1));
+}
 
-    cr = &self->coalescence_records[self->num_coalescence_records];
-    if (self->num_coalescence_records != 0) {
-        lcr = &self->coalescence_records[self->num_coalescence_records - 1];
-        if (lcr->right == left && lcr->num_children == num_children
-                && lcr->node == node) {
-            /* Compare the children */
-            equal = 1;
-            for (j = 0; equal && j < num_children; j++) {
-                equal = equal && (children[j] == lcr->children[j]);
-            }
-            if (equal) {
-                /* squash this record into the last */
-                lcr->right = right;
-                cr = NULL;
-                msp_free_children(self, num_children, children);
-            }
+static int WARN_UNUSED
+msp_insert_overlap_node(msp_t *self, avl_tree_t *index, uint32_t x, uint32_t u)
+{
+    int ret = 0;
+    overlap_node_t *node;
+    avl_node_t *avl_node;
+
+    if (object_heap_empty(&self->overlap_node_heap)) {
+        ret = msp_expand_object_heap(self, &self->overlap_node_heap);
+        if (ret != 0) {
+            goto out;
         }
     }
-    if (cr != NULL) {
-        cr->num_children = num_children;
-        cr->children = children;
-        cr->left = (double) left;
-        cr->right = (double) right;
-        cr->node = node;
-        cr->time = self->time;
-        cr->population_id = population_id;
-        self->num_coalescence_records++;
-    }
+    node = (overlap_node_t *) object_heap_alloc_object(
+            &self->overlap_node_heap);
+    node->key = ((uint64_t) x << 32) | u;
+    avl_init_node(&node->node, &node->key);
+    avl_node = avl_insert_node(index, &node->node);
+    assert(avl_node != NULL);
 out:
     return ret;
 }
 
-static int
-msp_compress_overlap_counts(msp_t *self, uint32_t l, uint32_t r)
+static void
+msp_remove_overlap_node(msp_t *self, avl_tree_t *index, uint32_t x, uint32_t u)
 {
-    int ret = 0;
-    avl_node_t *node1, *node2;
-    node_mapping_t search, *nm1, *nm2;
-
-    search.left = l;
-    node1 = avl_search(&self->overlap_counts, &search);
-    assert(node1 != NULL);
-    if (node1->prev != NULL) {
-        node1 = node1->prev;
-    }
-    node2 = node1->next;
-    do {
-        nm1 = (node_mapping_t *) node1->item;
-        nm2 = (node_mapping_t *) node2->item;
-        if (nm1->value == nm2->value) {
-            avl_unlink_node(&self->overlap_counts, node2);
-            msp_free_avl_node(self, node2);
-            msp_free_node_mapping(self, nm2);
-            node2 = node1->next;
-        } else {
-            node1 = node2;
-            node2 = node2->next;
-        }
-    } while (node2 != NULL && nm2->left <= r);
-    return ret;
+    uint64_t key = ((uint64_t) x << 32) | u;
+    avl_node_t *node = avl_search(index, &key);
+
+    assert(node != NULL);
+    avl_unlink_node(index, node);
+    object_heap_free_object(&self->overlap_node_heap, node);
 }
 
+/*
+ * Adds the lineage with head segment u to the overlap index of its
+ * population.
+ */
 static int WARN_UNUSED
-msp_conditional_compress_overlap_counts(msp_t *self, uint32_t l, uint32_t r)
+msp_insert_overlap_index(msp_t *self, uint32_t u)
 {
     int ret = 0;
-    double covered_fraction = (r - l) / (double) self->num_loci;
-
-    /* This is a heuristic to prevent us spending a lot of time pointlessly
-     * trying to defragment during the early stages of the simulation.
-     * 5% of the overall length seems like a good value and leads to
-     * a ~15% time reduction when doing large simulations.
-     */
-    if (covered_fraction < 0.05) {
-        ret = msp_compress_overlap_counts(self, l, r);
-        if (ret != 0) {
-            goto out;
-        }
+    segment_t *S = self->segments;
+    population_t *pop = &self->populations[S[u].population_id];
+    uint32_t left = S[u].left;
+    uint32_t end = msp_get_lineage_end(self, u);
+
+    self->lineage_ends[u] = end;
+    pop->num_overlapping_pairs += avl_count(&pop->left_index)
+        - msp_get_num_disjoint_lineages(self, pop, left, end);
+    ret = msp_insert_overlap_node(self, &pop->left_index, left, u);
+    if (ret != 0) {
+        goto out;
     }
+    ret = msp_insert_overlap_node(self, &pop->right_index, end, u);
 out:
     return ret;
 }
 
-static int WARN_UNUSED
-msp_defrag_segment_chain(msp_t *self, segment_t *z)
+/*
+ * Removes the lineage with head segment u from the overlap index of its
+ * population. The lineage must not have changed since it was inserted.
+ */
+static void
+msp_remove_overlap_index(msp_t *self, uint32_t u)
 {
-    segment_t *y, *x;
+    segment_t *S = self->segments;
+    population_t *pop = &self->populations[S[u].population_id];
+    uint32_t left = S[u].left;
+    uint32_t end = self->lineage_ends[u];
+    uint64_t num_pairs;
+
+    msp_remove_overlap_node(self, &pop->left_index, left, u);
+    msp_remove_overlap_node(self, &pop->right_index, end, u);
+    num_pairs = avl_count(&pop->left_index)
+        - msp_get_num_disjoint_lineages(self, pop, left, end);
+    assert(pop->num_overlapping_pairs >= num_pairs);
+    pop->num_overlapping_pairs -= num_pairs;
+}
 
-    y = z;
-    while (y->prev != NULL) {
-        x = y->prev;
-        if (x->right == y->left && x->value == y->value) {
-            x->right = y->right;
-            x->next = y->next;
-            if (y->next != NULL) {
-                y->next->prev = x;
-            }
-            fenwick_increment(&self->links, x->id, y->right - y->left);
-            msp_free_segment(self, y);
+/*
+ * Removes all lineages from the overlap indexes.
+ */
+static void
+msp_clear_overlap_index(msp_t *self)
+{
+    uint32_t j;
+    population_t *pop;
+    avl_tree_t *indexes[2];
+    avl_node_t *node, *next;
+    size_t k;
+
+    for (j = 0; j < self->num_populations; j++) {
+        pop = &self->populations[j];
+        indexes[0] = &pop->left_index;
+        indexes[1] = &pop->right_index;
+        for (k = 0; k < 2; k++) {
+            for (node = indexes[k]->head; node != NULL; node = next) {
+                next = node->next;
+                object_heap_free_object(&self->overlap_node_heap, node);
+            }
+            avl_clear_tree(indexes[k]);
         }
-        y = x;
+        pop->num_overlapping_pairs = 0;
     }
-    return 0;
 }
 
+/*
+ * Rebuilds the overlap index from the populations' ancestors.
+ */
 static int WARN_UNUSED
-msp_recombination_event(msp_t *self)
+msp_reset_overlap_index(msp_t *self)
 {
     int ret = 0;
-    int64_t l, t, gap, k;
-    size_t segment_id;
-    node_mapping_t search;
-    segment_t *x, *y, *z;
-    int64_t num_links = fenwick_get_total(&self->links);
+    uint32_t j;
+    size_t k;
+    lineage_set_t *ancestors;
 
-    self->num_re_events++;
-    /* We can't use the GSL integer generator here as the range is too large */
-    l = 1 + (int64_t) (gsl_rng_uniform(self->rng) * (double) num_links);
-    assert(l > 0 && l <= num_links);
-    segment_id = fenwick_find(&self->links, l);
-    t = fenwick_get_cumulative_sum(&self->links, segment_id);
-    gap = t - l;
-    assert(gap >= 0 && gap < self->num_loci);
-    y = msp_get_segment(self, segment_id);
-    x = y->prev;
-    k = y->right - gap - 1;
-    assert(k >= 0 && k < self->num_loci);
-    if (y->left < k) {
-        z = msp_alloc_segment(self, (uint32_t) k, y->right, y->value,
-                y->population_id, NULL, y->next);
-        if (z == NULL) {
-            ret = MSP_ERR_NO_MEMORY;
-            goto out;
-        }
-        if (y->next != NULL) {
-            y->next->prev = z;
-        }
-        y->next = NULL;
-        y->right = (uint32_t) k;
-        fenwick_increment(&self->links, y->id, k - z->right);
-        search.left = (uint32_t) k;
-        if (avl_search(&self->breakpoints, &search) == NULL) {
-            ret = msp_insert_breakpoint(self, (uint32_t) k);
-            if (ret != 0) {
-                goto out;
+    msp_clear_overlap_index(self);
+    if (msp_has_overlap_index(self)) {
+        for (j = 0; j < self->num_populations; j++) {
+            ancestors = &self->populations[j].ancestors;
+            for (k = 0; k < lineage_set_get_size(ancestors); k++) {
+                ret = msp_insert_overlap_index(self,
+                        lineage_set_get_item(ancestors, k));
+                if (ret != 0) {
+                    goto out;
+                }
             }
-        } else {
-            self->num_multiple_re_events++;
         }
-    } else {
-        assert(x != NULL);
-        x->next = NULL;
-        y->prev = NULL;
-        z = y;
-        self->num_trapped_re_events++;
     }
-    fenwick_set_value(&self->links, z->id, z->right - z->left - 1);
-    ret = msp_insert_individual(self, z);
 out:
     return ret;
 }
 
-/* If we're implementing the SMC or SMC', discard this CA event if
- * there aren't any overlapping segments.
+/*
+ * Returns the number of ordered pairs of distinct lineages in the
+ * specified population that can coalesce.
  */
-static int WARN_UNUSED
-msp_reject_ca_event(msp_t *self, segment_t *a, segment_t *b)
+static inline double
+msp_get_num_ca_pairs(msp_t *self, population_t *pop)
 {
-    int ret = 0;
-    segment_t *x = a;
-    segment_t *y = b;
-    segment_t *beta;
-    int64_t overlap, min_overlap;
+    /* Need to perform n * (n - 1) as a double due to overflow */
+    double n = (double) lineage_set_get_size(&pop->ancestors);
+    double ret = n * (n - 1.0);
 
-    if (self->model == MSP_MODEL_SMC || self->model == MSP_MODEL_SMC_PRIME) {
-        ret = 1;
-        min_overlap = self->model == MSP_MODEL_SMC ? 1: 0;
-        while (x != NULL && y != NULL) {
-            if (y->left < x->left) {
-                beta = x;
-                x = y;
-                y = beta;
-            }
-            overlap = ((int64_t) x->right) - ((int64_t) y->left);
-            if (overlap >= min_overlap) {
-                ret = 0;
-                break;
-            }
-            x = x->next;
-        }
+    if (msp_has_overlap_index(self)) {
+        ret = 2.0 * (double) pop->num_overlapping_pairs;
     }
     return ret;
 }
 
-static int WARN_UNUSED
-msp_merge_two_ancestors(msp_t *self, uint32_t population_id, segment_t *a,
-        segment_t *b)
+/*
+ * Updates the common ancestor and migration rates for the specified
+ * population after the number of lineages it contains has changed.
+ */
+static inline void
+msp_update_population_rates(msp_t *self, uint32_t population_id)
 {
-    int ret = 0;
-    int coalescence = 0;
-    int defrag_required = 0;
-    uint32_t v, l, r, l_min, r_max, *children;
-    avl_node_t *node;
-    node_mapping_t *nm, search;
-    segment_t *x, *y, *z, *alpha, *beta;
+    population_t *pop = &self->populations[population_id];
+    size_t N = self->num_populations;
+    double n = (double) lineage_set_get_size(&pop->ancestors);
+    double ca_rate = 0.0;
 
-    x = a;
-    y = b;
-    /* Keep GCC happy */
-    l_min = 0;
-    r_max = 0;
+    if (n > 1 && msp_has_constant_size(pop)) {
+        ca_rate = msp_get_num_ca_pairs(self, pop) / pop->initial_size;
+    }
+    rate_tree_set_value(&self->event_rates, 1 + population_id, ca_rate);
+    rate_tree_set_value(&self->event_rates, 1 + N + population_id,
+            n * migration_matrix_get_row_sum(&self->migration_matrix,
+                population_id));
+}
 
-    /* update num_links and get ready for loop */
-    z = NULL;
-    while (x != NULL || y != NULL) {
-        alpha = NULL;
-        if (x == NULL || y == NULL) {
-            if (x != NULL) {
-                alpha = x;
-                x = NULL;
-            }
-            if (y != NULL) {
-                alpha = y;
-                y = NULL;
-            }
-        } else {
-            if (y->left < x->left) {
-                beta = x;
-                x = y;
-                y = beta;
-            }
-            if (x->right <= y->left) {
-                alpha = x;
-                x = x->next;
-                alpha->next = NULL;
-            } else if (x->left != y->left) {
-                alpha = msp_alloc_segment(self, x->left, y->left, x->value,
-                        x->population_id, NULL, NULL);
-                if (alpha == NULL) {
-                    ret = MSP_ERR_NO_MEMORY;
-                    goto out;
-                }
-                x->left = y->left;
-            } else {
-                l = x->left;
-                r_max = GSL_MIN(x->right, y->right);
-                if (!coalescence) {
-                    coalescence = 1;
-                    l_min = l;
-                    self->next_node++;
-                    /* Check for overflow */
-                    assert(self->next_node != 0);
-                }
-                v = self->next_node - 1;
-                /* Insert overlap counts for bounds, if necessary */
-                search.left = l;
-                node = avl_search(&self->overlap_counts, &search);
-                if (node == NULL) {
-                    ret = msp_copy_overlap_count(self, l);
-                    if (ret < 0) {
-                        goto out;
-                    }
-                }
-                search.left = r_max;
-                node = avl_search(&self->overlap_counts, &search);
-                if (node == NULL) {
-                    ret = msp_copy_overlap_count(self, r_max);
-                    if (ret < 0) {
-                        goto out;
-                    }
-                }
-                /* Now get overlap count at the left */
-                search.left = l;
-                node = avl_search(&self->overlap_counts, &search);
-                assert(node != NULL);
-                nm = (node_mapping_t *) node->item;
-                if (nm->value == 2) {
-                    nm->value = 0;
-                    node = node->next;
-                    assert(node != NULL);
-                    nm = (node_mapping_t *) node->item;
-                    r = nm->left;
-                } else {
-                    r = l;
-                    while (nm->value != 2 && r < r_max) {
-                        nm->value--;
-                        node = node->next;
-                        assert(node != NULL);
-                        nm = (node_mapping_t *) node->item;
-                        r = nm->left;
-                    }
-                    alpha = msp_alloc_segment(self, l, r, v, population_id,
-                            NULL, NULL);
-                    if (alpha == NULL) {
-                        ret = MSP_ERR_NO_MEMORY;
-                        goto out;
-                    }
-                }
-                children = msp_alloc_children(self, 2);
-                if (children == NULL) {
-                    ret = MSP_ERR_NO_MEMORY;
-                    goto out;
-                }
-                children[0] = x->value;
-                children[1] = y->value;
-                ret = msp_record_coalescence(self, l, r, 2, children, v,
-                        population_id);
-                if (ret != 0) {
-                    goto out;
-                }
-                /* Trim the ends of x and y, and prepare for next iteration. */
-                if (x->right == r) {
-                    beta = x;
-                    x = x->next;
-                    msp_free_segment(self, beta);
-                } else {
-                    x->left = r;
-                }
-                if (y->right == r) {
-                    beta = y;
-                    y = y->next;
-                    msp_free_segment(self, beta);
-                } else {
-                    y->left = r;
-                }
-            }
-        }
-        if (alpha != NULL) {
-            if (z == NULL) {
-                ret = msp_insert_individual(self, alpha);
-                if (ret != 0) {
-                    goto out;
-                }
-                fenwick_set_value(&self->links, alpha->id,
-                        alpha->right - alpha->left - 1);
-            } else {
-                defrag_required |= z->right == alpha->left && z->value == alpha->value;
-                z->next = alpha;
-                fenwick_set_value(&self->links, alpha->id, alpha->right - z->right);
-            }
-            alpha->prev = z;
-            z = alpha;
+/*
+ * Recomputes all event rates from the current population parameters
+ * and migration matrix. This must be called whenever these change.
+ */
+static void
+msp_reset_event_rates(msp_t *self)
+{
+    uint32_t j;
+    size_t N = self->num_populations;
+
+    self->num_variable_rate_populations = 0;
+    for (j = 0; j < N; j++) {
+        if (!msp_has_constant_size(&self->populations[j])) {
+            self->variable_rate_populations[
+                self->num_variable_rate_populations] = j;
+            self->num_variable_rate_populations++;
         }
     }
-    if (defrag_required) {
-        ret = msp_defrag_segment_chain(self, z);
+    rate_tree_clear(&self->event_rates);
+    rate_tree_set_value(&self->event_rates, 0,
+            (double) fenwick_get_total(&self->links)
+            * self->scaled_recombination_rate);
+    for (j = 0; j < N; j++) {
+        msp_update_population_rates(self, j);
+    }
+}
+
+static inline int WARN_UNUSED
+msp_insert_individual(msp_t *self, uint32_t u)
+{
+    int ret = 0;
+    size_t increment;
+    uint32_t population_id = msp_get_segment(self, u)->population_id;
+    population_t *pop = &self->populations[population_id];
+
+    if (lineage_set_is_full(&pop->ancestors)) {
+        increment = msp_get_lineage_set_mem_increment(self, pop);
+        if (self->used_memory + increment > self->max_memory) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        ret = lineage_set_expand(&pop->ancestors, increment / sizeof(uint32_t));
         if (ret != 0) {
             goto out;
         }
+        self->used_memory += increment;
     }
-    if (coalescence) {
-        ret = msp_conditional_compress_overlap_counts(self, l_min, r_max);
+    lineage_set_insert(&pop->ancestors, u);
+    if (msp_has_overlap_index(self)) {
+        ret = msp_insert_overlap_index(self, u);
         if (ret != 0) {
             goto out;
         }
-
     }
+    msp_update_population_rates(self, population_id);
 out:
     return ret;
 }
 
-static int WARN_UNUSED
-msp_common_ancestor_event(msp_t *self, uint32_t population_id)
+/*
+ * Removes the individual at the specified index from the population
+ * and returns it. The individual at the end of the population's
+ * ancestors is moved into this position.
+ */
+static inline uint32_t
+msp_remove_individual(msp_t *self, uint32_t population_id, size_t index)
 {
-    int ret = 0;
-    uint32_t j, n;
-    avl_tree_t *ancestors;
-    avl_node_t *x_node, *y_node, *node;
-    segment_t *x, *y;
+    lineage_set_t *ancestors = &self->populations[population_id].ancestors;
+    uint32_t u;
 
-    ancestors = &self->populations[population_id].ancestors;
-    /* Choose x and y */
-    n = avl_count(ancestors);
-    j = (uint32_t) gsl_rng_uniform_int(self->rng, n);
-    x_node = avl_at(ancestors, j);
-    assert(x_node != NULL);
-    x = (segment_t *) x_node->item;
-    avl_unlink_node(ancestors, x_node);
-    j = (uint32_t) gsl_rng_uniform_int(self->rng, n - 1);
-    y_node = avl_at(ancestors, j);
-    assert(y_node != NULL);
-    y = (segment_t *) y_node->item;
-    avl_unlink_node(ancestors, y_node);
-
-    /* For SMC and SMC' models we reject some events to get the required
-     * distribution. */
-    if (msp_reject_ca_event(self, x, y)) {
-        self->num_rejected_ca_events++;
-        /* insert x and y back into the population */
-        assert(x_node->item == x);
-        node = avl_insert_node(ancestors, x_node);
-        assert(node != NULL);
-        assert(y_node->item == y);
-        node = avl_insert_node(ancestors, y_node);
-        assert(node != NULL);
-    } else {
-        self->num_ca_events++;
-        msp_free_avl_node(self, x_node);
-        msp_free_avl_node(self, y_node);
-        ret = msp_merge_two_ancestors(self, population_id, x, y);
+    if (msp_has_overlap_index(self)) {
+        msp_remove_overlap_index(self, lineage_set_get_item(ancestors, index));
     }
-    return ret;
+    u = lineage_set_remove(ancestors, index);
+    msp_update_population_rates(self, population_id);
+    return u;
 }
 
-static int WARN_UNUSED
-msp_priority_queue_insert(msp_t *self, avl_tree_t *Q, segment_t *u)
+static void
+msp_print_segment_chain(msp_t *self, uint32_t head, FILE *out)
 {
-    int ret = 0;
-    avl_node_t *node;
+    uint32_t u = head;
+    segment_t *s = msp_get_segment(self, head);
 
-    assert(u != NULL);
-    node = msp_alloc_avl_node(self);
-    if (node == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
+    fprintf(out, "[%d]", s->population_id);
+    while (u != MSP_NULL_SEGMENT) {
+        s = msp_get_segment(self, u);
+        fprintf(out, "[(%d-%d) %d] ", s->left, s->right, s->value);
+        u = s->next;
     }
-    avl_init_node(node, u);
-    node = avl_insert_node(Q, node);
-    assert(node != NULL);
-out:
-    return ret;
+    fprintf(out, "\n");
 }
 
-/* Merge the specified set of ancestors into a single ancestor. This is a
- * generalisation of the msp_common_ancestor_event method where we allow
- * any number of ancestors to merge. The avl tree is a priority queue in
- * sorted by left coordinate.
- */
-static int WARN_UNUSED
-msp_merge_ancestors(msp_t *self, avl_tree_t *Q, uint32_t population_id)
+static void
+msp_verify_segments(msp_t *self)
 {
-    int ret = MSP_ERR_GENERIC;
-    int coalescence = 0;
-    int defrag_required = 0;
-    uint32_t j, l, r, h, r_max, next_l, l_min, v, *children;
-    avl_node_t *node;
-    node_mapping_t *nm, search;
-    segment_t *x, *z, *alpha;
-    segment_t **H = NULL;
-
-    assert(self->model == MSP_MODEL_HUDSON);
-    H = malloc(avl_count(Q) * sizeof(segment_t *));
-    if (H == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
-    }
-    l_min = 0;
-    z = NULL;
-    while (avl_count(Q) > 0) {
-        h = 0;
-        node = Q->head;
-        l = ((segment_t *) node->item)->left;
-        r_max = self->num_loci;
-        while (node != NULL && ((segment_t *) node->item)->left == l) {
-            H[h] = (segment_t *) node->item;
-            r_max = GSL_MIN(r_max, H[h]->right);
-            h++;
-            msp_free_avl_node(self, node);
-            avl_unlink_node(Q, node);
-            node = node->next;
-        }
-        next_l = 0;
-        if (node != NULL) {
-            next_l = ((segment_t *) node->item)->left;
-            r_max = GSL_MIN(r_max, next_l);
-        }
-        alpha = NULL;
-        if (h == 1) {
-            x = H[0];
-            if (node != NULL && next_l < x->right) {
-                alpha = msp_alloc_segment(self, x->left, next_l, x->value,
-                        x->population_id, NULL, NULL);
-                if (alpha == NULL) {
-                    ret = MSP_ERR_NO_MEMORY;
-                    goto out;
+    int64_t s, ss, total_links, left, right, alt_total_links;
+    size_t j, k;
+    size_t total_segments = 0;
+    size_t total_free_segments = 0;
+    lineage_set_t *ancestors;
+    uint32_t id;
+    segment_t *u;
+
+    total_links = 0;
+    alt_total_links = 0;
+    for (j = 0; j < self->num_populations; j++) {
+        ancestors = &self->populations[j].ancestors;
+        for (k = 0; k < lineage_set_get_size(ancestors); k++) {
+            id = lineage_set_get_item(ancestors, k);
+            u = msp_get_segment(self, id);
+            assert(u->prev == MSP_NULL_SEGMENT);
+            left = u->left;
+            while (id != MSP_NULL_SEGMENT) {
+                u = msp_get_segment(self, id);
+                total_segments++;
+                assert(u->population_id == j);
+                assert(u->left < u->right);
+                assert(u->right <= self->num_loci);
+                if (u->prev != MSP_NULL_SEGMENT) {
+                    assert(msp_get_segment(self, u->prev)->next == id);
+                    s = u->right - msp_get_segment(self, u->prev)->right;
+                } else {
+                    s = u->right - u->left - 1;
                 }
-                x->left = next_l;
-            } else {
-                alpha = x;
-                x = x->next;
-                alpha->next = NULL;
-            }
-            if (x != NULL) {
-                ret = msp_priority_queue_insert(self, Q, x);
-                if (ret != 0) {
-                    goto out;
+                ss = fenwick_get_value(&self->links, id);
+                total_links += ss;
+                assert(s == ss);
+                if (s == ss) {
+                    /* do nothing; just to keep compiler happy - see below also */
                 }
+                right = u->right;
+                id = u->next;
             }
-        } else {
-            if (!coalescence) {
-                coalescence = 1;
-                l_min = l;
-                self->next_node++;
-                /* Check for overflow */
-                assert(self->next_node != 0);
-            }
-            v = self->next_node - 1;
-            /* Insert overlap counts for bounds, if necessary */
-            search.left = l;
-            node = avl_search(&self->overlap_counts, &search);
-            if (node == NULL) {
-                ret = msp_copy_overlap_count(self, l);
-                if (ret < 0) {
-                    goto out;
-                }
+            alt_total_links += right - left - 1;
+        }
+    }
+    assert(total_links == fenwick_get_total(&self->links));
+    assert(total_links == alt_total_links);
+    assert(total_segments == self->num_segments);
+    for (id = self->free_segment; id != MSP_NULL_SEGMENT;
+            id = msp_get_segment(self, id)->next) {
+        assert(fenwick_get_value(&self->links, id) == 0);
+        total_free_segments++;
+    }
+    assert(total_segments + total_free_segments == self->max_segments - 1);
+    assert(fenwick_get_size(&self->links) == self->max_segments - 1);
+    btree_verify(&self->breakpoints);
+    btree_verify(&self->overlap_counts);
+    /* The segment queue and scratch space are only used within events. */
+    assert(priority_queue_get_size(&self->segment_queue) == 0);
+    assert(self->scratch.offset == 0 && self->scratch.overflow == NULL);
+    if (total_free_segments == total_segments) {
+        /* do nothing - this is just to keep the compiler happy when
+         * asserts are turned off.
+         */
+    }
+}
+
+static void
+msp_verify_overlaps(msp_t *self)
+{
+    btree_position_t pos;
+    bool valid;
+    segment_t *u;
+    lineage_set_t *ancestors;
+    uint32_t j, k, id, left, right, count;
+    size_t l;
+    /* We check for every locus, so obviously this rules out large numbers
+     * of loci. This code should never be called except during testing,
+     * so we don't need to recover from malloc failure.
+     */
+    uint32_t *overlaps = calloc(self->num_loci, sizeof(uint32_t));
+
+    assert(overlaps != NULL);
+    /* Add in the counts for any historical samples that haven't been
+     * included yet.
+     */
+    for (j = 0; j < self->sample_size; j++) {
+        if (self->samples[j].time > self->time) {
+            for (k = 0; k < self->num_loci; k++) {
+                overlaps[k]++;
             }
-            search.left = r_max;
-            node = avl_search(&self->overlap_counts, &search);
-            if (node == NULL) {
-                ret = msp_copy_overlap_count(self, r_max);
-                if (ret < 0) {
-                    goto out;
+        }
+    }
+    for (j = 0; j < self->num_populations; j++) {
+        ancestors = &self->populations[j].ancestors;
+        for (l = 0; l < lineage_set_get_size(ancestors); l++) {
+            id = lineage_set_get_item(ancestors, l);
+            while (id != MSP_NULL_SEGMENT) {
+                u = msp_get_segment(self, id);
+                for (k = u->left; k < u->right; k++) {
+                    overlaps[k]++;
                 }
+                id = u->next;
             }
-            /* Update the extant segments and allocate alpha if the interval
-             * has not coalesced. */
-            search.left = l;
-            node = avl_search(&self->overlap_counts, &search);
-            assert(node != NULL);
-            nm = (node_mapping_t *) node->item;
-            if (nm->value == h) {
-                nm->value = 0;
-                node = node->next;
-                assert(node != NULL);
-                nm = (node_mapping_t *) node->item;
-                r = nm->left;
-            } else {
-                r = l;
-                while (nm->value != h && r < r_max) {
-                    nm->value -= h - 1;
-                    node = node->next;
-                    assert(node != NULL);
-                    nm = (node_mapping_t *) node->item;
-                    r = nm->left;
-                }
-                alpha = msp_alloc_segment(self, l, r, v, population_id,
-                        NULL, NULL);
-                if (alpha == NULL) {
-                    ret = MSP_ERR_NO_MEMORY;
-                    goto out;
-                }
+        }
+    }
+    valid = btree_first(&self->overlap_counts, &pos);
+    while (valid) {
+        left = btree_get_key(&self->overlap_counts, &pos);
+        count = btree_get_value(&self->overlap_counts, &pos);
+        valid = btree_next(&self->overlap_counts, &pos);
+        if (valid) {
+            right = btree_get_key(&self->overlap_counts, &pos);
+            for (k = left; k < right; k++) {
+                assert(overlaps[k] == count);
             }
-            /* Create the record and update the priority queue */
-            children = msp_alloc_children(self, h);
-            if (children == NULL) {
-                ret = MSP_ERR_NO_MEMORY;
-                goto out;
+        }
+    }
+    free(overlaps);
+}
+
+static void
+msp_verify_event_rates(msp_t *self)
+{
+    uint32_t j, k;
+    size_t l;
+    size_t N = self->num_populations;
+    double n, rate;
+    population_t *pop;
+    migration_matrix_t *mm = &self->migration_matrix;
+
+    k = 0;
+    for (j = 0; j < N; j++) {
+        pop = &self->populations[j];
+        n = (double) lineage_set_get_size(&pop->ancestors);
+        rate = 0.0;
+        if (msp_has_constant_size(pop)) {
+            if (n > 1) {
+                rate = msp_get_num_ca_pairs(self, pop) / pop->initial_size;
             }
-            for (j = 0; j < h; j++) {
-                x = H[j];
-                children[j] = x->value;
-                if (x->right == r) {
-                    msp_free_segment(self, x);
-                    x = x->next;
-                } else if (x->right > r) {
-                    x->left = r;
-                }
-                if (x != NULL) {
-                    ret = msp_priority_queue_insert(self, Q, x);
-                    if (ret != 0) {
-                        goto out;
+        } else {
+            assert(k < self->num_variable_rate_populations);
+            assert(self->variable_rate_populations[k] == j);
+            k++;
+        }
+        assert(rate_tree_get_value(&self->event_rates, 1 + j) == rate);
+        rate = n * migration_matrix_get_row_sum(mm, j);
+        assert(rate_tree_get_value(&self->event_rates, 1 + N + j) == rate);
+        rate = 0.0;
+        for (l = mm->row_start[j]; l < mm->row_start[j + 1]; l++) {
+            assert(mm->source[l] == j);
+            assert(mm->dest[l] != j && mm->dest[l] < N);
+            assert(l == mm->row_start[j] || mm->dest[l - 1] < mm->dest[l]);
+            rate += mm->rate[l];
+            assert(mm->cumulative_rate[l] == rate);
+        }
+        assert(migration_matrix_get_row_sum(mm, j) == rate);
+    }
+    assert(k == self->num_variable_rate_populations);
+}
+
+static void
+msp_verify_overlap_index(msp_t *self)
+{
+    uint32_t j, u, v, x, y;
+    size_t k, l, n;
+    uint64_t key, num_pairs;
+    int64_t min_overlap = msp_get_min_overlap(self);
+    bool overlap;
+    population_t *pop;
+    segment_t *S = self->segments;
+
+    for (j = 0; j < self->num_populations; j++) {
+        pop = &self->populations[j];
+        n = lineage_set_get_size(&pop->ancestors);
+        assert(avl_count(&pop->left_index) == n);
+        assert(avl_count(&pop->right_index) == n);
+        num_pairs = 0;
+        for (k = 0; k < n; k++) {
+            u = lineage_set_get_item(&pop->ancestors, k);
+            assert(self->lineage_ends[u] == msp_get_lineage_end(self, u));
+            key = ((uint64_t) S[u].left << 32) | u;
+            assert(avl_search(&pop->left_index, &key) != NULL);
+            key = ((uint64_t) self->lineage_ends[u] << 32) | u;
+            assert(avl_search(&pop->right_index, &key) != NULL);
+            for (l = k + 1; l < n; l++) {
+                v = lineage_set_get_item(&pop->ancestors, l);
+                /* Check the segments directly */
+                overlap = false;
+                x = u;
+                y = v;
+                while (x != MSP_NULL_SEGMENT && y != MSP_NULL_SEGMENT) {
+                    if (((int64_t) GSL_MIN(S[x].right, S[y].right))
+                            - ((int64_t) GSL_MAX(S[x].left, S[y].left))
+                            >= min_overlap) {
+                        overlap = true;
+                        break;
+                    }
+                    if (S[x].right < S[y].right) {
+                        x = S[x].next;
+                    } else {
+                        y = S[y].next;
                     }
                 }
+                assert(overlap == msp_lineages_overlap(self, u, v));
+                num_pairs += overlap;
             }
-            ret = msp_record_coalescence(self, l, r, h, children, v,
-                    population_id);
-            if (ret != 0) {
-                goto out;
+        }
+        assert(pop->num_overlapping_pairs == num_pairs);
+    }
+}
+
+static void
+msp_verify_sequential_tree(msp_t *self)
+{
+    sequential_tree_t *tree = &self->sequential_tree;
+    uint32_t n = self->sample_size;
+    uint32_t u, v, j;
+    double next;
+
+    assert(tree->parent[tree->root] == MSP_NULL_NODE);
+    for (u = n; u < 2 * n - 1; u++) {
+        assert(u - n == 0 || tree->internal_times[u - n - 1]
+                < tree->internal_times[u - n]);
+        for (j = 0; j < 2; j++) {
+            v = tree->children[2 * u + j];
+            assert(tree->parent[v] == u);
+            assert(tree->time[v] < tree->time[u]);
+        }
+        assert(tree->left[u] <= tree->position);
+    }
+    for (u = 0; u < 2 * n - 1; u++) {
+        assert(u == tree->root || tree->parent[u] != MSP_NULL_NODE);
+    }
+    /* There is one branch above the root */
+    assert(msp_sequential_num_branches(self,
+                tree->internal_times[n - 2], &next) == 1);
+    assert(next == DBL_MAX);
+}
+
+void
+msp_verify(msp_t *self)
+{
+    /* The sequential engine leaves the back-in-time state untouched */
+    if (self->sequential && self->state == MSP_STATE_SIMULATING) {
+        if (msp_get_num_ancestors(self) > 0) {
+            msp_verify_sequential_tree(self);
+        }
+    } else {
+        msp_verify_segments(self);
+        msp_verify_overlaps(self);
+        msp_verify_event_rates(self);
+        if (msp_has_overlap_index(self)) {
+            msp_verify_overlap_index(self);
+        }
+    }
+}
+
+int
+msp_print_state(msp_t *self, FILE *out)
+{
+    int ret = 0;
+    btree_position_t pos;
+    bool valid;
+    segment_t *u;
+    coalescence_record_t record, *cr;
+    migration_record_t *mr;
+    demographic_event_t *de;
+    sampling_event_t *se;
+    int64_t v;
+    uint32_t j, k;
+    size_t l, offset;
+    migration_matrix_t *mm = &self->migration_matrix;
+    lineage_set_t *ancestors;
+    double gig = 1024.0 * 1024;
+
+    fprintf(out, "simulation model = '%s' (%d)\n", msp_get_model_str(self),
+            msp_get_model(self));
+    fprintf(out, "sequential = %d\n", self->sequential);
+    fprintf(out, "hugepages = %d\n", self->hugepages);
+    fprintf(out, "used_memory = %f MiB\n", (double) self->used_memory / gig);
+    fprintf(out, "max_memory  = %f MiB\n", (double) self->max_memory / gig);
+    fprintf(out, "n = %d\n", self->sample_size);
+    fprintf(out, "m = %d\n", self->num_loci);
+    fprintf(out, "Samples = \n");
+    for (j = 0; j < self->sample_size; j++) {
+        fprintf(out, "\t%d\tpopulation=%d\ttime=%f\n", j, self->samples[j].population_id,
+                self->samples[j].time);
+    }
+    fprintf(out, "Sampling events:\n");
+    for (j = 0; j < self->num_sampling_events; j++) {
+        if (j == self->next_sampling_event) {
+            fprintf(out, "  ***");
+        }
+        se = &self->sampling_events[j];
+        fprintf(out, "\t");
+        fprintf(out, "%d @ %f in deme %d\n", se->sample, se->time, se->population_id);
+    }
+    fprintf(out, "Demographic events:\n");
+    for (de = self->demographic_events_head; de != NULL; de = de->next) {
+        if (de == self->next_demographic_event) {
+            fprintf(out, "  ***");
+        }
+        fprintf(out, "\t");
+        de->print_state(self, de, out);
+    }
+    fprintf(out, "Migration matrix (source (total): dest:rate)\n");
+    for (j = 0; j < self->num_populations; j++) {
+        fprintf(out, "\t%d (%0.3f):", j, migration_matrix_get_row_sum(mm, j));
+        for (l = mm->row_start[j]; l < mm->row_start[j + 1]; l++) {
+            fprintf(out, " %d:%0.3f", mm->dest[l], mm->rate[l]);
+        }
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "num_links = %ld\n", (long) fenwick_get_total(&self->links));
+    for (j = 0; j < self->num_populations; j++) {
+        fprintf(out, "population[%d] = %d\n", j,
+            (int) lineage_set_get_size(&self->populations[j].ancestors));
+        fprintf(out, "\tstart_time = %f\n", self->populations[j].start_time);
+        fprintf(out, "\tinitial_size = %f\n", self->populations[j].initial_size);
+        fprintf(out, "\tgrowth_rate = %f\n", self->populations[j].growth_rate);
+    }
+    fprintf(out, "Time = %f\n", self->time);
+    for (j = 0; j < self->num_populations; j++) {
+        ancestors = &self->populations[j].ancestors;
+        for (l = 0; l < lineage_set_get_size(ancestors); l++) {
+            fprintf(out, "\t");
+            msp_print_segment_chain(self, lineage_set_get_item(ancestors, l),
+                    out);
+        }
+    }
+    fprintf(out, "Fenwick tree\n");
+    for (j = 1; j <= (uint32_t) fenwick_get_size(&self->links); j++) {
+        u = msp_get_segment(self, j);
+        v = fenwick_get_value(&self->links, j);
+        if (v != 0) {
+            fprintf(out, "\t%ld\ti=%d l=%d r=%d v=%d prev=%d next=%d\n",
+                    (long) v, (int) j, u->left, u->right, (int) u->value,
+                    (int) u->prev, (int) u->next);
+        }
+    }
+    fprintf(out, "Breakpoints = %d\n",
+            (int) btree_get_size(&self->breakpoints));
+    for (valid = btree_first(&self->breakpoints, &pos); valid;
+            valid = btree_next(&self->breakpoints, &pos)) {
+        fprintf(out, "\t%d -> %d\n", btree_get_key(&self->breakpoints, &pos),
+                btree_get_value(&self->breakpoints, &pos));
+    }
+    fprintf(out, "Overlap count = %d\n",
+            (int) btree_get_size(&self->overlap_counts));
+    for (valid = btree_first(&self->overlap_counts, &pos); valid;
+            valid = btree_next(&self->overlap_counts, &pos)) {
+        fprintf(out, "\t%d -> %d\n",
+                btree_get_key(&self->overlap_counts, &pos),
+                btree_get_value(&self->overlap_counts, &pos));
+    }
+    fprintf(out, "Coalescence records = %ld (flushed = %ld)\n",
+            (long) self->coalescence_records.num_records,
+            (long) self->num_flushed_coalescence_records);
+    offset = 0;
+    for (j = 0; j < self->coalescence_records.num_records; j++) {
+        msp_get_coalescence_record(self, j, offset, &record);
+        offset += record.num_children;
+        cr = &record;
+        fprintf(out, "\t%f\t%f\t%d\t(", cr->left, cr->right,
+                cr->node);
+        for (k = 0; k < cr->num_children; k++) {
+            fprintf(out, "%d", cr->children[k]);
+            if (k < cr->num_children - 1) {
+                fprintf(out, ", ");
             }
         }
-        /* Loop tail; integrate alpha into the global state */
-        if (alpha != NULL) {
-            if (z == NULL) {
-                ret = msp_insert_individual(self, alpha);
-                if (ret != 0) {
-                    goto out;
-                }
-                fenwick_set_value(&self->links, alpha->id,
-                        alpha->right - alpha->left - 1);
-            } else {
-                defrag_required |=
-                    z->right == alpha->left && z->value == alpha->value;
-                z->next = alpha;
-                fenwick_set_value(&self->links, alpha->id,
-                        alpha->right - z->right);
+        fprintf(out, ")\t%f\t%d\n", cr->time, cr->population_id);
+    }
+    fprintf(out, "Migration records = %ld\n",
+            (long) self->num_migration_records);
+    for (j = 0; j < self->num_migration_records; j++) {
+        mr = &self->migration_records[j];
+        fprintf(out, "\t%f\t%f\t%d\t%f\t%d\t%d\n", mr->left, mr->right,
+                mr->node, mr->time, mr->source, mr->dest);
+    }
+    fprintf(out, "Memory heaps\n");
+    fprintf(out, "segments: size = %d allocated = %d blocks = %d\n",
+            (int) self->max_segments - 1, (int) self->num_segments,
+            (int) self->num_segment_blocks);
+    fprintf(out, "segment_queue: size = %d blocks = %d\n",
+            (int) self->segment_queue.max_size,
+            (int) self->num_node_mapping_blocks);
+    scratch_print_state(&self->scratch, out);
+    fprintf(out, "variates: block_size = %d uniform = %d exponential = %d\n",
+            (int) self->variates.block_size,
+            (int) self->variates.uniform_position,
+            (int) self->variates.exponential_position);
+    fprintf(out, "breakpoints: nodes = %d allocated = %d height = %d\n",
+            (int) self->breakpoints.max_nodes - 1,
+            (int) self->breakpoints.num_nodes,
+            (int) self->breakpoints.height);
+    fprintf(out, "overlap_counts: nodes = %d allocated = %d height = %d\n",
+            (int) self->overlap_counts.max_nodes - 1,
+            (int) self->overlap_counts.num_nodes,
+            (int) self->overlap_counts.height);
+    fprintf(out, "overlap_node_heap:");
+    object_heap_print_state(&self->overlap_node_heap, out);
+    msp_verify(self);
+    return ret;
+}
+
+
+static int WARN_UNUSED
+msp_record_migration(msp_t *self, uint32_t left, uint32_t right,
+        uint32_t node, uint32_t source_pop, uint32_t dest_pop)
+{
+    int ret = 0;
+    migration_record_t *mr;
+
+    if (self->num_migration_records == self->max_migration_records - 1) {
+        /* Grow the array */
+        self->max_migration_records += self->migration_record_block_size;;
+        mr = realloc(self->migration_records,
+                self->max_migration_records * sizeof(migration_record_t));
+        if (mr == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        self->migration_records = mr;
+        self->num_migration_record_blocks++;
+    }
+    mr = &self->migration_records[self->num_migration_records];
+    mr->left = (double) left;
+    mr->right = (double) right;
+    mr->node = node;
+    mr->time = self->time;
+    mr->source = source_pop;
+    mr->dest = dest_pop;
+    self->num_migration_records++;
+out:
+    return ret;
+}
+
+static int WARN_UNUSED
+msp_move_individual(msp_t *self, uint32_t source_pop, size_t index,
+        uint32_t dest_pop)
+{
+    int ret = 0;
+    uint32_t ind, id;
+    segment_t *x;
+
+    ind = msp_remove_individual(self, source_pop, index);
+    /* Need to set the population_id for each segment. */
+    id = ind;
+    while (id != MSP_NULL_SEGMENT) {
+        x = msp_get_segment(self, id);
+        if (self->store_migration_records) {
+            ret = msp_record_migration(self, x->left, x->right, x->value,
+                    x->population_id, dest_pop);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        x->population_id = dest_pop;
+        id = x->next;
+    }
+    ret = msp_insert_individual(self, ind);
+out:
+    return ret;
+}
+
+/*
+ * Inserts the specified key into the B-tree, accounting for any memory
+ * that is allocated in doing so.
+ */
+static int WARN_UNUSED
+msp_btree_insert(msp_t *self, btree_t *tree, uint32_t key, uint32_t value)
+{
+    int ret = 0;
+    size_t size = btree_get_memory_size(tree);
+
+    ret = btree_insert(tree, key, value);
+    if (ret != 0) {
+        goto out;
+    }
+    self->used_memory += btree_get_memory_size(tree) - size;
+    if (self->used_memory > self->max_memory) {
+        ret = MSP_ERR_NO_MEMORY;
+    }
+out:
+    return ret;
+}
+
+/*
+ * Inserts a new breakpoint at the specified locus left.
+ */
+static int WARN_UNUSED
+msp_insert_breakpoint(msp_t *self, uint32_t left)
+{
+    return msp_btree_insert(self, &self->breakpoints, left, 0);
+}
+
+/*
+ * Inserts a new overlap_count at the specified locus left, mapping to the
+ * specified number of overlapping segments b.
+ */
+static int WARN_UNUSED
+msp_insert_overlap_count(msp_t *self, uint32_t left, uint32_t v)
+{
+    return msp_btree_insert(self, &self->overlap_counts, left, v);
+}
+
+/*
+ * Inserts a new overlap_count at the specified locus, and copies its
+ * node mapping from the containing overlap_count.
+ */
+static int WARN_UNUSED
+msp_copy_overlap_count(msp_t *self, uint32_t k)
+{
+    int ret;
+    btree_position_t pos;
+    bool found;
+
+    found = btree_search_floor(&self->overlap_counts, k, &pos);
+    assert(found);
+    ret = msp_insert_overlap_count(self, k,
+            found ? btree_get_value(&self->overlap_counts, &pos) : 0);
+    return ret;
+}
+
+/* Passes the first num_records coalescence records to the sink, and moves
+ * the remainder to the start of the columns. */
+static int WARN_UNUSED
+msp_flush_coalescence_record_batch(msp_t *self, size_t num_records)
+{
+    int ret = 0;
+    size_t j, num_children;
+    record_columns_t *records = &self->coalescence_records;
+    size_t n = records->num_records - num_records;
+
+    assert(self->coalescence_record_sink != NULL);
+    assert(num_records <= records->num_records);
+    ret = msp_update_coalescence_record_view(self, num_records);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = self->coalescence_record_sink(self->coalescence_record_sink_arg,
+            num_records, self->coalescence_record_view);
+    if (ret != 0) {
+        goto out;
+    }
+    num_children = 0;
+    for (j = 0; j < num_records; j++) {
+        num_children += records->num_children[j];
+    }
+    memmove(records->left, records->left + num_records, n * sizeof(uint32_t));
+    memmove(records->right, records->right + num_records, n * sizeof(uint32_t));
+    memmove(records->node, records->node + num_records, n * sizeof(uint32_t));
+    memmove(records->num_children, records->num_children + num_records,
+            n * sizeof(uint32_t));
+    memmove(records->population_id, records->population_id + num_records,
+            n * sizeof(uint32_t));
+    memmove(records->time, records->time + num_records, n * sizeof(double));
+    memmove(records->children, records->children + num_children,
+            (records->num_children_total - num_children) * sizeof(uint32_t));
+    records->num_records = n;
+    records->num_children_total -= num_children;
+    self->num_flushed_coalescence_records += num_records;
+out:
+    return ret;
+}
+
+/* Passes all coalescence records held in memory to the sink. */
+int WARN_UNUSED
+msp_flush_coalescence_records(msp_t *self)
+{
+    int ret = 0;
+
+    if (self->coalescence_record_sink == NULL) {
+        ret = MSP_ERR_BAD_STATE;
+        goto out;
+    }
+    ret = msp_flush_coalescence_record_batch(self,
+            self->coalescence_records.num_records);
+out:
+    return ret;
+}
+
+/*
+ * Returns space for the children of the next coalescence record at the end
+ * of the children column, so that they are written in place. The record
+ * must be added with msp_record_coalescence before anything else changes
+ * the columns.
+ */
+static int WARN_UNUSED
+msp_alloc_children(msp_t *self, uint32_t num_children, uint32_t **children)
+{
+    int ret = 0;
+    record_columns_t *records = &self->coalescence_records;
+    size_t max_records = records->max_records;
+    size_t max_children_total = records->max_children_total;
+
+    if (records->num_records == records->max_records - 1
+            || records->num_children_total + num_children
+                > records->max_children_total) {
+        if (self->coalescence_record_sink != NULL
+                && records->num_records > 1) {
+            /* The last record may still be extended, so we keep it */
+            ret = msp_flush_coalescence_record_batch(self,
+                    records->num_records - 1);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        if (records->num_records == records->max_records - 1) {
+            max_records += self->coalescence_record_block_size;
+            self->num_coalescence_record_blocks++;
+        }
+        if (records->num_children_total + num_children > max_children_total) {
+            max_children_total = GSL_MAX(2 * max_children_total,
+                    records->num_children_total + num_children);
+        }
+        ret = msp_expand_coalescence_records(self, max_records,
+                max_children_total);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    *children = records->children + records->num_children_total;
+out:
+    return ret;
+}
+
+/*
+ * Adds a coalescence record whose children have been written to the space
+ * returned by msp_alloc_children. If the record continues the last record,
+ * it is squashed into it.
+ */
+static int WARN_UNUSED
+msp_record_coalescence(msp_t *self, uint32_t left, uint32_t right,
+        uint32_t num_children, uint32_t *children, uint32_t node,
+        uint32_t population_id)
+{
+    int ret = 0;
+    int equal;
+    uint32_t j;
+    size_t k = self->coalescence_records.num_records;
+    record_columns_t *records = &self->coalescence_records;
+    uint32_t *last_children;
+
+    assert(children == records->children + records->num_children_total);
+    assert(k < records->max_records);
+    assert(records->num_children_total + num_children
+            <= records->max_children_total);
+    /* Sort the children */
+    qsort(children, num_children, sizeof(uint32_t), cmp_uint32_t);
+
+    if (k != 0) {
+        if (records->right[k - 1] == left
+                && records->num_children[k - 1] == num_children
+                && records->node[k - 1] == node) {
+            /* Compare the children */
+            last_children = children - num_children;
+            equal = 1;
+            for (j = 0; equal && j < num_children; j++) {
+                equal = equal && (children[j] == last_children[j]);
+            }
+            if (equal) {
+                /* squash this record into the last */
+                records->right[k - 1] = right;
+                goto out;
+            }
+        }
+    }
+    records->left[k] = left;
+    records->right[k] = right;
+    records->node[k] = node;
+    records->num_children[k] = num_children;
+    records->population_id[k] = population_id;
+    records->time[k] = self->time;
+    records->num_children_total += num_children;
+    records->num_records++;
+out:
+    return ret;
+}
+
+/*
+ * Removes redundant overlap counts between l and r, where an interval has
+ * the same count as the interval to its left.
+ */
+static int
+msp_compress_overlap_counts(msp_t *self, uint32_t l, uint32_t r)
+{
+    int ret = 0;
+    btree_t *tree = &self->overlap_counts;
+    btree_position_t pos;
+    uint32_t value, key;
+    bool valid;
+
+    valid = btree_search(tree, l, &pos);
+    assert(valid);
+    if (!btree_prev(tree, &pos)) {
+        valid = btree_first(tree, &pos);
+    }
+    value = btree_get_value(tree, &pos);
+    valid = btree_next(tree, &pos);
+    while (valid) {
+        key = btree_get_key(tree, &pos);
+        if (btree_get_value(tree, &pos) == value) {
+            valid = btree_remove(tree, &pos);
+        } else {
+            value = btree_get_value(tree, &pos);
+            valid = btree_next(tree, &pos);
+        }
+        if (key > r) {
+            break;
+        }
+    }
+    return ret;
+}
+
+static int WARN_UNUSED
+msp_conditional_compress_overlap_counts(msp_t *self, uint32_t l, uint32_t r)
+{
+    int ret = 0;
+    double covered_fraction = (r - l) / (double) self->num_loci;
+
+    /* This is a heuristic to prevent us spending a lot of time pointlessly
+     * trying to defragment during the early stages of the simulation.
+     * 5% of the overall length seems like a good value and leads to
+     * a ~15% time reduction when doing large simulations.
+     */
+    if (covered_fraction < 0.05) {
+        ret = msp_compress_overlap_counts(self, l, r);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+out:
+    return ret;
+}
+
+static int WARN_UNUSED
+msp_defrag_segment_chain(msp_t *self, uint32_t z)
+{
+    uint32_t x, y;
+    segment_t *S = self->segments;
+
+    y = z;
+    while (S[y].prev != MSP_NULL_SEGMENT) {
+        x = S[y].prev;
+        if (S[x].right == S[y].left && S[x].value == S[y].value) {
+            S[x].right = S[y].right;
+            S[x].next = S[y].next;
+            if (S[y].next != MSP_NULL_SEGMENT) {
+                S[S[y].next].prev = x;
+            }
+            fenwick_increment(&self->links, x, S[y].right - S[y].left);
+            msp_free_segment(self, y);
+        }
+        y = x;
+    }
+    return 0;
+}
+
+static int WARN_UNUSED
+msp_recombination_event(msp_t *self)
+{
+    int ret = 0;
+    int64_t l, t, gap, k;
+    uint32_t x, y, z, head;
+    btree_position_t pos;
+    segment_t *S = self->segments;
+    int64_t num_links = fenwick_get_total(&self->links);
+
+    self->num_re_events++;
+    /* We can't use the GSL integer generator here as the range is too large */
+    l = 1 + (int64_t) (msp_uniform(self) * (double) num_links);
+    assert(l > 0 && l <= num_links);
+    y = (uint32_t) fenwick_find(&self->links, l);
+    t = fenwick_get_cumulative_sum(&self->links, y);
+    gap = t - l;
+    assert(gap >= 0 && gap < self->num_loci);
+    x = S[y].prev;
+    k = S[y].right - gap - 1;
+    assert(k >= 0 && k < self->num_loci);
+    head = MSP_NULL_SEGMENT;
+    if (msp_has_overlap_index(self)) {
+        /* The ancestor containing y loses material, so we take it out of
+         * the overlap index until the split is done. */
+        head = y;
+        while (S[head].prev != MSP_NULL_SEGMENT) {
+            head = S[head].prev;
+        }
+        msp_remove_overlap_index(self, head);
+    }
+    if (S[y].left < k) {
+        z = msp_alloc_segment(self, (uint32_t) k, S[y].right, S[y].value,
+                S[y].population_id, MSP_NULL_SEGMENT, S[y].next);
+        if (z == MSP_NULL_SEGMENT) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        S = self->segments;
+        if (S[y].next != MSP_NULL_SEGMENT) {
+            S[S[y].next].prev = z;
+        }
+        S[y].next = MSP_NULL_SEGMENT;
+        S[y].right = (uint32_t) k;
+        fenwick_increment(&self->links, y, k - S[z].right);
+        if (!btree_search(&self->breakpoints, (uint32_t) k, &pos)) {
+            ret = msp_insert_breakpoint(self, (uint32_t) k);
+            if (ret != 0) {
+                goto out;
+            }
+        } else {
+            self->num_multiple_re_events++;
+        }
+    } else {
+        assert(x != MSP_NULL_SEGMENT);
+        S[x].next = MSP_NULL_SEGMENT;
+        S[y].prev = MSP_NULL_SEGMENT;
+        z = y;
+        self->num_trapped_re_events++;
+    }
+    fenwick_set_value(&self->links, z, S[z].right - S[z].left - 1);
+    if (head != MSP_NULL_SEGMENT) {
+        ret = msp_insert_overlap_index(self, head);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    ret = msp_insert_individual(self, z);
+out:
+    return ret;
+}
+
+/*
+ * Segments are indexed directly in S here for speed. Allocating a segment
+ * may move the segment array, so S must be reloaded after every call to
+ * msp_alloc_segment.
+ */
+static int WARN_UNUSED
+msp_merge_two_ancestors(msp_t *self, uint32_t population_id, uint32_t a,
+        uint32_t b)
+{
+    int ret = 0;
+    int coalescence = 0;
+    int defrag_required = 0;
+    bool found;
+    uint32_t v, l, r, l_min, r_max, count, *children;
+    uint32_t x, y, z, alpha, beta, head;
+    btree_position_t pos;
+    segment_t *S = self->segments;
+    MSP_PROFILE_DECLARE(start);
+
+    x = a;
+    y = b;
+    head = MSP_NULL_SEGMENT;
+    /* Keep GCC happy */
+    l_min = 0;
+    r_max = 0;
+
+    /* update num_links and get ready for loop */
+    z = MSP_NULL_SEGMENT;
+    while (x != MSP_NULL_SEGMENT || y != MSP_NULL_SEGMENT) {
+        alpha = MSP_NULL_SEGMENT;
+        if (x == MSP_NULL_SEGMENT || y == MSP_NULL_SEGMENT) {
+            if (x != MSP_NULL_SEGMENT) {
+                alpha = x;
+                x = MSP_NULL_SEGMENT;
+            }
+            if (y != MSP_NULL_SEGMENT) {
+                alpha = y;
+                y = MSP_NULL_SEGMENT;
+            }
+        } else {
+            if (S[y].left < S[x].left) {
+                beta = x;
+                x = y;
+                y = beta;
+            }
+            if (S[x].right <= S[y].left) {
+                alpha = x;
+                x = S[x].next;
+                S[alpha].next = MSP_NULL_SEGMENT;
+            } else if (S[x].left != S[y].left) {
+                alpha = msp_alloc_segment(self, S[x].left, S[y].left,
+                        S[x].value, S[x].population_id, MSP_NULL_SEGMENT,
+                        MSP_NULL_SEGMENT);
+                if (alpha == MSP_NULL_SEGMENT) {
+                    ret = MSP_ERR_NO_MEMORY;
+                    goto out;
+                }
+                S = self->segments;
+                S[x].left = S[y].left;
+            } else {
+                l = S[x].left;
+                r_max = GSL_MIN(S[x].right, S[y].right);
+                if (!coalescence) {
+                    coalescence = 1;
+                    l_min = l;
+                    self->next_node++;
+                    /* Check for overflow */
+                    assert(self->next_node != 0);
+                }
+                v = self->next_node - 1;
+                MSP_PROFILE_START(start);
+                /* Insert overlap counts for bounds, if necessary */
+                if (!btree_search(&self->overlap_counts, l, &pos)) {
+                    ret = msp_copy_overlap_count(self, l);
+                    if (ret < 0) {
+                        goto out;
+                    }
+                }
+                if (!btree_search(&self->overlap_counts, r_max, &pos)) {
+                    ret = msp_copy_overlap_count(self, r_max);
+                    if (ret < 0) {
+                        goto out;
+                    }
+                }
+                /* Now get overlap count at the left */
+                found = btree_search(&self->overlap_counts, l, &pos);
+                assert(found);
+                count = btree_get_value(&self->overlap_counts, &pos);
+                if (count == 2) {
+                    btree_set_value(&self->overlap_counts, &pos, 0);
+                    found = btree_next(&self->overlap_counts, &pos);
+                    assert(found);
+                    r = btree_get_key(&self->overlap_counts, &pos);
+                    MSP_PROFILE_STOP(self, merge_overlap_count_time, start);
+                } else {
+                    r = l;
+                    while (count != 2 && r < r_max) {
+                        btree_set_value(&self->overlap_counts, &pos, count - 1);
+                        found = btree_next(&self->overlap_counts, &pos);
+                        assert(found);
+                        count = btree_get_value(&self->overlap_counts, &pos);
+                        r = btree_get_key(&self->overlap_counts, &pos);
+                    }
+                    MSP_PROFILE_STOP(self, merge_overlap_count_time, start);
+                    alpha = msp_alloc_segment(self, l, r, v, population_id,
+                            MSP_NULL_SEGMENT, MSP_NULL_SEGMENT);
+                    if (alpha == MSP_NULL_SEGMENT) {
+                        ret = MSP_ERR_NO_MEMORY;
+                        goto out;
+                    }
+                    S = self->segments;
+                }
+                ret = msp_alloc_children(self, 2, &children);
+                if (ret != 0) {
+                    goto out;
+                }
+                children[0] = S[x].value;
+                children[1] = S[y].value;
+                ret = msp_record_coalescence(self, l, r, 2, children, v,
+                        population_id);
+                if (ret != 0) {
+                    goto out;
+                }
+                /* Trim the ends of x and y, and prepare for next iteration. */
+                if (S[x].right == r) {
+                    beta = x;
+                    x = S[x].next;
+                    msp_free_segment(self, beta);
+                } else {
+                    S[x].left = r;
+                }
+                if (S[y].right == r) {
+                    beta = y;
+                    y = S[y].next;
+                    msp_free_segment(self, beta);
+                } else {
+                    S[y].left = r;
+                }
+            }
+        }
+        if (alpha != MSP_NULL_SEGMENT) {
+            if (z == MSP_NULL_SEGMENT) {
+                head = alpha;
+                fenwick_set_value(&self->links, alpha,
+                        S[alpha].right - S[alpha].left - 1);
+            } else {
+                defrag_required |= S[z].right == S[alpha].left
+                    && S[z].value == S[alpha].value;
+                S[z].next = alpha;
+                fenwick_set_value(&self->links, alpha,
+                        S[alpha].right - S[z].right);
+            }
+            S[alpha].prev = z;
+            z = alpha;
+        }
+    }
+    if (defrag_required) {
+        MSP_PROFILE_START(start);
+        ret = msp_defrag_segment_chain(self, z);
+        MSP_PROFILE_STOP(self, merge_defrag_time, start);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    /* We insert the new ancestor once its chain is complete, so that
+     * the overlap index sees all of its material. */
+    if (head != MSP_NULL_SEGMENT) {
+        ret = msp_insert_individual(self, head);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    if (coalescence) {
+        MSP_PROFILE_START(start);
+        ret = msp_conditional_compress_overlap_counts(self, l_min, r_max);
+        MSP_PROFILE_STOP(self, merge_compress_time, start);
+        if (ret != 0) {
+            goto out;
+        }
+
+    }
+out:
+    return ret;
+}
+
+/*
+ * Merges the specified ancestors when no recombination can occur. Both are
+ * single segments over [0, num_loci), so they always coalesce over the
+ * whole sequence; we record the coalescence directly and reuse x as the
+ * segment for the new node, rather than working through the overlap counts
+ * segment by segment as msp_merge_two_ancestors does. The state is left
+ * exactly as msp_merge_two_ancestors would leave it. The caller must have
+ * removed x and y from the population without updating its rates.
+ *
+ * This is a fast path for the merge step only: lineages are still segments
+ * in the segment heap, and the rest of the simulation (the links tree,
+ * overlap counts and breakpoints) is shared with the general case.
+ * TODO a separate engine working on plain node arrays, with no segment
+ * heap, would remove the remaining per-lineage overhead for ms-style
+ * workloads with many r = 0 replicates.
+ */
+static int WARN_UNUSED
+msp_merge_two_single_locus_ancestors(msp_t *self, uint32_t population_id,
+        uint32_t a, uint32_t b)
+{
+    int ret = 0;
+    bool found;
+    uint32_t v, count, *children;
+    btree_position_t pos;
+    segment_t *x = msp_get_segment(self, a);
+    segment_t *y = msp_get_segment(self, b);
+
+    assert(x->left == 0 && x->right == self->num_loci);
+    assert(x->next == MSP_NULL_SEGMENT);
+    assert(y->left == 0 && y->right == self->num_loci);
+    assert(y->next == MSP_NULL_SEGMENT);
+    v = self->next_node;
+    self->next_node++;
+    /* Check for overflow */
+    assert(self->next_node != 0);
+    ret = msp_alloc_children(self, 2, &children);
+    if (ret != 0) {
+        goto out;
+    }
+    children[0] = GSL_MIN(x->value, y->value);
+    children[1] = GSL_MAX(x->value, y->value);
+    ret = msp_record_coalescence(self, 0, self->num_loci, 2, children, v,
+            population_id);
+    if (ret != 0) {
+        goto out;
+    }
+    msp_free_segment(self, b);
+    /* The first overlap count covers the whole sequence, and we've reached
+     * the MRCA when it drops to one. */
+    found = btree_first(&self->overlap_counts, &pos);
+    assert(found && btree_get_key(&self->overlap_counts, &pos) == 0);
+    count = btree_get_value(&self->overlap_counts, &pos);
+    if (count == 2) {
+        btree_set_value(&self->overlap_counts, &pos, 0);
+        msp_free_segment(self, a);
+        msp_update_population_rates(self, population_id);
+    } else {
+        btree_set_value(&self->overlap_counts, &pos, count - 1);
+        x->value = v;
+        ret = msp_insert_individual(self, a);
+    }
+out:
+    return ret;
+}
+
+/*
+ * Chooses a pair of ancestors in the specified population that can
+ * coalesce under the SMC or SMC', uniformly from all such pairs, and
+ * returns their indexes in the population's ancestors. When a reasonable
+ * fraction of pairs can coalesce, a few uniformly chosen pairs will find
+ * one quickly; if n tries fail we choose directly from the left index.
+ * Every pair (u, w) that can coalesce, with u before w in the left index,
+ * has w in the range of lineages starting after u and no later than the
+ * end of u (less min_overlap).
+ *
+ * A call draws at most n random pairs, and walks the left index at most
+ * once. The walk makes a rank query for each lineage, and so takes
+ * O(n log n) time. It is only needed when all n draws fail, which happens
+ * with probability at most exp(-qn), where q is the fraction of the
+ * n(n - 1) / 2 pairs that can coalesce. The expected cost of a call is
+ * therefore O(min(1 / q, n) + exp(-qn) n log n), which is never more than
+ * O(n log n). Drawing the pair in O(log n) time would need the number of
+ * partners of each lineage in an index ordered by left coordinate, but
+ * inserting a lineage changes the counts of all lineages that it
+ * overlaps, and the AVL trees cannot apply such range updates.
+ */
+static void
+msp_choose_overlapping_pair(msp_t *self, uint32_t population_id,
+        uint32_t *first, uint32_t *second)
+{
+    population_t *pop = &self->populations[population_id];
+    lineage_set_t *ancestors = &pop->ancestors;
+    uint32_t n = (uint32_t) lineage_set_get_size(ancestors);
+    uint32_t j, k, l, u, w;
+    uint64_t r, index, num_after;
+    avl_node_t *node;
+
+    assert(pop->num_overlapping_pairs > 0);
+    for (l = 0; l < n; l++) {
+        self->num_overlapping_pair_draws++;
+        j = (uint32_t) msp_uniform_int(self, n);
+        k = (uint32_t) msp_uniform_int(self, n - 1);
+        if (k >= j) {
+            k++;
+        }
+        if (msp_lineages_overlap(self, lineage_set_get_item(ancestors, j),
+                    lineage_set_get_item(ancestors, k))) {
+            goto out;
+        }
+    }
+    r = (uint64_t) (msp_uniform(self) * (double) pop->num_overlapping_pairs);
+    r = GSL_MIN(r, pop->num_overlapping_pairs - 1);
+    self->num_overlapping_pair_walks++;
+    index = 0;
+    for (node = pop->left_index.head; node != NULL; node = node->next) {
+        u = (uint32_t) *((uint64_t *) node->item);
+        num_after = msp_overlap_index_rank(&pop->left_index,
+                (uint64_t) ((int64_t) self->lineage_ends[u]
+                    - msp_get_min_overlap(self) + 1)) - index - 1;
+        if (r < num_after) {
+            break;
+        }
+        r -= num_after;
+        index++;
+    }
+    assert(node != NULL);
+    node = avl_at(&pop->left_index, (unsigned int) (index + 1 + r));
+    assert(node != NULL);
+    w = (uint32_t) *((uint64_t *) node->item);
+    assert(msp_lineages_overlap(self, u, w));
+    /* This is linear time, but so is the search above */
+    j = n;
+    k = n;
+    for (l = 0; l < n; l++) {
+        if (lineage_set_get_item(ancestors, l) == u) {
+            j = l;
+        } else if (lineage_set_get_item(ancestors, l) == w) {
+            k = l;
+        }
+    }
+    assert(j < n && k < n);
+out:
+    *first = j;
+    *second = k;
+}
+
+static int WARN_UNUSED
+msp_common_ancestor_event(msp_t *self, uint32_t population_id)
+{
+    int ret = 0;
+    uint32_t j, k, n;
+    lineage_set_t *ancestors;
+    uint32_t x, y;
+
+    ancestors = &self->populations[population_id].ancestors;
+    if (msp_has_overlap_index(self)) {
+        /* For the SMC and SMC' we only choose from the pairs that can
+         * coalesce, and the event rate is adjusted accordingly. */
+        msp_choose_overlapping_pair(self, population_id, &j, &k);
+    } else {
+        /* Choose x and y. We choose k from the n - 1 lineages other than
+         * j, so that the pair is uniformly distributed without removing x
+         * first. */
+        n = (uint32_t) lineage_set_get_size(ancestors);
+        j = (uint32_t) msp_uniform_int(self, n);
+        k = (uint32_t) msp_uniform_int(self, n - 1);
+        if (k >= j) {
+            k++;
+        }
+    }
+    x = lineage_set_get_item(ancestors, j);
+    y = lineage_set_get_item(ancestors, k);
+
+    self->num_ca_events++;
+    if (msp_is_single_locus(self)) {
+        /* The population's rates are updated once the merge is done. */
+        lineage_set_remove(ancestors, GSL_MAX(j, k));
+        lineage_set_remove(ancestors, GSL_MIN(j, k));
+        ret = msp_merge_two_single_locus_ancestors(self, population_id, x, y);
+    } else {
+        /* Remove the larger index first so that the smaller is not moved */
+        msp_remove_individual(self, population_id, GSL_MAX(j, k));
+        msp_remove_individual(self, population_id, GSL_MIN(j, k));
+        ret = msp_merge_two_ancestors(self, population_id, x, y);
+    }
+    return ret;
+}
+
+/*
+ * Returns size bytes of scratch memory, which is released at the end of
+ * the current event, or NULL if we are out of memory.
+ */
+static void *
+msp_scratch_alloc(msp_t *self, size_t size)
+{
+    void *ret;
+    size_t memory_size = scratch_get_memory_size(&self->scratch);
+
+    ret = scratch_alloc(&self->scratch, size);
+    self->used_memory += scratch_get_memory_size(&self->scratch) - memory_size;
+    if (self->used_memory > self->max_memory) {
+        ret = NULL;
+    }
+    return ret;
+}
+
+/*
+ * Inserts the specified segment into the segment queue. Segments are
+ * ordered by left coordinate, with ties broken by index.
+ */
+static int WARN_UNUSED
+msp_priority_queue_insert(msp_t *self, uint32_t u)
+{
+    int ret = 0;
+
+    assert(u != MSP_NULL_SEGMENT);
+    if (priority_queue_is_full(&self->segment_queue)) {
+        ret = msp_expand_segment_queue(self);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    priority_queue_push(&self->segment_queue,
+            ((uint64_t) msp_get_segment(self, u)->left << 32) | u);
+out:
+    return ret;
+}
+
+/* Merge the ancestors in the segment queue into a single ancestor. This is
+ * a generalisation of the msp_common_ancestor_event method where we allow
+ * any number of ancestors to merge. As in msp_merge_two_ancestors, S must
+ * be reloaded after every call to msp_alloc_segment.
+ */
+static int WARN_UNUSED
+msp_merge_ancestors(msp_t *self, uint32_t population_id)
+{
+    int ret = MSP_ERR_GENERIC;
+    int coalescence = 0;
+    int defrag_required = 0;
+    bool found;
+    uint32_t j, l, r, h, r_max, next_l, l_min, v, count, *children;
+    uint32_t x, z, alpha, beta;
+    bool more;
+    btree_position_t pos;
+    segment_t *S = self->segments;
+    priority_queue_t *Q = &self->segment_queue;
+    uint32_t *H;
+
+    assert(self->model == MSP_MODEL_HUDSON);
+    /* Each segment we pop is replaced by at most one, so the queue never
+     * holds more segments than it does now. */
+    H = msp_scratch_alloc(self, priority_queue_get_size(Q) * sizeof(uint32_t));
+    if (H == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    l_min = 0;
+    z = MSP_NULL_SEGMENT;
+    while (priority_queue_get_size(Q) > 0) {
+        /* Pop all the segments with the smallest left coordinate into H. */
+        h = 0;
+        l = (uint32_t) (priority_queue_peek(Q) >> 32);
+        r_max = self->num_loci;
+        more = true;
+        while (more) {
+            H[h] = (uint32_t) priority_queue_pop(Q);
+            r_max = GSL_MIN(r_max, S[H[h]].right);
+            h++;
+            more = priority_queue_get_size(Q) > 0
+                && (uint32_t) (priority_queue_peek(Q) >> 32) == l;
+        }
+        more = priority_queue_get_size(Q) > 0;
+        next_l = 0;
+        if (more) {
+            next_l = (uint32_t) (priority_queue_peek(Q) >> 32);
+            r_max = GSL_MIN(r_max, next_l);
+        }
+        alpha = MSP_NULL_SEGMENT;
+        if (h == 1) {
+            x = H[0];
+            if (more && next_l < S[x].right) {
+                alpha = msp_alloc_segment(self, S[x].left, next_l, S[x].value,
+                        S[x].population_id, MSP_NULL_SEGMENT,
+                        MSP_NULL_SEGMENT);
+                if (alpha == MSP_NULL_SEGMENT) {
+                    ret = MSP_ERR_NO_MEMORY;
+                    goto out;
+                }
+                S = self->segments;
+                S[x].left = next_l;
+            } else {
+                alpha = x;
+                x = S[x].next;
+                S[alpha].next = MSP_NULL_SEGMENT;
+            }
+            if (x != MSP_NULL_SEGMENT) {
+                ret = msp_priority_queue_insert(self, x);
+                if (ret != 0) {
+                    goto out;
+                }
+            }
+        } else {
+            if (!coalescence) {
+                coalescence = 1;
+                l_min = l;
+                self->next_node++;
+                /* Check for overflow */
+                assert(self->next_node != 0);
+            }
+            v = self->next_node - 1;
+            /* Insert overlap counts for bounds, if necessary */
+            if (!btree_search(&self->overlap_counts, l, &pos)) {
+                ret = msp_copy_overlap_count(self, l);
+                if (ret < 0) {
+                    goto out;
+                }
+            }
+            if (!btree_search(&self->overlap_counts, r_max, &pos)) {
+                ret = msp_copy_overlap_count(self, r_max);
+                if (ret < 0) {
+                    goto out;
+                }
+            }
+            /* Update the extant segments and allocate alpha if the interval
+             * has not coalesced. */
+            found = btree_search(&self->overlap_counts, l, &pos);
+            assert(found);
+            count = btree_get_value(&self->overlap_counts, &pos);
+            if (count == h) {
+                btree_set_value(&self->overlap_counts, &pos, 0);
+                found = btree_next(&self->overlap_counts, &pos);
+                assert(found);
+                r = btree_get_key(&self->overlap_counts, &pos);
+            } else {
+                r = l;
+                while (count != h && r < r_max) {
+                    btree_set_value(&self->overlap_counts, &pos,
+                            count - (h - 1));
+                    found = btree_next(&self->overlap_counts, &pos);
+                    assert(found);
+                    count = btree_get_value(&self->overlap_counts, &pos);
+                    r = btree_get_key(&self->overlap_counts, &pos);
+                }
+                alpha = msp_alloc_segment(self, l, r, v, population_id,
+                        MSP_NULL_SEGMENT, MSP_NULL_SEGMENT);
+                if (alpha == MSP_NULL_SEGMENT) {
+                    ret = MSP_ERR_NO_MEMORY;
+                    goto out;
+                }
+                S = self->segments;
+            }
+            /* Create the record and update the priority queue */
+            ret = msp_alloc_children(self, h, &children);
+            if (ret != 0) {
+                goto out;
+            }
+            for (j = 0; j < h; j++) {
+                x = H[j];
+                children[j] = S[x].value;
+                if (S[x].right == r) {
+                    beta = x;
+                    x = S[x].next;
+                    msp_free_segment(self, beta);
+                } else if (S[x].right > r) {
+                    S[x].left = r;
+                }
+                if (x != MSP_NULL_SEGMENT) {
+                    ret = msp_priority_queue_insert(self, x);
+                    if (ret != 0) {
+                        goto out;
+                    }
+                }
+            }
+            ret = msp_record_coalescence(self, l, r, h, children, v,
+                    population_id);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        /* Loop tail; integrate alpha into the global state */
+        if (alpha != MSP_NULL_SEGMENT) {
+            if (z == MSP_NULL_SEGMENT) {
+                ret = msp_insert_individual(self, alpha);
+                if (ret != 0) {
+                    goto out;
+                }
+                fenwick_set_value(&self->links, alpha,
+                        S[alpha].right - S[alpha].left - 1);
+            } else {
+                defrag_required |=
+                    S[z].right == S[alpha].left && S[z].value == S[alpha].value;
+                S[z].next = alpha;
+                fenwick_set_value(&self->links, alpha,
+                        S[alpha].right - S[z].right);
+            }
+            S[alpha].prev = z;
+            z = alpha;
+        }
+    }
+    if (defrag_required) {
+        ret = msp_defrag_segment_chain(self, z);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    if (coalescence) {
+        ret = msp_conditional_compress_overlap_counts(self, l_min, r_max);
+        if (ret != 0) {
+            goto out;
+        }
+
+    }
+    ret = 0;
+out:
+    priority_queue_clear(Q);
+    return ret;
+}
+
+static int WARN_UNUSED
+msp_migration_event(msp_t *self, size_t entry)
+{
+    int ret = 0;
+    size_t j;
+    uint32_t source_pop = self->migration_matrix.source[entry];
+    uint32_t dest_pop = self->migration_matrix.dest[entry];
+    lineage_set_t *source = &self->populations[source_pop].ancestors;
+
+    self->num_migration_events[entry]++;
+    j = msp_uniform_int(self, lineage_set_get_size(source));
+    ret = msp_move_individual(self, source_pop, j, dest_pop);
+    return ret;
+}
+
+
+/* Frees the segments of all ancestral lineages. */
+static void
+msp_free_ancestors(msp_t *self)
+{
+    population_t *pop;
+    uint32_t u, v;
+    size_t j, k;
+
+    for (j = 0; j < self->num_populations; j++) {
+        pop = &self->populations[j];
+        for (k = 0; k < lineage_set_get_size(&pop->ancestors); k++) {
+            u = lineage_set_get_item(&pop->ancestors, k);
+            while (u != MSP_NULL_SEGMENT) {
+                v = msp_get_segment(self, u)->next;
+                msp_free_segment(self, u);
+                u = v;
+            }
+        }
+        lineage_set_clear(&pop->ancestors);
+    }
+    msp_clear_overlap_index(self);
+}
+
+static int WARN_UNUSED
+msp_reset_memory_state(msp_t *self)
+{
+    int ret = 0;
+    size_t j;
+
+    msp_free_ancestors(self);
+    /* Rebuild the free list so that segments are allocated in the same
+     * order as in a new simulator. Segment indexes determine the outcome
+     * of the searches in the links Fenwick tree, so otherwise a replicate
+     * would depend on the replicates run before it. */
+    assert(self->num_segments == 0);
+    self->free_segment = MSP_NULL_SEGMENT;
+    for (j = self->max_segments; j > 1; j--) {
+        self->segments[j - 1].next = self->free_segment;
+        self->free_segment = (uint32_t) (j - 1);
+    }
+    btree_clear(&self->breakpoints);
+    btree_clear(&self->overlap_counts);
+    priority_queue_clear(&self->segment_queue);
+    scratch_reset(&self->scratch);
+    /* Variates drawn for the previous replicate are not reused */
+    rng_buffer_clear(&self->variates);
+    self->coalescence_records.num_records = 0;
+    self->coalescence_records.num_children_total = 0;
+    return ret;
+}
+
+static int WARN_UNUSED
+msp_insert_sample(msp_t *self, uint32_t sample, uint32_t population)
+{
+    int ret = MSP_ERR_GENERIC;
+    uint32_t u;
+
+    u = msp_alloc_segment(self, 0, self->num_loci, sample, population,
+            MSP_NULL_SEGMENT, MSP_NULL_SEGMENT);
+    if (u == MSP_NULL_SEGMENT) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    ret = msp_insert_individual(self, u);
+    if (ret != 0) {
+        goto out;
+    }
+    fenwick_set_value(&self->links, u, self->num_loci - 1);
+out:
+    return ret;
+}
+
+int
+msp_reset(msp_t *self)
+{
+    int ret = 0;
+    uint32_t j, population_id;
+    population_t *pop, *initial_pop;
+    size_t N = self->num_populations;
+
+    ret = msp_reset_memory_state(self);
+    if (ret != 0) {
+        goto out;
+    }
+    /* Set up the initial segments and algorithm state */
+    for (population_id = 0; population_id < N; population_id++) {
+        pop = &self->populations[population_id];
+        assert(lineage_set_get_size(&pop->ancestors) == 0);
+        /* Set the initial population parameters */
+        initial_pop = &self->initial_populations[population_id];
+        pop->growth_rate = initial_pop->growth_rate;
+        pop->initial_size = initial_pop->initial_size;
+        pop->start_time = 0.0;
+        pop->num_overlapping_pairs = 0;
+    }
+    /* Set up the sample */
+    for (j = 0; j < self->sample_size; j++) {
+        if (self->samples[j].time == 0.0) {
+            ret = msp_insert_sample(self, j, self->samples[j].population_id);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+    }
+    self->next_node = self->sample_size;
+    self->next_demographic_event = self->demographic_events_head;
+    ret = migration_matrix_copy_rates(&self->migration_matrix,
+            &self->initial_migration_matrix);
+    if (ret != 0) {
+        goto out;
+    }
+    msp_reset_event_rates(self);
+    ret = msp_insert_overlap_count(self, 0, self->sample_size);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_insert_overlap_count(self, self->num_loci,
+            self->sample_size + 1);
+    if (ret != 0) {
+        goto out;
+    }
+    self->time = 0.0;
+    self->next_sampling_event = 0;
+    self->num_flushed_coalescence_records = 0;
+    if (self->coalescence_record_spill_file != NULL) {
+        if (fseek(self->coalescence_record_spill_file, 0, SEEK_SET) != 0) {
+            ret = MSP_ERR_IO;
+            goto out;
+        }
+    }
+    self->num_re_events = 0;
+    self->num_ca_events = 0;
+    self->num_rejected_ca_events = 0;
+    self->num_overlapping_pair_draws = 0;
+    self->num_overlapping_pair_walks = 0;
+    self->num_trapped_re_events = 0;
+    self->num_multiple_re_events = 0;
+    memset(&self->profile, 0, sizeof(msp_profile_t));
+    memset(self->num_migration_events, 0,
+            migration_matrix_get_num_entries(&self->migration_matrix)
+            * sizeof(size_t));
+    self->state = MSP_STATE_INITIALISED;
+out:
+    return ret;
+}
+
+/*
+ * Sets up the memory heaps, initial population and trees.
+ */
+int WARN_UNUSED
+msp_initialise(msp_t *self)
+{
+    int ret = -1;
+    uint32_t j;
+
+    /* These should really be proper checks with a return value */
+    assert(self->sample_size > 1);
+    assert(self->num_loci >= 1);
+    assert(self->num_populations >= 1);
+
+    ret = msp_alloc_memory_blocks(self);
+    if (ret != 0) {
+        goto out;
+    }
+    /* First check that the sample configuration makes sense */
+    for (j = 0; j < self->sample_size; j++) {
+        if (self->samples[j].population_id >= self->num_populations) {
+            ret = MSP_ERR_BAD_SAMPLES;
+            goto out;
+        }
+    }
+    ret = msp_reset(self);
+    if (ret != 0) {
+        goto out;
+    }
+out:
+    return ret;
+}
+
+/*
+ * Returns the waiting time until the next common ancestor event in the
+ * specified population, where lambda is the number of ordered pairs of
+ * lineages that can coalesce.
+ */
+static double
+msp_get_common_ancestor_waiting_time_pairs(msp_t *self, population_t *pop,
+        double lambda)
+{
+    double ret = DBL_MAX;
+    double alpha = pop->growth_rate;
+    double t = self->time;
+    double u, dt, z;
+
+    if (lambda > 0.0) {
+        u = msp_exponential(self, 1.0 / lambda);
+        if (alpha == 0.0) {
+            ret = pop->initial_size * u;
+        } else {
+            dt = t - pop->start_time;
+            z = 1 + alpha * pop->initial_size * exp(-alpha * dt) * u;
+            /* if z is <= 0 no coancestry can occur */
+            if (z > 0) {
+                ret = log(z) / alpha;
+            }
+        }
+    }
+    return ret;
+}
+
+static double
+msp_get_common_ancestor_waiting_time_size(msp_t *self, population_t *pop,
+        uint32_t size)
+{
+    /* Need to perform n * (n - 1) as a double due to overflow */
+    double n = (double) size;
+
+    return msp_get_common_ancestor_waiting_time_pairs(self, pop, n * (n - 1.0));
+}
+
+static double
+msp_get_common_ancestor_waiting_time(msp_t *self, uint32_t population_id)
+{
+    population_t *pop = &self->populations[population_id];
+
+    return msp_get_common_ancestor_waiting_time_pairs(self, pop,
+            msp_get_num_ca_pairs(self, pop));
+}
+
+static int WARN_UNUSED
+msp_sanity_check(msp_t *self, int64_t num_links)
+{
+    int ret = 0;
+    size_t n = msp_get_num_ancestors(self);
+
+    /* TODO there are various worries when we're dealing with very
+     * large population sizes and numbers of links. For example,
+     * what if n is too big for the gsl integer random generator?
+     * To at least determine if these are real things to worry
+     * about, we put in some arbitrary (and hopefully safe) limits
+     * and see if they are ever hit in practise.
+     */
+    if (n >= UINT32_MAX / 8) {
+        ret = MSP_ERR_POPULATION_OVERFLOW;
+        goto out;
+    }
+    if (num_links >= INT64_MAX / 8) {
+        ret = MSP_ERR_LINKS_OVERFLOW;
+        goto out;
+    }
+out:
+    return ret;
+}
+
+static int WARN_UNUSED
+msp_apply_demographic_events(msp_t *self)
+{
+    int ret = 0;
+    demographic_event_t *event;
+
+    assert(self->next_demographic_event != NULL);
+    /* Process all events with equal time in one block. */
+    self->time = self->next_demographic_event->time;
+    while (self->next_demographic_event != NULL
+            && self->next_demographic_event->time == self->time) {
+        /* We skip ahead to the start time for the next demographic
+         * event, and use its change_state method to update the
+         * state of the simulation.
+         */
+        event = self->next_demographic_event;
+        assert(event->change_state != NULL);
+        ret = event->change_state(self, event);
+        if (ret != 0) {
+            goto out;
+        }
+        self->next_demographic_event = event->next;
+    }
+    msp_reset_event_rates(self);
+out:
+    return ret;
+}
+
+/*
+ * Performs the event corresponding to a channel chosen from the event
+ * rates tree in proportion to its rate.
+ */
+static int WARN_UNUSED
+msp_rate_tree_event(msp_t *self, double total_rate)
+{
+    int ret = 0;
+    uint32_t N = self->num_populations;
+    uint32_t source_pop;
+    size_t entry;
+    size_t channel = rate_tree_find(&self->event_rates,
+            msp_uniform(self) * total_rate);
+    MSP_PROFILE_DECLARE(start);
+
+    MSP_PROFILE_START(start);
+    if (channel == 0) {
+        ret = msp_recombination_event(self);
+        MSP_PROFILE_STOP(self, recombination_time, start);
+    } else if (channel <= N) {
+        ret = msp_common_ancestor_event(self, (uint32_t) channel - 1);
+        MSP_PROFILE_STOP(self, common_ancestor_time, start);
+    } else {
+        /* m[j, k] is the rate at which migrants move from population k
+         * to j forwards in time. Backwards in time, we move the individual
+         * from from population j into population k.
+         */
+        source_pop = (uint32_t) channel - N - 1;
+        entry = migration_matrix_find(&self->migration_matrix, source_pop,
+                msp_uniform(self) * migration_matrix_get_row_sum(
+                    &self->migration_matrix, source_pop));
+        ret = msp_migration_event(self, entry);
+        MSP_PROFILE_STOP(self, migration_time, start);
+    }
+    return ret;
+}
+
+/*
+ * The sequential engine. Rather than simulating back in time over the whole
+ * sequence, this simulates the SMC or SMC' from left to right along it,
+ * keeping only the marginal tree at the current position. The distance to
+ * the next recombination is exponential with rate proportional to the total
+ * branch length of the tree. At a recombination the lineage above a point
+ * chosen uniformly on the tree is detached and coalesces back into the tree
+ * at a time drawn from the number of branches at each time. Under the SMC'
+ * it may coalesce back into the branch it was detached from, in which case
+ * the tree does not change. The work is therefore linear in the sequence
+ * length, and the memory needed is bounded by one tree and the output.
+ *
+ * The coalescence record of a node is ended whenever its children change.
+ * Records are generated in sequence order, and are sorted into time order
+ * and their nodes renumbered when the simulation completes. Only a single
+ * population of constant size without demographic events is supported.
+ */
+
+static int WARN_UNUSED
+msp_sequential_check(msp_t *self)
+{
+    int ret = 0;
+    population_t *pop = &self->initial_populations[0];
+
+    if (self->model != MSP_MODEL_SMC && self->model != MSP_MODEL_SMC_PRIME) {
+        ret = MSP_ERR_BAD_MODEL;
+        goto out;
+    }
+    if (self->num_populations != 1 || pop->growth_rate != 0.0
+            || self->demographic_events_head != NULL
+            || self->coalescence_record_sink != NULL
+            || self->checkpoint_path != NULL) {
+        ret = MSP_ERR_UNSUPPORTED_OPERATION;
+        goto out;
+    }
+out:
+    return ret;
+}
+
+/* Records the children that node u has had since tree->left[u] up to
+ * right. */
+static int WARN_UNUSED
+msp_sequential_record(msp_t *self, uint32_t u, uint32_t right)
+{
+    int ret = 0;
+    sequential_tree_t *tree = &self->sequential_tree;
+    uint32_t *children;
+
+    if (tree->left[u] < right) {
+        ret = msp_alloc_children(self, 2, &children);
+        if (ret != 0) {
+            goto out;
+        }
+        children[0] = tree->id[tree->children[2 * u]];
+        children[1] = tree->id[tree->children[2 * u + 1]];
+        self->time = tree->time[u];
+        ret = msp_record_coalescence(self, tree->left[u], right, 2,
+                children, tree->id[u], 0);
+        if (ret != 0) {
+            goto out;
+        }
+        tree->left[u] = right;
+    }
+out:
+    return ret;
+}
+
+static void
+msp_sequential_replace_child(msp_t *self, uint32_t u, uint32_t child,
+        uint32_t replacement)
+{
+    sequential_tree_t *tree = &self->sequential_tree;
+
+    if (tree->children[2 * u] == child) {
+        tree->children[2 * u] = replacement;
+    } else {
+        assert(tree->children[2 * u + 1] == child);
+        tree->children[2 * u + 1] = replacement;
+    }
+}
+
+/* Makes a new internal node in slot w at the current time, with children
+ * a and b. */
+static void
+msp_sequential_set_node(msp_t *self, uint32_t w, uint32_t a, uint32_t b,
+        uint32_t left)
+{
+    sequential_tree_t *tree = &self->sequential_tree;
+
+    tree->children[2 * w] = a;
+    tree->children[2 * w + 1] = b;
+    tree->parent[a] = w;
+    tree->parent[b] = w;
+    tree->time[w] = self->time;
+    tree->id[w] = self->next_node;
+    tree->left[w] = left;
+    self->next_node++;
+}
+
+/* Simulates the tree at the left end of the sequence from the coalescent. */
+static int WARN_UNUSED
+msp_sequential_initialise(msp_t *self)
+{
+    int ret = 0;
+    sequential_tree_t *tree = &self->sequential_tree;
+    population_t *pop = &self->populations[0];
+    uint32_t j, a, b, n = self->sample_size;
+    uint32_t w = n;
+    uint32_t k = 0;
+    size_t next_sampling_event = 0;
+    double t_wait, sampling_event_time;
+
+    ret = msp_sequential_check(self);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_sequential_alloc(self);
+    if (ret != 0) {
+        goto out;
+    }
+    for (j = 0; j < n; j++) {
+        tree->parent[j] = MSP_NULL_NODE;
+        tree->id[j] = j;
+        tree->left[j] = 0;
+        tree->time[j] = self->samples[j].time;
+        tree->sample_times[j] = self->samples[j].time;
+        if (self->samples[j].time == 0.0) {
+            tree->lineages[k] = j;
+            k++;
+        }
+    }
+    qsort(tree->sample_times, n, sizeof(double), cmp_double);
+    while (k > 1 || next_sampling_event < self->num_sampling_events) {
+        t_wait = msp_get_common_ancestor_waiting_time_size(self, pop, k);
+        sampling_event_time = DBL_MAX;
+        if (next_sampling_event < self->num_sampling_events) {
+            sampling_event_time =
+                self->sampling_events[next_sampling_event].time;
+        }
+        if (t_wait >= sampling_event_time - self->time) {
+            self->time = sampling_event_time;
+            tree->lineages[k] =
+                self->sampling_events[next_sampling_event].sample;
+            k++;
+            next_sampling_event++;
+        } else {
+            self->time += t_wait;
+            j = (uint32_t) msp_uniform_int(self, k);
+            a = tree->lineages[j];
+            tree->lineages[j] = tree->lineages[k - 1];
+            k--;
+            j = (uint32_t) msp_uniform_int(self, k);
+            b = tree->lineages[j];
+            tree->lineages[j] = w;
+            msp_sequential_set_node(self, w, a, b, 0);
+            tree->internal_times[w - n] = self->time;
+            w++;
+        }
+    }
+    assert(w == 2 * n - 1);
+    tree->root = tree->lineages[0];
+    tree->parent[tree->root] = MSP_NULL_NODE;
+    tree->position = 0;
+out:
+    return ret;
+}
+
+/* Detaches the lineage above a point chosen uniformly on the tree and
+ * coalesces it back into the tree, recording the changes at breakpoint x.
+ */
+static int WARN_UNUSED
+msp_sequential_recombination_event(msp_t *self, double branch_length,
+        uint32_t x)
+{
+    int ret = 0;
+    sequential_tree_t *tree = &self->sequential_tree;
+    uint32_t n = self->sample_size;
+    uint32_t num_slots = 2 * n - 1;
+    uint32_t u, v, p, q, s, g, k, j;
+    bool smc = self->model == MSP_MODEL_SMC;
+    double size = self->populations[0].initial_size;
+    double target, length, t, t_next, t_wait, t_p;
+    size_t index;
+
+    self->num_re_events++;
+    /* Choose the branch to detach in proportion to its length */
+    target = msp_uniform(self) * branch_length;
+    u = MSP_NULL_NODE;
+    for (v = 0; v < num_slots; v++) {
+        if (v != tree->root) {
+            length = tree->time[tree->parent[v]] - tree->time[v];
+            if (length > 0) {
+                u = v;
+                if (target < length) {
+                    break;
+                }
+                target -= length;
+            }
+        }
+    }
+    assert(u != MSP_NULL_NODE);
+    p = tree->parent[u];
+    t_p = tree->time[p];
+    t = tree->time[u] + msp_uniform(self) * (t_p - tree->time[u]);
+
+    /* Find the time at which the lineage coalesces back into the tree. The
+     * branch above u below t_p is not available under the SMC. */
+    while (true) {
+        k = msp_sequential_num_branches(self, t, &t_next);
+        if (smc && t < t_p) {
+            k--;
+            t_next = GSL_MIN(t_next, t_p);
+        }
+        if (k > 0) {
+            t_wait = msp_exponential(self, size / (2.0 * k));
+            if (t_wait < t_next - t) {
+                t += t_wait;
+                break;
+            }
+        }
+        assert(t_next < DBL_MAX);
+        t = t_next;
+    }
+    self->num_ca_events++;
+    /* Choose one of the k branches at time t */
+    j = (uint32_t) msp_uniform_int(self, k);
+    v = MSP_NULL_NODE;
+    for (q = 0; q < num_slots; q++) {
+        if (tree->time[q] <= t && (q == tree->root
+                    || tree->time[tree->parent[q]] > t)
+                && !(smc && q == u)) {
+            v = q;
+            if (j == 0) {
+                break;
+            }
+            j--;
+        }
+    }
+    if (v == MSP_NULL_NODE) {
+        ret = MSP_ERR_ASSERTION_FAILED;
+        goto out;
+    }
+    if (v == u) {
+        /* The lineage coalesced back into its own branch */
+        self->num_rejected_ca_events++;
+        goto out;
+    }
+    ret = msp_insert_breakpoint(self, x);
+    if (ret != 0) {
+        goto out;
+    }
+    /* Remove p, joining u's sibling s to p's parent g */
+    s = tree->children[2 * p] == u ? tree->children[2 * p + 1]
+        : tree->children[2 * p];
+    g = tree->parent[p];
+    ret = msp_sequential_record(self, p, x);
+    if (ret != 0) {
+        goto out;
+    }
+    if (g == MSP_NULL_NODE) {
+        tree->root = s;
+    } else {
+        ret = msp_sequential_record(self, g, x);
+        if (ret != 0) {
+            goto out;
+        }
+        msp_sequential_replace_child(self, g, p, s);
+    }
+    tree->parent[s] = g;
+    index = msp_sequential_bisect(tree->internal_times, n - 1, t_p) - 1;
+    assert(tree->internal_times[index] == t_p);
+    memmove(tree->internal_times + index, tree->internal_times + index + 1,
+            (n - 2 - index) * sizeof(double));
+    if (v == p) {
+        v = s;
+    }
+    /* Reuse p's slot for the new node above v */
+    q = tree->parent[v];
+    if (q == MSP_NULL_NODE) {
+        tree->root = p;
+    } else {
+        ret = msp_sequential_record(self, q, x);
+        if (ret != 0) {
+            goto out;
+        }
+        msp_sequential_replace_child(self, q, v, p);
+    }
+    self->time = t;
+    msp_sequential_set_node(self, p, u, v, x);
+    tree->parent[p] = q;
+    index = msp_sequential_bisect(tree->internal_times, n - 2, t);
+    memmove(tree->internal_times + index + 1, tree->internal_times + index,
+            (n - 2 - index) * sizeof(double));
+    tree->internal_times[index] = t;
+out:
+    return ret;
+}
+
+static int
+cmp_sequential_record(const void *a, const void *b) {
+    const coalescence_record_t *ia = (const coalescence_record_t *) a;
+    const coalescence_record_t *ib = (const coalescence_record_t *) b;
+    int ret = (ia->time > ib->time) - (ia->time < ib->time);
+
+    if (ret == 0) {
+        ret = (ia->node > ib->node) - (ia->node < ib->node);
+    }
+    if (ret == 0) {
+        ret = (ia->left > ib->left) - (ia->left < ib->left);
+    }
+    return ret;
+}
+
+/* Records the final tree, sorts the records into time order and numbers
+ * the nodes in the order that they appear. The records are copied into
+ * new columns in sorted order. */
+static int WARN_UNUSED
+msp_sequential_finalise(msp_t *self)
+{
+    int ret = 0;
+    uint32_t n = self->sample_size;
+    uint32_t u, c, next_node;
+    uint32_t *node_map = NULL;
+    size_t j, k, num_records;
+    coalescence_record_t *cr;
+    record_columns_t unsorted, tmp;
+    record_columns_t *records = &self->coalescence_records;
+
+    memset(&unsorted, 0, sizeof(unsorted));
+    for (u = n; u < 2 * n - 1; u++) {
+        ret = msp_sequential_record(self, u, self->num_loci);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    num_records = records->num_records;
+    ret = msp_update_coalescence_record_view(self, num_records);
+    if (ret != 0) {
+        goto out;
+    }
+    qsort(self->coalescence_record_view, num_records,
+            sizeof(coalescence_record_t), cmp_sequential_record);
+    node_map = malloc((self->next_node - n) * sizeof(uint32_t));
+    if (node_map == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    for (u = 0; u < self->next_node - n; u++) {
+        node_map[u] = MSP_NULL_NODE;
+    }
+    /* The view points into the unsorted columns, which we keep until the
+     * sorted columns are filled. */
+    unsorted = *records;
+    memset(records, 0, sizeof(record_columns_t));
+    ret = msp_expand_coalescence_records(self, unsorted.max_records,
+            unsorted.max_children_total);
+    if (ret != 0) {
+        goto out;
+    }
+    next_node = n;
+    for (j = 0; j < num_records; j++) {
+        cr = &self->coalescence_record_view[j];
+        if (node_map[cr->node - n] == MSP_NULL_NODE) {
+            node_map[cr->node - n] = next_node;
+            next_node++;
+        }
+        records->left[j] = (uint32_t) cr->left;
+        records->right[j] = (uint32_t) cr->right;
+        records->node[j] = node_map[cr->node - n];
+        records->num_children[j] = cr->num_children;
+        records->population_id[j] = cr->population_id;
+        records->time[j] = cr->time;
+        /* Children are older records, so they have been mapped already */
+        for (k = 0; k < cr->num_children; k++) {
+            c = cr->children[k];
+            if (c >= n) {
+                assert(node_map[c - n] != MSP_NULL_NODE);
+                c = node_map[c - n];
             }
-            alpha->prev = z;
-            z = alpha;
+            records->children[records->num_children_total + k] = c;
         }
-    }
-    if (defrag_required) {
-        ret = msp_defrag_segment_chain(self, z);
+        qsort(records->children + records->num_children_total,
+                cr->num_children, sizeof(uint32_t), cmp_uint32_t);
+        records->num_children_total += cr->num_children;
+        records->num_records++;
+        self->time = cr->time;
+    }
+    self->next_node = next_node;
+    self->next_sampling_event = self->num_sampling_events;
+    msp_free_ancestors(self);
+out:
+    if (unsorted.left != NULL) {
+        /* Free whichever set of columns we are not keeping, and release
+         * its children from the memory accounting. */
         if (ret != 0) {
-            goto out;
+            tmp = *records;
+            *records = unsorted;
+            unsorted = tmp;
         }
+        self->used_memory -= unsorted.max_children_total * sizeof(uint32_t);
+        msp_free_record_columns(&unsorted);
     }
-    if (coalescence) {
-        ret = msp_conditional_compress_overlap_counts(self, l_min, r_max);
-        if (ret != 0) {
-            goto out;
-        }
+    if (node_map != NULL) {
+        free(node_map);
+    }
+    return ret;
+}
+
+/* Runs the sequential engine for at most max_events recombinations. */
+static int WARN_UNUSED
+msp_sequential_run(msp_t *self, unsigned long max_events)
+{
+    int ret = 0;
+    sequential_tree_t *tree = &self->sequential_tree;
+    unsigned long events = 0;
+    uint32_t x;
+    double branch_length, distance;
 
+    if (msp_get_num_ancestors(self) == 0) {
+        goto out;
+    }
+    while (tree->position < self->num_loci && events < max_events) {
+        events++;
+        /* Recombination breakpoints fall between loci. The number of links
+         * to the next breakpoint is geometric. */
+        branch_length = msp_sequential_branch_length(self);
+        x = self->num_loci;
+        if (self->scaled_recombination_rate > 0 && branch_length > 0) {
+            distance = msp_exponential(self,
+                    1.0 / (self->scaled_recombination_rate * branch_length));
+            if (distance < (double) (self->num_loci - tree->position - 1)) {
+                x = tree->position + 1 + (uint32_t) distance;
+            }
+        }
+        if (x < self->num_loci) {
+            ret = msp_sequential_recombination_event(self, branch_length, x);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        tree->position = x;
+    }
+    if (tree->position < self->num_loci) {
+        ret = 1;
+    } else {
+        ret = msp_sequential_finalise(self);
     }
-    ret = 0;
 out:
-    if (H != NULL) {
-        free(H);
+    return ret;
+}
+
+/*
+ * Checkpointing. A checkpoint holds the dynamic state of the simulation in
+ * native byte order, and can only be restored into a simulator with the
+ * same configuration on the same platform. The configuration (samples,
+ * parameters and demographic events) is not stored, but a summary of it is
+ * checked on restore. Coalescence records passed to a sink are not stored,
+ * so checkpointing is not supported when a sink is set.
+ */
+
+#define MSP_CHECKPOINT_MAGIC "MSPCKPT"
+#define MSP_CHECKPOINT_VERSION 2
+#define MSP_CHECKPOINT_RNG_NAME_LENGTH 32
+#define MSP_CHECKPOINT_NUM_CONFIG 9
+#define MSP_CHECKPOINT_NUM_STATE 16
+
+static int WARN_UNUSED
+msp_checkpoint_write(FILE *file, const void *data, size_t size, size_t count)
+{
+    int ret = 0;
+
+    if (fwrite(data, size, count, file) != count) {
+        ret = MSP_ERR_IO;
     }
     return ret;
 }
 
 static int WARN_UNUSED
-msp_migration_event(msp_t *self, uint32_t source_pop, uint32_t dest_pop)
+msp_checkpoint_read(FILE *file, void *data, size_t size, size_t count)
 {
     int ret = 0;
-    uint32_t j;
-    avl_node_t *node;
-    avl_tree_t *source = &self->populations[source_pop].ancestors;
 
-    self->num_migration_events[source_pop * self->num_populations + dest_pop]++;
-    j = (uint32_t) gsl_rng_uniform_int(self->rng, avl_count(source));
-    node = avl_at(source, j);
-    assert(node != NULL);
-    ret = msp_move_individual(self, node, source, dest_pop);
+    if (fread(data, size, count, file) != count) {
+        ret = feof(file) ? MSP_ERR_FILE_FORMAT : MSP_ERR_IO;
+    }
     return ret;
 }
 
+/* Fills in the values that a checkpoint must agree with the simulator on. */
+static void
+msp_get_checkpoint_config(msp_t *self, uint64_t *config, double *rate,
+        char *rng_name)
+{
+    demographic_event_t *de;
+    uint64_t num_demographic_events = 0;
+
+    for (de = self->demographic_events_head; de != NULL; de = de->next) {
+        num_demographic_events++;
+    }
+    config[0] = MSP_CHECKPOINT_VERSION;
+    config[1] = self->sample_size;
+    config[2] = self->num_loci;
+    config[3] = self->num_populations;
+    config[4] = (uint64_t) self->model;
+    config[5] = num_demographic_events;
+    config[6] = migration_matrix_get_num_entries(&self->migration_matrix);
+    config[7] = gsl_rng_size(self->rng);
+    config[8] = self->variates.block_size;
+    *rate = self->scaled_recombination_rate;
+    memset(rng_name, 0, MSP_CHECKPOINT_RNG_NAME_LENGTH);
+    strncpy(rng_name, gsl_rng_name(self->rng),
+            MSP_CHECKPOINT_RNG_NAME_LENGTH - 1);
+}
 
 static int WARN_UNUSED
-msp_reset_memory_state(msp_t *self)
+msp_write_checkpoint(msp_t *self, FILE *file)
 {
     int ret = 0;
-    avl_node_t *node;
-    node_mapping_t *nm;
+    size_t j, k;
+    uint64_t config[MSP_CHECKPOINT_NUM_CONFIG];
+    uint64_t state[MSP_CHECKPOINT_NUM_STATE];
+    double rate;
+    double time_and_rates[3];
+    char rng_name[MSP_CHECKPOINT_RNG_NAME_LENGTH];
+    size_t num_entries = migration_matrix_get_num_entries(&self->migration_matrix);
+    demographic_event_t *de;
     population_t *pop;
-    segment_t *u, *v;
-    coalescence_record_t *cr;
-    size_t j;
-
+    int64_t value;
+    uint32_t header[3];
+    double coordinates[3];
+    uint32_t item[2];
+    bool valid;
+    btree_t *trees[] = {&self->breakpoints, &self->overlap_counts};
+    btree_position_t pos;
+    coalescence_record_t record;
+    migration_record_t *mr;
+    size_t offset;
+
+    msp_get_checkpoint_config(self, config, &rate, rng_name);
+    state[0] = (uint64_t) self->state;
+    state[1] = self->next_node;
+    state[2] = self->next_sampling_event;
+    state[3] = 0;
+    for (de = self->demographic_events_head; de != self->next_demographic_event;
+            de = de->next) {
+        state[3]++;
+    }
+    state[4] = self->num_re_events;
+    state[5] = self->num_ca_events;
+    state[6] = self->num_rejected_ca_events;
+    state[7] = self->num_trapped_re_events;
+    state[8] = self->num_multiple_re_events;
+    state[9] = self->max_segments;
+    state[10] = self->num_segments;
+    state[11] = self->free_segment;
+    state[12] = self->coalescence_records.num_records;
+    state[13] = self->num_migration_records;
+    state[14] = self->variates.uniform_position;
+    state[15] = self->variates.exponential_position;
+
+    ret = msp_checkpoint_write(file, MSP_CHECKPOINT_MAGIC,
+            sizeof(MSP_CHECKPOINT_MAGIC), 1);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_write(file, config, sizeof(config), 1);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_write(file, &rate, sizeof(rate), 1);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_write(file, rng_name, sizeof(rng_name), 1);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_write(file, state, sizeof(state), 1);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_write(file, &self->time, sizeof(double), 1);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_write(file, gsl_rng_state(self->rng), 1,
+            gsl_rng_size(self->rng));
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_write(file, self->variates.uniforms, sizeof(double),
+            self->variates.block_size);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_write(file, self->variates.exponentials,
+            sizeof(double), self->variates.block_size);
+    if (ret != 0) {
+        goto out;
+    }
+    /* Demographic events change the migration rates and population sizes */
+    ret = msp_checkpoint_write(file, self->num_migration_events,
+            sizeof(size_t), num_entries);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_write(file, self->migration_matrix.rate,
+            sizeof(double), num_entries);
+    if (ret != 0) {
+        goto out;
+    }
     for (j = 0; j < self->num_populations; j++) {
         pop = &self->populations[j];
-        for (node = pop->ancestors.head; node != NULL; node = node->next) {
-            u = (segment_t *) node->item;
-            while (u != NULL) {
-                v = u->next;
-                msp_free_segment(self, u);
-                u = v;
-            }
-            avl_unlink_node(&pop->ancestors, node);
-            msp_free_avl_node(self, node);
+        time_and_rates[0] = pop->initial_size;
+        time_and_rates[1] = pop->growth_rate;
+        time_and_rates[2] = pop->start_time;
+        ret = msp_checkpoint_write(file, time_and_rates,
+                sizeof(time_and_rates), 1);
+        if (ret != 0) {
+            goto out;
+        }
+        /* The order of the lineages determines which are chosen. */
+        ret = msp_checkpoint_write(file, &pop->ancestors.size,
+                sizeof(size_t), 1);
+        if (ret != 0) {
+            goto out;
+        }
+        ret = msp_checkpoint_write(file, pop->ancestors.items,
+                sizeof(uint32_t), pop->ancestors.size);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    /* The segments are stored along with the free list, so that they are
+     * allocated in the same order after restoring. */
+    ret = msp_checkpoint_write(file, self->segments + 1, sizeof(segment_t),
+            self->max_segments - 1);
+    if (ret != 0) {
+        goto out;
+    }
+    for (j = 1; j < self->max_segments; j++) {
+        value = fenwick_get_value(&self->links, j);
+        ret = msp_checkpoint_write(file, &value, sizeof(value), 1);
+        if (ret != 0) {
+            goto out;
         }
     }
-    for (node = self->breakpoints.head; node != NULL; node = node->next) {
-        nm = (node_mapping_t *) node->item;
-        avl_unlink_node(&self->breakpoints, node);
-        msp_free_avl_node(self, node);
-        msp_free_node_mapping(self, nm);
+    for (k = 0; k < 2; k++) {
+        value = (int64_t) btree_get_size(trees[k]);
+        ret = msp_checkpoint_write(file, &value, sizeof(value), 1);
+        if (ret != 0) {
+            goto out;
+        }
+        for (valid = btree_first(trees[k], &pos); valid;
+                valid = btree_next(trees[k], &pos)) {
+            item[0] = btree_get_key(trees[k], &pos);
+            item[1] = btree_get_value(trees[k], &pos);
+            ret = msp_checkpoint_write(file, item, sizeof(item), 1);
+            if (ret != 0) {
+                goto out;
+            }
+        }
     }
-    for (node = self->overlap_counts.head; node != NULL; node = node->next) {
-        nm = (node_mapping_t *) node->item;
-        avl_unlink_node(&self->overlap_counts, node);
-        msp_free_avl_node(self, node);
-        msp_free_node_mapping(self, nm);
+    offset = 0;
+    for (j = 0; j < self->coalescence_records.num_records; j++) {
+        msp_get_coalescence_record(self, j, offset, &record);
+        ret = msp_write_coalescence_record(file, &record);
+        if (ret != 0) {
+            goto out;
+        }
+        offset += record.num_children;
     }
-    for (j = 0; j < self->num_coalescence_records; j++) {
-        cr = &self->coalescence_records[j];
-        if (cr->children != NULL) {
-            msp_free_children(self, cr->num_children, cr->children);
+    for (j = 0; j < self->num_migration_records; j++) {
+        mr = &self->migration_records[j];
+        header[0] = mr->source;
+        header[1] = mr->dest;
+        header[2] = mr->node;
+        coordinates[0] = mr->left;
+        coordinates[1] = mr->right;
+        coordinates[2] = mr->time;
+        ret = msp_checkpoint_write(file, header, sizeof(header), 1);
+        if (ret != 0) {
+            goto out;
+        }
+        ret = msp_checkpoint_write(file, coordinates, sizeof(coordinates), 1);
+        if (ret != 0) {
+            goto out;
         }
-        cr->children = NULL;
     }
+out:
     return ret;
 }
 
-static int WARN_UNUSED
-msp_insert_sample(msp_t *self, uint32_t sample, uint32_t population)
+/*
+ * Writes the state of the simulation to the specified path. The checkpoint
+ * is written to a temporary file first and then renamed, so that an
+ * existing checkpoint is never left partially written.
+ */
+int WARN_UNUSED
+msp_checkpoint(msp_t *self, const char *path)
 {
-    int ret = MSP_ERR_GENERIC;
-    segment_t *u;
+    int ret = 0;
+    FILE *file = NULL;
+    char *tmp_path = NULL;
+    const char *suffix = ".tmp";
 
-    u = msp_alloc_segment(self, 0, self->num_loci, sample, population,
-            NULL, NULL);
-    if (u == NULL) {
+    if (self->state == MSP_STATE_NEW || self->state == MSP_STATE_DEBUGGING) {
+        ret = MSP_ERR_BAD_STATE;
+        goto out;
+    }
+    if (self->coalescence_record_sink != NULL || self->sequential) {
+        ret = MSP_ERR_UNSUPPORTED_OPERATION;
+        goto out;
+    }
+    tmp_path = malloc(strlen(path) + strlen(suffix) + 1);
+    if (tmp_path == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    ret = msp_insert_individual(self, u);
+    strcpy(tmp_path, path);
+    strcat(tmp_path, suffix);
+    file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        ret = MSP_ERR_IO;
+        goto out;
+    }
+    ret = msp_write_checkpoint(self, file);
     if (ret != 0) {
         goto out;
     }
-    fenwick_set_value(&self->links, u->id, self->num_loci - 1);
+    if (fclose(file) != 0) {
+        file = NULL;
+        ret = MSP_ERR_IO;
+        goto out;
+    }
+    file = NULL;
+    if (rename(tmp_path, path) != 0) {
+        ret = MSP_ERR_IO;
+        goto out;
+    }
+    self->events_since_checkpoint = 0;
+    self->last_checkpoint_time = time(NULL);
 out:
+    if (file != NULL) {
+        fclose(file);
+    }
+    if (tmp_path != NULL) {
+        if (ret != 0) {
+            remove(tmp_path);
+        }
+        free(tmp_path);
+    }
     return ret;
 }
 
-int
-msp_reset(msp_t *self)
+static int WARN_UNUSED
+msp_read_checkpoint(msp_t *self, FILE *file)
 {
     int ret = 0;
-    uint32_t j, population_id;
-    population_t *pop, *initial_pop;
-    size_t N = self->num_populations;
+    size_t j, k, n, max_segments, increment, mem_increment;
+    uint64_t config[MSP_CHECKPOINT_NUM_CONFIG];
+    uint64_t saved_config[MSP_CHECKPOINT_NUM_CONFIG];
+    uint64_t state[MSP_CHECKPOINT_NUM_STATE];
+    double rate, saved_rate;
+    double time_and_rates[3];
+    char rng_name[MSP_CHECKPOINT_RNG_NAME_LENGTH];
+    char saved_rng_name[MSP_CHECKPOINT_RNG_NAME_LENGTH];
+    char magic[sizeof(MSP_CHECKPOINT_MAGIC)];
+    size_t num_entries = migration_matrix_get_num_entries(&self->migration_matrix);
+    population_t *pop;
+    int64_t value;
+    uint32_t item[2], u;
+    uint32_t header[3];
+    double coordinates[3];
+    btree_t *trees[] = {&self->breakpoints, &self->overlap_counts};
+    coalescence_record_t record;
+    record_columns_t *records;
+    migration_record_t *mr;
+    uint32_t *children = NULL;
+    size_t max_children = 0;
+    size_t max_records, offset;
+    void *p;
 
+    ret = msp_checkpoint_read(file, magic, sizeof(magic), 1);
+    if (ret != 0) {
+        goto out;
+    }
+    if (memcmp(magic, MSP_CHECKPOINT_MAGIC, sizeof(magic)) != 0) {
+        ret = MSP_ERR_FILE_FORMAT;
+        goto out;
+    }
+    msp_get_checkpoint_config(self, config, &rate, rng_name);
+    ret = msp_checkpoint_read(file, saved_config, sizeof(saved_config), 1);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_read(file, &saved_rate, sizeof(saved_rate), 1);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_read(file, saved_rng_name, sizeof(saved_rng_name), 1);
+    if (ret != 0) {
+        goto out;
+    }
+    if (memcmp(config, saved_config, sizeof(config)) != 0
+            || rate != saved_rate
+            || memcmp(rng_name, saved_rng_name, sizeof(rng_name)) != 0) {
+        ret = MSP_ERR_BAD_CHECKPOINT;
+        goto out;
+    }
+    ret = msp_checkpoint_read(file, state, sizeof(state), 1);
+    if (ret != 0) {
+        goto out;
+    }
+    max_segments = (size_t) state[9];
+    if ((state[0] != MSP_STATE_INITIALISED && state[0] != MSP_STATE_SIMULATING)
+            || state[3] > config[5] || max_segments < self->max_segments
+            || state[11] >= max_segments
+            || state[14] > self->variates.block_size
+            || state[15] > self->variates.block_size) {
+        ret = MSP_ERR_BAD_CHECKPOINT;
+        goto out;
+    }
+    /* Clear out the current state and grow the segments to match. */
     ret = msp_reset_memory_state(self);
     if (ret != 0) {
         goto out;
     }
-    /* Set up the initial segments and algorithm state */
-    for (population_id = 0; population_id < N; population_id++) {
-        pop = &self->populations[population_id];
-        assert(avl_count(&pop->ancestors) == 0);
-        /* Set the initial population parameters */
-        initial_pop = &self->initial_populations[population_id];
-        pop->growth_rate = initial_pop->growth_rate;
-        pop->initial_size = initial_pop->initial_size;
-        pop->start_time = 0.0;
+    self->num_migration_records = 0;
+    if (max_segments > self->max_segments) {
+        increment = max_segments - self->max_segments;
+        mem_increment = msp_get_segment_mem_increment(self, increment);
+        if (self->used_memory + mem_increment > self->max_memory) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        ret = msp_expand_segments(self, increment);
+        if (ret != 0) {
+            goto out;
+        }
+        self->used_memory += mem_increment;
     }
-    /* Set up the sample */
-    for (j = 0; j < self->sample_size; j++) {
-        if (self->samples[j].time == 0.0) {
-            ret = msp_insert_sample(self, j, self->samples[j].population_id);
+    self->state = (int) state[0];
+    self->next_node = (uint32_t) state[1];
+    self->next_sampling_event = (size_t) state[2];
+    self->next_demographic_event = self->demographic_events_head;
+    for (j = 0; j < state[3]; j++) {
+        self->next_demographic_event = self->next_demographic_event->next;
+    }
+    self->num_re_events = (size_t) state[4];
+    self->num_ca_events = (size_t) state[5];
+    self->num_rejected_ca_events = (size_t) state[6];
+    self->num_trapped_re_events = (size_t) state[7];
+    self->num_multiple_re_events = (size_t) state[8];
+    self->num_segments = (size_t) state[10];
+    self->free_segment = (uint32_t) state[11];
+    ret = msp_checkpoint_read(file, &self->time, sizeof(double), 1);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_read(file, gsl_rng_state(self->rng), 1,
+            gsl_rng_size(self->rng));
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_read(file, self->variates.uniforms, sizeof(double),
+            self->variates.block_size);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_checkpoint_read(file, self->variates.exponentials,
+            sizeof(double), self->variates.block_size);
+    if (ret != 0) {
+        goto out;
+    }
+    self->variates.uniform_position = (size_t) state[14];
+    self->variates.exponential_position = (size_t) state[15];
+    ret = msp_checkpoint_read(file, self->num_migration_events,
+            sizeof(size_t), num_entries);
+    if (ret != 0) {
+        goto out;
+    }
+    for (j = 0; j < num_entries; j++) {
+        ret = msp_checkpoint_read(file, &rate, sizeof(rate), 1);
+        if (ret != 0) {
+            goto out;
+        }
+        migration_matrix_set_rate(&self->migration_matrix, j, rate);
+    }
+    /* Read the lineages now and insert them once the segments are in place */
+    for (j = 0; j < self->num_populations; j++) {
+        pop = &self->populations[j];
+        ret = msp_checkpoint_read(file, time_and_rates,
+                sizeof(time_and_rates), 1);
+        if (ret != 0) {
+            goto out;
+        }
+        pop->initial_size = time_and_rates[0];
+        pop->growth_rate = time_and_rates[1];
+        pop->start_time = time_and_rates[2];
+        ret = msp_checkpoint_read(file, &n, sizeof(size_t), 1);
+        if (ret != 0) {
+            goto out;
+        }
+        while (pop->ancestors.max_size < n) {
+            increment = msp_get_lineage_set_mem_increment(self, pop);
+            if (self->used_memory + increment > self->max_memory) {
+                ret = MSP_ERR_NO_MEMORY;
+                goto out;
+            }
+            ret = lineage_set_expand(&pop->ancestors,
+                    increment / sizeof(uint32_t));
+            if (ret != 0) {
+                goto out;
+            }
+            self->used_memory += increment;
+        }
+        for (k = 0; k < n; k++) {
+            ret = msp_checkpoint_read(file, &u, sizeof(u), 1);
+            if (ret != 0) {
+                goto out;
+            }
+            lineage_set_insert(&pop->ancestors, u);
+        }
+    }
+    ret = msp_checkpoint_read(file, self->segments + 1, sizeof(segment_t),
+            max_segments - 1);
+    if (ret != 0) {
+        goto out;
+    }
+    for (j = 1; j < max_segments; j++) {
+        ret = msp_checkpoint_read(file, &value, sizeof(value), 1);
+        if (ret != 0) {
+            goto out;
+        }
+        fenwick_set_value(&self->links, j, value);
+    }
+    for (k = 0; k < 2; k++) {
+        ret = msp_checkpoint_read(file, &value, sizeof(value), 1);
+        if (ret != 0) {
+            goto out;
+        }
+        for (j = 0; j < (size_t) value; j++) {
+            ret = msp_checkpoint_read(file, item, sizeof(item), 1);
+            if (ret != 0) {
+                goto out;
+            }
+            ret = msp_btree_insert(self, trees[k], item[0], item[1]);
             if (ret != 0) {
                 goto out;
             }
         }
     }
-    self->next_node = self->sample_size;
-    self->next_demographic_event = self->demographic_events_head;
-    memcpy(self->migration_matrix, self->initial_migration_matrix,
-            N * N * sizeof(double));
-    ret = msp_insert_overlap_count(self, 0, self->sample_size);
+    n = (size_t) state[12];
+    records = &self->coalescence_records;
+    max_records = records->max_records;
+    while (max_records <= n) {
+        max_records += self->coalescence_record_block_size;
+        self->num_coalescence_record_blocks++;
+    }
+    ret = msp_expand_coalescence_records(self, max_records, 0);
     if (ret != 0) {
         goto out;
     }
-    ret = msp_insert_overlap_count(self, self->num_loci,
-            self->sample_size + 1);
+    for (j = 0; j < n; j++) {
+        ret = msp_read_coalescence_record(file, &record, &children,
+                &max_children);
+        if (ret != 0) {
+            goto out;
+        }
+        offset = records->num_children_total;
+        if (offset + record.num_children > records->max_children_total) {
+            ret = msp_expand_coalescence_records(self, max_records,
+                    GSL_MAX(2 * records->max_children_total,
+                        offset + record.num_children));
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        /* The records are copied verbatim, without squashing */
+        records->left[j] = (uint32_t) record.left;
+        records->right[j] = (uint32_t) record.right;
+        records->node[j] = record.node;
+        records->num_children[j] = record.num_children;
+        records->population_id[j] = record.population_id;
+        records->time[j] = record.time;
+        memcpy(records->children + offset, children,
+                record.num_children * sizeof(uint32_t));
+        records->num_children_total += record.num_children;
+        records->num_records++;
+    }
+    n = (size_t) state[13];
+    while (self->max_migration_records <= n) {
+        self->max_migration_records += self->migration_record_block_size;
+        self->num_migration_record_blocks++;
+    }
+    p = realloc(self->migration_records,
+            self->max_migration_records * sizeof(migration_record_t));
+    if (p == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    self->migration_records = p;
+    for (j = 0; j < n; j++) {
+        ret = msp_checkpoint_read(file, header, sizeof(header), 1);
+        if (ret != 0) {
+            goto out;
+        }
+        ret = msp_checkpoint_read(file, coordinates, sizeof(coordinates), 1);
+        if (ret != 0) {
+            goto out;
+        }
+        mr = &self->migration_records[j];
+        mr->source = header[0];
+        mr->dest = header[1];
+        mr->node = header[2];
+        mr->left = coordinates[0];
+        mr->right = coordinates[1];
+        mr->time = coordinates[2];
+        self->num_migration_records++;
+    }
+    ret = msp_reset_overlap_index(self);
     if (ret != 0) {
         goto out;
     }
-    self->time = 0.0;
-    self->next_sampling_event = 0;
-    self->num_coalescence_records = 0;
-    self->num_re_events = 0;
-    self->num_ca_events = 0;
-    self->num_rejected_ca_events = 0;
-    self->num_trapped_re_events = 0;
-    self->num_multiple_re_events = 0;
-    memset(self->num_migration_events, 0, N * N * sizeof(size_t));
-    self->state = MSP_STATE_INITIALISED;
+    msp_reset_event_rates(self);
 out:
+    if (children != NULL) {
+        free(children);
+    }
     return ret;
 }
 
 /*
- * Sets up the memory heaps, initial population and trees.
+ * Restores the state of the simulation from a checkpoint written by
+ * msp_checkpoint. The simulator must have been initialised with the same
+ * configuration as the one that wrote the checkpoint, and not yet run.
+ * Continuing from the restored state gives exactly the same results as
+ * continuing the original simulation. If an error occurs, the simulator
+ * must be reset before it is used again.
  */
 int WARN_UNUSED
-msp_initialise(msp_t *self)
+msp_restore(msp_t *self, const char *path)
 {
-    int ret = -1;
-    uint32_t j;
-
-    /* These should really be proper checks with a return value */
-    assert(self->sample_size > 1);
-    assert(self->num_loci >= 1);
-    assert(self->num_populations >= 1);
+    int ret = 0;
+    FILE *file = NULL;
 
-    ret = msp_alloc_memory_blocks(self);
-    if (ret != 0) {
+    if (self->state != MSP_STATE_INITIALISED) {
+        ret = MSP_ERR_BAD_STATE;
         goto out;
     }
-    /* First check that the sample configuration makes sense */
-    for (j = 0; j < self->sample_size; j++) {
-        if (self->samples[j].population_id >= self->num_populations) {
-            ret = MSP_ERR_BAD_SAMPLES;
-            goto out;
-        }
+    if (self->coalescence_record_sink != NULL || self->sequential) {
+        ret = MSP_ERR_UNSUPPORTED_OPERATION;
+        goto out;
     }
-    ret = msp_reset(self);
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        ret = MSP_ERR_IO;
+        goto out;
+    }
+    ret = msp_read_checkpoint(self, file);
     if (ret != 0) {
         goto out;
     }
+    self->events_since_checkpoint = 0;
+    self->last_checkpoint_time = time(NULL);
 out:
-    return ret;
-}
-
-static double
-msp_get_common_ancestor_waiting_time_size(msp_t *self, population_t *pop,
-        uint32_t size)
-{
-    double ret = DBL_MAX;
-    /* Need to perform n * (n - 1) as a double due to overflow */
-    double n = (double) size;
-    double lambda = n * (n - 1.0);
-    double alpha = pop->growth_rate;
-    double t = self->time;
-    double u, dt, z;
-
-    if (lambda > 0.0) {
-        u = gsl_ran_exponential(self->rng, 1.0 / lambda);
-        if (alpha == 0.0) {
-            ret = pop->initial_size * u;
-        } else {
-            dt = t - pop->start_time;
-            z = 1 + alpha * pop->initial_size * exp(-alpha * dt) * u;
-            /* if z is <= 0 no coancestry can occur */
-            if (z > 0) {
-                ret = log(z) / alpha;
-            }
-        }
+    if (file != NULL) {
+        fclose(file);
     }
     return ret;
 }
 
-static double
-msp_get_common_ancestor_waiting_time(msp_t *self, uint32_t population_id)
-{
-    population_t *pop = &self->populations[population_id];
-
-    return msp_get_common_ancestor_waiting_time_size(self, pop,
-            (uint32_t) avl_count(&pop->ancestors));
-}
-
+/* Checkpoints the simulation if either interval has elapsed. */
 static int WARN_UNUSED
-msp_sanity_check(msp_t *self, int64_t num_links)
+msp_conditional_checkpoint(msp_t *self)
 {
     int ret = 0;
-    size_t n = msp_get_num_ancestors(self);
+    bool checkpoint = false;
 
-    /* TODO there are various worries when we're dealing with very
-     * large population sizes and numbers of links. For example,
-     * what if n is too big for the gsl integer random generator?
-     * To at least determine if these are real things to worry
-     * about, we put in some arbitrary (and hopefully safe) limits
-     * and see if they are ever hit in practise.
-     */
-    if (n >= UINT32_MAX / 8) {
-        ret = MSP_ERR_POPULATION_OVERFLOW;
-        goto out;
+    self->events_since_checkpoint++;
+    if (self->checkpoint_interval_events > 0) {
+        checkpoint = self->events_since_checkpoint
+            >= self->checkpoint_interval_events;
     }
-    if (num_links >= INT64_MAX / 8) {
-        ret = MSP_ERR_LINKS_OVERFLOW;
-        goto out;
+    if (self->checkpoint_interval_seconds > 0) {
+        checkpoint = checkpoint || difftime(time(NULL),
+                self->last_checkpoint_time) >= self->checkpoint_interval_seconds;
+    }
+    if (checkpoint) {
+        ret = msp_checkpoint(self, self->checkpoint_path);
     }
-out:
     return ret;
 }
 
-static int WARN_UNUSED
-msp_apply_demographic_events(msp_t *self)
+#ifdef MSP_PROFILE
+static void
+msp_profile_peaks(msp_t *self)
 {
-    int ret = 0;
-    demographic_event_t *event;
-
-    assert(self->next_demographic_event != NULL);
-    /* Process all events with equal time in one block. */
-    self->time = self->next_demographic_event->time;
-    while (self->next_demographic_event != NULL
-            && self->next_demographic_event->time == self->time) {
-        /* We skip ahead to the start time for the next demographic
-         * event, and use its change_state method to update the
-         * state of the simulation.
-         */
-        event = self->next_demographic_event;
-        assert(event->change_state != NULL);
-        ret = event->change_state(self, event);
-        if (ret != 0) {
-            goto out;
-        }
-        self->next_demographic_event = event->next;
-    }
-out:
-    return ret;
+    msp_profile_t *profile = &self->profile;
+
+    profile->max_num_ancestors = GSL_MAX(profile->max_num_ancestors,
+            msp_get_num_ancestors(self));
+    profile->max_num_segments = GSL_MAX(profile->max_num_segments,
+            self->num_segments);
+    profile->max_num_links = GSL_MAX(profile->max_num_links,
+            fenwick_get_total(&self->links));
 }
+#endif
 
 int WARN_UNUSED
 msp_run(msp_t *self, double max_time, unsigned long max_events)
 {
     int ret = 0;
-    double lambda, t_temp, t_wait, ca_t_wait, re_t_wait, mig_t_wait,
-           sampling_event_time, demographic_event_time;
+    double total_rate, t_temp, t_wait, sampling_event_time,
+           demographic_event_time;
     int64_t num_links;
-    uint32_t j, k, n;
-    uint32_t ca_pop_id, mig_source_pop, mig_dest_pop;
+    uint32_t j, k;
+    uint32_t ca_pop_id;
+    bool variable_rate_ca_event;
     unsigned long events = 0;
     sampling_event_t *se;
+    MSP_PROFILE_DECLARE(start);
 
+    if (self->sequential) {
+        /* The sequential engine moves along the sequence, not back in
+         * time, so it cannot stop at a given time. */
+        if (max_time != DBL_MAX) {
+            ret = MSP_ERR_UNSUPPORTED_OPERATION;
+            goto out;
+        }
+        if (self->state == MSP_STATE_INITIALISED) {
+            ret = msp_sequential_initialise(self);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+    }
     if (self->state == MSP_STATE_INITIALISED) {
         self->state = MSP_STATE_SIMULATING;
     }
@@ -2283,55 +4967,42 @@ msp_run(msp_t *self, double max_time, unsigned long max_events)
         ret = MSP_ERR_BAD_STATE;
         goto out;
     }
+    if (self->sequential) {
+        ret = msp_sequential_run(self, max_events);
+        goto out;
+    }
     while (msp_get_num_ancestors(self) > 0
             && self->time < max_time && events < max_events) {
         events++;
+        MSP_PROFILE_PEAKS(self);
         num_links = fenwick_get_total(&self->links);
         ret = msp_sanity_check(self, num_links);
         if (ret != 0) {
             goto out;
         }
-        /* Recombination */
-        lambda = (double) num_links * self->scaled_recombination_rate;
-        re_t_wait = DBL_MAX;
-        if (lambda != 0.0) {
-            re_t_wait = gsl_ran_exponential(self->rng, 1.0 / lambda);
+        /* The waiting times for recombination, migration and common
+         * ancestor events in populations of constant size are all
+         * exponential, so we draw the time until the first of them
+         * from the total rate and decide which one it was afterwards. */
+        rate_tree_set_value(&self->event_rates, 0,
+                (double) num_links * self->scaled_recombination_rate);
+        total_rate = rate_tree_get_total(&self->event_rates);
+        t_wait = DBL_MAX;
+        if (total_rate > 0.0) {
+            t_wait = msp_exponential(self, 1.0 / total_rate);
         }
-        /* Common ancestors */
-        ca_t_wait = DBL_MAX;
+        /* Common ancestors in populations with changing size */
+        variable_rate_ca_event = false;
         ca_pop_id = 0;
-        for (j = 0; j < self->num_populations; j++) {
-            t_temp = msp_get_common_ancestor_waiting_time(self, j);
-            if (t_temp < ca_t_wait) {
-                ca_t_wait = t_temp;
-                ca_pop_id = j;
-            }
-        }
-        /* Migration */
-        mig_t_wait = DBL_MAX;
-        mig_source_pop = 0;
-        mig_dest_pop = 0;
-        for (j = 0; j < self->num_populations; j++) {
-            n = avl_count(&self->populations[j].ancestors);
-            for (k = 0; k < self->num_populations; k++) {
-                lambda = n * self->migration_matrix[
-                    j * self->num_populations + k];
-                if (lambda != 0.0) {
-                    t_temp = gsl_ran_exponential(self->rng, 1.0 / lambda);
-                    if (t_temp < mig_t_wait) {
-                        mig_t_wait = t_temp;
-                        /* m[j, k] is the rate at which migrants move from
-                         * population k to j forwards in time. Backwards
-                         * in time, we move the individual from from
-                         * population j into population k.
-                         */
-                        mig_source_pop = j;
-                        mig_dest_pop = k;
-                    }
-                }
+        for (j = 0; j < self->num_variable_rate_populations; j++) {
+            k = self->variable_rate_populations[j];
+            t_temp = msp_get_common_ancestor_waiting_time(self, k);
+            if (t_temp < t_wait) {
+                t_wait = t_temp;
+                ca_pop_id = k;
+                variable_rate_ca_event = true;
             }
         }
-        t_wait = GSL_MIN(GSL_MIN(re_t_wait, ca_t_wait), mig_t_wait);
         if (self->next_demographic_event == NULL
                 && self->next_sampling_event == self->num_sampling_events
                 && t_wait == DBL_MAX) {
@@ -2352,29 +5023,40 @@ msp_run(msp_t *self, double max_time, unsigned long max_events)
                 && sampling_event_time < demographic_event_time) {
             se = &self->sampling_events[self->next_sampling_event];
             self->time = se->time;
+            MSP_PROFILE_START(start);
             ret = msp_insert_sample(self, se->sample, se->population_id);
+            MSP_PROFILE_STOP(self, sampling_time, start);
             if (ret != 0) {
                 goto out;
             }
             self->next_sampling_event++;
         } else if (demographic_event_time < t_temp) {
+            MSP_PROFILE_START(start);
             ret = msp_apply_demographic_events(self);
+            MSP_PROFILE_STOP(self, demographic_time, start);
             if (ret != 0) {
                 goto out;
             }
         } else {
             self->time += t_wait;
-            if (re_t_wait == t_wait) {
-                ret = msp_recombination_event(self);
-            } else if (ca_t_wait == t_wait) {
+            if (variable_rate_ca_event) {
+                MSP_PROFILE_START(start);
                 ret = msp_common_ancestor_event(self, ca_pop_id);
+                MSP_PROFILE_STOP(self, common_ancestor_time, start);
             } else {
-                ret = msp_migration_event(self, mig_source_pop, mig_dest_pop);
+                ret = msp_rate_tree_event(self, total_rate);
             }
             if (ret != 0) {
                 goto out;
             }
         }
+        scratch_reset(&self->scratch);
+        if (self->checkpoint_path != NULL) {
+            ret = msp_conditional_checkpoint(self);
+            if (ret != 0) {
+                goto out;
+            }
+        }
     }
     if (msp_get_num_ancestors(self) != 0) {
         ret = 1;
@@ -2403,6 +5085,7 @@ msp_debug_demography(msp_t *self, double *end_time)
     }
     if (! first_call && self->next_demographic_event != NULL) {
         ret = msp_apply_demographic_events(self);
+        scratch_reset(&self->scratch);
         if (ret != 0) {
             goto out;
         }
@@ -2461,6 +5144,12 @@ msp_get_store_migration_records(msp_t *self)
     return self->store_migration_records;
 }
 
+bool
+msp_get_sequential(msp_t *self)
+{
+    return self->sequential;
+}
+
 size_t
 msp_get_num_populations(msp_t *self)
 {
@@ -2474,7 +5163,7 @@ msp_get_num_ancestors(msp_t *self)
     size_t j;
 
     for (j = 0; j < self->num_populations; j++) {
-        n += avl_count(&self->populations[j].ancestors);
+        n += lineage_set_get_size(&self->populations[j].ancestors);
     }
     return n;
 }
@@ -2482,13 +5171,21 @@ msp_get_num_ancestors(msp_t *self)
 size_t
 msp_get_num_breakpoints(msp_t *self)
 {
-    return avl_count(&self->breakpoints);
+    return btree_get_size(&self->breakpoints);
 }
 
 size_t
 msp_get_num_coalescence_records(msp_t *self)
 {
-    return self->num_coalescence_records;
+    return self->coalescence_records.num_records;
+}
+
+/* Returns the number of coalescence records passed to the sink. These
+ * are no longer included in msp_get_num_coalescence_records. */
+size_t
+msp_get_num_flushed_coalescence_records(msp_t *self)
+{
+    return self->num_flushed_coalescence_records;
 }
 
 size_t
@@ -2501,15 +5198,15 @@ int WARN_UNUSED
 msp_get_ancestors(msp_t *self, segment_t **ancestors)
 {
     int ret = -1;
-    avl_node_t *node;
-    avl_tree_t *population_ancestors;
-    size_t j;
+    lineage_set_t *population_ancestors;
+    size_t j, l;
     size_t k = 0;
 
     for (j = 0; j < self->num_populations; j++) {
         population_ancestors = &self->populations[j].ancestors;
-        for (node = population_ancestors->head; node != NULL; node = node->next) {
-            ancestors[k] = (segment_t *) node->item;
+        for (l = 0; l < lineage_set_get_size(population_ancestors); l++) {
+            ancestors[k] = msp_get_segment(self, lineage_set_get_item(
+                    population_ancestors, l));
             k++;
         }
     }
@@ -2517,17 +5214,33 @@ msp_get_ancestors(msp_t *self, segment_t **ancestors)
     return ret;
 }
 
+/*
+ * Returns the segment following the specified segment in its chain, or NULL
+ * if there is none. Pointers to segments are only valid until the
+ * simulation is next run or reset.
+ */
+segment_t *
+msp_get_next_segment(msp_t *self, segment_t *seg)
+{
+    segment_t *ret = NULL;
+
+    if (seg->next != MSP_NULL_SEGMENT) {
+        ret = msp_get_segment(self, seg->next);
+    }
+    return ret;
+}
+
 int WARN_UNUSED
 msp_get_breakpoints(msp_t *self, size_t *breakpoints)
 {
     int ret = -1;
-    avl_node_t *node;
-    node_mapping_t *nm;
+    btree_position_t pos;
+    bool valid;
     size_t j = 0;
 
-    for (node = (&self->breakpoints)->head; node != NULL; node = node->next) {
-        nm = (node_mapping_t *) node->item;
-        breakpoints[j] = (size_t) nm->left;
+    for (valid = btree_first(&self->breakpoints, &pos); valid;
+            valid = btree_next(&self->breakpoints, &pos)) {
+        breakpoints[j] = (size_t) btree_get_key(&self->breakpoints, &pos);
         j++;
     }
     ret = 0;
@@ -2537,26 +5250,68 @@ msp_get_breakpoints(msp_t *self, size_t *breakpoints)
 int WARN_UNUSED
 msp_get_migration_matrix(msp_t *self, double *migration_matrix)
 {
-    size_t N = self->num_populations;
+    migration_matrix_t *mm = &self->migration_matrix;
 
-    memcpy(migration_matrix, self->migration_matrix, N * N * sizeof(double));
+    if (self->state == MSP_STATE_NEW) {
+        mm = &self->initial_migration_matrix;
+    }
+    migration_matrix_get_dense(mm, migration_matrix);
     return 0;
 }
 
 int WARN_UNUSED
 msp_get_num_migration_events(msp_t *self, size_t *num_migration_events)
 {
+    size_t j;
     size_t N = self->num_populations;
+    migration_matrix_t *mm = &self->migration_matrix;
 
-    memcpy(num_migration_events, self->num_migration_events, N * N * sizeof(size_t));
+    memset(num_migration_events, 0, N * N * sizeof(size_t));
+    if (self->num_migration_events != NULL) {
+        for (j = 0; j < mm->num_entries; j++) {
+            num_migration_events[mm->source[j] * N + mm->dest[j]] =
+                self->num_migration_events[j];
+        }
+    }
     return 0;
 }
 
 int WARN_UNUSED
 msp_get_coalescence_records(msp_t *self, coalescence_record_t **coalescence_records)
 {
-    *coalescence_records = self->coalescence_records;
-    return 0;
+    int ret = msp_update_coalescence_record_view(self,
+            self->coalescence_records.num_records);
+
+    *coalescence_records = self->coalescence_record_view;
+    return ret;
+}
+
+/*
+ * Hands the coalescence record columns over to the caller, who becomes
+ * responsible for freeing them, and replaces them with empty columns so
+ * that the simulator can be reset and run again. The records are no longer
+ * included in msp_get_num_coalescence_records.
+ */
+int WARN_UNUSED
+msp_release_coalescence_records(msp_t *self, record_columns_t *records)
+{
+    int ret = 0;
+    record_columns_t released = self->coalescence_records;
+
+    self->used_memory -= released.max_children_total * sizeof(uint32_t);
+    ret = msp_alloc_coalescence_records(self);
+    if (ret != 0) {
+        /* Keep the old columns so that nothing is lost */
+        self->used_memory -= self->coalescence_records.max_children_total
+            * sizeof(uint32_t);
+        msp_free_coalescence_records(self);
+        self->coalescence_records = released;
+        self->used_memory += released.max_children_total * sizeof(uint32_t);
+        goto out;
+    }
+    *records = released;
+out:
+    return ret;
 }
 
 int WARN_UNUSED
@@ -2566,6 +5321,72 @@ msp_get_migration_records(msp_t *self, migration_record_t **migration_records)
     return 0;
 }
 
+/* Coalescence records are written to spill files as the population_id,
+ * num_children and node, followed by the left, right and time and then
+ * the children, all in native byte order. */
+int WARN_UNUSED
+msp_write_coalescence_record(FILE *file, coalescence_record_t *record)
+{
+    int ret = 0;
+    uint32_t header[3];
+    double coordinates[3];
+
+    header[0] = record->population_id;
+    header[1] = record->num_children;
+    header[2] = record->node;
+    coordinates[0] = record->left;
+    coordinates[1] = record->right;
+    coordinates[2] = record->time;
+    if (fwrite(header, sizeof(header), 1, file) != 1
+            || fwrite(coordinates, sizeof(coordinates), 1, file) != 1
+            || fwrite(record->children, sizeof(uint32_t),
+                record->num_children, file) != record->num_children) {
+        ret = MSP_ERR_IO;
+    }
+    return ret;
+}
+
+/* Reads a coalescence record written by msp_write_coalescence_record. The
+ * children are stored in the buffer pointed to by children, which holds
+ * max_children values and is grown with realloc if needed. */
+int WARN_UNUSED
+msp_read_coalescence_record(FILE *file, coalescence_record_t *record,
+        uint32_t **children, size_t *max_children)
+{
+    int ret = 0;
+    uint32_t header[3];
+    double coordinates[3];
+    uint32_t *p;
+
+    if (fread(header, sizeof(header), 1, file) != 1
+            || fread(coordinates, sizeof(coordinates), 1, file) != 1) {
+        ret = feof(file) ? MSP_ERR_FILE_FORMAT : MSP_ERR_IO;
+        goto out;
+    }
+    if (header[1] > *max_children) {
+        p = realloc(*children, header[1] * sizeof(uint32_t));
+        if (p == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        *children = p;
+        *max_children = header[1];
+    }
+    if (fread(*children, sizeof(uint32_t), header[1], file) != header[1]) {
+        ret = feof(file) ? MSP_ERR_FILE_FORMAT : MSP_ERR_IO;
+        goto out;
+    }
+    record->population_id = header[0];
+    record->num_children = header[1];
+    record->node = header[2];
+    record->left = coordinates[0];
+    record->right = coordinates[1];
+    record->time = coordinates[2];
+    record->children = *children;
+out:
+    return ret;
+}
+
 int WARN_UNUSED
 msp_get_samples(msp_t *self, sample_t **samples)
 {
@@ -2755,6 +5576,7 @@ static int WARN_UNUSED
 msp_change_migration_matrix_entry(msp_t *self, size_t index, double rate)
 {
     int ret = 0;
+    size_t entry;
     size_t N = self->num_populations;
 
     if (index >= N * N) {
@@ -2765,7 +5587,14 @@ msp_change_migration_matrix_entry(msp_t *self, size_t index, double rate)
         ret = MSP_ERR_DIAGONAL_MIGRATION_MATRIX_INDEX;
         goto out;
     }
-    self->migration_matrix[index] = rate;
+    /* All entries that can be changed are in the sparsity pattern, so this
+     * is only an error if the event was added after initialisation. */
+    ret = migration_matrix_get_index(&self->migration_matrix,
+            (uint32_t) (index / N), (uint32_t) (index % N), &entry);
+    if (ret != 0) {
+        goto out;
+    }
+    migration_matrix_set_rate(&self->migration_matrix, entry, rate);
 out:
     return ret;
 }
@@ -2779,15 +5608,11 @@ msp_change_migration_rate(msp_t *self, demographic_event_t *event)
     int N = (int) self->num_populations;
 
     if (index == -1) {
-        for (index = 0; index < N * N; index++) {
-            if (index % (N + 1) != 0) {
-                ret = msp_change_migration_matrix_entry(self, (size_t) index,
-                        rate);
-                if (ret != 0) {
-                    goto out;
-                }
-            }
-        }
+        /* The sparsity pattern contains all off-diagonal entries when
+         * there are events of this type. */
+        assert(migration_matrix_get_num_entries(&self->migration_matrix)
+                == (size_t) (N * (N - 1)));
+        migration_matrix_set_all_rates(&self->migration_matrix, rate);
     } else {
         ret = msp_change_migration_matrix_entry(self, (size_t) index, rate);
         if (ret != 0) {
@@ -2851,8 +5676,8 @@ msp_mass_migration(msp_t *self, demographic_event_t *event)
     int dest = event->params.mass_migration.destination;
     double p = event->params.mass_migration.proportion;
     int N = (int) self->num_populations;
-    avl_node_t *node, *next;
-    avl_tree_t *pop;
+    size_t j;
+    lineage_set_t *pop;
 
     /* This should have been caught on adding the event */
     if (source < 0 || source > N || dest < 0 || dest > N) {
@@ -2860,19 +5685,19 @@ msp_mass_migration(msp_t *self, demographic_event_t *event)
         goto out;
     }
     /*
-     * Move lineages from source to dest with propabality p.
+     * Move lineages from source to dest with propabality p. We iterate
+     * backwards so that removing the lineage at j only moves lineages
+     * that we have already visited.
      */
     pop = &self->populations[source].ancestors;
-    node = pop->head;
-    while (node != NULL) {
-        next = node->next;
-        if (gsl_rng_uniform(self->rng) < p) {
-            ret = msp_move_individual(self, node, pop, (uint32_t) dest);
+    for (j = lineage_set_get_size(pop); j > 0; j--) {
+        if (msp_uniform(self) < p) {
+            ret = msp_move_individual(self, (uint32_t) source, j - 1,
+                    (uint32_t) dest);
             if (ret != 0) {
                 goto out;
             }
         }
-        node = next;
     }
 out:
     return ret;
@@ -2932,40 +5757,30 @@ msp_simple_bottleneck(msp_t *self, demographic_event_t *event)
     int population_id = event->params.simple_bottleneck.population_id;
     double p = event->params.simple_bottleneck.proportion;
     int N = (int) self->num_populations;
-    avl_node_t *node, *next, *q_node;
-    avl_tree_t *pop, Q;
-    segment_t *u;
+    size_t j;
+    lineage_set_t *pop;
+    uint32_t u;
 
     /* This should have been caught on adding the event */
     if (population_id < 0 || population_id > N) {
         ret = MSP_ERR_ASSERTION_FAILED;
         goto out;
     }
-    avl_init_tree(&Q, cmp_segment_queue, NULL);
     /*
      * Find the individuals that descend from the common ancestor
      * during this simple_bottleneck.
      */
     pop = &self->populations[population_id].ancestors;
-    node = pop->head;
-    while (node != NULL) {
-        next = node->next;
-        if (gsl_rng_uniform(self->rng) < p) {
-            u = (segment_t *) node->item;
-            avl_unlink_node(pop, node);
-            msp_free_avl_node(self, node);
-            q_node = msp_alloc_avl_node(self);
-            if (q_node == NULL) {
-                ret = MSP_ERR_NO_MEMORY;
+    for (j = lineage_set_get_size(pop); j > 0; j--) {
+        if (msp_uniform(self) < p) {
+            u = msp_remove_individual(self, (uint32_t) population_id, j - 1);
+            ret = msp_priority_queue_insert(self, u);
+            if (ret != 0) {
                 goto out;
             }
-            avl_init_node(q_node, u);
-            q_node = avl_insert_node(&Q, q_node);
-            assert(q_node != NULL);
         }
-        node = next;
     }
-    ret = msp_merge_ancestors(self, &Q, (uint32_t) population_id);
+    ret = msp_merge_ancestors(self, (uint32_t) population_id);
 out:
     return ret;
 }
@@ -3025,13 +5840,13 @@ msp_instantaneous_bottleneck(msp_t *self, demographic_event_t *event)
     int N = (int) self->num_populations;
     uint32_t *lineages = NULL;
     uint32_t *pi = NULL;
-    avl_node_t **avl_nodes = NULL;
-    avl_tree_t *sets = NULL;
-    uint32_t j, k, n, u, parent, num_roots;
+    uint32_t *first_member = NULL;
+    uint32_t *next_member = NULL;
+    uint32_t *members = NULL;
+    uint32_t j, k, m, n, u, parent, num_roots, num_members;
     double t;
-    avl_tree_t *pop;
-    avl_node_t *node, *set_node;
-    segment_t *individual;
+    lineage_set_t *pop;
+    uint32_t individual;
 
     /* This should have been caught on adding the event */
     if (population_id < 0 || population_id >= N) {
@@ -3039,13 +5854,14 @@ msp_instantaneous_bottleneck(msp_t *self, demographic_event_t *event)
         goto out;
     }
     pop = &self->populations[population_id].ancestors;
-    n = avl_count(pop);
-    lineages = malloc(n * sizeof(uint32_t));
-    avl_nodes = malloc(n * sizeof(avl_node_t *));
-    pi = malloc(2 * n * sizeof(uint32_t));
-    sets = malloc(2 * n * sizeof(avl_tree_t));
-    if (lineages == NULL || avl_nodes == NULL || pi == NULL
-            || sets == NULL) {
+    n = (uint32_t) lineage_set_get_size(pop);
+    lineages = msp_scratch_alloc(self, n * sizeof(uint32_t));
+    pi = msp_scratch_alloc(self, 2 * n * sizeof(uint32_t));
+    first_member = msp_scratch_alloc(self, 2 * n * sizeof(uint32_t));
+    next_member = msp_scratch_alloc(self, n * sizeof(uint32_t));
+    members = msp_scratch_alloc(self, n * sizeof(uint32_t));
+    if (lineages == NULL || pi == NULL || first_member == NULL
+            || next_member == NULL || members == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
@@ -3054,11 +5870,7 @@ msp_instantaneous_bottleneck(msp_t *self, demographic_event_t *event)
     }
     for (j = 0; j < 2 * n; j++) {
         pi[j] = MSP_NULL_NODE;
-    }
-    j = 0;
-    for (node = pop->head; node != NULL; node = node->next) {
-        avl_nodes[j] = node;
-        j++;
+        first_member[j] = 0;
     }
 
     /* Now we implement the Kingman coalescent for these lineages until we have
@@ -3076,69 +5888,57 @@ msp_instantaneous_bottleneck(msp_t *self, demographic_event_t *event)
         /* Note: there might be issues here if we have very large sample
          * sizes as the uniform_int has a limited range.
          */
-        k = (uint32_t) gsl_rng_uniform_int(self->rng, j);
+        k = (uint32_t) msp_uniform_int(self, j);
         pi[lineages[k]] = parent;
         lineages[k] = lineages[j];
         j--;
-        k = j > 0 ? (uint32_t) gsl_rng_uniform_int(self->rng, j): 0;
+        k = j > 0 ? (uint32_t) msp_uniform_int(self, j): 0;
         pi[lineages[k]] = parent;
         lineages[k] = parent;
         parent++;
     }
     num_roots = j + 1;
-    for (j = 0; j < num_roots; j++) {
-        if (lineages[j] >= n) {
-            avl_init_tree(&sets[lineages[j]], cmp_segment_queue, NULL);
-        }
-    }
 
     /* Assign each lineage to the set corresponding to a given root.
      * For any root < n, this lineages has not been affected, so we
-     * leave it alone.
+     * leave it alone. Lineage j is the individual at index j in the
+     * population; we iterate backwards so that removing an individual
+     * only moves individuals that we have already visited. The members
+     * of each set are kept in a linked list starting at first_member;
+     * member m is stored in members[m - 1], and 0 ends the list.
      */
-    for (j = 0; j < n; j++) {
-        u = j;
+    num_members = 0;
+    for (j = n; j > 0; j--) {
+        u = j - 1;
         while (pi[u] != MSP_NULL_NODE) {
             u = pi[u];
         }
         if (u >= n) {
             /* Remove this node from the population, and add it into the
              * set for the root at u */
-            individual = (segment_t *) avl_nodes[j]->item;
-            avl_unlink_node(pop, avl_nodes[j]);
-            msp_free_avl_node(self, avl_nodes[j]);
-            set_node = msp_alloc_avl_node(self);
-            if (set_node == NULL) {
-                ret = MSP_ERR_NO_MEMORY;
-                goto out;
-            }
-            avl_init_node(set_node, individual);
-            set_node = avl_insert_node(&sets[u], set_node);
-            assert(set_node != NULL);
+            individual = msp_remove_individual(self,
+                    (uint32_t) population_id, j - 1);
+            members[num_members] = individual;
+            next_member[num_members] = first_member[u];
+            num_members++;
+            first_member[u] = num_members;
         }
     }
     for (j = 0; j < num_roots; j++) {
         if (lineages[j] >= n) {
-            ret = msp_merge_ancestors(self, &sets[lineages[j]],
-                    (uint32_t) population_id);
+            for (m = first_member[lineages[j]]; m != 0; m = next_member[m - 1]) {
+                ret = msp_priority_queue_insert(self, members[m - 1]);
+                if (ret != 0) {
+                    goto out;
+                }
+            }
+            ret = msp_merge_ancestors(self, (uint32_t) population_id);
             if (ret != 0) {
                 goto out;
             }
         }
     }
 out:
-    if (lineages != NULL) {
-        free(lineages);
-    }
-    if (pi != NULL) {
-        free(pi);
-    }
-    if (sets != NULL) {
-        free(sets);
-    }
-    if (avl_nodes != NULL) {
-        free(avl_nodes);
-    }
     return ret;
 }
 
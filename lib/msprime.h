@@ -26,18 +26,39 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <time.h>
 
 #include <gsl/gsl_rng.h>
 
 #include "err.h"
 #include "avl.h"
+#include "btree.h"
 #include "fenwick.h"
+#include "lineage_set.h"
+#include "rate_tree.h"
+#include "migration_matrix.h"
+#include "priority_queue.h"
+#include "scratch.h"
+#include "rng.h"
 
 /* Flags for tree sequence dump/load */
 #define MSP_ZLIB_COMPRESSION 1
+#define MSP_NATIVE_FORMAT 2
+#define MSP_LOAD_LAZY 4
+#define MSP_VARINT_ENCODING 8
+
+/* Groups of columns in a tree sequence that can be loaded lazily */
+#define MSP_COLUMNS_NODES 1
+#define MSP_COLUMNS_RECORDS 2
+#define MSP_COLUMNS_MUTATIONS 4
+#define MSP_COLUMNS_PROVENANCE 8
+#define MSP_COLUMNS_ALL 15
 
 #define MSP_FILE_FORMAT_VERSION_MAJOR 3
-#define MSP_FILE_FORMAT_VERSION_MINOR 2
+#define MSP_FILE_FORMAT_VERSION_MINOR 3
+
+#define MSP_NATIVE_FORMAT_VERSION_MAJOR 1
+#define MSP_NATIVE_FORMAT_VERSION_MINOR 1
 
 /* Flags for simplify() */
 #define MSP_FILTER_ROOT_MUTATIONS 1
@@ -65,15 +86,18 @@
 /* Indicates the that the population ID has not been set. */
 #define MSP_NULL_POPULATION_ID UINT32_MAX
 
-typedef struct segment_t_t {
+/* Indicates the end of a segment chain. Segments are stored in a single
+ * array and linked by their indexes in it; index 0 is never used. */
+#define MSP_NULL_SEGMENT 0
+
+typedef struct {
     uint32_t population_id;
     /* During simulation we use genetic coordinates */
     uint32_t left;
     uint32_t right;
     uint32_t value;
-    size_t id;
-    struct segment_t_t *prev;
-    struct segment_t_t *next;
+    uint32_t prev;
+    uint32_t next;
 } segment_t;
 
 typedef struct {
@@ -88,6 +112,31 @@ typedef struct {
     uint32_t *children;
 } coalescence_record_t;
 
+/* Coalescence records stored by column, in the order that they were made.
+ * Coordinates are genetic loci. The children of each record follow those
+ * of the previous record in the children column, so a tree sequence can
+ * take over the node, num_children, children, left and right columns
+ * without copying them. */
+typedef struct {
+    size_t num_records;
+    size_t max_records;
+    size_t num_children_total;
+    size_t max_children_total;
+    uint32_t *left;
+    uint32_t *right;
+    uint32_t *node;
+    uint32_t *num_children;
+    uint32_t *population_id;
+    double *time;
+    uint32_t *children;
+} record_columns_t;
+
+/* Receives a batch of coalescence records that the simulator will not
+ * change again. The records and their children are only valid during the
+ * call. Returns 0 on success or an error code. */
+typedef int (*msp_record_sink_t)(void *arg, size_t num_records,
+        coalescence_record_t *records);
+
 typedef struct {
     uint32_t source;
     uint32_t dest;
@@ -97,19 +146,35 @@ typedef struct {
     double time;
 } migration_record_t;
 
+/* An ancestor in the left or right index of its population. The key holds
+ * the coordinate in the high 32 bits and the index of the ancestor's first
+ * segment in the low 32 bits. */
+typedef struct {
+    avl_node_t node;
+    uint64_t key;
+} overlap_node_t;
+
 typedef struct {
     uint32_t left; /* TODO CHANGE THIS - not a good name! */
     uint32_t value;
 } node_mapping_t;
 
+/* Each block added to an object heap is twice the size of the last, up
+ * to max_block_size objects. */
 typedef struct {
     size_t object_size;
-    size_t block_size; /* number of objects in a block */
+    size_t block_size; /* number of objects in the first block */
+    size_t next_block_size; /* number of objects in the next block */
+    size_t max_block_size;
     size_t top;
     size_t size;
     size_t num_blocks;
+    size_t high_water_mark; /* most objects allocated at any one time */
+    int flags;
     void **heap;
     char **mem_blocks;
+    size_t *mem_block_sizes;
+    bool *mem_block_mapped;
     void (*init_object)(void **obj, size_t index);
 } object_heap_t;
 
@@ -122,7 +187,13 @@ typedef struct {
     double initial_size;
     double growth_rate;
     double start_time;
-    avl_tree_t ancestors;
+    lineage_set_t ancestors;
+    /* For the SMC and SMC', the left and right ends of the ancestors'
+     * material in order, and the number of pairs of ancestors that can
+     * coalesce. */
+    avl_tree_t left_index;
+    avl_tree_t right_index;
+    uint64_t num_overlapping_pairs;
 } population_t;
 
 typedef struct {
@@ -131,19 +202,67 @@ typedef struct {
     uint32_t population_id;
 } sampling_event_t;
 
+/* The time in seconds spent on each type of event and in the phases of
+ * msp_merge_two_ancestors, and the peak sizes of the simulation state.
+ * These are only recorded if the library is compiled with MSP_PROFILE
+ * defined, and enabled says whether it was. The overlap node heap is
+ * measured by the heap itself, so its high water mark and fragmentation
+ * are always reported. */
+typedef struct {
+    bool enabled;
+    double recombination_time;
+    double common_ancestor_time;
+    double migration_time;
+    double demographic_time;
+    double sampling_time;
+    double merge_overlap_count_time;
+    double merge_compress_time;
+    double merge_defrag_time;
+    size_t max_num_ancestors;
+    size_t max_num_segments;
+    int64_t max_num_links;
+    size_t max_num_overlap_nodes;
+    double overlap_node_heap_fragmentation;
+} msp_profile_t;
+
+/* The marginal tree of the sequential engine, which simulates the SMC or
+ * SMC' from left to right along the sequence by pruning and regrafting a
+ * single tree at each recombination breakpoint. The samples occupy slots
+ * 0 to n - 1 and the internal nodes slots n to 2n - 2. A slot holds the
+ * node id used in the coalescence records and the left coordinate from
+ * which the node has had its current children. */
+typedef struct {
+    uint32_t root;
+    uint32_t position;
+    uint32_t *parent;
+    uint32_t *children;
+    uint32_t *id;
+    uint32_t *left;
+    double *time;
+    /* The times of the samples and internal nodes in increasing order, used
+     * to find the number of branches in the tree at a given time. */
+    double *sample_times;
+    double *internal_times;
+    uint32_t *lineages;
+} sequential_tree_t;
+
 typedef struct {
     gsl_rng *rng;
     /* input parameters */
     int model;
     bool store_migration_records;
+    bool sequential;
+    /* Back large object heap blocks with hugepages where possible */
+    bool hugepages;
     uint32_t sample_size;
     uint32_t num_loci;
     double scaled_recombination_rate;
     uint32_t num_populations;
     sample_t *samples;
-    double *initial_migration_matrix;
+    migration_matrix_t initial_migration_matrix;
     population_t *initial_populations;
-    /* allocation block sizes */
+    /* allocation block sizes. avl_node_block_size is no longer used, and
+     * is kept for compatibility. */
     size_t avl_node_block_size;
     size_t node_mapping_block_size;
     size_t segment_block_size;
@@ -152,9 +271,16 @@ typedef struct {
     size_t num_re_events;
     size_t num_ca_events;
     size_t num_rejected_ca_events;
+    /* The work done by msp_choose_overlapping_pair: the number of random
+     * pairs drawn and the number of walks of the left index. These are not
+     * checkpointed. */
+    size_t num_overlapping_pair_draws;
+    size_t num_overlapping_pair_walks;
+    /* Indexed by the entries of migration_matrix */
     size_t *num_migration_events;
     size_t num_trapped_re_events;
     size_t num_multiple_re_events;
+    msp_profile_t profile;
     /* sampling events */
     sampling_event_t *sampling_events;
     size_t num_sampling_events;
@@ -168,28 +294,83 @@ typedef struct {
     size_t used_memory;
     double time;
     uint32_t next_node;
-    double *migration_matrix;
+    sequential_tree_t sequential_tree;
+    /* The sparsity pattern of migration_matrix includes all entries in the
+     * initial matrix and all entries changed by demographic events. */
+    migration_matrix_t migration_matrix;
     population_t *populations;
-    avl_tree_t breakpoints;
-    avl_tree_t overlap_counts;
+    /* Both map loci to values: breakpoints records the loci at which
+     * recombinations have occurred and overlap_counts maps the left end of
+     * each interval to the number of lineages ancestral to it. */
+    btree_t breakpoints;
+    btree_t overlap_counts;
     fenwick_t links;
+    /* Event scheduling. Channel 0 of the event_rates tree is recombination,
+     * channels 1 to N are common ancestor events within each population and
+     * channels N + 1 to 2N are migrations out of each population. Common
+     * ancestor waiting times in populations with a non-constant size are
+     * not exponential, and these are drawn separately. */
+    rate_tree_t event_rates;
+    uint32_t *variable_rate_populations;
+    uint32_t num_variable_rate_populations;
     /* memory management */
-    object_heap_t avl_node_heap;
-    object_heap_t segment_heap;
-    object_heap_t node_mapping_heap;
-    object_heap_t binary_children_heap;
-    /* coalescence records are stored in a flat array */
-    coalescence_record_t *coalescence_records;
-    size_t num_coalescence_records;
-    size_t max_coalescence_records;
+    /* Segments are stored in a flat array, which grows as needed, so
+     * pointers to segments are invalidated by allocating a segment. The
+     * index of a segment is also its index in the links Fenwick tree.
+     * Free segments are chained through their next field. */
+    segment_t *segments;
+    /* For the SMC and SMC', the right end of the material of the ancestor
+     * whose first segment has this index. Grows with the segment array. */
+    uint32_t *lineage_ends;
+    size_t max_segments;
+    size_t num_segments;
+    size_t num_segment_blocks;
+    uint32_t free_segment;
+    /* The segments being merged by msp_merge_ancestors, keyed by left
+     * coordinate in the high 32 bits and index in the low 32 bits. The
+     * queue is reused across events and grows in blocks of
+     * node_mapping_block_size. */
+    priority_queue_t segment_queue;
+    size_t num_node_mapping_blocks;
+    /* Temporary memory needed while processing an event. This is released
+     * after every event. */
+    scratch_t scratch;
+    /* Random variates are drawn from rng in blocks */
+    rng_buffer_t variates;
+    /* The nodes of the populations' left and right indexes */
+    object_heap_t overlap_node_heap;
+    /* Coalescence records are stored by column. The children of each
+     * record are written directly into the children column. */
+    record_columns_t coalescence_records;
+    /* msp_get_coalescence_records returns this array of records that
+     * point into the columns. It is rebuilt on each call. */
+    coalescence_record_t *coalescence_record_view;
+    size_t max_coalescence_record_view;
     size_t coalescence_record_block_size;
     size_t num_coalescence_record_blocks;
+    /* If a sink is set, all but the last coalescence record are passed to
+     * it whenever the array fills, so that the array does not grow. The
+     * last record is kept because the next record may be squashed into it.
+     * If the sink is a spill file, tree_sequence_create reads the flushed
+     * records back from it. */
+    msp_record_sink_t coalescence_record_sink;
+    void *coalescence_record_sink_arg;
+    FILE *coalescence_record_spill_file;
+    size_t num_flushed_coalescence_records;
     /* migration records are stored in a flat array */
     migration_record_t *migration_records;
     size_t num_migration_records;
     size_t max_migration_records;
     size_t migration_record_block_size;
     size_t num_migration_record_blocks;
+    /* If checkpoint_path is set, msp_run writes a checkpoint to it after
+     * every checkpoint_interval_events events or checkpoint_interval_seconds
+     * seconds, whichever comes first. Zero disables either condition. */
+    char *checkpoint_path;
+    unsigned long checkpoint_interval_events;
+    double checkpoint_interval_seconds;
+    unsigned long events_since_checkpoint;
+    time_t last_checkpoint_time;
 } msp_t;
 
 /* Demographic events */
@@ -275,6 +456,17 @@ typedef struct {
             uint32_t *insertion_order;
             uint32_t *removal_order;
         } indexes;
+        /* The records in every interval'th tree, which are built when a
+         * tree first seeks (or by tree_sequence_build_snapshots) so that
+         * it can start from the nearest one.
+         * The records of snapshot j are records[offset[j]] to
+         * records[offset[j + 1] - 1], in time order. */
+        struct {
+            size_t interval;
+            size_t num_snapshots;
+            size_t *offset;
+            uint32_t *records;
+        } snapshots;
     } trees;
     struct {
         size_t num_records;
@@ -295,10 +487,26 @@ typedef struct {
         uint32_t *right;
         double *time;
     } migrations;
+    /* If the tree sequence was made by joining independent contigs end
+     * to end, contig j starts at coordinate offset[j] and its non-sample
+     * nodes start at node_offset[j]. */
+    struct {
+        size_t num_records;
+        double *offset;
+        uint32_t *node_offset;
+    } contigs;
     char **provenance_strings;
     size_t num_provenance_strings;
     size_t num_nodes;
     size_t num_child_nodes;
+    /* When loaded from a native format file, the columns point directly
+     * into this private mapping of the file. */
+    void *mmap_addr;
+    size_t mmap_size;
+    /* When loaded with MSP_LOAD_LAZY, the groups of columns that have not
+     * yet been read from lazy_filename. */
+    int lazy_columns;
+    char *lazy_filename;
     coalescence_record_t returned_record;
     /* The number of trees referencing this tree sequence.
      * This is NOT threadsafe! TODO when we want to have trees
@@ -462,6 +670,8 @@ int msp_alloc(msp_t *self, size_t sample_size, sample_t *samples, gsl_rng *rng);
 int msp_set_model(msp_t *self, int model);
 int msp_set_num_loci(msp_t *self, size_t num_loci);
 int msp_set_store_migration_records(msp_t *self, bool store_migration_records);
+int msp_set_sequential(msp_t *self, bool sequential);
+int msp_set_hugepages(msp_t *self, bool hugepages);
 int msp_set_num_populations(msp_t *self, size_t num_populations);
 int msp_set_scaled_recombination_rate(msp_t *self,
         double scaled_recombination_rate);
@@ -471,10 +681,17 @@ int msp_set_segment_block_size(msp_t *self, size_t block_size);
 int msp_set_avl_node_block_size(msp_t *self, size_t block_size);
 int msp_set_coalescence_record_block_size(msp_t *self, size_t block_size);
 int msp_set_migration_record_block_size(msp_t *self, size_t block_size);
+int msp_set_coalescence_record_sink(msp_t *self, msp_record_sink_t sink,
+        void *arg);
+int msp_set_coalescence_record_spill_file(msp_t *self, FILE *file);
+int msp_set_checkpoint_interval(msp_t *self, const char *path,
+        unsigned long num_events, double num_seconds);
 int msp_set_sample_configuration(msp_t *self, size_t num_populations,
         size_t *sample_configuration);
 int msp_set_migration_matrix(msp_t *self, size_t size,
         double *migration_matrix);
+int msp_set_sparse_migration_matrix(msp_t *self, size_t num_entries,
+        uint32_t *source, uint32_t *dest, double *rate);
 int msp_set_population_configuration(msp_t *self, int population_id,
         double initial_size, double growth_rate);
 
@@ -493,16 +710,24 @@ int msp_initialise(msp_t *self);
 int msp_run(msp_t *self, double max_time, unsigned long max_events);
 int msp_debug_demography(msp_t *self, double *end_time);
 int msp_reset(msp_t *self);
+int msp_flush_coalescence_records(msp_t *self);
+int msp_checkpoint(msp_t *self, const char *path);
+int msp_restore(msp_t *self, const char *path);
 int msp_print_state(msp_t *self, FILE *out);
 int msp_free(msp_t *self);
 void msp_verify(msp_t *self);
 
 int msp_get_ancestors(msp_t *self, segment_t **ancestors);
+segment_t * msp_get_next_segment(msp_t *self, segment_t *seg);
 int msp_get_breakpoints(msp_t *self, size_t *breakpoints);
 int msp_get_migration_matrix(msp_t *self, double *migration_matrix);
 int msp_get_num_migration_events(msp_t *self, size_t *num_migration_events);
+int msp_release_coalescence_records(msp_t *self, record_columns_t *records);
 int msp_get_coalescence_records(msp_t *self, coalescence_record_t **records);
 int msp_get_migration_records(msp_t *self, migration_record_t **records);
+int msp_write_coalescence_record(FILE *file, coalescence_record_t *record);
+int msp_read_coalescence_record(FILE *file, coalescence_record_t *record,
+        uint32_t **children, size_t *max_children);
 int msp_get_samples(msp_t *self, sample_t **samples);
 int msp_get_population_configuration(msp_t *self, size_t population_id,
         double *initial_size, double *growth_rate);
@@ -513,31 +738,42 @@ int msp_is_completed(msp_t *self);
 int msp_get_model(msp_t *self);
 const char * msp_get_model_str(msp_t *self);
 bool msp_get_store_migration_records(msp_t *self);
+bool msp_get_sequential(msp_t *self);
 size_t msp_get_sample_size(msp_t *self);
 size_t msp_get_num_loci(msp_t *self);
 size_t msp_get_num_populations(msp_t *self);
 size_t msp_get_num_ancestors(msp_t *self);
 size_t msp_get_num_breakpoints(msp_t *self);
 size_t msp_get_num_coalescence_records(msp_t *self);
+size_t msp_get_num_flushed_coalescence_records(msp_t *self);
 size_t msp_get_num_migration_records(msp_t *self);
 size_t msp_get_num_avl_node_blocks(msp_t *self);
 size_t msp_get_num_node_mapping_blocks(msp_t *self);
 size_t msp_get_num_segment_blocks(msp_t *self);
 size_t msp_get_num_coalescence_record_blocks(msp_t *self);
 size_t msp_get_num_migration_record_blocks(msp_t *self);
+size_t msp_get_num_transient_allocations(msp_t *self);
 size_t msp_get_used_memory(msp_t *self);
 size_t msp_get_num_common_ancestor_events(msp_t *self);
 size_t msp_get_num_rejected_common_ancestor_events(msp_t *self);
 size_t msp_get_num_recombination_events(msp_t *self);
+int msp_get_profile(msp_t *self, msp_profile_t *profile);
 
 void tree_sequence_print_state(tree_sequence_t *self, FILE *out);
 int tree_sequence_create(tree_sequence_t *self, msp_t *sim,
         recomb_map_t *recomb_map, double Ne);
+int tree_sequence_adopt_simulation(tree_sequence_t *self, msp_t *sim,
+        recomb_map_t *recomb_map, double Ne);
+int tree_sequence_join(tree_sequence_t *self, size_t num_contigs,
+        tree_sequence_t **contigs);
 int tree_sequence_load_records(tree_sequence_t *self,
         size_t num_records, coalescence_record_t *records);
 int tree_sequence_load(tree_sequence_t *self, const char *filename, int flags);
 int tree_sequence_free(tree_sequence_t *self);
 int tree_sequence_dump(tree_sequence_t *self, const char *filename, int flags);
+int tree_sequence_load_columns(tree_sequence_t *self, int columns);
+int tree_sequence_build_snapshots(tree_sequence_t *self);
+int tree_sequence_get_loaded_columns(tree_sequence_t *self);
 int tree_sequence_increment_refcount(tree_sequence_t *self);
 int tree_sequence_decrement_refcount(tree_sequence_t *self);
 size_t tree_sequence_get_num_coalescence_records(tree_sequence_t *self);
@@ -553,6 +789,9 @@ int tree_sequence_get_coalescence_record(tree_sequence_t *self, size_t index,
 int tree_sequence_get_migration_record(tree_sequence_t *self, size_t index,
         migration_record_t *record);
 int tree_sequence_get_mutations(tree_sequence_t *self, mutation_t **mutations);
+size_t tree_sequence_get_num_contigs(tree_sequence_t *self);
+int tree_sequence_get_contigs(tree_sequence_t *self, double **offset,
+        uint32_t **node_offset);
 int tree_sequence_get_sample(tree_sequence_t *self, uint32_t u,
         sample_t *sample);
 int tree_sequence_get_pairwise_diversity(tree_sequence_t *self,
@@ -605,6 +844,8 @@ int sparse_tree_first(sparse_tree_t *self);
 int sparse_tree_last(sparse_tree_t *self);
 int sparse_tree_next(sparse_tree_t *self);
 int sparse_tree_prev(sparse_tree_t *self);
+int sparse_tree_seek(sparse_tree_t *self, double position);
+int sparse_tree_seek_index(sparse_tree_t *self, size_t index);
 
 int newick_converter_alloc(newick_converter_t *self,
         tree_sequence_t *tree_sequence, size_t precision, double Ne);
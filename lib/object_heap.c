@@ -16,10 +16,22 @@
 ** You should have received a copy of the GNU General Public License
 ** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
 */
+/* Needed for MAP_ANONYMOUS and MADV_HUGEPAGE */
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 
+#ifdef __linux__
+#include <sys/mman.h>
+#if defined(MAP_ANONYMOUS) && defined(MADV_HUGEPAGE)
+#define OBJECT_HEAP_HAVE_HUGEPAGES
+#endif
+#endif
+
 #include "err.h"
 #include "object_heap.h"
 
@@ -31,31 +43,180 @@ object_heap_get_num_allocated(object_heap_t *self)
     return self->size - self->top;
 }
 
+size_t
+object_heap_get_high_water_mark(object_heap_t *self)
+{
+    return self->high_water_mark;
+}
+
+/*
+ * Returns the fraction of the objects in the heap's blocks that are not
+ * currently allocated.
+ */
+double
+object_heap_get_fragmentation(object_heap_t *self)
+{
+    double ret = 0.0;
+
+    if (self->size > 0) {
+        ret = (double) self->top / (double) self->size;
+    }
+    return ret;
+}
+
+/* Mapped blocks are rounded up to a whole number of hugepages. */
+static size_t
+object_heap_get_mapped_size(size_t size)
+{
+    return ((size + OBJECT_HEAP_HUGEPAGE_SIZE - 1) / OBJECT_HEAP_HUGEPAGE_SIZE)
+        * OBJECT_HEAP_HUGEPAGE_SIZE;
+}
+
+/*
+ * Returns the number of bytes held by the heap's blocks and bookkeeping.
+ */
+size_t
+object_heap_get_memory(object_heap_t *self)
+{
+    size_t j, block_memory;
+    size_t ret = self->size * sizeof(void *);
+
+    for (j = 0; j < self->num_blocks; j++) {
+        block_memory = self->mem_block_sizes[j] * self->object_size;
+        if (self->mem_block_mapped[j]) {
+            block_memory = object_heap_get_mapped_size(block_memory);
+        }
+        ret += block_memory + sizeof(char *) + sizeof(size_t) + sizeof(bool);
+    }
+    return ret;
+}
+
+/*
+ * Returns the number of bytes that the next call to object_heap_expand
+ * will add to the heap, not counting the rounding of mapped blocks.
+ */
+size_t
+object_heap_get_next_block_memory(object_heap_t *self)
+{
+    return sizeof(char *) + sizeof(size_t) + sizeof(bool)
+        + self->next_block_size * (self->object_size + sizeof(void *));
+}
+
+/*
+ * Sets the largest number of objects in a block. Blocks are never smaller
+ * than the initial block size.
+ */
+void
+object_heap_set_max_block_size(object_heap_t *self, size_t max_block_size)
+{
+    if (max_block_size < self->block_size) {
+        max_block_size = self->block_size;
+    }
+    self->max_block_size = max_block_size;
+    if (self->next_block_size > max_block_size) {
+        self->next_block_size = max_block_size;
+    }
+}
+
+/*
+ * Sets the flags used when allocating blocks. These only affect blocks
+ * added after the call.
+ */
+void
+object_heap_set_flags(object_heap_t *self, int flags)
+{
+    self->flags = flags;
+}
+
 void
 object_heap_print_state(object_heap_t *self, FILE *out)
 {
+    size_t j, num_mapped = 0;
+
+    for (j = 0; j < self->num_blocks; j++) {
+        num_mapped += self->mem_block_mapped[j];
+    }
     fprintf(out, "object heap %p::\n", (void *) self);
     fprintf(out, "\tsize = %d\n", (int) self->size);
     fprintf(out, "\ttop = %d\n", (int) self->top);
     fprintf(out, "\tblock_size = %d\n", (int) self->block_size);
+    fprintf(out, "\tnext_block_size = %d\n", (int) self->next_block_size);
+    fprintf(out, "\tmax_block_size = %d\n", (int) self->max_block_size);
     fprintf(out, "\tnum_blocks = %d\n", (int) self->num_blocks);
+    fprintf(out, "\tnum_mapped_blocks = %d\n", (int) num_mapped);
     fprintf(out, "\ttotal allocated = %d\n",
             (int) object_heap_get_num_allocated(self));
+    fprintf(out, "\thigh_water_mark = %d\n", (int) self->high_water_mark);
+    fprintf(out, "\tfragmentation = %f\n",
+            object_heap_get_fragmentation(self));
+    fprintf(out, "\tmemory = %d\n", (int) object_heap_get_memory(self));
+}
+
+/*
+ * Allocates memory for a block of the specified number of objects. Large
+ * blocks are mapped directly if hugepages are requested, and we fall back
+ * to malloc if this fails.
+ */
+static char *
+object_heap_alloc_block(object_heap_t *self, size_t num_objects, bool *mapped)
+{
+    char *ret = NULL;
+    size_t size = num_objects * self->object_size;
+#ifdef OBJECT_HEAP_HAVE_HUGEPAGES
+    void *p;
+
+    if ((self->flags & OBJECT_HEAP_HUGEPAGES)
+            && size >= OBJECT_HEAP_HUGEPAGE_SIZE) {
+        size = object_heap_get_mapped_size(size);
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            /* This is only advice, so we don't mind if it fails */
+            madvise(p, size, MADV_HUGEPAGE);
+            *mapped = true;
+            ret = p;
+            goto out;
+        }
+        size = num_objects * self->object_size;
+    }
+#endif
+    *mapped = false;
+    ret = malloc(size);
+#ifdef OBJECT_HEAP_HAVE_HUGEPAGES
+out:
+#endif
+    return ret;
 }
 
 static void
-object_heap_add_block(object_heap_t *self, char *mem_block)
+object_heap_free_block(object_heap_t *self, size_t block)
 {
-    size_t j, index;
+    char *mem = self->mem_blocks[block];
+
+    if (mem != NULL) {
+#ifdef OBJECT_HEAP_HAVE_HUGEPAGES
+        if (self->mem_block_mapped[block]) {
+            munmap(mem, object_heap_get_mapped_size(
+                        self->mem_block_sizes[block] * self->object_size));
+            return;
+        }
+#endif
+        free(mem);
+    }
+}
 
-    for (j = 0; j < self->block_size; j++) {
+static void
+object_heap_add_block(object_heap_t *self, char *mem_block, size_t block_size)
+{
+    size_t j;
+
+    for (j = 0; j < block_size; j++) {
         self->heap[j] = mem_block + j * self->object_size;
         if (self->init_object != NULL) {
-            index = j + (self->num_blocks - 1) * self->block_size;
-            self->init_object(self->heap[j], index);
+            self->init_object(self->heap[j], self->size - block_size + j);
         }
     }
-    self->top = self->block_size;
+    self->top = block_size;
 }
 
 int WARN_UNUSED
@@ -63,19 +224,35 @@ object_heap_expand(object_heap_t *self)
 {
     int ret = -1;
     void *p;
+    size_t block_size = self->next_block_size;
+    size_t n = self->num_blocks + 1;
 
-    p = realloc(self->mem_blocks, (self->num_blocks + 1) * sizeof(void *));
+    p = realloc(self->mem_blocks, n * sizeof(char *));
     if (p == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
     self->mem_blocks = p;
-    p = malloc(self->block_size * self->object_size);
+    p = realloc(self->mem_block_sizes, n * sizeof(size_t));
+    if (p == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    self->mem_block_sizes = p;
+    p = realloc(self->mem_block_mapped, n * sizeof(bool));
+    if (p == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    self->mem_block_mapped = p;
+    p = object_heap_alloc_block(self, block_size,
+            &self->mem_block_mapped[self->num_blocks]);
     if (p == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
     self->mem_blocks[self->num_blocks] = p;
+    self->mem_block_sizes[self->num_blocks] = block_size;
     self->num_blocks++;
     /* Now we increase the size of the heap. Since it is currently empty,
      * we avoid the copying cost of realloc and free before making a new
@@ -83,13 +260,19 @@ object_heap_expand(object_heap_t *self)
      */
     free(self->heap);
     self->heap = NULL;
-    self->size += self->block_size;
+    self->size += block_size;
     self->heap = malloc(self->size * sizeof(void *));
     if (self->heap == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    object_heap_add_block(self, p);
+    object_heap_add_block(self, p, block_size);
+    /* Double the block size each time, so that the number of expansions
+     * is logarithmic in the size of the heap. */
+    self->next_block_size = 2 * block_size;
+    if (self->next_block_size > self->max_block_size) {
+        self->next_block_size = self->max_block_size;
+    }
     ret = 0;
 out:
     return ret;
@@ -102,12 +285,14 @@ inline void * WARN_UNUSED
 object_heap_get_object(object_heap_t *self, size_t index)
 {
     void *ret = NULL;
-    size_t block, obj;
+    size_t block;
 
-    block = index / self->block_size;
-    obj = index % self->block_size;
-    if (block < self->num_blocks && obj < self->block_size) {
-        ret = self->mem_blocks[block] + obj * self->object_size;
+    for (block = 0; block < self->num_blocks; block++) {
+        if (index < self->mem_block_sizes[block]) {
+            ret = self->mem_blocks[block] + index * self->object_size;
+            break;
+        }
+        index -= self->mem_block_sizes[block];
     }
     return ret;
 }
@@ -126,6 +311,9 @@ object_heap_alloc_object(object_heap_t *self)
     if (self->top > 0) {
         self->top--;
         ret = self->heap[self->top];
+        if (self->size - self->top > self->high_water_mark) {
+            self->high_water_mark = self->size - self->top;
+        }
     }
     return ret;
 }
@@ -142,30 +330,13 @@ int WARN_UNUSED
 object_heap_init(object_heap_t *self, size_t object_size, size_t block_size,
         void (*init_object)(void **, size_t))
 {
-    int ret = -1;
-
     memset(self, 0, sizeof(object_heap_t));
     self->block_size = block_size;
-    self->size = block_size;
+    self->next_block_size = block_size;
+    self->max_block_size = SIZE_MAX;
     self->object_size = object_size;
     self->init_object = init_object;
-    self->num_blocks = 1;
-    self->heap = malloc(self->size * sizeof(void *));
-    self->mem_blocks = malloc(sizeof(void *));
-    if (self->heap == NULL || self->mem_blocks == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
-    }
-    self->mem_blocks[0] = malloc(self->size * self->object_size);
-    if (self->mem_blocks[0] == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
-    }
-    self->top = 0;
-    object_heap_add_block(self, self->mem_blocks[0]);
-    ret = 0;
-out:
-    return ret;
+    return object_heap_expand(self);
 }
 
 void
@@ -175,12 +346,16 @@ object_heap_free(object_heap_t *self)
 
     if (self->mem_blocks != NULL) {
         for (j = 0; j < self->num_blocks; j++) {
-            if (self->mem_blocks[j] != NULL) {
-                free(self->mem_blocks[j]);
-            }
+            object_heap_free_block(self, j);
         }
         free(self->mem_blocks);
     }
+    if (self->mem_block_sizes != NULL) {
+        free(self->mem_block_sizes);
+    }
+    if (self->mem_block_mapped != NULL) {
+        free(self->mem_block_mapped);
+    }
     if (self->heap != NULL) {
         free(self->heap);
     }
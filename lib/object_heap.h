@@ -26,7 +26,21 @@
 
 #include "msprime.h"
 
+/* Back blocks of at least OBJECT_HEAP_HUGEPAGE_SIZE bytes with anonymous
+ * mappings that the kernel is advised to place in transparent hugepages.
+ * This is ignored on systems that do not support it. */
+#define OBJECT_HEAP_HUGEPAGES 1
+
+#define OBJECT_HEAP_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
 extern size_t object_heap_get_num_allocated(object_heap_t *self);
+extern size_t object_heap_get_high_water_mark(object_heap_t *self);
+extern double object_heap_get_fragmentation(object_heap_t *self);
+extern size_t object_heap_get_memory(object_heap_t *self);
+extern size_t object_heap_get_next_block_memory(object_heap_t *self);
+extern void object_heap_set_max_block_size(object_heap_t *self,
+        size_t max_block_size);
+extern void object_heap_set_flags(object_heap_t *self, int flags);
 extern void object_heap_print_state(object_heap_t *self, FILE *out);
 extern int object_heap_expand(object_heap_t *self);
 extern void * object_heap_get_object(object_heap_t *self, size_t index);
@@ -0,0 +1,164 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * d-ary min-heap. The children of the key at index j are at indexes
+ * d * j + 1, ..., d * j + d. A wider heap is shallower than a binary heap,
+ * and the children of a node share a cache line.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "err.h"
+#include "priority_queue.h"
+
+int WARN_UNUSED
+priority_queue_alloc(priority_queue_t *self, size_t initial_size)
+{
+    int ret = 0;
+
+    self->size = 0;
+    self->max_size = initial_size;
+    self->keys = NULL;
+    if (initial_size > 0) {
+        self->keys = malloc(initial_size * sizeof(uint64_t));
+        if (self->keys == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+        }
+    }
+    return ret;
+}
+
+int WARN_UNUSED
+priority_queue_expand(priority_queue_t *self, size_t increment)
+{
+    int ret = 0;
+    void *p;
+
+    p = realloc(self->keys, (self->max_size + increment) * sizeof(uint64_t));
+    if (p == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    self->keys = p;
+    self->max_size += increment;
+out:
+    return ret;
+}
+
+int
+priority_queue_free(priority_queue_t *self)
+{
+    if (self->keys != NULL) {
+        free(self->keys);
+        self->keys = NULL;
+    }
+    self->size = 0;
+    self->max_size = 0;
+    return 0;
+}
+
+size_t
+priority_queue_get_size(priority_queue_t *self)
+{
+    return self->size;
+}
+
+int
+priority_queue_is_full(priority_queue_t *self)
+{
+    return self->size == self->max_size;
+}
+
+void
+priority_queue_push(priority_queue_t *self, uint64_t key)
+{
+    uint64_t *keys = self->keys;
+    size_t j, parent;
+
+    assert(self->size < self->max_size);
+    j = self->size;
+    self->size++;
+    while (j > 0) {
+        parent = (j - 1) / PRIORITY_QUEUE_ARITY;
+        if (keys[parent] <= key) {
+            break;
+        }
+        keys[j] = keys[parent];
+        j = parent;
+    }
+    keys[j] = key;
+}
+
+uint64_t
+priority_queue_peek(priority_queue_t *self)
+{
+    assert(self->size > 0);
+    return self->keys[0];
+}
+
+/* Removes and returns the smallest key. */
+uint64_t
+priority_queue_pop(priority_queue_t *self)
+{
+    uint64_t *keys = self->keys;
+    uint64_t ret, key;
+    size_t j, k, child, last_child;
+
+    assert(self->size > 0);
+    ret = keys[0];
+    self->size--;
+    key = keys[self->size];
+    /* Sift the last key down from the root. */
+    j = 0;
+    while (true) {
+        child = PRIORITY_QUEUE_ARITY * j + 1;
+        if (child >= self->size) {
+            break;
+        }
+        last_child = child + PRIORITY_QUEUE_ARITY;
+        if (last_child > self->size) {
+            last_child = self->size;
+        }
+        for (k = child + 1; k < last_child; k++) {
+            if (keys[k] < keys[child]) {
+                child = k;
+            }
+        }
+        if (key <= keys[child]) {
+            break;
+        }
+        keys[j] = keys[child];
+        j = child;
+    }
+    keys[j] = key;
+    return ret;
+}
+
+void
+priority_queue_clear(priority_queue_t *self)
+{
+    self->size = 0;
+}
@@ -0,0 +1,48 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PRIORITY_QUEUE_H__
+#define __PRIORITY_QUEUE_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define PRIORITY_QUEUE_ARITY 4
+
+/* An array-backed d-ary min-heap of uint64_t keys. Composite keys can be
+ * packed into the high and low 32 bits to order on one value and break
+ * ties on the other.
+ */
+typedef struct {
+    size_t size;
+    size_t max_size;
+    uint64_t *keys;
+} priority_queue_t;
+
+int priority_queue_alloc(priority_queue_t *, size_t);
+int priority_queue_expand(priority_queue_t *, size_t);
+int priority_queue_free(priority_queue_t *);
+size_t priority_queue_get_size(priority_queue_t *);
+int priority_queue_is_full(priority_queue_t *);
+void priority_queue_push(priority_queue_t *, uint64_t);
+uint64_t priority_queue_peek(priority_queue_t *);
+uint64_t priority_queue_pop(priority_queue_t *);
+void priority_queue_clear(priority_queue_t *);
+
+#endif /*__PRIORITY_QUEUE_H__*/
@@ -0,0 +1,135 @@
+/*
+** Copyright (C) 2017 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "err.h"
+#include "radix_sort.h"
+
+/*
+ * Sorts the n keys into increasing order, moving the values with them.
+ * The sort is stable, so values with equal keys keep their input order.
+ * Digits on which all keys agree are skipped, so that small keys cost
+ * only as many passes as they have significant bytes.
+ */
+int WARN_UNUSED
+radix_sort(size_t n, uint64_t *keys, uint32_t *values)
+{
+    int ret = 0;
+    size_t j, d, digit, sum, count;
+    size_t (*counts)[RADIX_SORT_NUM_BUCKETS] = NULL;
+    uint64_t *src_keys, *dest_keys, *swap_keys, *tmp_keys = NULL;
+    uint32_t *src_values, *dest_values, *swap_values, *tmp_values = NULL;
+    unsigned int shift;
+
+    if (n < 2) {
+        goto out;
+    }
+    counts = calloc(RADIX_SORT_NUM_DIGITS, sizeof(*counts));
+    tmp_keys = malloc(n * sizeof(uint64_t));
+    tmp_values = malloc(n * sizeof(uint32_t));
+    if (counts == NULL || tmp_keys == NULL || tmp_values == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    /* Count all the digits in a single pass over the keys */
+    for (j = 0; j < n; j++) {
+        for (d = 0; d < RADIX_SORT_NUM_DIGITS; d++) {
+            digit = (size_t) (keys[j] >> (d * RADIX_SORT_DIGIT_BITS))
+                & (RADIX_SORT_NUM_BUCKETS - 1);
+            counts[d][digit]++;
+        }
+    }
+    src_keys = keys;
+    src_values = values;
+    dest_keys = tmp_keys;
+    dest_values = tmp_values;
+    for (d = 0; d < RADIX_SORT_NUM_DIGITS; d++) {
+        shift = (unsigned int) (d * RADIX_SORT_DIGIT_BITS);
+        digit = (size_t) (src_keys[0] >> shift) & (RADIX_SORT_NUM_BUCKETS - 1);
+        if (counts[d][digit] == n) {
+            continue;
+        }
+        /* Turn the counts into the starting offset of each bucket */
+        sum = 0;
+        for (digit = 0; digit < RADIX_SORT_NUM_BUCKETS; digit++) {
+            count = counts[d][digit];
+            counts[d][digit] = sum;
+            sum += count;
+        }
+        for (j = 0; j < n; j++) {
+            digit = (size_t) (src_keys[j] >> shift)
+                & (RADIX_SORT_NUM_BUCKETS - 1);
+            dest_keys[counts[d][digit]] = src_keys[j];
+            dest_values[counts[d][digit]] = src_values[j];
+            counts[d][digit]++;
+        }
+        swap_keys = src_keys;
+        src_keys = dest_keys;
+        dest_keys = swap_keys;
+        swap_values = src_values;
+        src_values = dest_values;
+        dest_values = swap_values;
+    }
+    if (src_keys != keys) {
+        memcpy(keys, src_keys, n * sizeof(uint64_t));
+        memcpy(values, src_values, n * sizeof(uint32_t));
+    }
+out:
+    if (counts != NULL) {
+        free(counts);
+    }
+    if (tmp_keys != NULL) {
+        free(tmp_keys);
+    }
+    if (tmp_values != NULL) {
+        free(tmp_values);
+    }
+    return ret;
+}
+
+/*
+ * Returns a key whose unsigned order is the same as the numerical order
+ * of the specified value, which must not be NaN. Positive values have the
+ * sign bit set and negative values have all their bits inverted.
+ */
+uint64_t
+radix_sort_double_key(double value)
+{
+    uint64_t bits;
+
+    /* Both zeros map to the same key */
+    if (value == 0.0) {
+        value = 0.0;
+    }
+    memcpy(&bits, &value, sizeof(bits));
+    if (bits >> 63) {
+        bits = ~bits;
+    } else {
+        bits |= (uint64_t) 1 << 63;
+    }
+    return bits;
+}
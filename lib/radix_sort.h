@@ -0,0 +1,34 @@
+/*
+** Copyright (C) 2017 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __RADIX_SORT_H__
+#define __RADIX_SORT_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Keys are sorted one byte at a time, least significant first. */
+#define RADIX_SORT_DIGIT_BITS 8
+#define RADIX_SORT_NUM_BUCKETS (1 << RADIX_SORT_DIGIT_BITS)
+#define RADIX_SORT_NUM_DIGITS (64 / RADIX_SORT_DIGIT_BITS)
+
+int radix_sort(size_t, uint64_t *, uint32_t *);
+uint64_t radix_sort_double_key(double);
+
+#endif /*__RADIX_SORT_H__*/
@@ -0,0 +1,135 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Sum tree of event rates, used to choose between competing event types
+ * in proportion to their rates. Internal nodes are recomputed from their
+ * children on every update rather than incremented, so that rounding
+ * errors do not accumulate over the course of a simulation.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "err.h"
+#include "rate_tree.h"
+
+int WARN_UNUSED
+rate_tree_alloc(rate_tree_t *self, size_t size)
+{
+    int ret = 0;
+
+    assert(size > 0);
+    self->size = size;
+    self->num_leaves = 1;
+    while (self->num_leaves < size) {
+        self->num_leaves *= 2;
+    }
+    /* Node 1 is the root and the children of node j are 2j and 2j + 1,
+     * so the leaves occupy nodes num_leaves to 2 * num_leaves - 1. */
+    self->nodes = calloc(2 * self->num_leaves, sizeof(double));
+    if (self->nodes == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+    }
+    return ret;
+}
+
+int
+rate_tree_free(rate_tree_t *self)
+{
+    if (self->nodes != NULL) {
+        free(self->nodes);
+        self->nodes = NULL;
+    }
+    return 0;
+}
+
+size_t
+rate_tree_get_size(rate_tree_t *self)
+{
+    return self->size;
+}
+
+double
+rate_tree_get_total(rate_tree_t *self)
+{
+    return self->nodes[1];
+}
+
+double
+rate_tree_get_value(rate_tree_t *self, size_t index)
+{
+    assert(index < self->size);
+    return self->nodes[self->num_leaves + index];
+}
+
+void
+rate_tree_set_value(rate_tree_t *self, size_t index, double value)
+{
+    size_t j = self->num_leaves + index;
+
+    assert(index < self->size);
+    assert(value >= 0.0);
+    self->nodes[j] = value;
+    while (j > 1) {
+        j /= 2;
+        self->nodes[j] = self->nodes[2 * j] + self->nodes[2 * j + 1];
+    }
+}
+
+void
+rate_tree_clear(rate_tree_t *self)
+{
+    size_t j;
+
+    for (j = 0; j < 2 * self->num_leaves; j++) {
+        self->nodes[j] = 0.0;
+    }
+}
+
+/*
+ * Returns the index of the leaf whose interval in the cumulative sum of
+ * the rates contains x, where 0 <= x < total. Leaves with zero rate are
+ * never returned, even if rounding pushes x past the end of the last
+ * non-zero interval.
+ */
+size_t
+rate_tree_find(rate_tree_t *self, double x)
+{
+    size_t j = 1;
+    double s = x;
+    double left, right;
+
+    assert(self->nodes[1] > 0.0);
+    while (j < self->num_leaves) {
+        left = self->nodes[2 * j];
+        right = self->nodes[2 * j + 1];
+        if (right == 0.0 || (s < left && left > 0.0)) {
+            j = 2 * j;
+        } else {
+            s -= left;
+            j = 2 * j + 1;
+        }
+    }
+    return j - self->num_leaves;
+}
@@ -0,0 +1,43 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __RATE_TREE_H__
+#define __RATE_TREE_H__
+
+#include <stdlib.h>
+
+/* A complete binary tree of non-negative rates in which each internal
+ * node holds the sum of its children. Leaves are indexed from 0.
+ */
+typedef struct {
+    size_t size;
+    size_t num_leaves;
+    double *nodes;
+} rate_tree_t;
+
+int rate_tree_alloc(rate_tree_t *, size_t);
+int rate_tree_free(rate_tree_t *);
+size_t rate_tree_get_size(rate_tree_t *);
+double rate_tree_get_total(rate_tree_t *);
+double rate_tree_get_value(rate_tree_t *, size_t);
+void rate_tree_set_value(rate_tree_t *, size_t, double);
+void rate_tree_clear(rate_tree_t *);
+size_t rate_tree_find(rate_tree_t *, double);
+
+#endif /*__RATE_TREE_H__*/
@@ -0,0 +1,299 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* open_memstream */
+#define _POSIX_C_SOURCE 200809L
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+#include <assert.h>
+
+#include "err.h"
+#include "replicates.h"
+
+static int WARN_UNUSED
+replicate_worker_alloc(replicate_worker_t *self, replicate_driver_t *driver,
+        replicate_configure_func configure, void *arg)
+{
+    int ret = MSP_ERR_NO_MEMORY;
+
+    memset(self, 0, sizeof(replicate_worker_t));
+    self->driver = driver;
+    self->rng = gsl_rng_alloc(rng_philox);
+    if (self->rng == NULL) {
+        goto out;
+    }
+    self->out = open_memstream(&self->buffer, &self->buffer_size);
+    if (self->out == NULL) {
+        ret = MSP_ERR_IO;
+        goto out;
+    }
+    ret = configure(&self->msp, &self->recomb_map, self->rng, arg);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_initialise(&self->msp);
+out:
+    return ret;
+}
+
+static void
+replicate_worker_free(replicate_worker_t *self)
+{
+    /* configure may have failed part way through, and both of these
+     * are safe to call on partially allocated objects. */
+    msp_free(&self->msp);
+    recomb_map_free(&self->recomb_map);
+    if (self->out != NULL) {
+        fclose(self->out);
+    }
+    if (self->buffer != NULL) {
+        free(self->buffer);
+    }
+    if (self->rng != NULL) {
+        gsl_rng_free(self->rng);
+    }
+}
+
+/* Simulates the specified replicate and writes its summary to the worker's
+ * output buffer.
+ */
+static int WARN_UNUSED
+replicate_worker_simulate(replicate_worker_t *self, size_t replicate)
+{
+    int ret = 0;
+    replicate_driver_t *driver = self->driver;
+    bool tree_sequence_created = false;
+    bool mutgen_allocated = false;
+
+    ret = rng_set_stream(self->rng, driver->seed, (uint32_t) replicate, 0);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_reset(&self->msp);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = 1;
+    while (ret == 1) {
+        ret = msp_run(&self->msp, DBL_MAX, ULONG_MAX);
+    }
+    if (ret != 0) {
+        goto out;
+    }
+    memset(&self->tree_sequence, 0, sizeof(tree_sequence_t));
+    ret = tree_sequence_adopt_simulation(&self->tree_sequence, &self->msp,
+            &self->recomb_map, driver->Ne);
+    if (ret != 0) {
+        goto out;
+    }
+    tree_sequence_created = true;
+    ret = mutgen_alloc(&self->mutgen, &self->tree_sequence,
+            driver->mutation_rate, self->rng);
+    mutgen_allocated = true;
+    if (ret != 0) {
+        goto out;
+    }
+    ret = mutgen_generate(&self->mutgen);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = tree_sequence_set_mutations(&self->tree_sequence,
+            self->mutgen.num_mutations, self->mutgen.mutations);
+    if (ret != 0) {
+        goto out;
+    }
+    if (fseek(self->out, 0, SEEK_SET) != 0) {
+        ret = MSP_ERR_IO;
+        goto out;
+    }
+    ret = driver->summarise(&self->tree_sequence, replicate, self->out,
+            driver->arg);
+    if (ret != 0) {
+        goto out;
+    }
+    if (fflush(self->out) != 0) {
+        ret = MSP_ERR_IO;
+        goto out;
+    }
+out:
+    if (mutgen_allocated) {
+        mutgen_free(&self->mutgen);
+    }
+    if (tree_sequence_created) {
+        tree_sequence_free(&self->tree_sequence);
+    }
+    return ret;
+}
+
+static void *
+replicate_worker_run(void *arg)
+{
+    replicate_worker_t *self = (replicate_worker_t *) arg;
+    replicate_driver_t *driver = self->driver;
+    size_t replicate;
+    long length;
+    int err;
+
+    pthread_mutex_lock(&driver->mutex);
+    while (driver->error == 0
+            && driver->next_replicate < driver->num_replicates) {
+        replicate = driver->next_replicate;
+        driver->next_replicate++;
+        pthread_mutex_unlock(&driver->mutex);
+
+        err = replicate_worker_simulate(self, replicate);
+
+        pthread_mutex_lock(&driver->mutex);
+        /* Replicates are claimed in order, so we never wait for long
+         * here: every replicate before this one is already running. */
+        while (driver->error == 0 && driver->next_output != replicate) {
+            pthread_cond_wait(&driver->cond, &driver->mutex);
+        }
+        if (err == 0 && driver->error == 0) {
+            length = ftell(self->out);
+            if (length < 0 || fwrite(self->buffer, 1, (size_t) length,
+                        driver->output) != (size_t) length) {
+                err = MSP_ERR_IO;
+            }
+        }
+        if (err != 0 && driver->error == 0) {
+            driver->error = err;
+        }
+        driver->next_output++;
+        pthread_cond_broadcast(&driver->cond);
+    }
+    pthread_mutex_unlock(&driver->mutex);
+    return NULL;
+}
+
+int WARN_UNUSED
+replicate_driver_alloc(replicate_driver_t *self, size_t num_threads,
+        unsigned long seed, double mutation_rate, double Ne,
+        replicate_configure_func configure,
+        replicate_summarise_func summarise, void *arg)
+{
+    int ret = 0;
+    size_t j;
+
+    memset(self, 0, sizeof(replicate_driver_t));
+    if (num_threads < 1 || configure == NULL || summarise == NULL
+            || mutation_rate < 0 || Ne <= 0) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    self->seed = seed;
+    self->mutation_rate = mutation_rate;
+    self->Ne = Ne;
+    self->summarise = summarise;
+    self->arg = arg;
+    if (pthread_mutex_init(&self->mutex, NULL) != 0) {
+        ret = MSP_ERR_THREAD;
+        goto out;
+    }
+    if (pthread_cond_init(&self->cond, NULL) != 0) {
+        pthread_mutex_destroy(&self->mutex);
+        ret = MSP_ERR_THREAD;
+        goto out;
+    }
+    self->workers = calloc(num_threads, sizeof(replicate_worker_t));
+    if (self->workers == NULL) {
+        pthread_cond_destroy(&self->cond);
+        pthread_mutex_destroy(&self->mutex);
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    /* The workers are configured here rather than on their threads so
+     * that configuration errors are reported before anything is run. */
+    for (j = 0; j < num_threads; j++) {
+        self->num_threads++;
+        ret = replicate_worker_alloc(&self->workers[j], self, configure, arg);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+out:
+    return ret;
+}
+
+int
+replicate_driver_free(replicate_driver_t *self)
+{
+    size_t j;
+
+    if (self->workers != NULL) {
+        for (j = 0; j < self->num_threads; j++) {
+            replicate_worker_free(&self->workers[j]);
+        }
+        free(self->workers);
+        self->workers = NULL;
+        pthread_cond_destroy(&self->cond);
+        pthread_mutex_destroy(&self->mutex);
+    }
+    return 0;
+}
+
+int WARN_UNUSED
+replicate_driver_run(replicate_driver_t *self, size_t num_replicates,
+        FILE *output)
+{
+    int ret = 0;
+    size_t j, num_started;
+
+    /* Replicate indexes select 32 bit Philox streams */
+    if (num_replicates > UINT32_MAX) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    self->output = output;
+    self->num_replicates = num_replicates;
+    self->next_replicate = 0;
+    self->next_output = 0;
+    self->error = 0;
+    for (num_started = 0; num_started < self->num_threads; num_started++) {
+        if (pthread_create(&self->workers[num_started].thread, NULL,
+                    replicate_worker_run, &self->workers[num_started]) != 0) {
+            /* Stop the threads that are already running. */
+            pthread_mutex_lock(&self->mutex);
+            self->error = MSP_ERR_THREAD;
+            pthread_cond_broadcast(&self->cond);
+            pthread_mutex_unlock(&self->mutex);
+            break;
+        }
+    }
+    for (j = 0; j < num_started; j++) {
+        if (pthread_join(self->workers[j].thread, NULL) != 0) {
+            self->error = MSP_ERR_THREAD;
+        }
+    }
+    ret = self->error;
+    if (ret == 0 && fflush(output) != 0) {
+        ret = MSP_ERR_IO;
+    }
+out:
+    return ret;
+}
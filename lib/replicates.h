@@ -0,0 +1,86 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __REPLICATES_H__
+#define __REPLICATES_H__
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include <gsl/gsl_rng.h>
+
+#include "msprime.h"
+#include "rng.h"
+
+/* Allocates and configures the simulator and recombination map for a
+ * single worker. The simulator must be allocated with the specified rng;
+ * it is initialised by the driver afterwards. */
+typedef int (*replicate_configure_func)(msp_t *msp, recomb_map_t *recomb_map,
+        gsl_rng *rng, void *arg);
+/* Writes the output for a completed replicate to out. Called concurrently
+ * from the worker threads, so must not modify any shared state. */
+typedef int (*replicate_summarise_func)(tree_sequence_t *tree_sequence,
+        size_t replicate, FILE *out, void *arg);
+
+typedef struct {
+    gsl_rng *rng;
+    msp_t msp;
+    recomb_map_t recomb_map;
+    tree_sequence_t tree_sequence;
+    mutgen_t mutgen;
+    FILE *out;
+    char *buffer;
+    size_t buffer_size;
+    pthread_t thread;
+    struct replicate_driver_t_t *driver;
+} replicate_worker_t;
+
+/* Runs independent replicates of a simulation on a pool of threads. Each
+ * thread owns a simulator, and replicate j is always simulated using
+ * stream (seed, j, 0) of a Philox generator, so the output depends only
+ * on the seed and not on the number of threads or scheduling. Output is
+ * written in replicate order.
+ */
+typedef struct replicate_driver_t_t {
+    size_t num_threads;
+    unsigned long seed;
+    double mutation_rate;
+    double Ne;
+    replicate_summarise_func summarise;
+    void *arg;
+    replicate_worker_t *workers;
+    /* The following are protected by mutex */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    FILE *output;
+    size_t num_replicates;
+    size_t next_replicate;
+    size_t next_output;
+    int error;
+} replicate_driver_t;
+
+int replicate_driver_alloc(replicate_driver_t *self, size_t num_threads,
+        unsigned long seed, double mutation_rate, double Ne,
+        replicate_configure_func configure,
+        replicate_summarise_func summarise, void *arg);
+int replicate_driver_free(replicate_driver_t *self);
+int replicate_driver_run(replicate_driver_t *self, size_t num_replicates,
+        FILE *output);
+
+#endif /*__REPLICATES_H__*/
@@ -0,0 +1,471 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include <gsl/gsl_randist.h>
+
+#include "err.h"
+#include "rng.h"
+
+/* The AVX2 kernels are compiled with a target attribute and selected at
+ * run time, so they do not need any special compiler flags. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RNG_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+#define PHILOX_ROUNDS 10
+
+/* Constants for the logarithm, from the fdlibm implementation. */
+#define LOG_LN2_HI 6.93147180369123816490e-01
+#define LOG_LN2_LO 1.90821492927058770002e-10
+#define LOG_LG1 6.666666666666735130e-01
+#define LOG_LG2 3.999999999940941908e-01
+#define LOG_LG3 2.857142874366239149e-01
+#define LOG_LG4 2.222219843214978396e-01
+#define LOG_LG5 1.818357216161805012e-01
+#define LOG_LG6 1.531383769920937332e-01
+#define LOG_LG7 1.479819860511658591e-01
+/* Moves the mantissa of x into [sqrt(2) / 2, sqrt(2)) */
+#define LOG_OFFSET 0x3fe6a09e00000000ULL
+#define LOG_MANTISSA 0x000fffffffffffffULL
+/* Adding the exponent bits to 2^52 converts them to a double exactly */
+#define LOG_MAGIC 0x4330000000000000ULL
+#define LOG_TWO52 4503599627370496.0
+
+/* Computes the Philox4x32-10 output block for the specified counter and
+ * key.
+ */
+void
+rng_philox_block(uint32_t counter[4], uint32_t key[2], uint32_t output[4])
+{
+    uint32_t c0 = counter[0];
+    uint32_t c1 = counter[1];
+    uint32_t c2 = counter[2];
+    uint32_t c3 = counter[3];
+    uint32_t k0 = key[0];
+    uint32_t k1 = key[1];
+    uint64_t p0, p1;
+    int j;
+
+    for (j = 0; j < PHILOX_ROUNDS; j++) {
+        p0 = (uint64_t) PHILOX_M0 * c0;
+        p1 = (uint64_t) PHILOX_M1 * c2;
+        c0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+        c2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t) p1;
+        c3 = (uint32_t) p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    output[0] = c0;
+    output[1] = c1;
+    output[2] = c2;
+    output[3] = c3;
+}
+
+static inline uint32_t
+philox_next(philox_state_t *self)
+{
+    if (self->position == 4) {
+        rng_philox_block(self->counter, self->key, self->output);
+        /* The low 64 bits of the counter index blocks within the stream */
+        self->counter[0]++;
+        if (self->counter[0] == 0) {
+            self->counter[1]++;
+        }
+        self->position = 0;
+    }
+    return self->output[self->position++];
+}
+
+/* Returns a uniform value in [0, 1) with 53 bits of precision. */
+static inline double
+philox_next_double(philox_state_t *self)
+{
+    uint32_t a = philox_next(self) >> 5;
+    uint32_t b = philox_next(self) >> 6;
+
+    return (a * 67108864.0 + b) * (1.0 / 9007199254740992.0);
+}
+
+static void
+philox_set_stream(philox_state_t *self, unsigned long seed, uint32_t replicate,
+        uint32_t chunk)
+{
+    uint64_t s = (uint64_t) seed;
+
+    self->key[0] = (uint32_t) s;
+    self->key[1] = (uint32_t) (s >> 32);
+    self->counter[0] = 0;
+    self->counter[1] = 0;
+    self->counter[2] = replicate;
+    self->counter[3] = chunk;
+    self->position = 4;
+}
+
+static void
+philox_set(void *state, unsigned long int seed)
+{
+    philox_set_stream((philox_state_t *) state, seed, 0, 0);
+}
+
+static unsigned long int
+philox_get(void *state)
+{
+    return philox_next((philox_state_t *) state);
+}
+
+static double
+philox_get_double(void *state)
+{
+    return philox_next_double((philox_state_t *) state);
+}
+
+static const gsl_rng_type philox_type = {
+    "philox4x32-10",
+    0xffffffffUL,
+    0,
+    sizeof(philox_state_t),
+    &philox_set,
+    &philox_get,
+    &philox_get_double
+};
+
+const gsl_rng_type *rng_philox = &philox_type;
+
+/* Moves the specified Philox generator to the start of the stream for
+ * the specified (seed, replicate, chunk) triple. Different triples give
+ * non-overlapping streams of 2^66 values.
+ */
+int WARN_UNUSED
+rng_set_stream(gsl_rng *rng, unsigned long seed, uint32_t replicate,
+        uint32_t chunk)
+{
+    int ret = 0;
+
+    if (rng->type != rng_philox) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    philox_set_stream((philox_state_t *) gsl_rng_state(rng), seed, replicate,
+            chunk);
+out:
+    return ret;
+}
+
+/* Returns the natural logarithm of x, which must be positive, finite and
+ * normal. This is the fdlibm algorithm without the special cases, written
+ * without branches so that the AVX2 kernel below can perform exactly the
+ * same sequence of operations and so give identical results.
+ */
+static double
+rng_log(double x)
+{
+    uint64_t ix, bits;
+    double m, f, s, z, w, t1, t2, R, hfsq, dk;
+
+    memcpy(&ix, &x, sizeof(ix));
+    ix += (0x3ff0000000000000ULL - LOG_OFFSET);
+    bits = (ix >> 52) | LOG_MAGIC;
+    memcpy(&dk, &bits, sizeof(dk));
+    dk = dk - (LOG_TWO52 + 1023.0);
+    bits = (ix & LOG_MANTISSA) + LOG_OFFSET;
+    memcpy(&m, &bits, sizeof(m));
+    f = m - 1.0;
+    hfsq = 0.5 * f * f;
+    s = f / (2.0 + f);
+    z = s * s;
+    w = z * z;
+    t1 = w * (LOG_LG2 + w * (LOG_LG4 + w * LOG_LG6));
+    t2 = z * (LOG_LG1 + w * (LOG_LG3 + w * (LOG_LG5 + w * LOG_LG7)));
+    R = t2 + t1;
+    return s * (hfsq + R) + dk * LOG_LN2_LO - hfsq + f + dk * LOG_LN2_HI;
+}
+
+#ifdef RNG_HAVE_AVX2
+
+/* Computes four consecutive Philox blocks at once, one in each 64 bit
+ * lane, and converts them to eight doubles in the same order as
+ * philox_next_double. Returns the number of values written, which is a
+ * multiple of eight.
+ */
+static __attribute__((target("avx2"))) size_t
+philox_uniform_block_avx2(philox_state_t *self, double *dest, size_t n)
+{
+    const __m256i m0 = _mm256_set1_epi64x(PHILOX_M0);
+    const __m256i m1 = _mm256_set1_epi64x(PHILOX_M1);
+    const __m256i low = _mm256_set1_epi64x(0xffffffffLL);
+    const __m256i magic = _mm256_set1_epi64x((long long) LOG_MAGIC);
+    const __m256d two52 = _mm256_set1_pd(LOG_TWO52);
+    const __m256d two26 = _mm256_set1_pd(67108864.0);
+    const __m256d scale = _mm256_set1_pd(1.0 / 9007199254740992.0);
+    __m256i k0[PHILOX_ROUNDS], k1[PHILOX_ROUNDS];
+    __m256i c0, c1, c2, c3, p0, p1;
+    __m256d a, b, x, y;
+    uint32_t key0 = self->key[0];
+    uint32_t key1 = self->key[1];
+    uint32_t c;
+    size_t j = 0;
+    int r;
+
+    for (r = 0; r < PHILOX_ROUNDS; r++) {
+        k0[r] = _mm256_set1_epi64x(key0);
+        k1[r] = _mm256_set1_epi64x(key1);
+        key0 += PHILOX_W0;
+        key1 += PHILOX_W1;
+    }
+    /* Stop before the low counter word wraps, and leave that to the
+     * scalar code. */
+    while (n - j >= 8 && self->counter[0] <= UINT32_MAX - 4) {
+        c = self->counter[0];
+        c0 = _mm256_set_epi64x(c + 3, c + 2, c + 1, c);
+        c1 = _mm256_set1_epi64x(self->counter[1]);
+        c2 = _mm256_set1_epi64x(self->counter[2]);
+        c3 = _mm256_set1_epi64x(self->counter[3]);
+        for (r = 0; r < PHILOX_ROUNDS; r++) {
+            p0 = _mm256_mul_epu32(m0, c0);
+            p1 = _mm256_mul_epu32(m1, c2);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(
+                        _mm256_srli_epi64(p1, 32), c1), k0[r]);
+            c2 = _mm256_xor_si256(_mm256_xor_si256(
+                        _mm256_srli_epi64(p0, 32), c3), k1[r]);
+            c1 = _mm256_and_si256(p1, low);
+            c3 = _mm256_and_si256(p0, low);
+        }
+        /* The first double of each block comes from words 0 and 1, and
+         * the second from words 2 and 3. */
+        a = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(
+                    _mm256_srli_epi64(c0, 5), magic)), two52);
+        b = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(
+                    _mm256_srli_epi64(c1, 6), magic)), two52);
+        x = _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(a, two26), b), scale);
+        a = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(
+                    _mm256_srli_epi64(c2, 5), magic)), two52);
+        b = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(
+                    _mm256_srli_epi64(c3, 6), magic)), two52);
+        y = _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(a, two26), b), scale);
+        a = _mm256_unpacklo_pd(x, y);
+        b = _mm256_unpackhi_pd(x, y);
+        _mm256_storeu_pd(dest + j, _mm256_permute2f128_pd(a, b, 0x20));
+        _mm256_storeu_pd(dest + j + 4, _mm256_permute2f128_pd(a, b, 0x31));
+        self->counter[0] += 4;
+        j += 8;
+    }
+    return j;
+}
+
+/* Replaces each of the uniforms in x with -mean * log(1 - x), four at a
+ * time, using the same operations as rng_log. Returns the number of
+ * values transformed. */
+static __attribute__((target("avx2"))) size_t
+exponential_block_avx2(double mean, double *x, size_t n)
+{
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d bias = _mm256_set1_pd(LOG_TWO52 + 1023.0);
+    const __m256d minus_mean = _mm256_set1_pd(-mean);
+    const __m256i exponent_offset = _mm256_set1_epi64x(
+            (long long) (0x3ff0000000000000ULL - LOG_OFFSET));
+    const __m256i offset = _mm256_set1_epi64x((long long) LOG_OFFSET);
+    const __m256i mantissa = _mm256_set1_epi64x((long long) LOG_MANTISSA);
+    const __m256i magic = _mm256_set1_epi64x((long long) LOG_MAGIC);
+    __m256i ix;
+    __m256d m, f, s, z, w, t1, t2, R, hfsq, dk, y;
+    size_t j;
+
+    for (j = 0; j + 4 <= n; j += 4) {
+        y = _mm256_sub_pd(one, _mm256_loadu_pd(x + j));
+        ix = _mm256_add_epi64(_mm256_castpd_si256(y), exponent_offset);
+        dk = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(
+                    _mm256_srli_epi64(ix, 52), magic)), bias);
+        m = _mm256_castsi256_pd(_mm256_add_epi64(
+                    _mm256_and_si256(ix, mantissa), offset));
+        f = _mm256_sub_pd(m, one);
+        hfsq = _mm256_mul_pd(_mm256_mul_pd(half, f), f);
+        s = _mm256_div_pd(f, _mm256_add_pd(two, f));
+        z = _mm256_mul_pd(s, s);
+        w = _mm256_mul_pd(z, z);
+        t1 = _mm256_mul_pd(w, _mm256_add_pd(_mm256_set1_pd(LOG_LG2),
+                _mm256_mul_pd(w, _mm256_add_pd(_mm256_set1_pd(LOG_LG4),
+                _mm256_mul_pd(w, _mm256_set1_pd(LOG_LG6))))));
+        t2 = _mm256_mul_pd(z, _mm256_add_pd(_mm256_set1_pd(LOG_LG1),
+                _mm256_mul_pd(w, _mm256_add_pd(_mm256_set1_pd(LOG_LG3),
+                _mm256_mul_pd(w, _mm256_add_pd(_mm256_set1_pd(LOG_LG5),
+                _mm256_mul_pd(w, _mm256_set1_pd(LOG_LG7))))))));
+        R = _mm256_add_pd(t2, t1);
+        y = _mm256_add_pd(_mm256_mul_pd(s, _mm256_add_pd(hfsq, R)),
+                _mm256_mul_pd(dk, _mm256_set1_pd(LOG_LN2_LO)));
+        y = _mm256_add_pd(_mm256_sub_pd(y, hfsq), f);
+        y = _mm256_add_pd(y, _mm256_mul_pd(dk, _mm256_set1_pd(LOG_LN2_HI)));
+        _mm256_storeu_pd(x + j, _mm256_mul_pd(minus_mean, y));
+    }
+    return j;
+}
+
+static int
+rng_have_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+/* Fills dest with n values from gsl_rng_uniform. For Philox generators
+ * the values are computed directly rather than through the function
+ * pointers in the gsl_rng_type, four blocks at a time if the CPU
+ * supports AVX2.
+ */
+void
+rng_uniform_block(gsl_rng *rng, double *dest, size_t n)
+{
+    size_t j = 0;
+    philox_state_t *state;
+
+    if (rng->type == rng_philox) {
+        state = (philox_state_t *) gsl_rng_state(rng);
+#ifdef RNG_HAVE_AVX2
+        /* The vector kernel starts on a block boundary, so we use up the
+         * current block first. If an odd number of words has been used,
+         * doubles straddle blocks and we must stay with the scalar code. */
+        while (j < n && state->position % 4 != 0) {
+            dest[j] = philox_next_double(state);
+            j++;
+        }
+        if (state->position == 4 && rng_have_avx2()) {
+            j += philox_uniform_block_avx2(state, dest + j, n - j);
+        }
+#endif
+        for (; j < n; j++) {
+            dest[j] = philox_next_double(state);
+        }
+    } else {
+        for (j = 0; j < n; j++) {
+            dest[j] = gsl_rng_uniform(rng);
+        }
+    }
+}
+
+/* Fills dest with n exponential variates with the specified mean, using
+ * one value from gsl_rng_uniform for each. The logarithms are computed
+ * four at a time if the CPU supports AVX2, giving the same values as the
+ * scalar code.
+ */
+void
+rng_exponential_block(gsl_rng *rng, double mean, double *dest, size_t n)
+{
+    size_t j = 0;
+
+    rng_uniform_block(rng, dest, n);
+#ifdef RNG_HAVE_AVX2
+    if (rng_have_avx2()) {
+        j = exponential_block_avx2(mean, dest, n);
+    }
+#endif
+    for (; j < n; j++) {
+        dest[j] = -mean * rng_log(1.0 - dest[j]);
+    }
+}
+
+int WARN_UNUSED
+rng_buffer_alloc(rng_buffer_t *self, gsl_rng *rng, size_t block_size)
+{
+    int ret = 0;
+
+    memset(self, 0, sizeof(rng_buffer_t));
+    if (block_size == 0) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    self->rng = rng;
+    self->block_size = block_size;
+    self->uniforms = malloc(block_size * sizeof(double));
+    self->exponentials = malloc(block_size * sizeof(double));
+    if (self->uniforms == NULL || self->exponentials == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    rng_buffer_clear(self);
+out:
+    return ret;
+}
+
+int
+rng_buffer_free(rng_buffer_t *self)
+{
+    if (self->uniforms != NULL) {
+        free(self->uniforms);
+        self->uniforms = NULL;
+    }
+    if (self->exponentials != NULL) {
+        free(self->exponentials);
+        self->exponentials = NULL;
+    }
+    return 0;
+}
+
+/* Discards the buffered values, so that the next values are drawn from
+ * the current state of the rng. */
+void
+rng_buffer_clear(rng_buffer_t *self)
+{
+    self->uniform_position = self->block_size;
+    self->exponential_position = self->block_size;
+}
+
+double
+rng_buffer_uniform(rng_buffer_t *self)
+{
+    if (self->uniform_position == self->block_size) {
+        rng_uniform_block(self->rng, self->uniforms, self->block_size);
+        self->uniform_position = 0;
+    }
+    return self->uniforms[self->uniform_position++];
+}
+
+double
+rng_buffer_exponential(rng_buffer_t *self, double mean)
+{
+    if (self->exponential_position == self->block_size) {
+        rng_exponential_block(self->rng, 1.0, self->exponentials,
+                self->block_size);
+        self->exponential_position = 0;
+    }
+    return mean * self->exponentials[self->exponential_position++];
+}
+
+size_t
+rng_buffer_get_memory_size(rng_buffer_t *self)
+{
+    return 2 * self->block_size * sizeof(double);
+}
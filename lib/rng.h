@@ -0,0 +1,73 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __RNG_H__
+#define __RNG_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <gsl/gsl_rng.h>
+
+/* The Philox4x32-10 counter-based generator of Salmon et al. (2011),
+ * packaged as a GSL generator type so that it can be used anywhere a
+ * gsl_rng is accepted. Each output block of four 32 bit words is a
+ * function of a 128 bit counter and a 64 bit key only. The key is the
+ * seed, the high 64 bits of the counter select a stream, and the low 64
+ * bits count blocks within it. Independent streams therefore need no
+ * coordination, and jumping to a stream is O(1).
+ */
+extern const gsl_rng_type *rng_philox;
+
+typedef struct {
+    uint32_t key[2];
+    uint32_t counter[4];
+    uint32_t output[4];
+    uint32_t position;
+} philox_state_t;
+
+/* Uniform and unit exponential variates drawn from rng in blocks of
+ * block_size, so that the cost of generating them is amortised over many
+ * draws. Each kind is refilled when it runs out, so the values returned
+ * for a given seed depend only on the sequence of calls.
+ */
+typedef struct {
+    gsl_rng *rng;
+    size_t block_size;
+    size_t uniform_position;
+    size_t exponential_position;
+    double *uniforms;
+    double *exponentials;
+} rng_buffer_t;
+
+void rng_philox_block(uint32_t counter[4], uint32_t key[2],
+        uint32_t output[4]);
+int rng_set_stream(gsl_rng *rng, unsigned long seed, uint32_t replicate,
+        uint32_t chunk);
+void rng_uniform_block(gsl_rng *rng, double *dest, size_t n);
+void rng_exponential_block(gsl_rng *rng, double mean, double *dest, size_t n);
+
+int rng_buffer_alloc(rng_buffer_t *self, gsl_rng *rng, size_t block_size);
+int rng_buffer_free(rng_buffer_t *self);
+void rng_buffer_clear(rng_buffer_t *self);
+double rng_buffer_uniform(rng_buffer_t *self);
+double rng_buffer_exponential(rng_buffer_t *self, double mean);
+size_t rng_buffer_get_memory_size(rng_buffer_t *self);
+
+#endif /*__RNG_H__*/
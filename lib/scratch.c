@@ -0,0 +1,162 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "err.h"
+#include "scratch.h"
+
+static size_t
+scratch_round_size(size_t size)
+{
+    return (size + SCRATCH_ALIGNMENT - 1) & ~((size_t) SCRATCH_ALIGNMENT - 1);
+}
+
+int WARN_UNUSED
+scratch_init(scratch_t *self, size_t initial_size)
+{
+    int ret = 0;
+
+    memset(self, 0, sizeof(scratch_t));
+    self->size = scratch_round_size(initial_size);
+    if (self->size > 0) {
+        self->mem = malloc(self->size);
+        if (self->mem == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        self->num_allocations++;
+    }
+out:
+    return ret;
+}
+
+static void
+scratch_free_overflow(scratch_t *self)
+{
+    char *block = self->overflow;
+    void *next;
+
+    while (block != NULL) {
+        memcpy(&next, block, sizeof(void *));
+        free(block);
+        block = next;
+    }
+    self->overflow = NULL;
+    self->overflow_size = 0;
+}
+
+int
+scratch_free(scratch_t *self)
+{
+    scratch_free_overflow(self);
+    if (self->mem != NULL) {
+        free(self->mem);
+        self->mem = NULL;
+    }
+    self->size = 0;
+    self->offset = 0;
+    return 0;
+}
+
+/* Returns a pointer to size bytes of memory that remain valid until the
+ * next call to scratch_reset, or NULL if we are out of memory.
+ */
+void *
+scratch_alloc(scratch_t *self, size_t size)
+{
+    void *ret = NULL;
+    char *block;
+
+    /* NULL means out of memory, so zero sized requests still use space */
+    size = scratch_round_size(size == 0 ? 1 : size);
+    if (size <= self->size - self->offset) {
+        ret = self->mem + self->offset;
+        self->offset += size;
+    } else {
+        /* The first SCRATCH_ALIGNMENT bytes of an overflow block link it
+         * into the list of overflow blocks. */
+        block = malloc(SCRATCH_ALIGNMENT + size);
+        if (block == NULL) {
+            goto out;
+        }
+        memcpy(block, &self->overflow, sizeof(void *));
+        self->overflow = block;
+        self->overflow_size += SCRATCH_ALIGNMENT + size;
+        self->num_allocations++;
+        ret = block + SCRATCH_ALIGNMENT;
+    }
+out:
+    return ret;
+}
+
+/* Releases all memory returned by scratch_alloc. If any allocations did
+ * not fit in the block, it is replaced by one large enough to hold
+ * everything that was allocated since the last reset. If this fails we
+ * keep the old block, since it is still usable.
+ */
+void
+scratch_reset(scratch_t *self)
+{
+    size_t size;
+    char *mem;
+
+    if (self->overflow != NULL) {
+        size = self->size + self->overflow_size;
+        scratch_free_overflow(self);
+        mem = malloc(size);
+        if (mem != NULL) {
+            self->num_allocations++;
+            if (self->mem != NULL) {
+                free(self->mem);
+            }
+            self->mem = mem;
+            self->size = size;
+        }
+    }
+    self->offset = 0;
+}
+
+/* Returns the number of bytes currently held by the arena. */
+size_t
+scratch_get_memory_size(scratch_t *self)
+{
+    return self->size + self->overflow_size;
+}
+
+size_t
+scratch_get_num_allocations(scratch_t *self)
+{
+    return self->num_allocations;
+}
+
+void
+scratch_print_state(scratch_t *self, FILE *out)
+{
+    fprintf(out, "scratch: size = %d offset = %d overflow_size = %d "
+            "num_allocations = %d\n", (int) self->size, (int) self->offset,
+            (int) self->overflow_size, (int) self->num_allocations);
+}
@@ -0,0 +1,54 @@
+/*
+** Copyright (C) 2016 Jerome Kelleher <jerome.kelleher@well.ox.ac.uk>
+**
+** This file is part of msprime.
+**
+** msprime is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** msprime is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SCRATCH_H__
+#define __SCRATCH_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* All allocations are rounded up to a multiple of this. */
+#define SCRATCH_ALIGNMENT 16
+
+/* A bump allocator for temporary memory that is released all at once.
+ * Allocations are carved from a single block of memory. Requests that do
+ * not fit are malloced separately, and on reset these are freed and the
+ * block grown to hold them, so that a workload that repeats does not call
+ * malloc once the block has reached its peak size.
+ */
+typedef struct {
+    char *mem;
+    size_t size;
+    size_t offset;
+    /* Blocks allocated since the last reset that did not fit in mem */
+    void *overflow;
+    size_t overflow_size;
+    /* The number of times we have called malloc */
+    size_t num_allocations;
+} scratch_t;
+
+int scratch_init(scratch_t *, size_t);
+int scratch_free(scratch_t *);
+void *scratch_alloc(scratch_t *, size_t);
+void scratch_reset(scratch_t *);
+size_t scratch_get_memory_size(scratch_t *);
+size_t scratch_get_num_allocations(scratch_t *);
+void scratch_print_state(scratch_t *, FILE *);
+
+#endif /*__SCRATCH_H__*/
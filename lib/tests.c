@@ -22,14 +22,22 @@
  */
 
 #include "msprime.h"
+#include "replicates.h"
+#include "contigs.h"
+#include "rng.h"
+#include "object_heap.h"
+#include "radix_sort.h"
+#include "codec.h"
 
 #include <float.h>
 #include <limits.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <hdf5.h>
 #include <gsl/gsl_math.h>
+#include <gsl/gsl_randist.h>
 #include <CUnit/Basic.h>
 
 /* Global variables used for test in state in the test suite */
@@ -472,6 +480,39 @@ get_example_tree_sequences(int include_nonbinary)
     return ret;
 }
 
+/* Appends a tree sequence joined from several contigs to the specified
+ * NULL terminated list of examples.
+ */
+static void
+add_joined_example(tree_sequence_t **examples)
+{
+    int ret;
+    size_t j;
+    tree_sequence_t *contigs[3];
+    tree_sequence_t *joined = malloc(sizeof(tree_sequence_t));
+
+    CU_ASSERT_FATAL(joined != NULL);
+    contigs[0] = get_example_tree_sequence(10, 0, 100, 100.0, 1.0, 1.0, 0,
+            NULL);
+    contigs[1] = get_example_tree_sequence(10, 0, 10, 50.0, 2.0, 2.0, 0,
+            NULL);
+    contigs[2] = contigs[0];
+    ret = tree_sequence_join(joined, 3, contigs);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = tree_sequence_add_provenance_string(joined, "joined");
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    for (j = 0; j < 2; j++) {
+        tree_sequence_free(contigs[j]);
+        free(contigs[j]);
+    }
+    j = 0;
+    while (examples[j] != NULL) {
+        j++;
+    }
+    examples[j] = joined;
+    examples[j + 1] = NULL;
+}
+
 /* Simple unit tests for the Fenwick tree API. */
 static void
 test_fenwick(void)
@@ -499,10 +540,913 @@ test_fenwick(void)
              */
             CU_ASSERT(fenwick_expand(&t, 1) == 0);
         }
+        /* A failed expansion leaves the tree as it was */
+        CU_ASSERT(fenwick_expand(&t, SIZE_MAX / 64) != 0);
+        CU_ASSERT(fenwick_get_size(&t) == 2 * n);
+        CU_ASSERT(fenwick_get_total(&t) == s);
+        for (j = 1; j <= n; j++) {
+            CU_ASSERT(fenwick_get_value(&t, j) == (int64_t) j);
+        }
+        CU_ASSERT(fenwick_find(&t, s) == n);
         CU_ASSERT(fenwick_free(&t) == 0);
     }
 }
 
+static void
+test_object_heap(void)
+{
+    object_heap_t heap;
+    size_t j, k, n, block_size;
+    uint64_t *obj;
+    uint64_t **objects = malloc(1000 * sizeof(uint64_t *));
+
+    CU_ASSERT_FATAL(objects != NULL);
+    for (block_size = 1; block_size < 20; block_size += 6) {
+        CU_ASSERT_EQUAL_FATAL(object_heap_init(&heap, sizeof(uint64_t),
+                    block_size, NULL), 0);
+        CU_ASSERT_EQUAL(heap.num_blocks, 1);
+        CU_ASSERT_EQUAL(heap.size, block_size);
+        CU_ASSERT_EQUAL(object_heap_get_fragmentation(&heap), 1.0);
+        for (j = 0; j < 1000; j++) {
+            if (object_heap_empty(&heap)) {
+                CU_ASSERT_EQUAL_FATAL(object_heap_expand(&heap), 0);
+            }
+            objects[j] = object_heap_alloc_object(&heap);
+            CU_ASSERT_FATAL(objects[j] != NULL);
+            *objects[j] = j;
+        }
+        /* Blocks double in size, so we need a logarithmic number */
+        n = block_size;
+        for (k = 1; k < heap.num_blocks; k++) {
+            n += block_size << k;
+        }
+        CU_ASSERT_EQUAL(heap.size, n);
+        CU_ASSERT(n >= 1000 && n - (block_size << (heap.num_blocks - 1)) < 1000);
+        CU_ASSERT_EQUAL(object_heap_get_num_allocated(&heap), 1000);
+        CU_ASSERT_EQUAL(object_heap_get_high_water_mark(&heap), 1000);
+        CU_ASSERT(object_heap_get_memory(&heap) >= n * sizeof(uint64_t));
+        /* Every object is reachable by its index */
+        for (j = 0; j < n; j++) {
+            obj = object_heap_get_object(&heap, j);
+            CU_ASSERT_FATAL(obj != NULL);
+        }
+        CU_ASSERT_EQUAL(object_heap_get_object(&heap, n), NULL);
+        for (j = 0; j < 1000; j++) {
+            CU_ASSERT_EQUAL(*objects[j], j);
+            object_heap_free_object(&heap, objects[j]);
+        }
+        CU_ASSERT_EQUAL(object_heap_get_num_allocated(&heap), 0);
+        CU_ASSERT_EQUAL(object_heap_get_high_water_mark(&heap), 1000);
+        CU_ASSERT_EQUAL(object_heap_get_fragmentation(&heap), 1.0);
+        object_heap_print_state(&heap, _devnull);
+        object_heap_free(&heap);
+    }
+
+    /* Blocks stop growing at the maximum size */
+    CU_ASSERT_EQUAL_FATAL(object_heap_init(&heap, sizeof(uint64_t), 2, NULL), 0);
+    object_heap_set_max_block_size(&heap, 7);
+    for (j = 0; j < 10; j++) {
+        CU_ASSERT_EQUAL_FATAL(object_heap_expand(&heap), 0);
+    }
+    CU_ASSERT_EQUAL(heap.size, 2 + 4 + 9 * 7);
+    CU_ASSERT_EQUAL(object_heap_get_next_block_memory(&heap),
+            sizeof(char *) + sizeof(size_t) + sizeof(bool)
+            + 7 * (sizeof(uint64_t) + sizeof(void *)));
+    object_heap_free(&heap);
+
+    /* Large blocks may be backed by hugepages */
+    n = OBJECT_HEAP_HUGEPAGE_SIZE / sizeof(uint64_t) + 1;
+    CU_ASSERT_EQUAL_FATAL(object_heap_init(&heap, sizeof(uint64_t), 1, NULL), 0);
+    object_heap_set_max_block_size(&heap, n);
+    object_heap_set_flags(&heap, OBJECT_HEAP_HUGEPAGES);
+    for (j = 0; j < n + 100; j++) {
+        if (object_heap_empty(&heap)) {
+            CU_ASSERT_EQUAL_FATAL(object_heap_expand(&heap), 0);
+        }
+        obj = object_heap_alloc_object(&heap);
+        CU_ASSERT_FATAL(obj != NULL);
+        *obj = j;
+    }
+    CU_ASSERT(object_heap_get_memory(&heap) >= heap.size * sizeof(uint64_t));
+    object_heap_print_state(&heap, _devnull);
+    object_heap_free(&heap);
+    free(objects);
+}
+
+static void
+test_lineage_set(void)
+{
+    lineage_set_t set;
+    size_t j, k, n;
+
+    for (n = 0; n < 100; n += 7) {
+        CU_ASSERT_EQUAL_FATAL(lineage_set_alloc(&set, n), 0);
+        CU_ASSERT_EQUAL(lineage_set_get_size(&set), 0);
+        for (j = 0; j < 100; j++) {
+            if (lineage_set_is_full(&set)) {
+                CU_ASSERT_EQUAL_FATAL(lineage_set_expand(&set, 1), 0);
+            }
+            lineage_set_insert(&set, (uint32_t) j);
+            CU_ASSERT_EQUAL(lineage_set_get_size(&set), j + 1);
+            for (k = 0; k <= j; k++) {
+                CU_ASSERT_EQUAL(lineage_set_get_item(&set, k), k);
+            }
+        }
+        /* Removing from the end leaves the other items in place */
+        CU_ASSERT_EQUAL(lineage_set_remove(&set, 99), 99);
+        CU_ASSERT_EQUAL(lineage_set_get_size(&set), 99);
+        /* Removing from the middle moves the last item into the gap */
+        CU_ASSERT_EQUAL(lineage_set_remove(&set, n), n);
+        CU_ASSERT_EQUAL(lineage_set_get_size(&set), 98);
+        if (n < 98) {
+            CU_ASSERT_EQUAL(lineage_set_get_item(&set, n), 98);
+        }
+        for (k = 0; k < n; k++) {
+            CU_ASSERT_EQUAL(lineage_set_get_item(&set, k), k);
+        }
+        lineage_set_clear(&set);
+        CU_ASSERT_EQUAL(lineage_set_get_size(&set), 0);
+        CU_ASSERT_EQUAL(lineage_set_free(&set), 0);
+    }
+}
+
+static void
+test_btree(void)
+{
+    btree_t tree;
+    btree_position_t pos;
+    size_t j, k, size, num_keys, initial_size;
+    uint32_t key;
+    uint32_t *values;
+    bool valid;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    CU_ASSERT_FATAL(rng != NULL);
+    for (num_keys = 1; num_keys < 5000; num_keys *= 3) {
+        /* values[k] is the value mapped to by k, or 0 if k is absent */
+        values = calloc(num_keys, sizeof(uint32_t));
+        CU_ASSERT_FATAL(values != NULL);
+        for (initial_size = 1; initial_size < 100; initial_size *= 10) {
+            CU_ASSERT_EQUAL_FATAL(btree_alloc(&tree, initial_size), 0);
+            CU_ASSERT_EQUAL(btree_get_size(&tree), 0);
+            CU_ASSERT_FALSE(btree_first(&tree, &pos));
+            CU_ASSERT_FALSE(btree_search_floor(&tree, 0, &pos));
+            memset(values, 0, num_keys * sizeof(uint32_t));
+            size = 0;
+            for (j = 1; j < 10 * num_keys; j++) {
+                key = (uint32_t) gsl_rng_uniform_int(rng, num_keys);
+                if (btree_search(&tree, key, &pos)) {
+                    CU_ASSERT_EQUAL_FATAL(btree_get_value(&tree, &pos),
+                            values[key]);
+                    if (gsl_rng_uniform(rng) < 0.5) {
+                        btree_set_value(&tree, &pos, (uint32_t) j);
+                        values[key] = (uint32_t) j;
+                    } else {
+                        valid = btree_remove(&tree, &pos);
+                        values[key] = 0;
+                        size--;
+                        /* The position moves on to the next key */
+                        k = key + 1;
+                        while (k < num_keys && values[k] == 0) {
+                            k++;
+                        }
+                        CU_ASSERT_EQUAL_FATAL(valid, k < num_keys);
+                        if (valid) {
+                            CU_ASSERT_EQUAL_FATAL(btree_get_key(&tree, &pos), k);
+                        }
+                    }
+                } else {
+                    CU_ASSERT_EQUAL_FATAL(values[key], 0);
+                    CU_ASSERT_EQUAL_FATAL(
+                            btree_insert(&tree, key, (uint32_t) j), 0);
+                    values[key] = (uint32_t) j;
+                    size++;
+                }
+                CU_ASSERT_EQUAL_FATAL(btree_get_size(&tree), size);
+                if (j % 97 == 0) {
+                    btree_verify(&tree);
+                }
+            }
+            btree_verify(&tree);
+            /* Iterate forwards and backwards over the entries */
+            k = 0;
+            for (valid = btree_first(&tree, &pos); valid;
+                    valid = btree_next(&tree, &pos)) {
+                while (values[k] == 0) {
+                    k++;
+                }
+                CU_ASSERT_EQUAL_FATAL(btree_get_key(&tree, &pos), k);
+                CU_ASSERT_EQUAL_FATAL(btree_get_value(&tree, &pos), values[k]);
+                k++;
+            }
+            /* Floor searches find the closest key to the left */
+            for (k = 0; k < num_keys; k++) {
+                valid = btree_search_floor(&tree, (uint32_t) k, &pos);
+                j = k + 1;
+                while (j > 0 && values[j - 1] == 0) {
+                    j--;
+                }
+                CU_ASSERT_EQUAL_FATAL(valid, j > 0);
+                if (valid) {
+                    CU_ASSERT_EQUAL_FATAL(btree_get_key(&tree, &pos), j - 1);
+                    if (btree_prev(&tree, &pos)) {
+                        CU_ASSERT_TRUE(btree_get_key(&tree, &pos) < j - 1);
+                    }
+                }
+            }
+            /* Remove everything from the front */
+            while (btree_first(&tree, &pos)) {
+                btree_remove(&tree, &pos);
+            }
+            CU_ASSERT_EQUAL(btree_get_size(&tree), 0);
+            btree_verify(&tree);
+            btree_print_state(&tree, _devnull);
+            CU_ASSERT_EQUAL_FATAL(btree_insert(&tree, 1, 2), 0);
+            btree_clear(&tree);
+            CU_ASSERT_EQUAL(btree_get_size(&tree), 0);
+            btree_verify(&tree);
+            CU_ASSERT_EQUAL(btree_free(&tree), 0);
+        }
+        free(values);
+    }
+    gsl_rng_free(rng);
+}
+
+static void
+test_btree_remove_positions(void)
+{
+    btree_t tree;
+    btree_position_t pos;
+    btree_position_t *positions;
+    uint32_t j, k, num_keys = 1000;
+    bool valid;
+
+    positions = malloc(num_keys * sizeof(btree_position_t));
+    CU_ASSERT_FATAL(positions != NULL);
+    for (k = 0; k < num_keys; k += 7) {
+        CU_ASSERT_EQUAL_FATAL(btree_alloc(&tree, 1), 0);
+        for (j = 0; j < num_keys; j++) {
+            CU_ASSERT_EQUAL_FATAL(btree_insert(&tree, j, j), 0);
+        }
+        for (valid = btree_first(&tree, &pos); valid;
+                valid = btree_next(&tree, &pos)) {
+            positions[btree_get_key(&tree, &pos)] = pos;
+        }
+        pos = positions[k];
+        valid = btree_remove(&tree, &pos);
+        CU_ASSERT_EQUAL_FATAL(valid, k < num_keys - 1);
+        if (valid) {
+            CU_ASSERT_EQUAL_FATAL(btree_get_key(&tree, &pos), k + 1);
+        }
+        /* Entries in other leaves and earlier in the same leaf keep their
+         * positions; later entries in the same leaf move down a slot. */
+        for (j = 0; j < num_keys; j++) {
+            if (j == k) {
+                continue;
+            }
+            pos = positions[j];
+            if (pos.node == positions[k].node
+                    && pos.index > positions[k].index) {
+                pos.index--;
+            }
+            CU_ASSERT_EQUAL_FATAL(btree_get_key(&tree, &pos), j);
+            CU_ASSERT_EQUAL_FATAL(btree_get_value(&tree, &pos), j);
+        }
+        btree_verify(&tree);
+        CU_ASSERT_EQUAL(btree_free(&tree), 0);
+    }
+    free(positions);
+}
+
+static void
+test_priority_queue(void)
+{
+    priority_queue_t queue;
+    size_t j, n;
+    uint64_t key, last;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    CU_ASSERT_FATAL(rng != NULL);
+    for (n = 1; n < 200; n += 11) {
+        CU_ASSERT_EQUAL_FATAL(priority_queue_alloc(&queue, 0), 0);
+        CU_ASSERT_EQUAL(priority_queue_get_size(&queue), 0);
+        for (j = 0; j < n; j++) {
+            if (priority_queue_is_full(&queue)) {
+                CU_ASSERT_EQUAL_FATAL(priority_queue_expand(&queue, 3), 0);
+            }
+            /* Use a small range of values in the high bits to get ties */
+            key = (gsl_rng_uniform_int(rng, 10) << 32) | j;
+            priority_queue_push(&queue, key);
+            CU_ASSERT_EQUAL(priority_queue_get_size(&queue), j + 1);
+        }
+        /* Keys come out in increasing order, interleaved with pushes of
+         * keys that are larger than any popped so far. */
+        last = 0;
+        for (j = 0; j < n; j++) {
+            key = priority_queue_peek(&queue);
+            CU_ASSERT_EQUAL_FATAL(priority_queue_pop(&queue), key);
+            CU_ASSERT_FATAL(key >= last);
+            last = key;
+            if (j % 3 == 0) {
+                priority_queue_push(&queue, key + 1 + n);
+            }
+        }
+        while (priority_queue_get_size(&queue) > 0) {
+            key = priority_queue_pop(&queue);
+            CU_ASSERT_FATAL(key >= last);
+            last = key;
+        }
+        priority_queue_push(&queue, 1);
+        priority_queue_clear(&queue);
+        CU_ASSERT_EQUAL(priority_queue_get_size(&queue), 0);
+        CU_ASSERT_EQUAL(priority_queue_free(&queue), 0);
+    }
+    gsl_rng_free(rng);
+}
+
+static void
+test_philox(void)
+{
+    int ret;
+    size_t j, k, n = 1001;
+    /* Known answer tests from the Random123 distribution */
+    uint32_t counters[3][4] = {
+        {0, 0, 0, 0},
+        {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+        {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}};
+    uint32_t keys[3][2] = {
+        {0, 0},
+        {0xffffffff, 0xffffffff},
+        {0xa4093822, 0x299f31d0}};
+    uint32_t expected[3][4] = {
+        {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+        {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+        {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}};
+    uint32_t output[4];
+    unsigned long a[8], b[8];
+    double *block = malloc(n * sizeof(double));
+    double *uniforms = malloc(n * sizeof(double));
+    double sum, x, y;
+    gsl_rng *rngs[2];
+    gsl_rng *rng = gsl_rng_alloc(rng_philox);
+    gsl_rng *other = gsl_rng_alloc(rng_philox);
+    gsl_rng *third = gsl_rng_alloc(rng_philox);
+
+    CU_ASSERT_FATAL(rng != NULL && other != NULL && third != NULL);
+    CU_ASSERT_FATAL(block != NULL && uniforms != NULL);
+    for (j = 0; j < 3; j++) {
+        rng_philox_block(counters[j], keys[j], output);
+        for (k = 0; k < 4; k++) {
+            CU_ASSERT_EQUAL(output[k], expected[j][k]);
+        }
+    }
+    /* Seed 0 starts at counter 0 with key 0 */
+    gsl_rng_set(rng, 0);
+    for (k = 0; k < 4; k++) {
+        CU_ASSERT_EQUAL(gsl_rng_get(rng), expected[0][k]);
+    }
+    CU_ASSERT_STRING_EQUAL(gsl_rng_name(rng), "philox4x32-10");
+
+    /* Streams are reproducible and distinct */
+    gsl_rng_set(other, 5);
+    ret = rng_set_stream(rng, 5, 0, 0);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (k = 0; k < 8; k++) {
+        CU_ASSERT_EQUAL(gsl_rng_get(rng), gsl_rng_get(other));
+    }
+    ret = rng_set_stream(rng, 5, 1, 0);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (k = 0; k < 8; k++) {
+        a[k] = gsl_rng_get(rng);
+    }
+    ret = rng_set_stream(rng, 5, 1, 0);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (k = 0; k < 8; k++) {
+        CU_ASSERT_EQUAL(gsl_rng_get(rng), a[k]);
+    }
+    ret = rng_set_stream(rng, 5, 1, 1);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (k = 0; k < 8; k++) {
+        b[k] = gsl_rng_get(rng);
+    }
+    CU_ASSERT(memcmp(a, b, sizeof(a)) != 0);
+    ret = rng_set_stream(rng, 6, 1, 0);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (k = 0; k < 8; k++) {
+        b[k] = gsl_rng_get(rng);
+    }
+    CU_ASSERT(memcmp(a, b, sizeof(a)) != 0);
+
+    /* Blocks give the same values as the per-draw functions, for both
+     * Philox and GSL generators. */
+    rngs[0] = rng;
+    rngs[1] = gsl_rng_alloc(gsl_rng_default);
+    CU_ASSERT_FATAL(rngs[1] != NULL);
+    for (j = 0; j < 2; j++) {
+        gsl_rng_memcpy(other, rngs[j]);
+        if (j == 1) {
+            gsl_rng_free(other);
+            other = gsl_rng_alloc(gsl_rng_default);
+            CU_ASSERT_FATAL(other != NULL);
+            gsl_rng_set(rngs[j], 7);
+            gsl_rng_set(other, 7);
+        }
+        rng_uniform_block(rngs[j], block, n);
+        sum = 0;
+        for (k = 0; k < n; k++) {
+            CU_ASSERT_EQUAL(block[k], gsl_rng_uniform(other));
+            CU_ASSERT(block[k] >= 0 && block[k] < 1);
+            sum += block[k];
+        }
+        CU_ASSERT(fabs(sum / (double) n - 0.5) < 0.05);
+        /* The vectorised logarithm gives the same values as the scalar
+         * code, and agrees with the system log1p to within rounding. */
+        gsl_rng_memcpy(third, other);
+        rng_uniform_block(third, uniforms, n);
+        rng_exponential_block(rngs[j], 2.0, block, n);
+        for (k = 0; k < n; k++) {
+            rng_exponential_block(other, 2.0, &x, 1);
+            CU_ASSERT_EQUAL(block[k], x);
+            y = -2.0 * log1p(-uniforms[k]);
+            CU_ASSERT(fabs(x - y) <= 4 * DBL_EPSILON * y);
+        }
+        CU_ASSERT_EQUAL(gsl_rng_get(rngs[j]), gsl_rng_get(other));
+        /* Doubles straddle Philox blocks after an odd number of words */
+        rng_uniform_block(rngs[j], block, n);
+        for (k = 0; k < n; k++) {
+            CU_ASSERT_EQUAL(block[k], gsl_rng_uniform(other));
+        }
+        if (j == 0) {
+            gsl_rng_free(third);
+            third = gsl_rng_alloc(gsl_rng_default);
+            CU_ASSERT_FATAL(third != NULL);
+        }
+    }
+    /* Streams need a Philox generator */
+    ret = rng_set_stream(rngs[1], 5, 1, 0);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+
+    gsl_rng_free(rngs[1]);
+    gsl_rng_free(rng);
+    gsl_rng_free(other);
+    gsl_rng_free(third);
+    free(block);
+    free(uniforms);
+}
+
+static void
+test_rng_buffer(void)
+{
+    int ret;
+    size_t j, k, block_size;
+    double uniforms[7], exponentials[7];
+    rng_buffer_t buffer;
+    gsl_rng *rng = gsl_rng_alloc(rng_philox);
+    gsl_rng *other = gsl_rng_alloc(rng_philox);
+
+    CU_ASSERT_FATAL(rng != NULL && other != NULL);
+    ret = rng_buffer_alloc(&buffer, rng, 0);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+    rng_buffer_free(&buffer);
+
+    for (block_size = 1; block_size <= 7; block_size += 3) {
+        gsl_rng_set(rng, 1);
+        gsl_rng_set(other, 1);
+        ret = rng_buffer_alloc(&buffer, rng, block_size);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        CU_ASSERT_EQUAL(rng_buffer_get_memory_size(&buffer),
+                2 * block_size * sizeof(double));
+        /* Each kind of variate is drawn from the rng when it runs out */
+        for (j = 0; j < 3; j++) {
+            rng_uniform_block(other, uniforms, block_size);
+            for (k = 0; k < block_size; k++) {
+                CU_ASSERT_EQUAL(rng_buffer_uniform(&buffer), uniforms[k]);
+                if (k == 0) {
+                    rng_exponential_block(other, 1.0, exponentials,
+                            block_size);
+                }
+                CU_ASSERT_EQUAL(rng_buffer_exponential(&buffer, 3.0),
+                        3.0 * exponentials[k]);
+            }
+        }
+        /* Clearing the buffer discards the remaining values */
+        rng_uniform_block(other, uniforms, block_size);
+        CU_ASSERT_EQUAL(rng_buffer_uniform(&buffer), uniforms[0]);
+        rng_buffer_clear(&buffer);
+        rng_uniform_block(other, uniforms, block_size);
+        CU_ASSERT_EQUAL(rng_buffer_uniform(&buffer), uniforms[0]);
+        rng_buffer_free(&buffer);
+    }
+    gsl_rng_free(rng);
+    gsl_rng_free(other);
+}
+
+static void
+test_scratch(void)
+{
+    scratch_t scratch;
+    size_t j, k, m, num_allocations;
+    size_t sizes[] = {0, 1, 7, 16, 100, 1000};
+    size_t num_sizes = sizeof(sizes) / sizeof(size_t);
+    char *p[sizeof(sizes) / sizeof(size_t)];
+
+    for (m = 0; m < num_sizes; m++) {
+        CU_ASSERT_EQUAL_FATAL(scratch_init(&scratch, sizes[m]), 0);
+        CU_ASSERT_EQUAL(scratch_get_num_allocations(&scratch),
+                sizes[m] == 0 ? 0 : 1);
+        /* The first round allocates; after it the block is big enough. */
+        for (k = 0; k < 3; k++) {
+            num_allocations = scratch_get_num_allocations(&scratch);
+            for (j = 0; j < num_sizes; j++) {
+                p[j] = scratch_alloc(&scratch, sizes[j]);
+                CU_ASSERT_FATAL(p[j] != NULL);
+                CU_ASSERT_EQUAL((size_t) p[j] % SCRATCH_ALIGNMENT, 0);
+                memset(p[j], (int) j, sizes[j]);
+            }
+            for (j = 0; j < num_sizes; j++) {
+                if (sizes[j] > 0) {
+                    CU_ASSERT_EQUAL(p[j][0], (char) j);
+                    CU_ASSERT_EQUAL(p[j][sizes[j] - 1], (char) j);
+                }
+            }
+            scratch_print_state(&scratch, _devnull);
+            scratch_reset(&scratch);
+            if (k > 0) {
+                CU_ASSERT_EQUAL(scratch_get_num_allocations(&scratch),
+                        num_allocations);
+            }
+        }
+        CU_ASSERT_TRUE(scratch_get_memory_size(&scratch) >= 1124);
+        CU_ASSERT_EQUAL(scratch_free(&scratch), 0);
+    }
+}
+
+static void
+test_radix_sort(void)
+{
+    int ret;
+    size_t j, k, n;
+    uint64_t masks[] = {0, 0xff, 0xffff00, UINT64_MAX};
+    double values[] = {-INFINITY, -1e300, -2.0, -1e-300, -0.0, 0.0, 1e-300,
+        0.5, 1.0, 1e300, INFINITY};
+    size_t num_values = sizeof(values) / sizeof(double);
+    uint64_t *keys = malloc(1000 * sizeof(uint64_t));
+    uint32_t *order = malloc(1000 * sizeof(uint32_t));
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    CU_ASSERT_FATAL(keys != NULL);
+    CU_ASSERT_FATAL(order != NULL);
+    CU_ASSERT_FATAL(rng != NULL);
+    for (n = 0; n < 1000; n = 2 * n + 1) {
+        for (k = 0; k < sizeof(masks) / sizeof(uint64_t); k++) {
+            for (j = 0; j < n; j++) {
+                keys[j] = (((uint64_t) gsl_rng_get(rng) << 32)
+                        | gsl_rng_get(rng)) & masks[k];
+                order[j] = (uint32_t) j;
+            }
+            ret = radix_sort(n, keys, order);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            /* Equal keys keep their input order */
+            for (j = 1; j < n; j++) {
+                CU_ASSERT_FATAL(keys[j - 1] <= keys[j]);
+                if (keys[j - 1] == keys[j]) {
+                    CU_ASSERT_FATAL(order[j - 1] < order[j]);
+                }
+            }
+        }
+    }
+    for (j = 1; j < num_values; j++) {
+        if (values[j - 1] == values[j]) {
+            CU_ASSERT_EQUAL(radix_sort_double_key(values[j - 1]),
+                    radix_sort_double_key(values[j]));
+        } else {
+            CU_ASSERT_TRUE(radix_sort_double_key(values[j - 1])
+                    < radix_sort_double_key(values[j]));
+        }
+    }
+    free(keys);
+    free(order);
+    gsl_rng_free(rng);
+}
+
+static void
+test_codec(void)
+{
+    int ret;
+    size_t j, n, num_chunks;
+    size_t chunk_items = 1000;
+    size_t num_items = 2500;
+    uint32_t *values = malloc(num_items * sizeof(uint32_t));
+    uint32_t *decoded = malloc(num_items * sizeof(uint32_t));
+    codec_chunk_t chunks[3];
+    unsigned char data[] = "abcde";
+
+    CU_ASSERT_FATAL(values != NULL);
+    CU_ASSERT_FATAL(decoded != NULL);
+    CU_ASSERT_EQUAL(codec_fletcher32(data, 0), 0);
+    CU_ASSERT_EQUAL(codec_fletcher32(data, 1), 0x61006100);
+    CU_ASSERT_EQUAL(codec_fletcher32(data, 2), 0x61626162);
+    CU_ASSERT_TRUE(codec_fletcher32(data, 4) != codec_fletcher32(data, 5));
+    for (j = 0; j < num_items; j++) {
+        values[j] = (uint32_t) (j * j);
+    }
+    num_chunks = (num_items + chunk_items - 1) / chunk_items;
+    for (n = 1; n <= 4; n++) {
+        memset(chunks, 0, sizeof(chunks));
+        memset(decoded, 0, num_items * sizeof(uint32_t));
+        for (j = 0; j < num_chunks; j++) {
+            chunks[j].data = values + j * chunk_items;
+            chunks[j].item_size = sizeof(uint32_t);
+            chunks[j].chunk_items = chunk_items;
+            chunks[j].num_items = GSL_MIN(chunk_items, num_items - j * chunk_items);
+            chunks[j].level = 9;
+        }
+        ret = codec_run(chunks, num_chunks, codec_encode_chunk, n);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        for (j = 0; j < num_chunks; j++) {
+            CU_ASSERT_FATAL(chunks[j].encoded_size > 4);
+            chunks[j].data = decoded + j * chunk_items;
+        }
+        ret = codec_run(chunks, num_chunks, codec_decode_chunk, n);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        CU_ASSERT_EQUAL(memcmp(values, decoded, num_items * sizeof(uint32_t)), 0);
+        /* Corrupting an encoded chunk must be detected */
+        chunks[num_chunks - 1].encoded[0] ^= 1;
+        ret = codec_run(chunks, num_chunks, codec_decode_chunk, n);
+        CU_ASSERT_EQUAL(ret, MSP_ERR_FILE_FORMAT);
+        for (j = 0; j < num_chunks; j++) {
+            codec_chunk_free(&chunks[j]);
+            CU_ASSERT_EQUAL(chunks[j].encoded, NULL);
+        }
+    }
+    CU_ASSERT_TRUE(codec_get_num_threads() >= 1);
+    free(values);
+    free(decoded);
+}
+
+static void
+test_varint_codec(void)
+{
+    int ret;
+    size_t j, n, size;
+    uint32_t values[] = {0, 1, 2, 2, 1, 0, 255, 256, 65535, 65536, 1u << 24,
+        UINT32_MAX, 0, UINT32_MAX, 7, 100000, 99999};
+    size_t num_values = sizeof(values) / sizeof(uint32_t);
+    uint32_t decoded[sizeof(values) / sizeof(uint32_t)];
+    unsigned char *encoded = malloc(codec_varint_bound(num_values));
+
+    CU_ASSERT_FATAL(encoded != NULL);
+    for (n = 0; n <= num_values; n++) {
+        size = codec_varint_encode(values, n, encoded);
+        CU_ASSERT_FATAL(size <= codec_varint_bound(n));
+        memset(decoded, 0xff, sizeof(decoded));
+        ret = codec_varint_decode(encoded, size, decoded, n);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        for (j = 0; j < n; j++) {
+            CU_ASSERT_EQUAL(decoded[j], values[j]);
+        }
+        /* Truncated or overlong input must be rejected */
+        if (size > 0) {
+            ret = codec_varint_decode(encoded, size - 1, decoded, n);
+            CU_ASSERT_EQUAL(ret, MSP_ERR_FILE_FORMAT);
+            ret = codec_varint_decode(encoded, size, decoded, n - 1);
+            CU_ASSERT_EQUAL(ret, MSP_ERR_FILE_FORMAT);
+        }
+    }
+    /* Small differences take one byte each */
+    for (j = 0; j < 8; j++) {
+        values[j] = (uint32_t) (1000000 + 2 * j);
+    }
+    size = codec_varint_encode(values + 1, 7, encoded);
+    CU_ASSERT_EQUAL(size, 2 + 3 + 6);
+    free(encoded);
+}
+
+#ifdef H5_VERSION_GE
+#if H5_VERSION_GE(1, 10, 2)
+/* Chunks encoded by the codec must be readable through HDF5's own filter
+ * pipeline, and chunks encoded by HDF5 must be decodable by the codec.
+ */
+static void
+test_codec_hdf5(void)
+{
+    int ret;
+    herr_t status;
+    hid_t file_id, dataspace_id, plist_id, direct_id, filtered_id;
+    size_t j, num_chunks;
+    size_t chunk_items = 1000;
+    size_t num_items = 2500;
+    hsize_t dims[1] = {2500};
+    hsize_t chunk_dims[1] = {1000};
+    hsize_t offset[1], chunk_size;
+    uint32_t filter_mask;
+    double *values = malloc(num_items * sizeof(double));
+    double *decoded = malloc(num_items * sizeof(double));
+    codec_chunk_t chunks[3];
+
+    CU_ASSERT_FATAL(values != NULL);
+    CU_ASSERT_FATAL(decoded != NULL);
+    for (j = 0; j < num_items; j++) {
+        values[j] = (double) j / 7.0;
+    }
+    num_chunks = (num_items + chunk_items - 1) / chunk_items;
+    memset(chunks, 0, sizeof(chunks));
+    for (j = 0; j < num_chunks; j++) {
+        chunks[j].data = values + j * chunk_items;
+        chunks[j].item_size = sizeof(double);
+        chunks[j].chunk_items = chunk_items;
+        chunks[j].num_items = GSL_MIN(chunk_items, num_items - j * chunk_items);
+        chunks[j].level = 9;
+    }
+    ret = codec_run(chunks, num_chunks, codec_encode_chunk, 2);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    file_id = H5Fcreate(_tmp_file_name, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    CU_ASSERT_FATAL(file_id >= 0);
+    dataspace_id = H5Screate_simple(1, dims, NULL);
+    CU_ASSERT_FATAL(dataspace_id >= 0);
+    plist_id = H5Pcreate(H5P_DATASET_CREATE);
+    CU_ASSERT_FATAL(plist_id >= 0);
+    CU_ASSERT_FATAL(H5Pset_chunk(plist_id, 1, chunk_dims) >= 0);
+    CU_ASSERT_FATAL(H5Pset_shuffle(plist_id) >= 0);
+    CU_ASSERT_FATAL(H5Pset_deflate(plist_id, 9) >= 0);
+    CU_ASSERT_FATAL(H5Pset_fletcher32(plist_id) >= 0);
+    direct_id = H5Dcreate2(file_id, "/direct", H5T_NATIVE_DOUBLE, dataspace_id,
+            H5P_DEFAULT, plist_id, H5P_DEFAULT);
+    CU_ASSERT_FATAL(direct_id >= 0);
+    filtered_id = H5Dcreate2(file_id, "/filtered", H5T_NATIVE_DOUBLE,
+            dataspace_id, H5P_DEFAULT, plist_id, H5P_DEFAULT);
+    CU_ASSERT_FATAL(filtered_id >= 0);
+    for (j = 0; j < num_chunks; j++) {
+        offset[0] = j * chunk_items;
+        status = H5Dwrite_chunk(direct_id, H5P_DEFAULT, 0, offset,
+                chunks[j].encoded_size, chunks[j].encoded);
+        CU_ASSERT_FATAL(status >= 0);
+        codec_chunk_free(&chunks[j]);
+    }
+    status = H5Dwrite(filtered_id, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL,
+            H5P_DEFAULT, values);
+    CU_ASSERT_FATAL(status >= 0);
+
+    /* Read back the directly written chunks through the filters */
+    status = H5Dread(direct_id, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL,
+            H5P_DEFAULT, decoded);
+    CU_ASSERT_FATAL(status >= 0);
+    CU_ASSERT_EQUAL(memcmp(values, decoded, num_items * sizeof(double)), 0);
+
+    /* Decode the chunks written through the filters ourselves */
+    memset(decoded, 0, num_items * sizeof(double));
+    for (j = 0; j < num_chunks; j++) {
+        offset[0] = j * chunk_items;
+        status = H5Dget_chunk_storage_size(filtered_id, offset, &chunk_size);
+        CU_ASSERT_FATAL(status >= 0);
+        chunks[j].encoded = malloc((size_t) chunk_size);
+        CU_ASSERT_FATAL(chunks[j].encoded != NULL);
+        chunks[j].encoded_size = (size_t) chunk_size;
+        status = H5Dread_chunk(filtered_id, H5P_DEFAULT, offset, &filter_mask,
+                chunks[j].encoded);
+        CU_ASSERT_FATAL(status >= 0);
+        CU_ASSERT_EQUAL(filter_mask, 0);
+        chunks[j].data = decoded + j * chunk_items;
+    }
+    ret = codec_run(chunks, num_chunks, codec_decode_chunk, 2);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL(memcmp(values, decoded, num_items * sizeof(double)), 0);
+    for (j = 0; j < num_chunks; j++) {
+        codec_chunk_free(&chunks[j]);
+    }
+
+    CU_ASSERT_FATAL(H5Dclose(direct_id) >= 0);
+    CU_ASSERT_FATAL(H5Dclose(filtered_id) >= 0);
+    CU_ASSERT_FATAL(H5Pclose(plist_id) >= 0);
+    CU_ASSERT_FATAL(H5Sclose(dataspace_id) >= 0);
+    CU_ASSERT_FATAL(H5Fclose(file_id) >= 0);
+    free(values);
+    free(decoded);
+}
+#endif
+#endif
+
+static void
+test_rate_tree(void)
+{
+    rate_tree_t tree;
+    size_t j, n, last;
+    double value, sum;
+
+    for (n = 1; n < 40; n++) {
+        CU_ASSERT_EQUAL_FATAL(rate_tree_alloc(&tree, n), 0);
+        CU_ASSERT_EQUAL(rate_tree_get_size(&tree), n);
+        CU_ASSERT_EQUAL(rate_tree_get_total(&tree), 0.0);
+        /* Odd leaves have zero rate and must never be chosen */
+        sum = 0.0;
+        last = 0;
+        for (j = 0; j < n; j++) {
+            value = j % 2 == 0 ? (double) j + 0.5 : 0.0;
+            rate_tree_set_value(&tree, j, value);
+            CU_ASSERT_EQUAL(rate_tree_get_value(&tree, j), value);
+            sum += value;
+            if (value > 0) {
+                last = j;
+            }
+        }
+        CU_ASSERT_DOUBLE_EQUAL(rate_tree_get_total(&tree), sum, 1e-9);
+        sum = 0.0;
+        for (j = 0; j < n; j++) {
+            value = rate_tree_get_value(&tree, j);
+            if (value > 0) {
+                CU_ASSERT_EQUAL(rate_tree_find(&tree, sum), j);
+                CU_ASSERT_EQUAL(rate_tree_find(&tree, sum + value / 2), j);
+            }
+            sum += value;
+        }
+        CU_ASSERT_EQUAL(rate_tree_find(&tree, rate_tree_get_total(&tree)),
+                last);
+        /* Updates are reflected in the total */
+        rate_tree_set_value(&tree, 0, 0.0);
+        if (n < 3) {
+            CU_ASSERT_EQUAL(rate_tree_get_total(&tree), 0.0);
+        } else {
+            CU_ASSERT_EQUAL(rate_tree_find(&tree, 0.0), 2);
+        }
+        rate_tree_clear(&tree);
+        CU_ASSERT_EQUAL(rate_tree_get_total(&tree), 0.0);
+        CU_ASSERT_EQUAL(rate_tree_free(&tree), 0);
+    }
+}
+
+static void
+test_migration_matrix(void)
+{
+    migration_matrix_t mm, other;
+    uint32_t source[] = {2, 0, 1, 0, 2};
+    uint32_t dest[] = {1, 2, 0, 1, 1};
+    double rate[] = {1.0, 2.0, 0.5, 0.0, 1.0};
+    double dense[9];
+    double expected[] = {0, 0, 2, 0.5, 0, 0, 0, 2, 0};
+    size_t j, index;
+
+    CU_ASSERT_EQUAL(migration_matrix_alloc(&mm, 3, 5, source, dest, rate), 0);
+    /* The repeated entry for 2 -> 1 is merged */
+    CU_ASSERT_EQUAL(migration_matrix_get_num_entries(&mm), 4);
+    CU_ASSERT_EQUAL(migration_matrix_get_row_sum(&mm, 0), 2.0);
+    CU_ASSERT_EQUAL(migration_matrix_get_row_sum(&mm, 1), 0.5);
+    CU_ASSERT_EQUAL(migration_matrix_get_row_sum(&mm, 2), 2.0);
+    migration_matrix_get_dense(&mm, dense);
+    for (j = 0; j < 9; j++) {
+        CU_ASSERT_EQUAL(dense[j], expected[j]);
+    }
+    CU_ASSERT_EQUAL(migration_matrix_get_index(&mm, 0, 1, &index), 0);
+    CU_ASSERT_EQUAL(index, 0);
+    CU_ASSERT_EQUAL(migration_matrix_get_index(&mm, 0, 2, &index), 0);
+    CU_ASSERT_EQUAL(index, 1);
+    CU_ASSERT_EQUAL(migration_matrix_get_index(&mm, 1, 2, &index),
+            MSP_ERR_BAD_MIGRATION_MATRIX_INDEX);
+    CU_ASSERT_EQUAL(migration_matrix_get_index(&mm, 3, 0, &index),
+            MSP_ERR_BAD_MIGRATION_MATRIX_INDEX);
+    /* Entry 0 -> 1 has zero rate and is never chosen */
+    CU_ASSERT_EQUAL(migration_matrix_find(&mm, 0, 0.0), 1);
+    CU_ASSERT_EQUAL(migration_matrix_find(&mm, 0, 2.0), 1);
+    migration_matrix_set_rate(&mm, 0, 1.0);
+    CU_ASSERT_EQUAL(migration_matrix_get_row_sum(&mm, 0), 3.0);
+    CU_ASSERT_EQUAL(migration_matrix_find(&mm, 0, 0.5), 0);
+    CU_ASSERT_EQUAL(migration_matrix_find(&mm, 0, 1.5), 1);
+    migration_matrix_set_all_rates(&mm, 4.0);
+    CU_ASSERT_EQUAL(migration_matrix_get_row_sum(&mm, 0), 8.0);
+    CU_ASSERT_EQUAL(migration_matrix_get_row_sum(&mm, 1), 4.0);
+
+    /* Copying rates requires a compatible sparsity pattern */
+    CU_ASSERT_EQUAL(migration_matrix_alloc(&other, 3, 1, source + 2,
+                dest + 2, rate + 2), 0);
+    CU_ASSERT_EQUAL(migration_matrix_copy_rates(&other, &mm),
+            MSP_ERR_BAD_MIGRATION_MATRIX_INDEX);
+    CU_ASSERT_EQUAL(migration_matrix_copy_rates(&mm, &other), 0);
+    CU_ASSERT_EQUAL(migration_matrix_get_row_sum(&mm, 0), 0.0);
+    CU_ASSERT_EQUAL(migration_matrix_get_row_sum(&mm, 1), 0.5);
+    CU_ASSERT_EQUAL(migration_matrix_free(&other), 0);
+    CU_ASSERT_EQUAL(migration_matrix_free(&mm), 0);
+
+    /* Bad entries */
+    source[0] = 1;
+    CU_ASSERT_EQUAL(migration_matrix_alloc(&mm, 3, 5, source, dest, rate),
+            MSP_ERR_BAD_MIGRATION_MATRIX);
+    CU_ASSERT_EQUAL(migration_matrix_free(&mm), 0);
+    source[0] = 3;
+    CU_ASSERT_EQUAL(migration_matrix_alloc(&mm, 3, 5, source, dest, rate),
+            MSP_ERR_BAD_MIGRATION_MATRIX);
+    CU_ASSERT_EQUAL(migration_matrix_free(&mm), 0);
+    source[0] = 2;
+    rate[0] = -1.0;
+    CU_ASSERT_EQUAL(migration_matrix_alloc(&mm, 3, 5, source, dest, rate),
+            MSP_ERR_BAD_MIGRATION_MATRIX);
+    CU_ASSERT_EQUAL(migration_matrix_free(&mm), 0);
+    /* Empty matrices are fine */
+    CU_ASSERT_EQUAL(migration_matrix_alloc(&mm, 3, 0, NULL, NULL, NULL), 0);
+    CU_ASSERT_EQUAL(migration_matrix_get_num_entries(&mm), 0);
+    CU_ASSERT_EQUAL(migration_matrix_get_row_sum(&mm, 2), 0.0);
+    CU_ASSERT_EQUAL(migration_matrix_free(&mm), 0);
+}
+
 static void
 test_vcf(void)
 {
@@ -844,41 +1788,156 @@ test_single_locus_many_populations(void)
 }
 
 static void
-test_single_locus_historical_sample(void)
+test_single_locus_sparse_migration(void)
 {
     int ret;
     msp_t msp;
     gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
-    sample_t samples[] = {{0, 0.0}, {0, 10.0}};
-    coalescence_record_t *record;
-    size_t num_records;
-    uint32_t n = 2;
+    uint32_t j, k;
+    uint32_t N = 200;
+    uint32_t n = 20;
+    uint32_t *source = malloc(2 * N * sizeof(uint32_t));
+    uint32_t *dest = malloc(2 * N * sizeof(uint32_t));
+    double *rate = malloc(2 * N * sizeof(double));
+    double *migration_matrix = malloc(N * N * sizeof(double));
+    size_t *migration_events = malloc(N * N * sizeof(size_t));
+    sample_t *samples = malloc(n * sizeof(sample_t));
+    size_t num_migration_events;
 
     CU_ASSERT_FATAL(rng != NULL);
-
+    CU_ASSERT_FATAL(source != NULL && dest != NULL && rate != NULL);
+    CU_ASSERT_FATAL(migration_matrix != NULL && migration_events != NULL);
+    CU_ASSERT_FATAL(samples != NULL);
+    for (j = 0; j < n; j++) {
+        samples[j].population_id = (j * 17) % N;
+        samples[j].time = 0.0;
+    }
+    /* A stepping stone model on a ring */
+    for (j = 0; j < N; j++) {
+        source[2 * j] = j;
+        dest[2 * j] = (j + 1) % N;
+        rate[2 * j] = 10.0;
+        source[2 * j + 1] = (j + 1) % N;
+        dest[2 * j + 1] = j;
+        rate[2 * j + 1] = 5.0;
+    }
     ret = msp_alloc(&msp, n, samples, rng);
     CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_num_populations(&msp, N);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    source[0] = N;
+    ret = msp_set_sparse_migration_matrix(&msp, 2 * N, source, dest, rate);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_MIGRATION_MATRIX);
+    source[0] = 1;
+    ret = msp_set_sparse_migration_matrix(&msp, 2 * N, source, dest, rate);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_MIGRATION_MATRIX);
+    source[0] = 0;
+    rate[0] = -1;
+    ret = msp_set_sparse_migration_matrix(&msp, 2 * N, source, dest, rate);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_MIGRATION_MATRIX);
+    rate[0] = 10.0;
+    ret = msp_set_sparse_migration_matrix(&msp, 2, source + 2, dest, rate);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_MIGRATION_MATRIX);
+    ret = msp_set_sparse_migration_matrix(&msp, 2 * N, source, dest, rate);
+    CU_ASSERT_EQUAL(ret, 0);
+
+    /* Turn off some existing links and add a new one */
+    ret = msp_add_migration_rate_change(&msp, 0.1, 1, 0.0);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_add_migration_rate_change(&msp, 0.1, (int) N, 0.0);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_add_migration_rate_change(&msp, 0.2, (int) (N / 2), 1.0);
+    CU_ASSERT_EQUAL(ret, 0);
     ret = msp_initialise(&msp);
     CU_ASSERT_EQUAL(ret, 0);
 
+    ret = msp_get_migration_matrix(&msp, migration_matrix);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (j = 0; j < N; j++) {
+        for (k = 0; k < N; k++) {
+            if (k == (j + 1) % N) {
+                CU_ASSERT_EQUAL(migration_matrix[j * N + k], 10.0);
+            } else if (j == (k + 1) % N) {
+                CU_ASSERT_EQUAL(migration_matrix[j * N + k], 5.0);
+            } else {
+                CU_ASSERT_EQUAL(migration_matrix[j * N + k], 0.0);
+            }
+        }
+    }
     msp_print_state(&msp, _devnull);
-    ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+    while ((ret = msp_run(&msp, DBL_MAX, 100)) == 1) {
+        msp_verify(&msp);
+    }
     CU_ASSERT_EQUAL(ret, 0);
     msp_verify(&msp);
     msp_print_state(&msp, _devnull);
-    num_records = msp_get_num_coalescence_records(&msp);
-    CU_ASSERT_EQUAL_FATAL(num_records, 1);
-    ret = msp_get_coalescence_records(&msp, &record);
-    CU_ASSERT_EQUAL(ret, 0);
-    CU_ASSERT_EQUAL(record->left, 0);
-    CU_ASSERT_EQUAL(record->right, 1);
-    CU_ASSERT_EQUAL(record->node, 2);
-    CU_ASSERT_TRUE(record->time > 10.0);
 
-    ret = msp_free(&msp);
+    ret = msp_get_migration_matrix(&msp, migration_matrix);
     CU_ASSERT_EQUAL(ret, 0);
-    gsl_rng_free(rng);
-}
+    CU_ASSERT_EQUAL(migration_matrix[1], 0.0);
+    CU_ASSERT_EQUAL(migration_matrix[N], 0.0);
+    CU_ASSERT_EQUAL(migration_matrix[N / 2], 1.0);
+    CU_ASSERT_EQUAL(migration_matrix[N + 2], 10.0);
+    ret = msp_get_num_migration_events(&msp, migration_events);
+    CU_ASSERT_EQUAL(ret, 0);
+    num_migration_events = 0;
+    for (j = 0; j < N * N; j++) {
+        if (migration_events[j] > 0) {
+            CU_ASSERT(j == N / 2 || migration_matrix[j] > 0.0
+                    || j == 1 || j == N);
+        }
+        num_migration_events += migration_events[j];
+    }
+    CU_ASSERT(num_migration_events > 0);
+
+    ret = msp_free(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    gsl_rng_free(rng);
+    free(source);
+    free(dest);
+    free(rate);
+    free(migration_matrix);
+    free(migration_events);
+    free(samples);
+}
+
+static void
+test_single_locus_historical_sample(void)
+{
+    int ret;
+    msp_t msp;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+    sample_t samples[] = {{0, 0.0}, {0, 10.0}};
+    coalescence_record_t *record;
+    size_t num_records;
+    uint32_t n = 2;
+
+    CU_ASSERT_FATAL(rng != NULL);
+
+    ret = msp_alloc(&msp, n, samples, rng);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+
+    msp_print_state(&msp, _devnull);
+    ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    msp_verify(&msp);
+    msp_print_state(&msp, _devnull);
+    num_records = msp_get_num_coalescence_records(&msp);
+    CU_ASSERT_EQUAL_FATAL(num_records, 1);
+    ret = msp_get_coalescence_records(&msp, &record);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL(record->left, 0);
+    CU_ASSERT_EQUAL(record->right, 1);
+    CU_ASSERT_EQUAL(record->node, 2);
+    CU_ASSERT_TRUE(record->time > 10.0);
+
+    ret = msp_free(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    gsl_rng_free(rng);
+}
 
 static void
 test_simulator_getters_setters(void)
@@ -994,7 +2053,7 @@ test_simulator_getters_setters(void)
     CU_ASSERT_EQUAL(population->start_time, 0.0);
 
     CU_ASSERT_TRUE(msp_get_store_migration_records(&msp));
-    CU_ASSERT_EQUAL(msp_get_num_avl_node_blocks(&msp), 1);
+    CU_ASSERT_EQUAL(msp_get_num_avl_node_blocks(&msp), 0);
     CU_ASSERT_EQUAL(msp_get_num_node_mapping_blocks(&msp), 1);
     CU_ASSERT_EQUAL(msp_get_num_segment_blocks(&msp), 1);
     CU_ASSERT_EQUAL(msp_get_num_coalescence_record_blocks(&msp), 1);
@@ -1275,10 +2334,92 @@ test_single_locus_simulation(void)
     free(samples);
 }
 
+/* Simulations without recombination use a specialised common ancestor
+ * event. With the same seed, a single locus simulation and a multi-locus
+ * simulation with zero recombination rate should produce the same records
+ * over the respective sequence lengths. */
+static void
+test_zero_recombination_simulation(void)
+{
+    int ret;
+    uint32_t j, k;
+    uint32_t n = 20;
+    uint32_t num_loci[] = {1, 100};
+    long seed = 10;
+    double migration_matrix[] = {0, 0.1, 0.1, 0};
+    size_t num_records[2];
+    coalescence_record_t *records[2];
+    sample_t *samples = malloc(n * sizeof(sample_t));
+    msp_t *msp = malloc(2 * sizeof(msp_t));
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    CU_ASSERT_FATAL(msp != NULL);
+    CU_ASSERT_FATAL(samples != NULL);
+    CU_ASSERT_FATAL(rng != NULL);
+
+    memset(samples, 0, n * sizeof(sample_t));
+    for (j = 0; j < n / 2; j++) {
+        samples[j].population_id = 1;
+    }
+    samples[n - 1].time = 0.5;
+    for (k = 0; k < 2; k++) {
+        gsl_rng_set(rng, (unsigned long) seed);
+        ret = msp_alloc(&msp[k], n, samples, rng);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_num_loci(&msp[k], num_loci[k]);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_num_populations(&msp[k], 2);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_migration_matrix(&msp[k], 4, migration_matrix);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_add_simple_bottleneck(&msp[k], 0.1, 0, 0.5);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_add_mass_migration(&msp[k], 1.0, 1, 0, 1.0);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_initialise(&msp[k]);
+        CU_ASSERT_EQUAL(ret, 0);
+        while ((ret = msp_run(&msp[k], DBL_MAX, 1)) == 1) {
+            msp_verify(&msp[k]);
+        }
+        CU_ASSERT_EQUAL(ret, 0);
+        msp_verify(&msp[k]);
+        CU_ASSERT_EQUAL(msp_get_num_breakpoints(&msp[k]), 0);
+        num_records[k] = msp_get_num_coalescence_records(&msp[k]);
+        ret = msp_get_coalescence_records(&msp[k], &records[k]);
+        CU_ASSERT_EQUAL(ret, 0);
+        for (j = 0; j < num_records[k]; j++) {
+            CU_ASSERT_EQUAL(records[k][j].left, 0);
+            CU_ASSERT_EQUAL(records[k][j].right, num_loci[k]);
+        }
+    }
+    CU_ASSERT_EQUAL_FATAL(num_records[0], num_records[1]);
+    CU_ASSERT_TRUE(num_records[0] > 0);
+    for (j = 0; j < num_records[0]; j++) {
+        CU_ASSERT_EQUAL(records[0][j].node, records[1][j].node);
+        CU_ASSERT_EQUAL(records[0][j].time, records[1][j].time);
+        CU_ASSERT_EQUAL(records[0][j].population_id,
+                records[1][j].population_id);
+        CU_ASSERT_EQUAL_FATAL(records[0][j].num_children,
+                records[1][j].num_children);
+        for (k = 0; k < records[0][j].num_children; k++) {
+            CU_ASSERT_EQUAL(records[0][j].children[k],
+                    records[1][j].children[k]);
+        }
+    }
+    for (k = 0; k < 2; k++) {
+        ret = msp_free(&msp[k]);
+        CU_ASSERT_EQUAL(ret, 0);
+    }
+    gsl_rng_free(rng);
+    free(msp);
+    free(samples);
+}
+
 static void
 test_simulation_memory_limit(void)
 {
     int ret;
+    size_t max_memory;
     uint32_t n = 1000;
     sample_t *samples = malloc(n * sizeof(sample_t));
     msp_t *msp = malloc(sizeof(msp_t));
@@ -1302,9 +2443,166 @@ test_simulation_memory_limit(void)
 
     ret = msp_run(msp, DBL_MAX, ULONG_MAX);
     CU_ASSERT_EQUAL(ret, MSP_ERR_NO_MEMORY);
+    /* Running out of memory leaves a link for every segment */
+    CU_ASSERT_EQUAL(fenwick_get_size(&msp->links), msp->max_segments - 1);
 
     ret = msp_free(msp);
     CU_ASSERT_EQUAL(ret, 0);
+
+    /* A segment queue block that doesn't fit is not counted as used */
+    ret = msp_alloc(msp, n, samples, rng);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_max_memory(msp, 1024 * 1024);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_node_mapping_block_size(msp, 1024 * 1024);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_initialise(msp);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_NO_MEMORY);
+    CU_ASSERT_EQUAL(msp_get_num_node_mapping_blocks(msp), 0);
+    CU_ASSERT(msp_get_used_memory(msp) <= 1024 * 1024);
+    ret = msp_free(msp);
+    CU_ASSERT_EQUAL(ret, 0);
+
+    /* Nor is a lineage set expansion that doesn't fit. The samples'
+     * lineage set is the largest block allocated after the segments. */
+    ret = msp_alloc(msp, n, samples, rng);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_segment_block_size(msp, 65536);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_initialise(msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    max_memory = msp_get_used_memory(msp) - 65536 * sizeof(uint32_t) - 1;
+    CU_ASSERT_EQUAL(msp->populations[0].ancestors.max_size, 65536);
+    ret = msp_free(msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_alloc(msp, n, samples, rng);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_segment_block_size(msp, 65536);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_max_memory(msp, max_memory);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_initialise(msp);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_NO_MEMORY);
+    CU_ASSERT_EQUAL(msp->populations[0].ancestors.max_size, 0);
+    CU_ASSERT(msp_get_used_memory(msp) <= max_memory);
+    ret = msp_free(msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    gsl_rng_free(rng);
+    free(msp);
+    free(samples);
+}
+
+static void
+test_overlap_node_heap_growth(void)
+{
+    int ret;
+    uint32_t n = 1000;
+    size_t block_size = 16;
+    size_t max_num_overlap_nodes, num_blocks;
+    sample_t *samples = malloc(n * sizeof(sample_t));
+    msp_t *msp = malloc(sizeof(msp_t));
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+    msp_profile_t profile;
+
+    CU_ASSERT_FATAL(msp != NULL);
+    CU_ASSERT_FATAL(samples != NULL);
+    CU_ASSERT_FATAL(rng != NULL);
+
+    memset(samples, 0, n * sizeof(sample_t));
+    ret = msp_alloc(msp, n, samples, rng);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_model(msp, MSP_MODEL_SMC);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_num_loci(msp, 1000);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_scaled_recombination_rate(msp, 0.1);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_segment_block_size(msp, block_size);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_initialise(msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_run(msp, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+
+    ret = msp_get_profile(msp, &profile);
+    CU_ASSERT_EQUAL(ret, 0);
+    /* Every sample is in both the left and the right index at the start */
+    max_num_overlap_nodes = profile.max_num_overlap_nodes;
+    CU_ASSERT(max_num_overlap_nodes >= 2 * n);
+    CU_ASSERT_EQUAL(max_num_overlap_nodes,
+            object_heap_get_high_water_mark(&msp->overlap_node_heap));
+    /* The blocks double in size, so the heap needs a logarithmic number
+     * of them to hold the high water mark. */
+    num_blocks = 0;
+    while ((block_size << num_blocks) - block_size < max_num_overlap_nodes) {
+        num_blocks++;
+    }
+    CU_ASSERT(msp->overlap_node_heap.num_blocks <= num_blocks);
+    CU_ASSERT(msp->overlap_node_heap.size >= max_num_overlap_nodes);
+    CU_ASSERT(msp->overlap_node_heap.size
+            < 2 * max_num_overlap_nodes + block_size);
+    CU_ASSERT(msp_get_used_memory(msp)
+            >= object_heap_get_memory(&msp->overlap_node_heap));
+    /* All of the lineages have been removed from the index at the end */
+    CU_ASSERT_EQUAL(profile.overlap_node_heap_fragmentation, 1.0);
+    msp_print_state(msp, _devnull);
+
+    ret = msp_free(msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    gsl_rng_free(rng);
+    free(msp);
+    free(samples);
+}
+
+static void
+test_overlapping_pair_bound(void)
+{
+    int ret;
+    uint32_t n = 100;
+    size_t j, num_ancestors, draws, walks;
+    int models[] = {MSP_MODEL_SMC, MSP_MODEL_SMC_PRIME};
+    sample_t *samples = malloc(n * sizeof(sample_t));
+    msp_t *msp = malloc(sizeof(msp_t));
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    CU_ASSERT_FATAL(msp != NULL);
+    CU_ASSERT_FATAL(samples != NULL);
+    CU_ASSERT_FATAL(rng != NULL);
+    memset(samples, 0, n * sizeof(sample_t));
+
+    for (j = 0; j < sizeof(models) / sizeof(int); j++) {
+        gsl_rng_set(rng, 1);
+        ret = msp_alloc(msp, n, samples, rng);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_model(msp, models[j]);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_num_loci(msp, 1000);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_scaled_recombination_rate(msp, 1.0);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_initialise(msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        /* Each event draws at most as many pairs as there are lineages
+         * in the population, and walks the left index at most once. */
+        do {
+            num_ancestors = msp_get_num_ancestors(msp);
+            draws = msp->num_overlapping_pair_draws;
+            walks = msp->num_overlapping_pair_walks;
+            ret = msp_run(msp, DBL_MAX, 1);
+            CU_ASSERT_FATAL(ret >= 0);
+            CU_ASSERT(msp->num_overlapping_pair_draws - draws <= num_ancestors);
+            CU_ASSERT(msp->num_overlapping_pair_walks - walks <= 1);
+        } while (ret == 1);
+        CU_ASSERT(msp->num_overlapping_pair_draws
+                >= msp_get_num_common_ancestor_events(msp));
+        CU_ASSERT(msp->num_overlapping_pair_walks
+                <= msp_get_num_common_ancestor_events(msp));
+        /* Few pairs can coalesce near the end, so the walk is exercised */
+        CU_ASSERT(msp->num_overlapping_pair_walks > 0);
+        msp_verify(msp);
+        ret = msp_free(msp);
+        CU_ASSERT_EQUAL(ret, 0);
+    }
     gsl_rng_free(rng);
     free(msp);
     free(samples);
@@ -1325,6 +2623,7 @@ test_multi_locus_simulation(void)
     const char *model_strs[] = {"hudson", "smc", "smc_prime"};
     const char *model_str;
     size_t j;
+    msp_profile_t profile;
 
     for (j = 0; j < sizeof(models) / sizeof(int); j++) {
         sample_t *samples = malloc(n * sizeof(sample_t));
@@ -1356,6 +2655,8 @@ test_multi_locus_simulation(void)
         CU_ASSERT_EQUAL(ret, 0);
         ret = msp_set_migration_record_block_size(msp, 1);
         CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_hugepages(msp, true);
+        CU_ASSERT_EQUAL(ret, 0);
         ret = msp_set_num_loci(msp, m);
         CU_ASSERT_EQUAL(ret, 0);
         ret = msp_set_scaled_recombination_rate(msp, 1.0);
@@ -1364,6 +2665,7 @@ test_multi_locus_simulation(void)
         CU_ASSERT_EQUAL(ret, 0);
         ret = msp_initialise(msp);
         CU_ASSERT_EQUAL(ret, 0);
+        CU_ASSERT_EQUAL(msp_set_hugepages(msp, false), MSP_ERR_BAD_STATE);
 
         num_events = 0;
         while ((ret = msp_run(msp, DBL_MAX, 1)) == 1) {
@@ -1381,9 +2683,27 @@ test_multi_locus_simulation(void)
                 msp_get_num_recombination_events(msp) +
                 msp_get_num_common_ancestor_events(msp) +
                 msp_get_num_rejected_common_ancestor_events(msp));
+        /* The SMC models sample overlapping pairs directly */
+        CU_ASSERT_EQUAL(msp_get_num_rejected_common_ancestor_events(msp), 0);
+        ret = msp_get_profile(msp, &profile);
+        CU_ASSERT_EQUAL(ret, 0);
+        if (profile.enabled) {
+            CU_ASSERT_TRUE(profile.common_ancestor_time > 0);
+            CU_ASSERT_TRUE(profile.recombination_time > 0);
+            CU_ASSERT_TRUE(profile.max_num_ancestors >= n);
+            CU_ASSERT_TRUE(profile.max_num_segments >= n);
+            CU_ASSERT_TRUE(profile.max_num_links >= n * (m - 1));
+        } else {
+            CU_ASSERT_EQUAL(profile.common_ancestor_time, 0);
+            CU_ASSERT_EQUAL(profile.max_num_ancestors, 0);
+        }
         if (models[j] == MSP_MODEL_HUDSON) {
-            CU_ASSERT_EQUAL(msp_get_num_rejected_common_ancestor_events(msp), 0);
+            CU_ASSERT_EQUAL(profile.max_num_overlap_nodes, 0);
+        } else {
+            CU_ASSERT(profile.max_num_overlap_nodes >= 2 * n);
         }
+        CU_ASSERT(profile.overlap_node_heap_fragmentation >= 0.0);
+        CU_ASSERT(profile.overlap_node_heap_fragmentation <= 1.0);
 
         gsl_rng_set(rng, seed);
         ret = msp_reset(msp);
@@ -1400,9 +2720,8 @@ test_multi_locus_simulation(void)
                 msp_get_num_recombination_events(msp) +
                 msp_get_num_common_ancestor_events(msp) +
                 msp_get_num_rejected_common_ancestor_events(msp));
-        if (models[j] == MSP_MODEL_HUDSON) {
-            CU_ASSERT_EQUAL(msp_get_num_rejected_common_ancestor_events(msp), 0);
-        }
+        /* The SMC models sample overlapping pairs directly */
+        CU_ASSERT_EQUAL(msp_get_num_rejected_common_ancestor_events(msp), 0);
 
         model = msp_get_model(msp);
         CU_ASSERT_EQUAL(model, models[j]);
@@ -1504,6 +2823,7 @@ test_large_bottleneck_simulation(void)
     gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
     uint32_t num_bottlenecks = 10;
     bottleneck_desc_t bottlenecks[num_bottlenecks];
+    size_t num_transient_allocations;
     double t;
 
     CU_ASSERT_FATAL(msp != NULL);
@@ -1523,47 +2843,499 @@ test_large_bottleneck_simulation(void)
     gsl_rng_set(rng, seed);
     memset(samples, 0, n * sizeof(sample_t));
     ret = msp_alloc(msp, n, samples, rng);
-    CU_ASSERT_EQUAL(ret, 0);
-    ret = msp_set_scaled_recombination_rate(msp, 1.0);
-    CU_ASSERT_EQUAL(ret, 0);
-    ret = msp_set_num_loci(msp, m);
-    CU_ASSERT_EQUAL(ret, 0);
-    for (j = 0; j < num_bottlenecks; j++) {
-        ret = msp_add_simple_bottleneck(msp, bottlenecks[j].time, 0,
-                bottlenecks[j].parameter);
-        CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_scaled_recombination_rate(msp, 1.0);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_num_loci(msp, m);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (j = 0; j < num_bottlenecks; j++) {
+        ret = msp_add_simple_bottleneck(msp, bottlenecks[j].time, 0,
+                bottlenecks[j].parameter);
+        CU_ASSERT_EQUAL(ret, 0);
+    }
+    ret = msp_initialise(msp);
+    CU_ASSERT_EQUAL(ret, 0);
+
+    for (j = 0; j < num_bottlenecks - 1; j++) {
+        ret = msp_run(msp, bottlenecks[j].time, ULONG_MAX);
+        CU_ASSERT_EQUAL(ret, 2);
+        CU_ASSERT_FALSE(msp_is_completed(msp));
+        CU_ASSERT_EQUAL(msp->time, bottlenecks[j].time);
+        msp_verify(msp);
+    }
+    ret = msp_run(msp, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_TRUE(msp_is_completed(msp));
+    CU_ASSERT_EQUAL(msp->time, bottlenecks[num_bottlenecks - 1].time);
+    msp_verify(msp);
+    num_transient_allocations = msp_get_num_transient_allocations(msp);
+    CU_ASSERT_TRUE(num_transient_allocations > 0);
+
+    /* Test out resets on partially completed simulations. */
+    ret = msp_reset(msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (j = 0; j < num_bottlenecks - 1; j++) {
+        ret = msp_run(msp, bottlenecks[j].time, ULONG_MAX);
+        CU_ASSERT_EQUAL(ret, 2);
+    }
+    ret = msp_reset(msp);
+    msp_verify(msp);
+
+    /* Repeating the simulation needs no more scratch memory. */
+    gsl_rng_set(rng, seed);
+    ret = msp_run(msp, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL(msp_get_num_transient_allocations(msp),
+            num_transient_allocations);
+    msp_verify(msp);
+
+    ret = msp_free(msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    gsl_rng_free(rng);
+    free(msp);
+    free(samples);
+}
+
+static void
+alloc_checkpoint_simulation(msp_t *msp, sample_t *samples, uint32_t n,
+        uint32_t num_loci, gsl_rng *rng)
+{
+    int ret;
+    double migration_matrix[] = {0, 1, 1, 0};
+
+    ret = msp_alloc(msp, n, samples, rng);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_num_loci(msp, num_loci);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_scaled_recombination_rate(msp, 0.5);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_num_populations(msp, 2);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_migration_matrix(msp, 4, migration_matrix);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_store_migration_records(msp, true);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_segment_block_size(msp, 16);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_add_population_parameters_change(msp, 0.05, 1, 0.5, 1.0);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_add_migration_rate_change(msp, 0.1, -1, 2.0);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_add_instantaneous_bottleneck(msp, 0.2, 0, 0.5);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_add_mass_migration(msp, 0.3, 1, 0, 1.0);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_initialise(msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+}
+
+static void
+verify_simulations_equal(msp_t *msp1, msp_t *msp2)
+{
+    int ret;
+    size_t j, k;
+    coalescence_record_t *cr1, *cr2;
+    migration_record_t *mr1, *mr2;
+
+    CU_ASSERT_EQUAL(msp1->time, msp2->time);
+    CU_ASSERT_EQUAL(msp_get_num_recombination_events(msp1),
+            msp_get_num_recombination_events(msp2));
+    CU_ASSERT_EQUAL(msp_get_num_common_ancestor_events(msp1),
+            msp_get_num_common_ancestor_events(msp2));
+    CU_ASSERT_EQUAL_FATAL(msp_get_num_coalescence_records(msp1),
+            msp_get_num_coalescence_records(msp2));
+    ret = msp_get_coalescence_records(msp1, &cr1);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_get_coalescence_records(msp2, &cr2);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (j = 0; j < msp_get_num_coalescence_records(msp1); j++) {
+        CU_ASSERT_EQUAL(cr1[j].left, cr2[j].left);
+        CU_ASSERT_EQUAL(cr1[j].right, cr2[j].right);
+        CU_ASSERT_EQUAL(cr1[j].node, cr2[j].node);
+        CU_ASSERT_EQUAL(cr1[j].time, cr2[j].time);
+        CU_ASSERT_EQUAL(cr1[j].population_id, cr2[j].population_id);
+        CU_ASSERT_EQUAL_FATAL(cr1[j].num_children, cr2[j].num_children);
+        for (k = 0; k < cr1[j].num_children; k++) {
+            CU_ASSERT_EQUAL(cr1[j].children[k], cr2[j].children[k]);
+        }
+    }
+    CU_ASSERT_EQUAL_FATAL(msp_get_num_migration_records(msp1),
+            msp_get_num_migration_records(msp2));
+    ret = msp_get_migration_records(msp1, &mr1);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_get_migration_records(msp2, &mr2);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (j = 0; j < msp_get_num_migration_records(msp1); j++) {
+        CU_ASSERT_EQUAL(mr1[j].left, mr2[j].left);
+        CU_ASSERT_EQUAL(mr1[j].right, mr2[j].right);
+        CU_ASSERT_EQUAL(mr1[j].node, mr2[j].node);
+        CU_ASSERT_EQUAL(mr1[j].source, mr2[j].source);
+        CU_ASSERT_EQUAL(mr1[j].dest, mr2[j].dest);
+        CU_ASSERT_EQUAL(mr1[j].time, mr2[j].time);
+    }
+}
+
+static void
+test_simulation_checkpoint(void)
+{
+    int ret;
+    uint32_t j, n = 40, num_loci = 500;
+    size_t max_size, max_memory;
+    unsigned long num_events[] = {1, 10, 500, 2000};
+    msp_t msp, msp_checkpointed, msp_restored;
+    sample_t *samples = calloc(n, sizeof(sample_t));
+    gsl_rng *rng1 = gsl_rng_alloc(gsl_rng_default);
+    gsl_rng *rng2 = gsl_rng_alloc(gsl_rng_default);
+    gsl_rng *rng3 = gsl_rng_alloc(gsl_rng_default);
+    FILE *f;
+
+    CU_ASSERT_FATAL(samples != NULL && rng1 != NULL && rng2 != NULL
+            && rng3 != NULL);
+    for (j = 0; j < n; j++) {
+        samples[j].population_id = j % 2;
+    }
+    gsl_rng_set(rng1, 7);
+    alloc_checkpoint_simulation(&msp, samples, n, num_loci, rng1);
+    CU_ASSERT_EQUAL(msp_checkpoint(&msp, _tmp_file_name), 0);
+    ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    for (j = 0; j < sizeof(num_events) / sizeof(unsigned long); j++) {
+        gsl_rng_set(rng2, 7);
+        alloc_checkpoint_simulation(&msp_checkpointed, samples, n, num_loci,
+                rng2);
+        ret = msp_run(&msp_checkpointed, DBL_MAX, num_events[j]);
+        CU_ASSERT_TRUE(ret >= 0);
+        ret = msp_checkpoint(&msp_checkpointed, _tmp_file_name);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        /* Checkpointing does not change the simulation */
+        ret = msp_run(&msp_checkpointed, DBL_MAX, ULONG_MAX);
+        CU_ASSERT_EQUAL(ret, 0);
+        verify_simulations_equal(&msp, &msp_checkpointed);
+
+        /* The restored simulation gives exactly the same result. The
+         * seed is different to show that the RNG state is restored. */
+        gsl_rng_set(rng3, 1234);
+        alloc_checkpoint_simulation(&msp_restored, samples, n, num_loci, rng3);
+        ret = msp_restore(&msp_restored, _tmp_file_name);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        msp_verify(&msp_restored);
+        ret = msp_run(&msp_restored, DBL_MAX, ULONG_MAX);
+        CU_ASSERT_EQUAL(ret, 0);
+        msp_verify(&msp_restored);
+        verify_simulations_equal(&msp, &msp_restored);
+        CU_ASSERT_EQUAL(msp_restore(&msp_restored, _tmp_file_name),
+                MSP_ERR_BAD_STATE);
+        msp_free(&msp_restored);
+        msp_free(&msp_checkpointed);
+    }
+
+    /* Periodic checkpoints during msp_run */
+    gsl_rng_set(rng2, 7);
+    alloc_checkpoint_simulation(&msp_checkpointed, samples, n, num_loci, rng2);
+    ret = msp_set_checkpoint_interval(&msp_checkpointed, _tmp_file_name, 100,
+            0);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL(msp_set_checkpoint_interval(&msp_checkpointed,
+                _tmp_file_name, 0, -1), MSP_ERR_BAD_PARAM_VALUE);
+    remove(_tmp_file_name);
+    ret = msp_run(&msp_checkpointed, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    verify_simulations_equal(&msp, &msp_checkpointed);
+    gsl_rng_set(rng3, 1234);
+    alloc_checkpoint_simulation(&msp_restored, samples, n, num_loci, rng3);
+    ret = msp_restore(&msp_restored, _tmp_file_name);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_TRUE(msp_restored.time > 0);
+    ret = msp_run(&msp_restored, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    verify_simulations_equal(&msp, &msp_restored);
+    msp_free(&msp_restored);
+    msp_free(&msp_checkpointed);
+
+    /* Running out of memory while the lineage sets grow. The limit leaves
+     * room for the segments, but not for the first lineage set block. */
+    gsl_rng_set(rng2, 7);
+    alloc_checkpoint_simulation(&msp_checkpointed, samples, n, num_loci, rng2);
+    ret = msp_run(&msp_checkpointed, DBL_MAX, 500);
+    CU_ASSERT_EQUAL_FATAL(ret, 1);
+    ret = msp_checkpoint(&msp_checkpointed, _tmp_file_name);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    alloc_checkpoint_simulation(&msp_restored, samples, n, num_loci, rng3);
+    max_size = msp_restored.populations[0].ancestors.max_size;
+    CU_ASSERT_FATAL(max_size
+            < lineage_set_get_size(&msp_checkpointed.populations[0].ancestors));
+    max_memory = msp_get_used_memory(&msp_restored)
+        + (msp_checkpointed.max_segments - msp_restored.max_segments)
+            * (sizeof(segment_t) + 2 * sizeof(int64_t) + sizeof(uint32_t))
+        + max_size * sizeof(uint32_t) / 2;
+    ret = msp_set_max_memory(&msp_restored, max_memory);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_restore(&msp_restored, _tmp_file_name);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_NO_MEMORY);
+    CU_ASSERT_EQUAL(msp_restored.max_segments, msp_checkpointed.max_segments);
+    CU_ASSERT_EQUAL(msp_restored.populations[0].ancestors.max_size, max_size);
+    CU_ASSERT(msp_get_used_memory(&msp_restored) <= max_memory);
+    msp_free(&msp_restored);
+    msp_free(&msp_checkpointed);
+
+    /* Errors */
+    alloc_checkpoint_simulation(&msp_restored, samples, n, num_loci + 1, rng3);
+    CU_ASSERT_EQUAL(msp_restore(&msp_restored, _tmp_file_name),
+            MSP_ERR_BAD_CHECKPOINT);
+    CU_ASSERT_EQUAL(msp_reset(&msp_restored), 0);
+    CU_ASSERT_EQUAL(msp_restore(&msp_restored, "/no/such/file"), MSP_ERR_IO);
+    CU_ASSERT_EQUAL(msp_checkpoint(&msp_restored, "/no/such/file"),
+            MSP_ERR_IO);
+    f = fopen(_tmp_file_name, "w");
+    CU_ASSERT_FATAL(f != NULL);
+    fprintf(f, "MSPCKP");
+    fclose(f);
+    CU_ASSERT_EQUAL(msp_restore(&msp_restored, _tmp_file_name),
+            MSP_ERR_FILE_FORMAT);
+    msp_free(&msp_restored);
+
+    msp_free(&msp);
+    gsl_rng_free(rng1);
+    gsl_rng_free(rng2);
+    gsl_rng_free(rng3);
+    free(samples);
+}
+
+static void
+alloc_smc_simulation(msp_t *msp, sample_t *samples, uint32_t n, int model,
+        gsl_rng *rng)
+{
+    int ret;
+    double migration_matrix[] = {0, 0.5, 0.5, 0};
+
+    ret = msp_alloc(msp, n, samples, rng);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_num_loci(msp, 1000);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_scaled_recombination_rate(msp, 0.1);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_model(msp, model);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_num_populations(msp, 2);
+    CU_ASSERT_EQUAL(ret, 0);
+    /* Population 1 is growing, so its waiting times are drawn separately */
+    ret = msp_set_population_configuration(msp, 1, 1.0, 0.5);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_migration_matrix(msp, 4, migration_matrix);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_segment_block_size(msp, 8);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_add_mass_migration(msp, 0.5, 1, 0, 0.5);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_initialise(msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+}
+
+static void
+test_smc_overlap_index(void)
+{
+    int ret;
+    uint32_t j, k, n = 20;
+    int models[] = {MSP_MODEL_SMC, MSP_MODEL_SMC_PRIME};
+    unsigned long num_events;
+    msp_t msp, msp_restored;
+    sample_t *samples = calloc(n, sizeof(sample_t));
+    gsl_rng *rng1 = gsl_rng_alloc(gsl_rng_default);
+    gsl_rng *rng2 = gsl_rng_alloc(gsl_rng_default);
+
+    CU_ASSERT_FATAL(samples != NULL && rng1 != NULL && rng2 != NULL);
+    for (j = 0; j < n; j++) {
+        samples[j].population_id = j % 2;
+    }
+    for (j = 0; j < sizeof(models) / sizeof(int); j++) {
+        gsl_rng_set(rng1, 5);
+        alloc_smc_simulation(&msp, samples, n, models[j], rng1);
+        num_events = 0;
+        while ((ret = msp_run(&msp, DBL_MAX, 1)) == 1) {
+            msp_verify(&msp);
+            num_events++;
+            if (num_events == 50) {
+                ret = msp_checkpoint(&msp, _tmp_file_name);
+                CU_ASSERT_EQUAL_FATAL(ret, 0);
+            }
+        }
+        CU_ASSERT_EQUAL(ret, 0);
+        CU_ASSERT_FATAL(num_events > 50);
+        msp_verify(&msp);
+        CU_ASSERT(msp_get_num_recombination_events(&msp) > 0);
+        CU_ASSERT(msp_get_num_common_ancestor_events(&msp) >= n - 1);
+        /* Only pairs that can coalesce are chosen */
+        CU_ASSERT_EQUAL(msp_get_num_rejected_common_ancestor_events(&msp), 0);
+        for (k = 0; k < 2; k++) {
+            CU_ASSERT_EQUAL(msp.populations[k].num_overlapping_pairs, 0);
+        }
+
+        /* The index is rebuilt when we restore */
+        gsl_rng_set(rng2, 1234);
+        alloc_smc_simulation(&msp_restored, samples, n, models[j], rng2);
+        ret = msp_restore(&msp_restored, _tmp_file_name);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        msp_verify(&msp_restored);
+        while ((ret = msp_run(&msp_restored, DBL_MAX, 1)) == 1) {
+            msp_verify(&msp_restored);
+        }
+        CU_ASSERT_EQUAL(ret, 0);
+        verify_simulations_equal(&msp, &msp_restored);
+        msp_free(&msp_restored);
+        msp_free(&msp);
+    }
+    gsl_rng_free(rng1);
+    gsl_rng_free(rng2);
+    free(samples);
+}
+
+static int
+configure_replicate(msp_t *msp, recomb_map_t *recomb_map, gsl_rng *rng,
+        void *arg)
+{
+    int ret;
+    uint32_t j, n = 10, num_loci = 100;
+    sample_t samples[10];
+    double positions[] = {0.0, 100.0};
+    double rates[] = {0.01, 0.0};
+
+    if (arg != NULL) {
+        return *((int *) arg);
+    }
+    for (j = 0; j < n; j++) {
+        samples[j].population_id = 0;
+        samples[j].time = 0;
+    }
+    ret = msp_alloc(msp, n, samples, rng);
+    if (ret != 0) {
+        goto out;
     }
-    ret = msp_initialise(msp);
-    CU_ASSERT_EQUAL(ret, 0);
-
-    for (j = 0; j < num_bottlenecks - 1; j++) {
-        ret = msp_run(msp, bottlenecks[j].time, ULONG_MAX);
-        CU_ASSERT_EQUAL(ret, 2);
-        CU_ASSERT_FALSE(msp_is_completed(msp));
-        CU_ASSERT_EQUAL(msp->time, bottlenecks[j].time);
-        msp_verify(msp);
+    ret = msp_set_num_loci(msp, num_loci);
+    if (ret != 0) {
+        goto out;
     }
-    ret = msp_run(msp, DBL_MAX, ULONG_MAX);
-    CU_ASSERT_EQUAL(ret, 0);
-    CU_ASSERT_TRUE(msp_is_completed(msp));
-    CU_ASSERT_EQUAL(msp->time, bottlenecks[num_bottlenecks - 1].time);
-    msp_verify(msp);
+    ret = recomb_map_alloc(recomb_map, num_loci, 100.0, positions, rates, 2);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_set_scaled_recombination_rate(msp,
+            recomb_map_get_per_locus_recombination_rate(recomb_map));
+out:
+    return ret;
+}
 
-    /* Test out resets on partially completed simulations. */
-    ret = msp_reset(msp);
-    CU_ASSERT_EQUAL(ret, 0);
-    for (j = 0; j < num_bottlenecks - 1; j++) {
-        ret = msp_run(msp, bottlenecks[j].time, ULONG_MAX);
-        CU_ASSERT_EQUAL(ret, 2);
+static int
+summarise_replicate(tree_sequence_t *ts, size_t replicate, FILE *out,
+        void *arg)
+{
+    int ret;
+    size_t j;
+    coalescence_record_t cr;
+    double total_time = 0;
+
+    if (arg != NULL && replicate == 5) {
+        return *((int *) arg);
     }
-    ret = msp_reset(msp);
-    msp_verify(msp);
+    for (j = 0; j < tree_sequence_get_num_coalescence_records(ts); j++) {
+        ret = tree_sequence_get_coalescence_record(ts, j, &cr,
+                MSP_ORDER_TIME);
+        if (ret != 0) {
+            goto out;
+        }
+        total_time += cr.time;
+    }
+    fprintf(out, "%d\t%d\t%d\t%.17g\n", (int) replicate,
+            (int) tree_sequence_get_num_coalescence_records(ts),
+            (int) tree_sequence_get_num_mutations(ts), total_time);
+    ret = 0;
+out:
+    return ret;
+}
 
-    ret = msp_free(msp);
-    CU_ASSERT_EQUAL(ret, 0);
-    gsl_rng_free(rng);
-    free(msp);
-    free(samples);
+static char *
+run_replicates(size_t num_threads, size_t num_replicates, unsigned long seed)
+{
+    int ret;
+    replicate_driver_t driver;
+    FILE *f = tmpfile();
+    long size;
+    char *output;
+
+    CU_ASSERT_FATAL(f != NULL);
+    ret = replicate_driver_alloc(&driver, num_threads, seed, 0.5, 0.25,
+            configure_replicate, summarise_replicate, NULL);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = replicate_driver_run(&driver, num_replicates, f);
+    CU_ASSERT_EQUAL(ret, 0);
+    replicate_driver_free(&driver);
+    size = ftell(f);
+    CU_ASSERT_FATAL(size > 0);
+    output = calloc((size_t) size + 1, 1);
+    CU_ASSERT_FATAL(output != NULL);
+    rewind(f);
+    CU_ASSERT_EQUAL(fread(output, 1, (size_t) size, f), (size_t) size);
+    fclose(f);
+    return output;
+}
+
+static void
+test_replicate_driver(void)
+{
+    int ret, err;
+    size_t j, num_replicates = 20;
+    char *single, *multiple, *line;
+    char expected[64];
+    replicate_driver_t driver;
+
+    single = run_replicates(1, num_replicates, 5);
+    /* Output is in replicate order */
+    line = single;
+    for (j = 0; j < num_replicates; j++) {
+        sprintf(expected, "%d\t", (int) j);
+        CU_ASSERT_EQUAL(strncmp(line, expected, strlen(expected)), 0);
+        line = strchr(line, '\n');
+        CU_ASSERT_FATAL(line != NULL);
+        line++;
+    }
+    CU_ASSERT_EQUAL(*line, '\0');
+    /* ... and doesn't depend on the number of threads */
+    for (j = 2; j <= 8; j *= 2) {
+        multiple = run_replicates(j, num_replicates, 5);
+        CU_ASSERT_STRING_EQUAL(single, multiple);
+        free(multiple);
+    }
+    /* A different seed gives different replicates */
+    multiple = run_replicates(4, num_replicates, 6);
+    CU_ASSERT(strcmp(single, multiple) != 0);
+    free(multiple);
+    free(single);
+
+    /* Errors */
+    ret = replicate_driver_alloc(&driver, 0, 1, 0, 0.25,
+            configure_replicate, summarise_replicate, NULL);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+    replicate_driver_free(&driver);
+    ret = replicate_driver_alloc(&driver, 1, 1, -1, 0.25,
+            configure_replicate, summarise_replicate, NULL);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+    replicate_driver_free(&driver);
+    err = MSP_ERR_BAD_PARAM_VALUE;
+    ret = replicate_driver_alloc(&driver, 2, 1, 0, 0.25,
+            configure_replicate, summarise_replicate, &err);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+    replicate_driver_free(&driver);
+    /* An error in one replicate stops the run. */
+    err = MSP_ERR_GENERIC;
+    for (j = 1; j <= 4; j++) {
+        ret = replicate_driver_alloc(&driver, j, 1, 0, 0.25,
+                configure_replicate, summarise_replicate, NULL);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        driver.arg = &err;
+        ret = replicate_driver_run(&driver, num_replicates, _devnull);
+        CU_ASSERT_EQUAL(ret, MSP_ERR_GENERIC);
+        replicate_driver_free(&driver);
+    }
 }
 
 static void
@@ -3295,105 +5067,599 @@ verify_tree_next_prev(tree_sequence_t *ts)
         j++;
     }
     CU_ASSERT_EQUAL_FATAL(ret, 0);
-    CU_ASSERT_EQUAL_FATAL(j, num_trees);
-    CU_ASSERT_EQUAL_FATAL(t.index, num_trees - 1);
-    /* Calling next should return 0 and have no effect. */
-    for (j = 0; j < 10; j++) {
-        ret = sparse_tree_next(&t);
+    CU_ASSERT_EQUAL_FATAL(j, num_trees);
+    CU_ASSERT_EQUAL_FATAL(t.index, num_trees - 1);
+    /* Calling next should return 0 and have no effect. */
+    for (j = 0; j < 10; j++) {
+        ret = sparse_tree_next(&t);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        CU_ASSERT_EQUAL_FATAL(t.index, num_trees - 1);
+        ret = sparse_tree_equal(&t, &trees[t.index]);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+    }
+
+    /* Do a zigzagging traversal */
+    ret = sparse_tree_first(&t);
+    CU_ASSERT_EQUAL_FATAL(ret, 1);
+    for (j = 1; j < GSL_MIN(10, num_trees / 2); j++) {
+        while (t.index < num_trees - j) {
+            ret = sparse_tree_next(&t);
+            CU_ASSERT_EQUAL_FATAL(ret, 1);
+        }
+        CU_ASSERT_EQUAL_FATAL(t.index, num_trees - j);
+        ret = sparse_tree_equal(&t, &trees[t.index]);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        while (t.index > j) {
+            ret = sparse_tree_prev(&t);
+            CU_ASSERT_EQUAL_FATAL(ret, 1);
+        }
+        CU_ASSERT_EQUAL_FATAL(t.index, j);
+        ret = sparse_tree_equal(&t, &trees[t.index]);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+    }
+
+    /* Free the trees. */
+    ret = sparse_tree_free(&t);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    for (j = 0; j < tree_sequence_get_num_trees(ts); j++) {
+        ret = sparse_tree_free(&trees[j]);
+    }
+    free(trees);
+}
+
+static void
+test_leaf_sets(void)
+{
+    int ret;
+    const char * text_records =
+        "2 10 4 2,3 0.071 0\n"
+        "0 2  5 1,3 0.090 0\n"
+        "2 10 5 1,4 0.090 0\n"
+        "0 7  6 0,5 0.170 0\n"
+        "7 10 7 0,5 0.202 0\n"
+        "0 2  8 2,6 0.253 0";
+    leaf_count_test_t tests[] = {
+        {0, 0, 1}, {0, 5, 2}, {0, 6, 3},
+        {1, 4, 2}, {1, 5, 3}, {1, 6, 4}};
+    size_t num_records;
+    uint32_t num_tests = 6;
+    tree_sequence_t ts;
+    coalescence_record_t *records;
+
+    parse_text_records(text_records, &num_records, &records);
+    CU_ASSERT_EQUAL_FATAL(num_records, 6);
+    ret = tree_sequence_load_records(&ts, num_records, records);
+    CU_ASSERT_EQUAL(ret, 0);
+    verify_leaf_counts(&ts, num_tests, tests);
+    verify_leaf_sets(&ts);
+
+    tree_sequence_free(&ts);
+    free_local_records(num_records, records);
+}
+
+static void
+test_nonbinary_leaf_sets(void)
+{
+    int ret;
+    const char * text_records =
+        "0	100	8	0,1,2,3	0.01	0\n"
+        "0	100	9	6,8	    0.068   0\n"
+        "0	17	10	4,5,7	0.2	    0\n"
+        "17	100	10	4,7	    0.2	    0\n"
+        "17	100	11	5,9	    0.279   0\n"
+        "0	17	12	9,10	0.405   0\n"
+        "17	100	12	10,11	0.405   0";
+    size_t num_records;
+    leaf_count_test_t tests[] = {
+        {0, 0, 1}, {0, 8, 4}, {0, 9, 5}, {0, 10, 3}, {0, 12, 8},
+        {1, 5, 1}, {1, 8, 4}, {1, 9, 5}, {0, 10, 2}, {0, 11, 1}};
+    uint32_t num_tests = 8;
+    coalescence_record_t *records;
+    tree_sequence_t ts;
+
+    parse_text_records(text_records, &num_records, &records);
+    CU_ASSERT_EQUAL_FATAL(num_records, 7);
+    ret = tree_sequence_load_records(&ts, num_records, records);
+    CU_ASSERT_EQUAL(ret, 0);
+    verify_leaf_counts(&ts, num_tests, tests);
+    verify_leaf_sets(&ts);
+
+    tree_sequence_free(&ts);
+    free_local_records(num_records, records);
+}
+
+static void
+verify_sequential_simulation(int model, uint32_t num_historical_samples,
+        unsigned long seed, tree_sequence_t *ts)
+{
+    int ret;
+    uint32_t j, n = 20, m = 200;
+    sample_t samples[20];
+    msp_t msp;
+    recomb_map_t recomb_map;
+    double positions[] = {0.0, 200.0};
+    double rates[] = {0.0, 0.0};
+    size_t num_breakpoints;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    CU_ASSERT_FATAL(rng != NULL);
+    gsl_rng_set(rng, seed);
+    memset(samples, 0, sizeof(samples));
+    for (j = 0; j < num_historical_samples; j++) {
+        samples[n - j - 1].time = 0.1 * (j + 1);
+    }
+    ret = msp_alloc(&msp, n, samples, rng);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_model(&msp, model);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_sequential(&msp, true);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_TRUE(msp_get_sequential(&msp));
+    ret = msp_set_num_loci(&msp, m);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_scaled_recombination_rate(&msp, 0.05);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_coalescence_record_block_size(&msp, 1);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL(msp_set_sequential(&msp, false), MSP_ERR_BAD_STATE);
+    CU_ASSERT_EQUAL(msp_run(&msp, 1.0, ULONG_MAX),
+            MSP_ERR_UNSUPPORTED_OPERATION);
+
+    while ((ret = msp_run(&msp, DBL_MAX, 1)) == 1) {
+        msp_verify(&msp);
+        CU_ASSERT_FALSE(msp_is_completed(&msp));
+    }
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_TRUE(msp_is_completed(&msp));
+    CU_ASSERT_EQUAL(msp_get_num_ancestors(&msp), 0);
+    CU_ASSERT(msp_get_num_recombination_events(&msp) > 0);
+    CU_ASSERT_EQUAL(msp_checkpoint(&msp, _tmp_file_name),
+            MSP_ERR_UNSUPPORTED_OPERATION);
+    num_breakpoints = msp_get_num_breakpoints(&msp);
+    CU_ASSERT(num_breakpoints > 0);
+
+    ret = recomb_map_alloc(&recomb_map, m, 200.0, positions, rates, 2);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = tree_sequence_create(ts, &msp, &recomb_map, 0.25);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL(tree_sequence_get_num_trees(ts), num_breakpoints + 1);
+    CU_ASSERT_EQUAL(tree_sequence_get_num_nodes(ts), msp.next_node);
+    verify_trees_consistent(ts);
+
+    /* Running again after a reset gives a new simulation */
+    ret = msp_reset(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_TRUE(msp_is_completed(&msp));
+
+    recomb_map_free(&recomb_map);
+    msp_free(&msp);
+    gsl_rng_free(rng);
+}
+
+static void
+test_sequential_simulation(void)
+{
+    int ret;
+    size_t j, k;
+    int models[] = {MSP_MODEL_SMC, MSP_MODEL_SMC_PRIME};
+    tree_sequence_t ts1, ts2;
+    coalescence_record_t r1, r2;
+    sample_t samples[2];
+    msp_t msp;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    for (j = 0; j < sizeof(models) / sizeof(int); j++) {
+        verify_sequential_simulation(models[j], 0, 1, &ts1);
+        tree_sequence_free(&ts1);
+        verify_sequential_simulation(models[j], 5, 2, &ts1);
+        /* The same seed gives the same records */
+        verify_sequential_simulation(models[j], 5, 2, &ts2);
+        CU_ASSERT_EQUAL_FATAL(tree_sequence_get_num_coalescence_records(&ts1),
+                tree_sequence_get_num_coalescence_records(&ts2));
+        for (k = 0; k < tree_sequence_get_num_coalescence_records(&ts1);
+                k++) {
+            ret = tree_sequence_get_coalescence_record(&ts1, k, &r1,
+                    MSP_ORDER_TIME);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            ret = tree_sequence_get_coalescence_record(&ts2, k, &r2,
+                    MSP_ORDER_TIME);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            verify_coalescence_records_equal(&r1, &r2, 1.0);
+            CU_ASSERT_EQUAL(r1.node, r2.node);
+        }
+        tree_sequence_free(&ts1);
+        tree_sequence_free(&ts2);
+    }
+
+    /* Unsupported configurations */
+    CU_ASSERT_FATAL(rng != NULL);
+    memset(samples, 0, sizeof(samples));
+    for (j = 0; j < 4; j++) {
+        ret = msp_alloc(&msp, 2, samples, rng);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = msp_set_sequential(&msp, true);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        if (j > 0) {
+            ret = msp_set_model(&msp, MSP_MODEL_SMC_PRIME);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+        }
+        if (j == 1) {
+            ret = msp_set_num_populations(&msp, 2);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+        } else if (j == 2) {
+            ret = msp_set_population_configuration(&msp, 0, 1.0, 0.5);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+        } else if (j == 3) {
+            ret = msp_add_population_parameters_change(&msp, 1.0, 0, 2.0,
+                    0.0);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+        }
+        ret = msp_initialise(&msp);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+        CU_ASSERT_EQUAL(ret, j == 0 ? MSP_ERR_BAD_MODEL
+                : MSP_ERR_UNSUPPORTED_OPERATION);
+        msp_free(&msp);
+    }
+    gsl_rng_free(rng);
+}
+
+/* Runs num_replicates SMC or SMC' simulations with the given engine and
+ * stores the mean and standard error of the number of distinct trees, the
+ * number of records and the TMRCA of the first tree in mean[] and se[]. */
+static void
+get_smc_engine_moments(int model, bool sequential, size_t num_replicates,
+        unsigned long seed, double *mean, double *se)
+{
+    int ret;
+    uint32_t n = 10;
+    size_t j, k, l, m, num_records;
+    sample_t samples[10];
+    msp_t msp;
+    coalescence_record_t *records;
+    double x[3], sum[3], sum_sq[3];
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+
+    CU_ASSERT_FATAL(rng != NULL);
+    gsl_rng_set(rng, seed);
+    memset(samples, 0, sizeof(samples));
+    memset(sum, 0, sizeof(sum));
+    memset(sum_sq, 0, sizeof(sum_sq));
+    ret = msp_alloc(&msp, n, samples, rng);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_model(&msp, model);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_sequential(&msp, sequential);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_num_loci(&msp, 1000);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_scaled_recombination_rate(&msp, 0.002);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    for (j = 0; j < num_replicates; j++) {
+        ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
         CU_ASSERT_EQUAL_FATAL(ret, 0);
-        CU_ASSERT_EQUAL_FATAL(t.index, num_trees - 1);
-        ret = sparse_tree_equal(&t, &trees[t.index]);
+        ret = msp_get_coalescence_records(&msp, &records);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        num_records = msp_get_num_coalescence_records(&msp);
+        x[0] = 0;
+        x[1] = (double) num_records;
+        x[2] = 0;
+        for (k = 0; k < num_records; k++) {
+            /* Count the distinct left coordinates rather than the
+             * breakpoints, since under the SMC' the back-in-time engine
+             * also has breakpoints at which the tree does not change. */
+            m = 0;
+            while (m < k && records[m].left != records[k].left) {
+                m++;
+            }
+            if (m == k) {
+                x[0]++;
+            }
+            if (records[k].left == 0) {
+                x[2] = GSL_MAX(x[2], records[k].time);
+            }
+        }
+        for (l = 0; l < 3; l++) {
+            sum[l] += x[l];
+            sum_sq[l] += x[l] * x[l];
+        }
+        ret = msp_reset(&msp);
         CU_ASSERT_EQUAL_FATAL(ret, 0);
     }
+    for (l = 0; l < 3; l++) {
+        mean[l] = sum[l] / (double) num_replicates;
+        se[l] = sqrt((sum_sq[l] / (double) num_replicates - mean[l] * mean[l])
+                / (double) (num_replicates - 1));
+    }
+    msp_free(&msp);
+    gsl_rng_free(rng);
+}
 
-    /* Do a zigzagging traversal */
-    ret = sparse_tree_first(&t);
-    CU_ASSERT_EQUAL_FATAL(ret, 1);
-    for (j = 1; j < GSL_MIN(10, num_trees / 2); j++) {
-        while (t.index < num_trees - j) {
-            ret = sparse_tree_next(&t);
-            CU_ASSERT_EQUAL_FATAL(ret, 1);
+static void
+test_sequential_simulation_equivalence(void)
+{
+    size_t j, l;
+    int models[] = {MSP_MODEL_SMC, MSP_MODEL_SMC_PRIME};
+    double mean1[3], se1[3], mean2[3], se2[3];
+
+    /* Both engines simulate the same model, so the means of the number
+     * of trees, the number of records and the first tree's TMRCA must
+     * agree to within sampling error. */
+    for (j = 0; j < sizeof(models) / sizeof(int); j++) {
+        get_smc_engine_moments(models[j], false, 5000, 1, mean1, se1);
+        get_smc_engine_moments(models[j], true, 5000, 2, mean2, se2);
+        for (l = 0; l < 3; l++) {
+            CU_ASSERT(se1[l] > 0);
+            CU_ASSERT(fabs(mean1[l] - mean2[l])
+                    < 4 * sqrt(se1[l] * se1[l] + se2[l] * se2[l]));
         }
-        CU_ASSERT_EQUAL_FATAL(t.index, num_trees - j);
-        ret = sparse_tree_equal(&t, &trees[t.index]);
-        CU_ASSERT_EQUAL_FATAL(ret, 0);
-        while (t.index > j) {
-            ret = sparse_tree_prev(&t);
-            CU_ASSERT_EQUAL_FATAL(ret, 1);
+    }
+}
+
+static void
+verify_joined_trees(tree_sequence_t *joined, size_t num_contigs,
+        tree_sequence_t **contigs)
+{
+    int ret;
+    size_t j, k, num_trees, num_mutations, contig_mutations;
+    uint32_t n = tree_sequence_get_sample_size(joined);
+    uint32_t mrca, contig_mrca;
+    double time, contig_time, *offset;
+    uint32_t *node_offset;
+    mutation_t *mutations, *contig_mutation_list;
+    sparse_tree_t tree, contig_tree;
+
+    CU_ASSERT_EQUAL_FATAL(tree_sequence_get_num_contigs(joined), num_contigs);
+    ret = tree_sequence_get_contigs(joined, &offset, &node_offset);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    num_trees = 0;
+    num_mutations = 0;
+    for (j = 0; j < num_contigs; j++) {
+        num_trees += tree_sequence_get_num_trees(contigs[j]);
+        num_mutations += tree_sequence_get_num_mutations(contigs[j]);
+        if (j == 0) {
+            CU_ASSERT_EQUAL(offset[j], 0);
+            CU_ASSERT_EQUAL(node_offset[j], n);
+        } else {
+            CU_ASSERT_EQUAL(offset[j], offset[j - 1]
+                    + tree_sequence_get_sequence_length(contigs[j - 1]));
+            CU_ASSERT_EQUAL(node_offset[j], node_offset[j - 1]
+                    + tree_sequence_get_num_nodes(contigs[j - 1]) - n);
         }
-        CU_ASSERT_EQUAL_FATAL(t.index, j);
-        ret = sparse_tree_equal(&t, &trees[t.index]);
+    }
+    CU_ASSERT_EQUAL(tree_sequence_get_num_trees(joined), num_trees);
+    CU_ASSERT_EQUAL(tree_sequence_get_num_mutations(joined), num_mutations);
+    CU_ASSERT_EQUAL(tree_sequence_get_sequence_length(joined),
+            offset[num_contigs - 1] + tree_sequence_get_sequence_length(
+                contigs[num_contigs - 1]));
+    verify_trees_consistent(joined);
+
+    /* Each contig's trees appear in order, shifted by its offset */
+    ret = sparse_tree_alloc(&tree, joined, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = sparse_tree_first(&tree);
+    CU_ASSERT_EQUAL_FATAL(ret, 1);
+    for (j = 0; j < num_contigs; j++) {
+        ret = sparse_tree_alloc(&contig_tree, contigs[j], 0);
         CU_ASSERT_EQUAL_FATAL(ret, 0);
+        for (ret = sparse_tree_first(&contig_tree); ret == 1;
+                ret = sparse_tree_next(&contig_tree)) {
+            CU_ASSERT_EQUAL(tree.left, contig_tree.left + offset[j]);
+            CU_ASSERT_EQUAL(tree.right, contig_tree.right + offset[j]);
+            ret = sparse_tree_get_mrca(&tree, 0, n - 1, &mrca);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            ret = sparse_tree_get_mrca(&contig_tree, 0, n - 1, &contig_mrca);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            CU_ASSERT_EQUAL(mrca, contig_mrca - n + node_offset[j]);
+            ret = sparse_tree_get_time(&tree, mrca, &time);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            ret = sparse_tree_get_time(&contig_tree, contig_mrca, &contig_time);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            CU_ASSERT_EQUAL(time, contig_time);
+            ret = sparse_tree_next(&tree);
+            CU_ASSERT_EQUAL(ret, j == num_contigs - 1
+                    && contig_tree.index
+                        == tree_sequence_get_num_trees(contigs[j]) - 1? 0: 1);
+        }
+        CU_ASSERT_EQUAL(ret, 0);
+        sparse_tree_free(&contig_tree);
     }
+    sparse_tree_free(&tree);
 
-    /* Free the trees. */
-    ret = sparse_tree_free(&t);
+    ret = tree_sequence_get_mutations(joined, &mutations);
     CU_ASSERT_EQUAL_FATAL(ret, 0);
-    for (j = 0; j < tree_sequence_get_num_trees(ts); j++) {
-        ret = sparse_tree_free(&trees[j]);
+    k = 0;
+    for (j = 0; j < num_contigs; j++) {
+        contig_mutations = tree_sequence_get_num_mutations(contigs[j]);
+        if (contig_mutations == 0) {
+            continue;
+        }
+        ret = tree_sequence_get_mutations(contigs[j], &contig_mutation_list);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        for (num_mutations = 0; num_mutations < contig_mutations;
+                num_mutations++) {
+            CU_ASSERT_EQUAL(mutations[k].position,
+                    contig_mutation_list[num_mutations].position + offset[j]);
+            k++;
+        }
     }
-    free(trees);
 }
 
 static void
-test_leaf_sets(void)
+test_tree_sequence_join(void)
 {
     int ret;
-    const char * text_records =
-        "2 10 4 2,3 0.071 0\n"
-        "0 2  5 1,3 0.090 0\n"
-        "2 10 5 1,4 0.090 0\n"
-        "0 7  6 0,5 0.170 0\n"
-        "7 10 7 0,5 0.202 0\n"
-        "0 2  8 2,6 0.253 0";
-    leaf_count_test_t tests[] = {
-        {0, 0, 1}, {0, 5, 2}, {0, 6, 3},
-        {1, 4, 2}, {1, 5, 3}, {1, 6, 4}};
-    size_t num_records;
-    uint32_t num_tests = 6;
-    tree_sequence_t ts;
-    coalescence_record_t *records;
+    tree_sequence_t joined;
+    tree_sequence_t *contigs[3];
+    tree_sequence_t *other = get_example_tree_sequence(5, 0, 10, 10.0, 1.0,
+            1.0, 0, NULL);
 
-    parse_text_records(text_records, &num_records, &records);
-    CU_ASSERT_EQUAL_FATAL(num_records, 6);
-    ret = tree_sequence_load_records(&ts, num_records, records);
-    CU_ASSERT_EQUAL(ret, 0);
-    verify_leaf_counts(&ts, num_tests, tests);
-    verify_leaf_sets(&ts);
+    contigs[0] = get_example_tree_sequence(10, 0, 100, 100.0, 1.0, 1.0, 0,
+            NULL);
+    contigs[1] = get_example_tree_sequence(10, 0, 10, 50.0, 2.0, 2.0, 0,
+            NULL);
+    contigs[2] = contigs[0];
 
-    tree_sequence_free(&ts);
-    free_local_records(num_records, records);
+    ret = tree_sequence_join(&joined, 1, contigs);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    verify_joined_trees(&joined, 1, contigs);
+    tree_sequence_free(&joined);
+
+    ret = tree_sequence_join(&joined, 3, contigs);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    verify_joined_trees(&joined, 3, contigs);
+    verify_tree_next_prev(&joined);
+    tree_sequence_free(&joined);
+
+    /* Errors */
+    ret = tree_sequence_join(&joined, 0, contigs);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+    tree_sequence_free(&joined);
+    contigs[2] = other;
+    ret = tree_sequence_join(&joined, 3, contigs);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_INCOMPATIBLE_CONTIGS);
+    tree_sequence_free(&joined);
+
+    tree_sequence_free(contigs[0]);
+    free(contigs[0]);
+    tree_sequence_free(contigs[1]);
+    free(contigs[1]);
+    tree_sequence_free(other);
+    free(other);
 }
 
-static void
-test_nonbinary_leaf_sets(void)
+static int
+configure_contig(msp_t *msp, size_t contig, recomb_map_t *recomb_map,
+        gsl_rng *rng, void *arg)
 {
     int ret;
-    const char * text_records =
-        "0	100	8	0,1,2,3	0.01	0\n"
-        "0	100	9	6,8	    0.068   0\n"
-        "0	17	10	4,5,7	0.2	    0\n"
-        "17	100	10	4,7	    0.2	    0\n"
-        "17	100	11	5,9	    0.279   0\n"
-        "0	17	12	9,10	0.405   0\n"
-        "17	100	12	10,11	0.405   0";
-    size_t num_records;
-    leaf_count_test_t tests[] = {
-        {0, 0, 1}, {0, 8, 4}, {0, 9, 5}, {0, 10, 3}, {0, 12, 8},
-        {1, 5, 1}, {1, 8, 4}, {1, 9, 5}, {0, 10, 2}, {0, 11, 1}};
-    uint32_t num_tests = 8;
-    coalescence_record_t *records;
-    tree_sequence_t ts;
+    uint32_t j, n = 10;
+    sample_t samples[10];
 
-    parse_text_records(text_records, &num_records, &records);
-    CU_ASSERT_EQUAL_FATAL(num_records, 7);
-    ret = tree_sequence_load_records(&ts, num_records, records);
-    CU_ASSERT_EQUAL(ret, 0);
-    verify_leaf_counts(&ts, num_tests, tests);
-    verify_leaf_sets(&ts);
+    if (arg != NULL && contig == 2) {
+        return *((int *) arg);
+    }
+    for (j = 0; j < n; j++) {
+        samples[j].population_id = 0;
+        samples[j].time = 0;
+    }
+    ret = msp_alloc(msp, n, samples, rng);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_set_num_loci(msp, recomb_map_get_num_loci(recomb_map));
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_set_scaled_recombination_rate(msp,
+            recomb_map_get_per_locus_recombination_rate(recomb_map));
+out:
+    return ret;
+}
 
-    tree_sequence_free(&ts);
-    free_local_records(num_records, records);
+static void
+test_contig_driver(void)
+{
+    int ret, err;
+    size_t j, k, num_contigs = 5;
+    recomb_map_t recomb_maps[5];
+    double positions[] = {0.0, 0.0};
+    double rates[] = {0.01, 0.0};
+    tree_sequence_t single, multiple;
+    coalescence_record_t r1, r2;
+    mutation_t *m1, *m2;
+    contig_driver_t driver;
+
+    for (j = 0; j < num_contigs; j++) {
+        positions[1] = 20.0 * (double) (j + 1);
+        ret = recomb_map_alloc(&recomb_maps[j], (uint32_t) positions[1],
+                positions[1], positions, rates, 2);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+    }
+    ret = contig_driver_alloc(&driver, num_contigs, recomb_maps, 1, 5, 0.5,
+            0.25, configure_contig, NULL);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = contig_driver_run(&driver, &single);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    contig_driver_free(&driver);
+    CU_ASSERT_EQUAL(tree_sequence_get_num_contigs(&single), num_contigs);
+    CU_ASSERT_EQUAL(tree_sequence_get_sequence_length(&single), 300.0);
+    CU_ASSERT(tree_sequence_get_num_mutations(&single) > 0);
+    verify_trees_consistent(&single);
+
+    /* The result doesn't depend on the number of threads */
+    for (j = 2; j <= 8; j *= 2) {
+        ret = contig_driver_alloc(&driver, num_contigs, recomb_maps, j, 5,
+                0.5, 0.25, configure_contig, NULL);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = contig_driver_run(&driver, &multiple);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        contig_driver_free(&driver);
+        CU_ASSERT_EQUAL_FATAL(
+                tree_sequence_get_num_coalescence_records(&single),
+                tree_sequence_get_num_coalescence_records(&multiple));
+        for (k = 0; k < tree_sequence_get_num_coalescence_records(&single);
+                k++) {
+            ret = tree_sequence_get_coalescence_record(&single, k, &r1,
+                    MSP_ORDER_TIME);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            ret = tree_sequence_get_coalescence_record(&multiple, k, &r2,
+                    MSP_ORDER_TIME);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            verify_coalescence_records_equal(&r1, &r2, 1.0);
+        }
+        CU_ASSERT_EQUAL_FATAL(tree_sequence_get_num_mutations(&single),
+                tree_sequence_get_num_mutations(&multiple));
+        ret = tree_sequence_get_mutations(&single, &m1);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = tree_sequence_get_mutations(&multiple, &m2);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        for (k = 0; k < tree_sequence_get_num_mutations(&single); k++) {
+            CU_ASSERT_EQUAL(m1[k].position, m2[k].position);
+            CU_ASSERT_EQUAL(m1[k].node, m2[k].node);
+        }
+        tree_sequence_free(&multiple);
+    }
+    tree_sequence_free(&single);
+
+    /* Errors */
+    ret = contig_driver_alloc(&driver, 0, recomb_maps, 1, 5, 0, 0.25,
+            configure_contig, NULL);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+    contig_driver_free(&driver);
+    ret = contig_driver_alloc(&driver, num_contigs, recomb_maps, 0, 5, 0,
+            0.25, configure_contig, NULL);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+    contig_driver_free(&driver);
+    ret = contig_driver_alloc(&driver, num_contigs, recomb_maps, 1, 5, -1,
+            0.25, configure_contig, NULL);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+    contig_driver_free(&driver);
+    /* Freeing must be safe when the contigs can't be allocated */
+    ret = contig_driver_alloc(&driver, UINT32_MAX, recomb_maps, 1, 5, 0,
+            0.25, configure_contig, NULL);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_NO_MEMORY);
+    contig_driver_free(&driver);
+    /* An error in one contig fails the run. */
+    err = MSP_ERR_GENERIC;
+    for (j = 1; j <= 4; j++) {
+        ret = contig_driver_alloc(&driver, num_contigs, recomb_maps, j, 5,
+                0.5, 0.25, configure_contig, &err);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = contig_driver_run(&driver, &multiple);
+        CU_ASSERT_EQUAL(ret, MSP_ERR_GENERIC);
+        tree_sequence_free(&multiple);
+        contig_driver_free(&driver);
+    }
+    for (j = 0; j < num_contigs; j++) {
+        recomb_map_free(&recomb_maps[j]);
+    }
 }
 
 static void
@@ -3771,6 +6037,110 @@ test_next_prev_from_examples(void)
     free(examples);
 }
 
+static void
+verify_tree_seek(tree_sequence_t *ts)
+{
+    int ret;
+    sparse_tree_t *trees, t, counts, reference;
+    size_t j, k, index;
+    size_t num_trees = tree_sequence_get_num_trees(ts);
+    uint32_t num_nodes = tree_sequence_get_num_nodes(ts);
+    double position;
+
+    trees = get_tree_list(ts);
+    ret = sparse_tree_alloc(&t, ts, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    /* Seek to every tree, jumping about from the previous one */
+    for (j = 0; j < num_trees; j++) {
+        for (k = 0; k < 2; k++) {
+            index = k == 0 ? (j * 7919) % num_trees : num_trees - j - 1;
+            ret = sparse_tree_seek_index(&t, index);
+            CU_ASSERT_EQUAL_FATAL(ret, 1);
+            CU_ASSERT_EQUAL_FATAL(t.index, index);
+            ret = sparse_tree_equal(&t, &trees[index]);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+        }
+    }
+    /* Seek by position and make sure we can carry on iterating afterwards */
+    for (j = 0; j < num_trees; j++) {
+        index = num_trees - j - 1;
+        position = trees[index].left + (trees[index].right - trees[index].left) / 2;
+        ret = sparse_tree_seek(&t, position);
+        CU_ASSERT_EQUAL_FATAL(ret, 1);
+        CU_ASSERT_EQUAL_FATAL(t.index, index);
+        ret = sparse_tree_equal(&t, &trees[index]);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = sparse_tree_seek(&t, trees[j].left);
+        CU_ASSERT_EQUAL_FATAL(ret, 1);
+        CU_ASSERT_EQUAL_FATAL(t.index, j);
+        ret = sparse_tree_next(&t);
+        if (j < num_trees - 1) {
+            CU_ASSERT_EQUAL_FATAL(ret, 1);
+            ret = sparse_tree_equal(&t, &trees[j + 1]);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            ret = sparse_tree_prev(&t);
+            CU_ASSERT_EQUAL_FATAL(ret, 1);
+            ret = sparse_tree_equal(&t, &trees[j]);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+        } else {
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+        }
+    }
+    ret = sparse_tree_seek_index(&t, num_trees);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_OUT_OF_BOUNDS);
+    ret = sparse_tree_seek(&t, -1);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_OUT_OF_BOUNDS);
+    ret = sparse_tree_seek(&t, tree_sequence_get_sequence_length(ts));
+    CU_ASSERT_EQUAL(ret, MSP_ERR_OUT_OF_BOUNDS);
+
+    /* The leaf counts must match those of a tree we iterate to */
+    ret = sparse_tree_alloc(&counts, ts, MSP_LEAF_COUNTS | MSP_LEAF_LISTS);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = sparse_tree_alloc(&reference, ts, MSP_LEAF_COUNTS | MSP_LEAF_LISTS);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    for (ret = sparse_tree_first(&reference); ret == 1;
+            ret = sparse_tree_next(&reference)) {
+        ret = sparse_tree_seek_index(&counts, reference.index);
+        CU_ASSERT_EQUAL_FATAL(ret, 1);
+        ret = sparse_tree_equal(&counts, &reference);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        for (k = 0; k < num_nodes; k++) {
+            CU_ASSERT_EQUAL_FATAL(counts.num_leaves[k], reference.num_leaves[k]);
+        }
+        verify_leaf_sets_for_tree(&counts);
+        ret = sparse_tree_seek_index(&counts, (reference.index * 7919) % num_trees);
+        CU_ASSERT_EQUAL_FATAL(ret, 1);
+    }
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    ret = sparse_tree_free(&t);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = sparse_tree_free(&counts);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = sparse_tree_free(&reference);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    for (j = 0; j < num_trees; j++) {
+        ret = sparse_tree_free(&trees[j]);
+    }
+    free(trees);
+}
+
+static void
+test_seek_from_examples(void)
+{
+    tree_sequence_t **examples = get_example_tree_sequences(1);
+    uint32_t j;
+
+    CU_ASSERT_FATAL(examples != NULL);
+    for (j = 0; examples[j] != NULL; j++) {
+        verify_tree_seek(examples[j]);
+        tree_sequence_free(examples[j]);
+        free(examples[j]);
+    }
+    free(examples);
+}
+
 static void
 verify_hapgen(tree_sequence_t *ts)
 {
@@ -3941,13 +6311,90 @@ test_ld_from_examples(void)
     tree_sequence_t **examples = get_example_tree_sequences(1);
     uint32_t j;
 
-    CU_ASSERT_FATAL(examples != NULL);
-    for (j = 0; examples[j] != NULL; j++) {
-        verify_ld(examples[j]);
-        tree_sequence_free(examples[j]);
-        free(examples[j]);
+    CU_ASSERT_FATAL(examples != NULL);
+    for (j = 0; examples[j] != NULL; j++) {
+        verify_ld(examples[j]);
+        tree_sequence_free(examples[j]);
+        free(examples[j]);
+    }
+    free(examples);
+}
+
+typedef struct {
+    ld_calc_t ld_calc;
+    size_t row;
+    size_t num_mutations;
+    double *r2;
+    int ret;
+} ld_thread_t;
+
+static void *
+ld_thread_worker(void *arg)
+{
+    ld_thread_t *self = (ld_thread_t *) arg;
+    size_t j;
+
+    for (j = 0; j < self->num_mutations && self->ret == 0; j++) {
+        self->ret = ld_calc_get_r2(&self->ld_calc, self->row, j, &self->r2[j]);
+    }
+    return NULL;
+}
+
+static void
+test_ld_multiple_threads(void)
+{
+    int ret;
+    size_t j, k;
+    size_t num_threads = 8;
+    tree_sequence_t *ts = get_example_tree_sequence(20, 0, 100, 100.0, 1.0,
+            10.0, 0, NULL);
+    size_t num_mutations = tree_sequence_get_num_mutations(ts);
+    ld_thread_t *workers = calloc(num_threads, sizeof(ld_thread_t));
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    ld_calc_t ld_calc;
+    double x;
+
+    CU_ASSERT_FATAL(workers != NULL);
+    CU_ASSERT_FATAL(threads != NULL);
+    CU_ASSERT_FATAL(num_mutations >= num_threads);
+    /* No tree has sought in this tree sequence yet */
+    CU_ASSERT_FATAL(ts->trees.snapshots.offset == NULL);
+    for (j = 0; j < num_threads; j++) {
+        ret = ld_calc_alloc(&workers[j].ld_calc, ts);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        workers[j].row = j;
+        workers[j].num_mutations = num_mutations;
+        workers[j].r2 = malloc(num_mutations * sizeof(double));
+        CU_ASSERT_FATAL(workers[j].r2 != NULL);
+    }
+    /* The calculators build the snapshots before any thread seeks */
+    CU_ASSERT_FATAL(ts->trees.snapshots.offset != NULL);
+    for (j = 0; j < num_threads; j++) {
+        ret = pthread_create(&threads[j], NULL, ld_thread_worker, &workers[j]);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+    }
+    for (j = 0; j < num_threads; j++) {
+        ret = pthread_join(threads[j], NULL);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+    }
+
+    ret = ld_calc_alloc(&ld_calc, ts);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    for (j = 0; j < num_threads; j++) {
+        CU_ASSERT_EQUAL(workers[j].ret, 0);
+        for (k = 0; k < num_mutations; k++) {
+            ret = ld_calc_get_r2(&ld_calc, j, k, &x);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            CU_ASSERT_DOUBLE_EQUAL(workers[j].r2[k], x, 1e-9);
+        }
+        ld_calc_free(&workers[j].ld_calc);
+        free(workers[j].r2);
     }
-    free(examples);
+    ld_calc_free(&ld_calc);
+    free(workers);
+    free(threads);
+    tree_sequence_free(ts);
+    free(ts);
 }
 
 static void
@@ -4271,6 +6718,9 @@ verify_tree_sequences_equal(tree_sequence_t *ts1, tree_sequence_t *ts2,
     size_t num_mutations = tree_sequence_get_num_mutations(ts1);
     mutation_t *mutations_1, *mutations_2;
     sparse_tree_t t1, t2;
+    size_t num_contigs = tree_sequence_get_num_contigs(ts1);
+    double *offset_1, *offset_2;
+    uint32_t *node_offset_1, *node_offset_2;
 
     CU_ASSERT_EQUAL(
         tree_sequence_get_sample_size(ts1),
@@ -4290,6 +6740,16 @@ verify_tree_sequences_equal(tree_sequence_t *ts1, tree_sequence_t *ts2,
     CU_ASSERT_EQUAL(
         tree_sequence_get_num_trees(ts1),
         tree_sequence_get_num_trees(ts2));
+    CU_ASSERT_EQUAL_FATAL(num_contigs, tree_sequence_get_num_contigs(ts2));
+
+    ret = tree_sequence_get_contigs(ts1, &offset_1, &node_offset_1);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = tree_sequence_get_contigs(ts2, &offset_2, &node_offset_2);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (j = 0; j < num_contigs; j++) {
+        CU_ASSERT_EQUAL(offset_1[j], offset_2[j]);
+        CU_ASSERT_EQUAL(node_offset_1[j], node_offset_2[j]);
+    }
 
     for (j = 0; j < tree_sequence_get_num_coalescence_records(ts1); j++) {
         ret = tree_sequence_get_coalescence_record(ts1, j, &r1, MSP_ORDER_TIME);
@@ -4361,6 +6821,202 @@ verify_tree_sequences_equal(tree_sequence_t *ts1, tree_sequence_t *ts2,
     sparse_tree_free(&t2);
 }
 
+static int
+count_coalescence_records(void *arg, size_t num_records,
+        coalescence_record_t *records)
+{
+    size_t j;
+    size_t *count = (size_t *) arg;
+
+    for (j = 0; j < num_records; j++) {
+        CU_ASSERT_TRUE(records[j].num_children >= 2);
+        CU_ASSERT_TRUE(records[j].left < records[j].right);
+    }
+    *count += num_records;
+    return 0;
+}
+
+static void
+run_record_sink_simulation(msp_t *msp, sample_t *samples, uint32_t n,
+        gsl_rng *rng, FILE *spill_file, size_t *count)
+{
+    int ret;
+
+    gsl_rng_set(rng, 5);
+    ret = msp_alloc(msp, n, samples, rng);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_num_loci(msp, 100);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_scaled_recombination_rate(msp, 1.0);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_coalescence_record_block_size(msp, 3);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_add_instantaneous_bottleneck(msp, 0.1, 0, 1.0);
+    CU_ASSERT_EQUAL(ret, 0);
+    if (spill_file != NULL) {
+        ret = msp_set_coalescence_record_spill_file(msp, spill_file);
+        CU_ASSERT_EQUAL(ret, 0);
+    }
+    if (count != NULL) {
+        ret = msp_set_coalescence_record_sink(msp, count_coalescence_records,
+                count);
+        CU_ASSERT_EQUAL(ret, 0);
+    }
+    ret = msp_initialise(msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_run(msp, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    msp_verify(msp);
+}
+
+static void
+test_coalescence_record_sink(void)
+{
+    int ret;
+    uint32_t n = 20;
+    size_t count = 0;
+    msp_t msp;
+    tree_sequence_t ts_memory, ts_spill;
+    sample_t *samples = calloc(n, sizeof(sample_t));
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+    recomb_map_t recomb_map;
+    double positions[] = {0.0, 100.0};
+    double rates[] = {1.0, 0.0};
+    FILE *spill_file = tmpfile();
+
+    CU_ASSERT_FATAL(samples != NULL);
+    CU_ASSERT_FATAL(rng != NULL);
+    CU_ASSERT_FATAL(spill_file != NULL);
+    ret = recomb_map_alloc(&recomb_map, 100, 100.0, positions, rates, 2);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    /* Keep all records in memory */
+    run_record_sink_simulation(&msp, samples, n, rng, NULL, NULL);
+    CU_ASSERT_EQUAL(msp_get_num_flushed_coalescence_records(&msp), 0);
+    CU_ASSERT_EQUAL(msp_flush_coalescence_records(&msp), MSP_ERR_BAD_STATE);
+    CU_ASSERT_TRUE(msp_get_num_coalescence_record_blocks(&msp) > 1);
+    ret = tree_sequence_create(&ts_memory, &msp, &recomb_map, 0.25);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    msp_free(&msp);
+
+    /* Spill to a file, which we read back in tree_sequence_create. The
+     * record array never grows. */
+    run_record_sink_simulation(&msp, samples, n, rng, spill_file, NULL);
+    CU_ASSERT_TRUE(msp_get_num_flushed_coalescence_records(&msp) > 0);
+    CU_ASSERT_EQUAL(msp_get_num_coalescence_record_blocks(&msp), 1);
+    CU_ASSERT_EQUAL(msp_set_coalescence_record_sink(&msp, NULL, NULL),
+            MSP_ERR_BAD_STATE);
+    msp_print_state(&msp, _devnull);
+    ret = tree_sequence_create(&ts_spill, &msp, &recomb_map, 0.25);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    verify_tree_sequences_equal(&ts_memory, &ts_spill, 1);
+    tree_sequence_free(&ts_spill);
+    /* Flushing everything leaves the records we read back unchanged */
+    ret = msp_flush_coalescence_records(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL(msp_get_num_coalescence_records(&msp), 0);
+    CU_ASSERT_EQUAL(msp_get_num_flushed_coalescence_records(&msp),
+            tree_sequence_get_num_coalescence_records(&ts_memory));
+    ret = tree_sequence_create(&ts_spill, &msp, &recomb_map, 0.25);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    verify_tree_sequences_equal(&ts_memory, &ts_spill, 1);
+    tree_sequence_free(&ts_spill);
+    /* Resetting rewinds the spill file */
+    ret = msp_reset(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL(msp_get_num_flushed_coalescence_records(&msp), 0);
+    ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = tree_sequence_create(&ts_spill, &msp, &recomb_map, 0.25);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    tree_sequence_free(&ts_spill);
+    msp_free(&msp);
+
+    /* Records passed to a callback cannot be read back */
+    run_record_sink_simulation(&msp, samples, n, rng, NULL, &count);
+    CU_ASSERT_EQUAL(count, msp_get_num_flushed_coalescence_records(&msp));
+    CU_ASSERT_TRUE(count > 0);
+    ret = tree_sequence_create(&ts_spill, &msp, &recomb_map, 0.25);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_RECORDS_FLUSHED);
+    ret = msp_flush_coalescence_records(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL(count,
+            tree_sequence_get_num_coalescence_records(&ts_memory));
+    msp_free(&msp);
+
+    tree_sequence_free(&ts_memory);
+    recomb_map_free(&recomb_map);
+    fclose(spill_file);
+    gsl_rng_free(rng);
+    free(samples);
+}
+
+static void
+test_tree_sequence_adopt_simulation(void)
+{
+    int ret;
+    uint32_t n = 20;
+    size_t count = 0;
+    msp_t msp;
+    tree_sequence_t ts_copy, ts_adopt;
+    sample_t *samples = calloc(n, sizeof(sample_t));
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+    recomb_map_t recomb_map;
+    double positions[] = {0.0, 100.0};
+    double rates[] = {1.0, 0.0};
+    FILE *spill_file = tmpfile();
+
+    CU_ASSERT_FATAL(samples != NULL);
+    CU_ASSERT_FATAL(rng != NULL);
+    CU_ASSERT_FATAL(spill_file != NULL);
+    ret = recomb_map_alloc(&recomb_map, 100, 100.0, positions, rates, 2);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    run_record_sink_simulation(&msp, samples, n, rng, NULL, NULL);
+    ret = tree_sequence_create(&ts_copy, &msp, &recomb_map, 0.25);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = tree_sequence_adopt_simulation(&ts_adopt, &msp, &recomb_map, 0.25);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    verify_tree_sequences_equal(&ts_copy, &ts_adopt, 1);
+    tree_sequence_free(&ts_adopt);
+    /* The records now belong to the tree sequence */
+    CU_ASSERT_EQUAL(msp_get_num_coalescence_records(&msp), 0);
+    ret = tree_sequence_create(&ts_adopt, &msp, &recomb_map, 0.25);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_ZERO_RECORDS);
+    tree_sequence_free(&ts_adopt);
+    /* The simulator can be reset and run again */
+    ret = msp_reset(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    msp_verify(&msp);
+    ret = tree_sequence_adopt_simulation(&ts_adopt, &msp, &recomb_map, 0.25);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_TRUE(tree_sequence_get_num_coalescence_records(&ts_adopt) > 0);
+    tree_sequence_free(&ts_adopt);
+    msp_free(&msp);
+
+    /* Records in a spill file are copied back as usual */
+    run_record_sink_simulation(&msp, samples, n, rng, spill_file, NULL);
+    CU_ASSERT_TRUE(msp_get_num_flushed_coalescence_records(&msp) > 0);
+    ret = tree_sequence_adopt_simulation(&ts_adopt, &msp, &recomb_map, 0.25);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    verify_tree_sequences_equal(&ts_copy, &ts_adopt, 1);
+    tree_sequence_free(&ts_adopt);
+    msp_free(&msp);
+
+    run_record_sink_simulation(&msp, samples, n, rng, NULL, &count);
+    ret = tree_sequence_adopt_simulation(&ts_adopt, &msp, &recomb_map, 0.25);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_RECORDS_FLUSHED);
+    msp_free(&msp);
+
+    tree_sequence_free(&ts_copy);
+    recomb_map_free(&recomb_map);
+    fclose(spill_file);
+    gsl_rng_free(rng);
+    free(samples);
+}
+
 static void
 test_save_hdf5(void)
 {
@@ -4372,6 +7028,7 @@ test_save_hdf5(void)
     int dump_flags[] = {0, MSP_ZLIB_COMPRESSION};
 
     CU_ASSERT_FATAL(examples != NULL);
+    add_joined_example(examples);
 
     for (j = 0; examples[j] != NULL; j++) {
         ts1 = examples[j];
@@ -4392,6 +7049,52 @@ test_save_hdf5(void)
     free(examples);
 }
 
+static long
+get_dump_size(tree_sequence_t *ts, int flags)
+{
+    int ret;
+    long size;
+    FILE *f;
+
+    ret = tree_sequence_dump(ts, _tmp_file_name, flags);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    f = fopen(_tmp_file_name, "r");
+    CU_ASSERT_FATAL(f != NULL);
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+static void
+test_save_native_varint(void)
+{
+    int ret;
+    size_t j;
+    tree_sequence_t **examples = get_example_tree_sequences(1);
+    tree_sequence_t *large = get_example_tree_sequence(100, 0, 10000,
+            10000.0, 0.2, 0.0, 0, NULL);
+
+    CU_ASSERT_FATAL(examples != NULL);
+    CU_ASSERT_FATAL(large != NULL);
+    CU_ASSERT(get_dump_size(large, MSP_VARINT_ENCODING | MSP_NATIVE_FORMAT)
+            < get_dump_size(large, MSP_NATIVE_FORMAT));
+    tree_sequence_free(large);
+    free(large);
+    for (j = 0; examples[j] != NULL; j++) {
+        /* Varint encoding is only supported by the native format */
+        ret = tree_sequence_dump(examples[j], _tmp_file_name,
+                MSP_VARINT_ENCODING);
+        CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+        ret = tree_sequence_dump(examples[j], _tmp_file_name,
+                MSP_VARINT_ENCODING | MSP_ZLIB_COMPRESSION);
+        CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+        tree_sequence_free(examples[j]);
+        free(examples[j]);
+    }
+    free(examples);
+}
+
 static void
 test_save_records_hdf5(void)
 {
@@ -4448,6 +7151,294 @@ test_save_records_hdf5(void)
     free(examples);
 }
 
+static void
+verify_native_file_corruption(long offset, uint32_t value, int expected_err)
+{
+    int ret;
+    FILE *f;
+    tree_sequence_t ts;
+
+    f = fopen(_tmp_file_name, "r+b");
+    CU_ASSERT_FATAL(f != NULL);
+    CU_ASSERT_EQUAL_FATAL(fseek(f, offset, SEEK_SET), 0);
+    CU_ASSERT_EQUAL_FATAL(fwrite(&value, sizeof(value), 1, f), 1);
+    CU_ASSERT_EQUAL_FATAL(fclose(f), 0);
+    ret = tree_sequence_load(&ts, _tmp_file_name, MSP_NATIVE_FORMAT);
+    CU_ASSERT_EQUAL(ret, expected_err);
+    tree_sequence_free(&ts);
+}
+
+static void
+test_save_native(void)
+{
+    int ret;
+    size_t j, k, num_mutations;
+    tree_sequence_t **examples = get_example_tree_sequences(1);
+    tree_sequence_t ts2;
+    tree_sequence_t *ts1;
+    mutation_t *mutations, *mutations_copy;
+    int dump_flags[] = {MSP_NATIVE_FORMAT,
+        MSP_NATIVE_FORMAT | MSP_VARINT_ENCODING};
+    int load_flags[] = {0, MSP_NATIVE_FORMAT, 0, MSP_NATIVE_FORMAT};
+
+    CU_ASSERT_FATAL(examples != NULL);
+    add_joined_example(examples);
+
+    for (j = 0; examples[j] != NULL; j++) {
+        ts1 = examples[j];
+        ret = tree_sequence_dump(ts1, _tmp_file_name,
+                MSP_NATIVE_FORMAT | MSP_ZLIB_COMPRESSION);
+        CU_ASSERT_EQUAL_FATAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+        for (k = 0; k < sizeof(load_flags) / sizeof(int); k++) {
+            ret = tree_sequence_dump(ts1, _tmp_file_name, dump_flags[k / 2]);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            ret = tree_sequence_load(&ts2, _tmp_file_name, load_flags[k]);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            CU_ASSERT_FATAL(ts2.mmap_addr != NULL);
+            CU_ASSERT_EQUAL(
+                (uintptr_t) ts2.trees.records.node % sizeof(uint64_t), 0);
+            verify_tree_sequences_equal(ts1, &ts2, 1);
+            tree_sequence_print_state(&ts2, _devnull);
+            verify_hapgen(&ts2);
+            verify_vargen(&ts2);
+            /* Replacing the mutations must not free the mapped columns */
+            num_mutations = tree_sequence_get_num_mutations(ts1);
+            ret = tree_sequence_get_mutations(ts1, &mutations);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            mutations_copy = malloc((num_mutations + 1) * sizeof(mutation_t));
+            CU_ASSERT_FATAL(mutations_copy != NULL);
+            if (num_mutations > 0) {
+                memcpy(mutations_copy, mutations,
+                        num_mutations * sizeof(mutation_t));
+            }
+            ret = tree_sequence_set_mutations(&ts2, num_mutations / 2,
+                    mutations_copy);
+            CU_ASSERT_EQUAL(ret, 0);
+            CU_ASSERT_EQUAL(tree_sequence_get_num_mutations(&ts2),
+                    num_mutations / 2);
+            ret = tree_sequence_add_provenance_string(&ts2, "native");
+            CU_ASSERT_EQUAL(ret, 0);
+            free(mutations_copy);
+            tree_sequence_free(&ts2);
+        }
+        tree_sequence_free(ts1);
+        free(ts1);
+    }
+    free(examples);
+
+    /* An HDF5 file is not a native file */
+    ts1 = get_example_tree_sequence(10, 0, 100, 10.0, 1.0, 1.0, 0, NULL);
+    CU_ASSERT_FATAL(ts1 != NULL);
+    ret = tree_sequence_dump(ts1, _tmp_file_name, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = tree_sequence_load(&ts2, _tmp_file_name, MSP_NATIVE_FORMAT);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_FILE_FORMAT);
+    tree_sequence_free(&ts2);
+    ret = tree_sequence_load(&ts2, "/file/does/not/exist", MSP_NATIVE_FORMAT);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_IO);
+    tree_sequence_free(&ts2);
+
+    /* Corrupt the major version and then the number of records */
+    ret = tree_sequence_dump(ts1, _tmp_file_name, MSP_NATIVE_FORMAT);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    verify_native_file_corruption(8, MSP_NATIVE_FORMAT_VERSION_MAJOR + 1,
+            MSP_ERR_FILE_VERSION_TOO_NEW);
+    verify_native_file_corruption(8, MSP_NATIVE_FORMAT_VERSION_MAJOR, 0);
+    verify_native_file_corruption(32, UINT32_MAX, MSP_ERR_FILE_FORMAT);
+
+    /* Corrupt the column encodings, and then an encoded column */
+    ret = tree_sequence_dump(ts1, _tmp_file_name,
+            MSP_NATIVE_FORMAT | MSP_VARINT_ENCODING);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    verify_native_file_corruption(320, 2, MSP_ERR_FILE_FORMAT);
+    verify_native_file_corruption(320, 1, MSP_ERR_FILE_FORMAT);
+    verify_native_file_corruption(320, 0, 0);
+    verify_native_file_corruption(4 * 4096, UINT32_MAX, MSP_ERR_FILE_FORMAT);
+    tree_sequence_free(ts1);
+    free(ts1);
+}
+
+static void
+verify_node_records_equal(node_record_t *r1, node_record_t *r2)
+{
+    uint32_t k;
+
+    while (r1 != NULL && r2 != NULL) {
+        CU_ASSERT_EQUAL(r1->node, r2->node);
+        CU_ASSERT_EQUAL(r1->time, r2->time);
+        CU_ASSERT_EQUAL_FATAL(r1->num_children, r2->num_children);
+        for (k = 0; k < r1->num_children; k++) {
+            CU_ASSERT_EQUAL(r1->children[k], r2->children[k]);
+        }
+        r1 = r1->next;
+        r2 = r2->next;
+    }
+    CU_ASSERT(r1 == NULL);
+    CU_ASSERT(r2 == NULL);
+}
+
+/* Checks that the diffs and newick trees of ts2 are the same as those of
+ * ts1, running ts2's iterators first so that they read its columns. */
+static void
+verify_diffs_and_newick_equal(tree_sequence_t *ts1, tree_sequence_t *ts2)
+{
+    int ret1, ret2;
+    tree_diff_iterator_t iter1, iter2;
+    newick_converter_t nc1, nc2;
+    node_record_t *out1, *in1, *out2, *in2;
+    double length1, length2;
+    char *tree1, *tree2;
+
+    ret2 = tree_diff_iterator_alloc(&iter2, ts2);
+    CU_ASSERT_EQUAL_FATAL(ret2, 0);
+    ret1 = tree_diff_iterator_alloc(&iter1, ts1);
+    CU_ASSERT_EQUAL_FATAL(ret1, 0);
+    while (1) {
+        ret2 = tree_diff_iterator_next(&iter2, &length2, &out2, &in2);
+        ret1 = tree_diff_iterator_next(&iter1, &length1, &out1, &in1);
+        CU_ASSERT_EQUAL_FATAL(ret1, ret2);
+        if (ret1 != 1) {
+            break;
+        }
+        CU_ASSERT_EQUAL(length1, length2);
+        verify_node_records_equal(out1, out2);
+        verify_node_records_equal(in1, in2);
+    }
+    CU_ASSERT_EQUAL(ret1, 0);
+    tree_diff_iterator_free(&iter1);
+    tree_diff_iterator_free(&iter2);
+
+    ret2 = newick_converter_alloc(&nc2, ts2, 4, 1);
+    CU_ASSERT_EQUAL_FATAL(ret2, 0);
+    ret1 = newick_converter_alloc(&nc1, ts1, 4, 1);
+    CU_ASSERT_EQUAL_FATAL(ret1, 0);
+    while (1) {
+        ret2 = newick_converter_next(&nc2, &length2, &tree2);
+        ret1 = newick_converter_next(&nc1, &length1, &tree1);
+        CU_ASSERT_EQUAL_FATAL(ret1, ret2);
+        if (ret1 != 1) {
+            break;
+        }
+        CU_ASSERT_EQUAL(length1, length2);
+        CU_ASSERT_STRING_EQUAL(tree1, tree2);
+    }
+    newick_converter_free(&nc1);
+    newick_converter_free(&nc2);
+}
+
+static void
+test_load_lazy(void)
+{
+    int ret;
+    size_t j, num_mutations, num_provenance_strings;
+    tree_sequence_t **examples = get_example_tree_sequences(1);
+    tree_sequence_t ts2;
+    tree_sequence_t *ts1;
+    sparse_tree_t tree;
+    sample_t sample;
+    coalescence_record_t record;
+    mutation_t *mutations;
+    char **provenance_strings;
+    hapgen_t hapgen;
+
+    CU_ASSERT_FATAL(examples != NULL);
+
+    for (j = 0; examples[j] != NULL; j++) {
+        ts1 = examples[j];
+        ret = tree_sequence_dump(ts1, _tmp_file_name, 0);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+        /* Each group of columns is read when first needed */
+        ret = tree_sequence_load(&ts2, _tmp_file_name, MSP_LOAD_LAZY);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        CU_ASSERT_EQUAL(tree_sequence_get_loaded_columns(&ts2), 0);
+        CU_ASSERT_EQUAL(tree_sequence_get_sample_size(&ts2),
+                tree_sequence_get_sample_size(ts1));
+        CU_ASSERT_EQUAL(tree_sequence_get_sequence_length(&ts2),
+                tree_sequence_get_sequence_length(ts1));
+        CU_ASSERT_EQUAL(tree_sequence_get_num_trees(&ts2),
+                tree_sequence_get_num_trees(ts1));
+        CU_ASSERT_EQUAL(tree_sequence_get_num_mutations(&ts2),
+                tree_sequence_get_num_mutations(ts1));
+        ret = tree_sequence_get_sample(&ts2, 0, &sample);
+        CU_ASSERT_EQUAL(ret, 0);
+        CU_ASSERT_EQUAL(tree_sequence_get_loaded_columns(&ts2),
+                MSP_COLUMNS_NODES);
+        ret = sparse_tree_alloc(&tree, &ts2, 0);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        CU_ASSERT_EQUAL(tree_sequence_get_loaded_columns(&ts2),
+                MSP_COLUMNS_NODES | MSP_COLUMNS_RECORDS);
+        ret = sparse_tree_first(&tree);
+        CU_ASSERT_EQUAL(ret, 1);
+        ret = sparse_tree_get_mutations(&tree, &num_mutations, &mutations);
+        CU_ASSERT_EQUAL(ret, 0);
+        CU_ASSERT_EQUAL(tree_sequence_get_loaded_columns(&ts2),
+                MSP_COLUMNS_NODES | MSP_COLUMNS_RECORDS | MSP_COLUMNS_MUTATIONS);
+        ret = tree_sequence_get_provenance_strings(&ts2, &num_provenance_strings,
+                &provenance_strings);
+        CU_ASSERT_EQUAL(ret, 0);
+        CU_ASSERT_EQUAL(tree_sequence_get_loaded_columns(&ts2), MSP_COLUMNS_ALL);
+        sparse_tree_free(&tree);
+        verify_tree_sequences_equal(ts1, &ts2, 1);
+        tree_sequence_free(&ts2);
+
+        /* Records and mutations on their own */
+        ret = tree_sequence_load(&ts2, _tmp_file_name, MSP_LOAD_LAZY);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        if (tree_sequence_get_num_coalescence_records(&ts2) > 0) {
+            ret = tree_sequence_get_coalescence_record(&ts2, 0, &record,
+                    MSP_ORDER_LEFT);
+            CU_ASSERT_EQUAL(ret, 0);
+            CU_ASSERT_EQUAL(tree_sequence_get_loaded_columns(&ts2),
+                    MSP_COLUMNS_NODES | MSP_COLUMNS_RECORDS);
+        }
+        ret = hapgen_alloc(&hapgen, &ts2);
+        CU_ASSERT_EQUAL(ret, 0);
+        hapgen_free(&hapgen);
+        CU_ASSERT_EQUAL(tree_sequence_get_loaded_columns(&ts2),
+                MSP_COLUMNS_NODES | MSP_COLUMNS_RECORDS | MSP_COLUMNS_MUTATIONS);
+        verify_tree_sequences_equal(ts1, &ts2, 1);
+        tree_sequence_free(&ts2);
+
+        /* The diff iterator and newick converter read the records */
+        ret = tree_sequence_load(&ts2, _tmp_file_name, MSP_LOAD_LAZY);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        verify_diffs_and_newick_equal(ts1, &ts2);
+        CU_ASSERT_EQUAL(tree_sequence_get_loaded_columns(&ts2),
+                MSP_COLUMNS_NODES | MSP_COLUMNS_RECORDS);
+        tree_sequence_free(&ts2);
+
+        /* Replacing the mutations doesn't read them */
+        ret = tree_sequence_load(&ts2, _tmp_file_name, MSP_LOAD_LAZY);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = tree_sequence_set_mutations(&ts2, 0, NULL);
+        CU_ASSERT_EQUAL(ret, 0);
+        CU_ASSERT_EQUAL(tree_sequence_get_loaded_columns(&ts2),
+                MSP_COLUMNS_MUTATIONS);
+        CU_ASSERT_EQUAL(tree_sequence_get_num_mutations(&ts2), 0);
+        ret = tree_sequence_get_mutations(&ts2, &mutations);
+        CU_ASSERT_EQUAL(ret, 0);
+        tree_sequence_print_state(&ts2, _devnull);
+        CU_ASSERT_EQUAL(tree_sequence_get_loaded_columns(&ts2), MSP_COLUMNS_ALL);
+        tree_sequence_free(&ts2);
+
+        /* Errors are reported when the columns are read */
+        ret = tree_sequence_load(&ts2, _tmp_file_name, MSP_LOAD_LAZY);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        remove(_tmp_file_name);
+        ret = tree_sequence_get_sample(&ts2, 0, &sample);
+        CU_ASSERT_EQUAL(ret, MSP_ERR_HDF5);
+        CU_ASSERT_EQUAL(tree_sequence_get_loaded_columns(&ts2), 0);
+        tree_sequence_free(&ts2);
+        /* Don't leave the error for msp_strerror to find in later tests */
+        H5Eclear2(H5E_DEFAULT);
+
+        tree_sequence_free(ts1);
+        free(ts1);
+    }
+    free(examples);
+}
+
 static void
 test_records_equivalent(void)
 {
@@ -4580,6 +7571,24 @@ main(int argc, char **argv)
     int ret;
     CU_TestInfo tests[] = {
         {"Fenwick tree", test_fenwick},
+        {"Object heap", test_object_heap},
+        {"Lineage set", test_lineage_set},
+        {"B-tree", test_btree},
+        {"B-tree positions after removal", test_btree_remove_positions},
+        {"Priority queue", test_priority_queue},
+        {"Scratch", test_scratch},
+        {"Radix sort", test_radix_sort},
+        {"Codec", test_codec},
+        {"Varint codec", test_varint_codec},
+#ifdef H5_VERSION_GE
+#if H5_VERSION_GE(1, 10, 2)
+        {"Codec HDF5 chunks", test_codec_hdf5},
+#endif
+#endif
+        {"Philox generator", test_philox},
+        {"Variate buffer", test_rng_buffer},
+        {"Rate tree", test_rate_tree},
+        {"Migration matrix", test_migration_matrix},
         {"VCF", test_vcf},
         {"VCF no mutations", test_vcf_no_mutations},
         {"Simple recombination map", test_simple_recomb_map},
@@ -4624,27 +7633,46 @@ main(int argc, char **argv)
         {"tree iter from examples", test_tree_iter_from_examples},
         {"tree equals from examples", test_tree_equals_from_examples},
         {"tree next and prev from examples", test_next_prev_from_examples},
+        {"tree seek from examples", test_seek_from_examples},
         {"leaf sets from examples", test_leaf_sets_from_examples},
         {"Test hapgen from examples", test_hapgen_from_examples},
         {"Test vargen from examples", test_vargen_from_examples},
         {"Test newick from examples", test_newick_from_examples},
         {"Test stats from examples", test_stats_from_examples},
         {"Test ld from examples", test_ld_from_examples},
+        {"Test ld from multiple threads", test_ld_multiple_threads},
         {"Test simplify from examples", test_simplify_from_examples},
         {"Test records equivalent after import", test_records_equivalent},
         {"Test saving to HDF5", test_save_hdf5},
+        {"Test native varint encoding", test_save_native_varint},
         {"Test saving records to HDF5", test_save_records_hdf5},
+        {"Test saving to native format", test_save_native},
+        {"Test lazy loading", test_load_lazy},
         {"Single locus two populations", test_single_locus_two_populations},
         {"Many populations", test_single_locus_many_populations},
+        {"Sparse migration matrix", test_single_locus_sparse_migration},
         {"Historical samples", test_single_locus_historical_sample},
         {"Simulator getters/setters", test_simulator_getters_setters},
         {"Model errors", test_simulator_model_errors},
         {"Demographic events", test_simulator_demographic_events},
         {"Single locus simulation", test_single_locus_simulation},
+        {"Zero recombination simulation", test_zero_recombination_simulation},
         {"Simulation memory limit", test_simulation_memory_limit},
+        {"Overlap node heap growth", test_overlap_node_heap_growth},
+        {"Overlapping pair bound", test_overlapping_pair_bound},
         {"Multi locus simulation", test_multi_locus_simulation},
         {"Bottleneck simulation", test_bottleneck_simulation},
         {"Large bottleneck simulation", test_large_bottleneck_simulation},
+        {"Simulation checkpoint", test_simulation_checkpoint},
+        {"SMC overlap index", test_smc_overlap_index},
+        {"Coalescence record sink", test_coalescence_record_sink},
+        {"Tree sequence adopt simulation", test_tree_sequence_adopt_simulation},
+        {"Replicate driver", test_replicate_driver},
+        {"Sequential simulation", test_sequential_simulation},
+        {"Sequential simulation equivalence",
+            test_sequential_simulation_equivalence},
+        {"Tree sequence join", test_tree_sequence_join},
+        {"Contig driver", test_contig_driver},
         {"Test error messages", test_strerror},
         CU_TEST_INFO_NULL,
     };
@@ -16,10 +16,17 @@
 ** You should have received a copy of the GNU General Public License
 ** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
 */
+/* Needed for mmap, fstat and strnlen */
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <hdf5.h>
 
@@ -27,15 +34,41 @@
 
 #include "err.h"
 #include "msprime.h"
+#include "radix_sort.h"
+#include "codec.h"
 
 #define MSP_DIR_FORWARD 1
 #define MSP_DIR_REVERSE -1
 
+/* The columns that the sample size and sequence length are derived from,
+ * which are read even when the rest of a file is loaded lazily. */
+#define MSP_COLUMNS_CORE (MSP_COLUMNS_ALL + 1)
+
+/* HDF5 1.10.2 added direct chunk reads and writes, which we use to encode
+ * and decode the chunks of compressed columns in parallel ourselves rather
+ * than one at a time in HDF5's filter pipeline. */
+#ifdef H5_VERSION_GE
+#if H5_VERSION_GE(1, 10, 2)
+#define MSP_HDF5_DIRECT_CHUNKS
+#endif
+#endif
+
+/* The number of items in each chunk of a compressed column. */
+#define MSP_HDF5_CHUNK_ITEMS 65536
+
+/* Reads a sequence of coalescence records, first num_file_records from
+ * file (if not NULL) and then num_records from the records array. */
 typedef struct {
-    double value;
-    uint32_t index;
-    int64_t time;
-} index_sort_t;
+    FILE *file;
+    long file_position;
+    size_t num_file_records;
+    size_t num_records;
+    coalescence_record_t *records;
+    size_t index;
+    coalescence_record_t record;
+    uint32_t *children;
+    size_t max_children;
+} record_reader_t;
 
 static int
 cmp_uint32_t(const void *a, const void *b) {
@@ -65,17 +98,6 @@ cmp_mutation_pointer(const void *a, const void *b) {
     return cmp_mutation(*ia, *ib);
 }
 
-static int
-cmp_index_sort(const void *a, const void *b) {
-    const index_sort_t *ca = (const index_sort_t *) a;
-    const index_sort_t *cb = (const index_sort_t *) b;
-    int ret = (ca->value > cb->value) - (ca->value < cb->value);
-    if (ret == 0) {
-        ret = (ca->time > cb->time) - (ca->time < cb->time);
-    }
-    return ret;
-}
-
 static int
 cmp_record_time_left(const void *a, const void *b) {
     const coalescence_record_t *ca = (const coalescence_record_t *) a;
@@ -103,6 +125,10 @@ tree_sequence_print_state(tree_sequence_t *self, FILE *out)
     size_t j, k;
 
     fprintf(out, "tree_sequence state\n");
+    if (tree_sequence_load_columns(self, MSP_COLUMNS_ALL) != 0) {
+        fprintf(out, "error loading columns\n");
+        return;
+    }
     fprintf(out, "refcount = %d\n", self->refcount);
     fprintf(out, "sample_size = %d\n", self->sample_size);
     fprintf(out, "provenance = (%d)\n", (int) self->num_provenance_strings);
@@ -171,11 +197,18 @@ tree_sequence_print_state(tree_sequence_t *self, FILE *out)
                 self->migrations.dest[j],
                 self->migrations.time[j]);
     }
+    fprintf(out, "contigs = (%d records)\n", (int) self->contigs.num_records);
+    for (j = 0; j < self->contigs.num_records; j++) {
+        fprintf(out, "\t%d\t%f\t%d\n", (int) j, self->contigs.offset[j],
+                (int) self->contigs.node_offset[j]);
+    }
     tree_sequence_check_state(self);
 }
 
 /* Allocates the memory required for arrays of values. Assumes that
- * the num_records and num_mutations have been set.
+ * the num_records and num_mutations have been set. If the record columns
+ * have already been set they are kept, as they have been adopted from a
+ * simulation.
  */
 static int
 tree_sequence_alloc(tree_sequence_t *self)
@@ -193,12 +226,16 @@ tree_sequence_alloc(tree_sequence_t *self)
     if (self->trees.breakpoints == NULL) {
         goto out;
     }
-    self->trees.records.left = malloc(self->trees.num_records * sizeof(double));
-    self->trees.records.right = malloc(self->trees.num_records * sizeof(double));
-    self->trees.records.num_children = malloc(self->trees.num_records * sizeof(uint32_t));
+    if (self->trees.records.node == NULL) {
+        self->trees.records.left = malloc(self->trees.num_records * sizeof(uint32_t));
+        self->trees.records.right = malloc(self->trees.num_records * sizeof(uint32_t));
+        self->trees.records.num_children = malloc(
+                self->trees.num_records * sizeof(uint32_t));
+        self->trees.records.node = malloc(self->trees.num_records * sizeof(uint32_t));
+        self->trees.records.children_mem = malloc(
+                self->num_child_nodes * sizeof(uint32_t));
+    }
     self->trees.records.children = malloc(self->trees.num_records * sizeof(uint32_t *));
-    self->trees.records.node = malloc(self->trees.num_records * sizeof(uint32_t));
-    self->trees.records.children_mem = malloc(self->num_child_nodes * sizeof(uint32_t));
     if (self->trees.records.left == NULL
             || self->trees.records.right == NULL
             || self->trees.records.children == NULL
@@ -226,6 +263,14 @@ tree_sequence_alloc(tree_sequence_t *self)
             goto out;
         }
     }
+    if (self->contigs.num_records > 0) {
+        self->contigs.offset = malloc(self->contigs.num_records * sizeof(double));
+        self->contigs.node_offset = malloc(
+                self->contigs.num_records * sizeof(uint32_t));
+        if (self->contigs.offset == NULL || self->contigs.node_offset == NULL) {
+            goto out;
+        }
+    }
     /* Avoid the potential portability issues with malloc(0) here */
     self->provenance_strings = malloc((1 + self->num_provenance_strings)
             * sizeof(char *));
@@ -237,6 +282,21 @@ out:
     return ret;
 }
 
+/* Frees the specified column unless it points into the mapping of a
+ * native format file, in which case it is released by munmap.
+ */
+static void
+tree_sequence_free_column(tree_sequence_t *self, void *column)
+{
+    uintptr_t addr = (uintptr_t) column;
+    uintptr_t start = (uintptr_t) self->mmap_addr;
+
+    if (column != NULL && (self->mmap_addr == NULL || addr < start
+                || addr >= start + self->mmap_size)) {
+        free(column);
+    }
+}
+
 int
 tree_sequence_free(tree_sequence_t *self)
 {
@@ -244,78 +304,46 @@ tree_sequence_free(tree_sequence_t *self)
 
     if (self->provenance_strings != NULL) {
         for (j = 0; j < self->num_provenance_strings; j++) {
-            free(self->provenance_strings[j]);
+            tree_sequence_free_column(self, self->provenance_strings[j]);
         }
         free(self->provenance_strings);
     }
-    if (self->trees.nodes.population != NULL) {
-        free(self->trees.nodes.population);
-    }
-    if (self->trees.nodes.time != NULL) {
-        free(self->trees.nodes.time);
-    }
-    if (self->trees.breakpoints != NULL) {
-        free(self->trees.breakpoints);
-    }
-    if (self->trees.records.left != NULL) {
-        free(self->trees.records.left);
-    }
-    if (self->trees.records.right != NULL) {
-        free(self->trees.records.right);
-    }
-    if (self->trees.records.children != NULL) {
-        free(self->trees.records.children);
-    }
-    if (self->trees.records.num_children != NULL) {
-        free(self->trees.records.num_children);
-    }
-    if (self->trees.records.children_mem != NULL) {
-        free(self->trees.records.children_mem);
-    }
-    if (self->trees.records.node != NULL) {
-        free(self->trees.records.node);
-    }
-    if (self->trees.indexes.insertion_order != NULL) {
-        free(self->trees.indexes.insertion_order);
-    }
-    if (self->trees.indexes.removal_order != NULL) {
-        free(self->trees.indexes.removal_order);
-    }
-    if (self->mutations.node != NULL) {
-        free(self->mutations.node);
-    }
-    if (self->mutations.position != NULL) {
-        free(self->mutations.position);
-    }
-    if (self->mutations.tree_mutations_mem != NULL) {
-        free(self->mutations.tree_mutations_mem);
-    }
-    if (self->mutations.tree_mutations != NULL) {
-        free(self->mutations.tree_mutations);
-    }
-    if (self->mutations.num_tree_mutations != NULL) {
-        free(self->mutations.num_tree_mutations);
-    }
-    if (self->migrations.breakpoints != NULL) {
-        free(self->migrations.breakpoints);
-    }
-    if (self->migrations.node != NULL) {
-        free(self->migrations.node);
-    }
-    if (self->migrations.source != NULL) {
-        free(self->migrations.source);
-    }
-    if (self->migrations.dest != NULL) {
-        free(self->migrations.dest);
-    }
-    if (self->migrations.left != NULL) {
-        free(self->migrations.left);
-    }
-    if (self->migrations.right != NULL) {
-        free(self->migrations.right);
-    }
-    if (self->migrations.time != NULL) {
-        free(self->migrations.time);
+    tree_sequence_free_column(self, self->trees.nodes.population);
+    tree_sequence_free_column(self, self->trees.nodes.time);
+    tree_sequence_free_column(self, self->trees.breakpoints);
+    tree_sequence_free_column(self, self->trees.records.left);
+    tree_sequence_free_column(self, self->trees.records.right);
+    tree_sequence_free_column(self, self->trees.records.children);
+    tree_sequence_free_column(self, self->trees.records.num_children);
+    tree_sequence_free_column(self, self->trees.records.children_mem);
+    tree_sequence_free_column(self, self->trees.records.node);
+    tree_sequence_free_column(self, self->trees.indexes.insertion_order);
+    tree_sequence_free_column(self, self->trees.indexes.removal_order);
+    tree_sequence_free_column(self, self->mutations.node);
+    tree_sequence_free_column(self, self->mutations.position);
+    tree_sequence_free_column(self, self->mutations.tree_mutations_mem);
+    tree_sequence_free_column(self, self->mutations.tree_mutations);
+    tree_sequence_free_column(self, self->mutations.num_tree_mutations);
+    tree_sequence_free_column(self, self->migrations.breakpoints);
+    tree_sequence_free_column(self, self->migrations.node);
+    tree_sequence_free_column(self, self->migrations.source);
+    tree_sequence_free_column(self, self->migrations.dest);
+    tree_sequence_free_column(self, self->migrations.left);
+    tree_sequence_free_column(self, self->migrations.right);
+    tree_sequence_free_column(self, self->migrations.time);
+    tree_sequence_free_column(self, self->contigs.offset);
+    tree_sequence_free_column(self, self->contigs.node_offset);
+    if (self->mmap_addr != NULL) {
+        munmap(self->mmap_addr, self->mmap_size);
+    }
+    if (self->lazy_filename != NULL) {
+        free(self->lazy_filename);
+    }
+    if (self->trees.snapshots.offset != NULL) {
+        free(self->trees.snapshots.offset);
+    }
+    if (self->trees.snapshots.records != NULL) {
+        free(self->trees.snapshots.records);
     }
     return 0;
 }
@@ -353,6 +381,10 @@ tree_sequence_add_provenance_string(tree_sequence_t *self,
         ret = MSP_ERR_BAD_PARAM_VALUE;
         goto out;
     }
+    ret = tree_sequence_load_columns(self, MSP_COLUMNS_PROVENANCE);
+    if (ret != 0) {
+        goto out;
+    }
     p = realloc(self->provenance_strings,
             (self->num_provenance_strings + 1) * sizeof(char *));
     if (p == NULL) {
@@ -378,9 +410,15 @@ int WARN_UNUSED
 tree_sequence_get_provenance_strings(tree_sequence_t *self,
         size_t *num_provenance_strings, char ***provenance_strings)
 {
+    int ret = tree_sequence_load_columns(self, MSP_COLUMNS_PROVENANCE);
+
+    if (ret != 0) {
+        goto out;
+    }
     *num_provenance_strings = self->num_provenance_strings;
     *provenance_strings = self->provenance_strings;
-    return 0;
+out:
+    return ret;
 }
 
 static int
@@ -441,16 +479,163 @@ out:
     return ret;
 }
 
+static int WARN_UNUSED
+record_reader_alloc(record_reader_t *self, FILE *file, size_t num_file_records,
+        size_t num_records, coalescence_record_t *records)
+{
+    int ret = 0;
+
+    memset(self, 0, sizeof(record_reader_t));
+    self->file = file;
+    self->num_file_records = file == NULL ? 0 : num_file_records;
+    self->num_records = num_records;
+    self->records = records;
+    if (self->file != NULL) {
+        /* We restore the position on free so that writing can continue */
+        self->file_position = ftell(self->file);
+        if (self->file_position < 0) {
+            ret = MSP_ERR_IO;
+            goto out;
+        }
+    }
+out:
+    return ret;
+}
+
 static int
-tree_sequence_init_from_records(tree_sequence_t *self,
-      size_t num_records, coalescence_record_t *records)
+record_reader_free(record_reader_t *self)
+{
+    int ret = 0;
+
+    if (self->file != NULL) {
+        if (fseek(self->file, self->file_position, SEEK_SET) != 0) {
+            ret = MSP_ERR_IO;
+        }
+    }
+    if (self->children != NULL) {
+        free(self->children);
+    }
+    return ret;
+}
+
+static size_t
+record_reader_get_num_records(record_reader_t *self)
+{
+    return self->num_file_records + self->num_records;
+}
+
+static int WARN_UNUSED
+record_reader_rewind(record_reader_t *self)
+{
+    int ret = 0;
+
+    self->index = 0;
+    if (self->file != NULL) {
+        if (fseek(self->file, 0, SEEK_SET) != 0) {
+            ret = MSP_ERR_IO;
+        }
+    }
+    return ret;
+}
+
+/* Sets record to point to the next record, which is valid until the
+ * following call. */
+static int WARN_UNUSED
+record_reader_next(record_reader_t *self, coalescence_record_t **record)
+{
+    int ret = 0;
+
+    assert(self->index < record_reader_get_num_records(self));
+    if (self->index < self->num_file_records) {
+        ret = msp_read_coalescence_record(self->file, &self->record,
+                &self->children, &self->max_children);
+        if (ret != 0) {
+            goto out;
+        }
+        *record = &self->record;
+    } else {
+        *record = &self->records[self->index - self->num_file_records];
+    }
+    self->index++;
+out:
+    return ret;
+}
+
+/* Sorts the records into insertion and removal order, and replaces the
+ * left and right coordinates of each record, given in input order in
+ * coordinates, with their indexes in the breakpoints. */
+static int
+tree_sequence_init_indexes(tree_sequence_t *self, double *coordinates)
+{
+    int ret = 0;
+    size_t j;
+    size_t num_records = self->trees.num_records;
+    uint32_t *left = self->trees.records.left;
+    uint32_t *right = self->trees.records.right;
+    uint64_t *keys = NULL;
+    double *breakpoint;
+
+    keys = malloc(num_records * sizeof(uint64_t));
+    if (keys == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    for (j = 0; j < num_records; j++) {
+        breakpoint = bsearch(&coordinates[2 * j], self->trees.breakpoints,
+                self->trees.num_breakpoints, sizeof(double), cmp_double);
+        assert(breakpoint != NULL);
+        left[j] = (uint32_t) (breakpoint - self->trees.breakpoints);
+        breakpoint = bsearch(&coordinates[2 * j + 1], self->trees.breakpoints,
+                self->trees.num_breakpoints, sizeof(double), cmp_double);
+        /* If we can't find the value in breakpoints, it means that
+         * we have right coordinates not matching to a left coord */
+        if (breakpoint == NULL) {
+            ret = MSP_ERR_BAD_COALESCENCE_RECORDS;
+            goto out;
+        }
+        right[j] = (uint32_t) (breakpoint - self->trees.breakpoints);
+    }
+    /* sort by left and increasing time to give us the order in which
+     * records should be inserted. When comparing equal left values, we
+     * sort by time. Since we require that records are provided in sorted
+     * order, the index can be taken as a proxy for time. We are actually
+     * making the stronger requirement that records must be provided *in
+     * the order they happened*, not just in increasing time. The radix
+     * sort is stable, so sorting the records in input order by left
+     * breaks ties by index. */
+    for (j = 0; j < num_records; j++) {
+        keys[j] = left[j];
+        self->trees.indexes.insertion_order[j] = (uint32_t) j;
+    }
+    ret = radix_sort(num_records, keys, self->trees.indexes.insertion_order);
+    if (ret != 0) {
+        goto out;
+    }
+    /* sort by right and decreasing time to give us the order in which
+     * records should be removed. */
+    for (j = 0; j < num_records; j++) {
+        keys[j] = right[num_records - j - 1];
+        self->trees.indexes.removal_order[j] = (uint32_t) (num_records - j - 1);
+    }
+    ret = radix_sort(num_records, keys, self->trees.indexes.removal_order);
+out:
+    if (keys != NULL) {
+        free(keys);
+    }
+    return ret;
+}
+
+static int
+tree_sequence_init_from_records(tree_sequence_t *self, record_reader_t *reader)
 {
     int ret = MSP_ERR_GENERIC;
     uint32_t node;
     size_t j, k, offset;
+    size_t num_records = record_reader_get_num_records(reader);
     double last_breakpoint;
     double *left = NULL;
-    index_sort_t *sort_buff = NULL;
+    double *coordinates = NULL;
+    coalescence_record_t *record;
 
     memset(self, 0, sizeof(tree_sequence_t));
     if (num_records == 0) {
@@ -458,7 +643,9 @@ tree_sequence_init_from_records(tree_sequence_t *self,
         goto out;
     }
     left = malloc((num_records + 1) * sizeof(double));
-    if (left == NULL) {
+    /* The left and right coordinates of each record in input order */
+    coordinates = malloc(2 * num_records * sizeof(double));
+    if (left == NULL || coordinates == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
@@ -473,24 +660,34 @@ tree_sequence_init_from_records(tree_sequence_t *self,
     self->sequence_length = 0.0;
     self->trees.num_records = num_records;
     self->num_nodes = 0;
+    ret = record_reader_rewind(reader);
+    if (ret != 0) {
+        goto out;
+    }
     for (j = 0; j < self->trees.num_records; j++) {
-        self->num_child_nodes += records[j].num_children;
-        if (records[j].node == MSP_NULL_NODE) {
+        ret = record_reader_next(reader, &record);
+        if (ret != 0) {
+            goto out;
+        }
+        self->num_child_nodes += record->num_children;
+        if (record->node == MSP_NULL_NODE) {
             ret = MSP_ERR_NULL_NODE_IN_RECORD;
             goto out;
         }
-        for (k = 0; k < records[j].num_children; k++) {
-            if (records[j].children[k] == MSP_NULL_NODE) {
+        for (k = 0; k < record->num_children; k++) {
+            if (record->children[k] == MSP_NULL_NODE) {
                 ret = MSP_ERR_NULL_NODE_IN_RECORD;
                 goto out;
             }
-            self->num_nodes = GSL_MAX(self->num_nodes, records[j].children[k]);
+            self->num_nodes = GSL_MAX(self->num_nodes, record->children[k]);
         }
-        self->sample_size = GSL_MIN(self->sample_size, records[j].node);
-        self->num_nodes = GSL_MAX(self->num_nodes, records[j].node);
+        self->sample_size = GSL_MIN(self->sample_size, record->node);
+        self->num_nodes = GSL_MAX(self->num_nodes, record->node);
         self->sequence_length = GSL_MAX(self->sequence_length,
-                records[j].right);
-        left[j] = records[j].left;
+                record->right);
+        left[j] = record->left;
+        coordinates[2 * j] = record->left;
+        coordinates[2 * j + 1] = record->right;
     }
     if (self->sample_size < 2) {
         ret = MSP_ERR_BAD_COALESCENCE_RECORDS;
@@ -527,93 +724,190 @@ tree_sequence_init_from_records(tree_sequence_t *self,
         }
     }
     /* Set up the nodes and the children pointers */
+    ret = record_reader_rewind(reader);
+    if (ret != 0) {
+        goto out;
+    }
     offset = 0;
     for (j = 0; j < self->trees.num_records; j++) {
-        node = records[j].node;
+        ret = record_reader_next(reader, &record);
+        if (ret != 0) {
+            goto out;
+        }
+        node = record->node;
         if (self->trees.nodes.time[node] == 0.0) {
-            self->trees.nodes.time[node] = records[j].time;
-        } else if (self->trees.nodes.time[node] != records[j].time) {
+            self->trees.nodes.time[node] = record->time;
+        } else if (self->trees.nodes.time[node] != record->time) {
             ret = MSP_ERR_INCONSISTENT_NODE_TIMES;
             goto out;
         }
         if (self->trees.nodes.population[node] == MSP_NULL_POPULATION_ID) {
-            self->trees.nodes.population[node] = records[j].population_id;
-        } else if (self->trees.nodes.population[node] != records[j].population_id) {
+            self->trees.nodes.population[node] = record->population_id;
+        } else if (self->trees.nodes.population[node] != record->population_id) {
             ret = MSP_ERR_INCONSISTENT_POPULATION_IDS;
             goto out;
         }
-        self->trees.records.node[j] = records[j].node;
-        self->trees.records.num_children[j] = records[j].num_children;
+        /* The file may have changed between the passes */
+        if (offset + record->num_children > self->num_child_nodes) {
+            ret = MSP_ERR_FILE_FORMAT;
+            goto out;
+        }
+        self->trees.records.node[j] = record->node;
+        self->trees.records.num_children[j] = record->num_children;
         self->trees.records.children[j] = &self->trees.records.children_mem[offset];
-        offset += records[j].num_children;
-        for (k = 0; k < records[j].num_children; k++) {
-            self->trees.records.children[j][k] = records[j].children[k];
+        offset += record->num_children;
+        for (k = 0; k < record->num_children; k++) {
+            self->trees.records.children[j][k] = record->children[k];
         }
     }
     assert(offset == self->num_child_nodes);
+    ret = tree_sequence_init_indexes(self, coordinates);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = tree_sequence_check(self);
+out:
+    if (left != NULL) {
+        free(left);
+    }
+    if (coordinates != NULL) {
+        free(coordinates);
+    }
+    return ret;
+}
+
+/* Initialises the tree sequence from the specified record columns, which
+ * are in time order. The left, right, node, num_children and children
+ * columns become the tree sequence's own arrays and are converted in
+ * place; the remaining columns are freed. In all cases the columns
+ * are owned by the tree sequence after this call. */
+static int
+tree_sequence_init_from_columns(tree_sequence_t *self,
+        record_columns_t *columns)
+{
+    int ret = MSP_ERR_GENERIC;
+    uint32_t node;
+    size_t j, k, offset;
+    size_t num_records = columns->num_records;
+    double last_breakpoint;
+    double *left = NULL;
+    double *coordinates = NULL;
 
-    /* Now sort create the indexes and set the breakpoint indexes in
-     * left and right. */
-    sort_buff = malloc(self->trees.num_records * sizeof(index_sort_t));
-    if (sort_buff == NULL) {
+    memset(self, 0, sizeof(tree_sequence_t));
+    self->trees.records.left = columns->left;
+    self->trees.records.right = columns->right;
+    self->trees.records.node = columns->node;
+    self->trees.records.num_children = columns->num_children;
+    self->trees.records.children_mem = columns->children;
+    columns->left = NULL;
+    columns->right = NULL;
+    columns->node = NULL;
+    columns->num_children = NULL;
+    columns->children = NULL;
+    if (num_records == 0) {
+        ret = MSP_ERR_ZERO_RECORDS;
+        goto out;
+    }
+    left = malloc((num_records + 1) * sizeof(double));
+    coordinates = malloc(2 * num_records * sizeof(double));
+    if (left == NULL || coordinates == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    /* sort by left and increasing time to give us the order in which
-     * records should be inserted */
-    for (j = 0; j < self->trees.num_records; j++) {
-        sort_buff[j].index = (uint32_t ) j;
-        sort_buff[j].value = records[j].left;
-        /* When comparing equal left values, we sort by time. Since we require
-         * that records are provided in sorted order, the index can be
-         * taken as a proxy for time. This avoids issues unstable sort
-         * algorithms when multiple events occur at the same time. We are
-         * actually making the stronger requirement that records must be
-         * provided *in the order they happened*, not just in increasing
-         * time. See also the removal order index below.
-         */
-        sort_buff[j].time = (int64_t ) j;
+    self->sample_size = UINT32_MAX;
+    self->num_child_nodes = columns->num_children_total;
+    self->sequence_length = 0.0;
+    self->trees.num_records = num_records;
+    self->num_nodes = 0;
+    for (j = 0; j < num_records; j++) {
+        node = self->trees.records.node[j];
+        if (node == MSP_NULL_NODE) {
+            ret = MSP_ERR_NULL_NODE_IN_RECORD;
+            goto out;
+        }
+        self->sample_size = GSL_MIN(self->sample_size, node);
+        self->num_nodes = GSL_MAX(self->num_nodes, node);
+        self->sequence_length = GSL_MAX(self->sequence_length,
+                self->trees.records.right[j]);
+        left[j] = self->trees.records.left[j];
+        coordinates[2 * j] = self->trees.records.left[j];
+        coordinates[2 * j + 1] = self->trees.records.right[j];
     }
-    qsort(sort_buff, self->trees.num_records, sizeof(index_sort_t), cmp_index_sort);
-    k = 0;
-    for (j = 0; j < self->trees.num_records; j++) {
-        self->trees.indexes.insertion_order[j] = sort_buff[j].index;
-        while (self->trees.breakpoints[k] < sort_buff[j].value) {
-            k++;
+    for (k = 0; k < self->num_child_nodes; k++) {
+        node = self->trees.records.children_mem[k];
+        if (node == MSP_NULL_NODE) {
+            ret = MSP_ERR_NULL_NODE_IN_RECORD;
+            goto out;
         }
-        assert(k < self->trees.num_breakpoints);
-        self->trees.records.left[sort_buff[j].index] = (uint32_t) k;
+        self->num_nodes = GSL_MAX(self->num_nodes, node);
     }
-    /* sort by right and decreasing time to give us the order in which
-     * records should be removed. */
-    for (j = 0; j < self->trees.num_records; j++) {
-        sort_buff[j].index = (uint32_t ) j;
-        sort_buff[j].value = records[j].right;
-        sort_buff[j].time = -1 * (int64_t ) j;
+    if (self->sample_size < 2 || self->sequence_length <= 0) {
+        ret = MSP_ERR_BAD_COALESCENCE_RECORDS;
+        goto out;
+    }
+    self->num_nodes++;
+    left[num_records] = self->sequence_length;
+    qsort(left, num_records + 1, sizeof(double), cmp_double);
+    self->trees.num_breakpoints = 0;
+    last_breakpoint = -1.0;
+    for (j = 0; j < num_records + 1; j++) {
+        if (left[j] != last_breakpoint) {
+            self->trees.num_breakpoints++;
+            last_breakpoint = left[j];
+        }
+    }
+    ret = tree_sequence_alloc(self);
+    if (ret != 0) {
+        goto out;
     }
-    qsort(sort_buff, self->trees.num_records, sizeof(index_sort_t), cmp_index_sort);
+    last_breakpoint = -1.0;
     k = 0;
-    for (j = 0; j < self->trees.num_records; j++) {
-        self->trees.indexes.removal_order[j] = sort_buff[j].index;
-        while (self->trees.breakpoints[k] < sort_buff[j].value) {
+    for (j = 0; j < num_records + 1; j++) {
+        if (left[j] != last_breakpoint) {
+            self->trees.breakpoints[k] = left[j];
             k++;
+            last_breakpoint = left[j];
         }
-        assert(k < self->trees.num_breakpoints);
-        /* If we can't find the value in breakpoints, it means that
-         * we have right coordinates not matching to a left coord */
-        if (self->trees.breakpoints[k] != sort_buff[j].value) {
-            ret = MSP_ERR_BAD_COALESCENCE_RECORDS;
+    }
+    offset = 0;
+    for (j = 0; j < num_records; j++) {
+        node = self->trees.records.node[j];
+        if (self->trees.nodes.time[node] == 0.0) {
+            self->trees.nodes.time[node] = columns->time[j];
+        } else if (self->trees.nodes.time[node] != columns->time[j]) {
+            ret = MSP_ERR_INCONSISTENT_NODE_TIMES;
+            goto out;
+        }
+        if (self->trees.nodes.population[node] == MSP_NULL_POPULATION_ID) {
+            self->trees.nodes.population[node] = columns->population_id[j];
+        } else if (self->trees.nodes.population[node]
+                != columns->population_id[j]) {
+            ret = MSP_ERR_INCONSISTENT_POPULATION_IDS;
             goto out;
         }
-        self->trees.records.right[sort_buff[j].index] = (uint32_t) k;
+        self->trees.records.children[j] = &self->trees.records.children_mem[offset];
+        offset += self->trees.records.num_children[j];
+    }
+    assert(offset == self->num_child_nodes);
+    ret = tree_sequence_init_indexes(self, coordinates);
+    if (ret != 0) {
+        goto out;
     }
     ret = tree_sequence_check(self);
 out:
+    if (columns->time != NULL) {
+        free(columns->time);
+        columns->time = NULL;
+    }
+    if (columns->population_id != NULL) {
+        free(columns->population_id);
+        columns->population_id = NULL;
+    }
     if (left != NULL) {
         free(left);
     }
-    if (sort_buff != NULL) {
-        free(sort_buff);
+    if (coordinates != NULL) {
+        free(coordinates);
     }
     return ret;
 }
@@ -711,8 +1005,14 @@ tree_sequence_load_records(tree_sequence_t *self,
       size_t num_records, coalescence_record_t *records)
 {
     int ret = MSP_ERR_GENERIC;
+    record_reader_t reader;
 
-    ret = tree_sequence_init_from_records(self, num_records, records);
+    ret = record_reader_alloc(&reader, NULL, 0, num_records, records);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = tree_sequence_init_from_records(self, &reader);
+    record_reader_free(&reader);
     if (ret != 0) {
         goto out;
     }
@@ -721,30 +1021,20 @@ out:
     return ret;
 }
 
-int WARN_UNUSED
-tree_sequence_create(tree_sequence_t *self, msp_t *sim,
+/* Sets up the samples and migrations, and rescales the records of a
+ * simulation into generations and physical coordinates. */
+static int
+tree_sequence_init_from_simulation(tree_sequence_t *self, msp_t *sim,
         recomb_map_t *recomb_map, double Ne)
 {
     int ret = MSP_ERR_GENERIC;
-    size_t j, num_coalescence_records, num_migration_records;
-    coalescence_record_t *coalescence_records = NULL;
+    size_t j, num_migration_records;
     migration_record_t *migration_records = NULL;
     sample_t *samples = NULL;
 
-    ret = msp_get_coalescence_records(sim, &coalescence_records);
-    if (ret != 0) {
-        goto out;
-    }
-    num_coalescence_records = msp_get_num_coalescence_records(sim);
-    ret = tree_sequence_init_from_records(self, num_coalescence_records,
-            coalescence_records);
-    if (ret != 0) {
-        goto out;
-    }
-    assert(self->sample_size == msp_get_sample_size(sim));
-    assert(self->sequence_length == (double) msp_get_num_loci(sim));
-    assert(self->trees.num_records == msp_get_num_coalescence_records(sim));
-    ret = msp_get_samples(sim, &samples);
+    assert(self->sample_size == msp_get_sample_size(sim));
+    assert(self->sequence_length == (double) msp_get_num_loci(sim));
+    ret = msp_get_samples(sim, &samples);
     if (ret != 0) {
         goto out;
     }
@@ -784,6 +1074,313 @@ out:
     return ret;
 }
 
+int WARN_UNUSED
+tree_sequence_create(tree_sequence_t *self, msp_t *sim,
+        recomb_map_t *recomb_map, double Ne)
+{
+    int ret = MSP_ERR_GENERIC;
+    int err;
+    size_t num_flushed_records;
+    coalescence_record_t *coalescence_records = NULL;
+    record_reader_t reader;
+
+    /* Records flushed to a spill file are read back from it; records
+     * passed to any other sink are gone. */
+    num_flushed_records = msp_get_num_flushed_coalescence_records(sim);
+    if (num_flushed_records > 0 && sim->coalescence_record_spill_file == NULL) {
+        ret = MSP_ERR_RECORDS_FLUSHED;
+        goto out;
+    }
+    ret = msp_get_coalescence_records(sim, &coalescence_records);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = record_reader_alloc(&reader, sim->coalescence_record_spill_file,
+            num_flushed_records, msp_get_num_coalescence_records(sim),
+            coalescence_records);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = tree_sequence_init_from_records(self, &reader);
+    err = record_reader_free(&reader);
+    if (ret == 0) {
+        ret = err;
+    }
+    if (ret != 0) {
+        goto out;
+    }
+    assert(self->trees.num_records == num_flushed_records
+            + msp_get_num_coalescence_records(sim));
+    ret = tree_sequence_init_from_simulation(self, sim, recomb_map, Ne);
+out:
+    return ret;
+}
+
+/*
+ * Creates the tree sequence from the simulation without copying its
+ * coalescence records: the record columns are handed over by the
+ * simulator and become the tree sequence's arrays. The simulator is left
+ * without any coalescence records, but can be reset and run again. If
+ * records have been flushed to a spill file they are read back by
+ * tree_sequence_create as usual.
+ */
+int WARN_UNUSED
+tree_sequence_adopt_simulation(tree_sequence_t *self, msp_t *sim,
+        recomb_map_t *recomb_map, double Ne)
+{
+    int ret = MSP_ERR_GENERIC;
+    record_columns_t columns;
+
+    if (msp_get_num_flushed_coalescence_records(sim) > 0) {
+        ret = tree_sequence_create(self, sim, recomb_map, Ne);
+        goto out;
+    }
+    memset(self, 0, sizeof(tree_sequence_t));
+    ret = msp_release_coalescence_records(sim, &columns);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = tree_sequence_init_from_columns(self, &columns);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = tree_sequence_init_from_simulation(self, sim, recomb_map, Ne);
+out:
+    return ret;
+}
+
+static inline uint32_t
+tree_sequence_join_node(uint32_t node, uint32_t sample_size, uint32_t shift)
+{
+    return node < sample_size ? node : node + shift;
+}
+
+/* Joins the specified tree sequences end to end. Contig j covers the
+ * interval from the end of contig j - 1 to the end of its own last tree.
+ * The contigs must have the same samples, which are shared between them,
+ * and the non-sample nodes of each contig are numbered after those of the
+ * contigs before it. Records are merged in time order, with ties broken
+ * by contig.
+ */
+int WARN_UNUSED
+tree_sequence_join(tree_sequence_t *self, size_t num_contigs,
+        tree_sequence_t **contigs)
+{
+    int ret = MSP_ERR_GENERIC;
+    int err;
+    size_t j, k, l, num_records, num_child_nodes, num_migrations,
+           num_mutations, record_index, child_index, migration_index,
+           mutation_index;
+    uint32_t n, shift, next_node;
+    double offset;
+    tree_sequence_t *ts;
+    coalescence_record_t *record;
+    coalescence_record_t *records = NULL;
+    coalescence_record_t *sorted = NULL;
+    uint32_t *children = NULL;
+    migration_record_t *migrations = NULL;
+    mutation_t *mutations = NULL;
+    sample_t *samples = NULL;
+    uint64_t *keys = NULL;
+    uint32_t *order = NULL;
+    double *offsets = NULL;
+    uint32_t *node_offsets = NULL;
+    record_reader_t reader;
+
+    memset(self, 0, sizeof(tree_sequence_t));
+    if (num_contigs == 0) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    n = contigs[0]->sample_size;
+    num_records = 0;
+    num_child_nodes = 0;
+    num_migrations = 0;
+    num_mutations = 0;
+    for (j = 0; j < num_contigs; j++) {
+        ts = contigs[j];
+        if (ts->sample_size != n) {
+            ret = MSP_ERR_INCOMPATIBLE_CONTIGS;
+            goto out;
+        }
+        ret = tree_sequence_load_columns(ts, MSP_COLUMNS_ALL);
+        if (ret != 0) {
+            goto out;
+        }
+        ret = MSP_ERR_GENERIC;
+        for (k = 0; k < n; k++) {
+            if (ts->trees.nodes.time[k] != contigs[0]->trees.nodes.time[k]
+                    || ts->trees.nodes.population[k]
+                        != contigs[0]->trees.nodes.population[k]) {
+                ret = MSP_ERR_INCOMPATIBLE_CONTIGS;
+                goto out;
+            }
+        }
+        num_records += ts->trees.num_records;
+        num_child_nodes += ts->num_child_nodes;
+        num_migrations += ts->migrations.num_records;
+        num_mutations += ts->mutations.num_records;
+    }
+    offsets = malloc(num_contigs * sizeof(double));
+    node_offsets = malloc(num_contigs * sizeof(uint32_t));
+    records = malloc(num_records * sizeof(coalescence_record_t));
+    sorted = malloc(num_records * sizeof(coalescence_record_t));
+    keys = malloc(num_records * sizeof(uint64_t));
+    order = malloc(num_records * sizeof(uint32_t));
+    children = malloc(num_child_nodes * sizeof(uint32_t));
+    samples = malloc(n * sizeof(sample_t));
+    /* Avoid malloc(0) for the optional records */
+    migrations = malloc((num_migrations + 1) * sizeof(migration_record_t));
+    mutations = malloc((num_mutations + 1) * sizeof(mutation_t));
+    if (offsets == NULL || node_offsets == NULL || records == NULL
+            || sorted == NULL || keys == NULL || order == NULL
+            || children == NULL
+            || samples == NULL || migrations == NULL || mutations == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+
+    offset = 0;
+    next_node = n;
+    record_index = 0;
+    child_index = 0;
+    migration_index = 0;
+    mutation_index = 0;
+    for (j = 0; j < num_contigs; j++) {
+        ts = contigs[j];
+        if ((uint64_t) next_node + ts->num_nodes - n >= UINT32_MAX) {
+            ret = MSP_ERR_BAD_PARAM_VALUE;
+            goto out;
+        }
+        offsets[j] = offset;
+        node_offsets[j] = next_node;
+        shift = next_node - n;
+        for (k = 0; k < ts->trees.num_records; k++) {
+            record = &records[record_index];
+            ret = tree_sequence_get_coalescence_record(ts, k, record,
+                    MSP_ORDER_TIME);
+            if (ret != 0) {
+                goto out;
+            }
+            record->left += offset;
+            record->right += offset;
+            record->node = tree_sequence_join_node(record->node, n, shift);
+            for (l = 0; l < record->num_children; l++) {
+                children[child_index + l] = tree_sequence_join_node(
+                        record->children[l], n, shift);
+            }
+            record->children = &children[child_index];
+            child_index += record->num_children;
+            keys[record_index] = radix_sort_double_key(record->time);
+            order[record_index] = (uint32_t) record_index;
+            record_index++;
+        }
+        for (k = 0; k < ts->migrations.num_records; k++) {
+            ret = tree_sequence_get_migration_record(ts, k,
+                    &migrations[migration_index]);
+            if (ret != 0) {
+                goto out;
+            }
+            migrations[migration_index].left += offset;
+            migrations[migration_index].right += offset;
+            migrations[migration_index].node = tree_sequence_join_node(
+                    migrations[migration_index].node, n, shift);
+            migration_index++;
+        }
+        for (k = 0; k < ts->mutations.num_records; k++) {
+            mutations[mutation_index].position = ts->mutations.position[k]
+                + offset;
+            mutations[mutation_index].node = tree_sequence_join_node(
+                    ts->mutations.node[k], n, shift);
+            mutations[mutation_index].index = mutation_index;
+            mutation_index++;
+        }
+        /* The next contig starts where the last tree of this one ends */
+        offset += ts->trees.breakpoints[ts->trees.num_breakpoints - 1];
+        next_node += (uint32_t) ts->num_nodes - n;
+    }
+    assert(record_index == num_records);
+    assert(child_index == num_child_nodes);
+
+    /* The records of each contig are in time order, so sorting by time
+     * and then by position in the input keeps them in the order they
+     * happened. */
+    ret = radix_sort(num_records, keys, order);
+    if (ret != 0) {
+        goto out;
+    }
+    for (j = 0; j < num_records; j++) {
+        sorted[j] = records[order[j]];
+    }
+    ret = record_reader_alloc(&reader, NULL, 0, num_records, sorted);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = tree_sequence_init_from_records(self, &reader);
+    err = record_reader_free(&reader);
+    if (ret == 0) {
+        ret = err;
+    }
+    if (ret != 0) {
+        goto out;
+    }
+    for (j = 0; j < n; j++) {
+        ret = tree_sequence_get_sample(contigs[0], (uint32_t) j, &samples[j]);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    ret = tree_sequence_set_samples(self, n, samples);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = tree_sequence_init_migrations(self, num_migrations, migrations);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = tree_sequence_set_mutations(self, num_mutations, mutations);
+    if (ret != 0) {
+        goto out;
+    }
+    self->contigs.num_records = num_contigs;
+    self->contigs.offset = offsets;
+    self->contigs.node_offset = node_offsets;
+    offsets = NULL;
+    node_offsets = NULL;
+out:
+    if (offsets != NULL) {
+        free(offsets);
+    }
+    if (node_offsets != NULL) {
+        free(node_offsets);
+    }
+    if (records != NULL) {
+        free(records);
+    }
+    if (sorted != NULL) {
+        free(sorted);
+    }
+    if (keys != NULL) {
+        free(keys);
+    }
+    if (order != NULL) {
+        free(order);
+    }
+    if (children != NULL) {
+        free(children);
+    }
+    if (samples != NULL) {
+        free(samples);
+    }
+    if (migrations != NULL) {
+        free(migrations);
+    }
+    if (mutations != NULL) {
+        free(mutations);
+    }
+    return ret;
+}
+
 /* Sets up the memory for the mutations associated with each tree.
  */
 static int
@@ -913,6 +1510,8 @@ tree_sequence_check_hdf5_dimensions(tree_sequence_t *self, hid_t file_id)
         {"/trees/records/children", 0, self->num_child_nodes, 1},
         {"/trees/indexes/insertion_order", 1, self->trees.num_records, 1},
         {"/trees/indexes/removal_order", 1, self->trees.num_records, 1},
+        {"/contigs/offset", 1, self->contigs.num_records, 0},
+        {"/contigs/node_offset", 1, self->contigs.num_records, 0},
     };
     size_t num_fields = sizeof(fields) / sizeof(struct _dimension_check);
     size_t j;
@@ -921,6 +1520,9 @@ tree_sequence_check_hdf5_dimensions(tree_sequence_t *self, hid_t file_id)
         fields[j].size = self->mutations.num_records;
         fields[j].required = self->mutations.num_records > 0;
     }
+    for (j = num_fields - 2; j < num_fields; j++) {
+        fields[j].required = self->contigs.num_records > 0;
+    }
     for (j = 0; j < num_fields; j++) {
         if (fields[j].required) {
             dataset_id = H5Dopen(file_id, fields[j].name, H5P_DEFAULT);
@@ -983,6 +1585,7 @@ tree_sequence_read_hdf5_dimensions(tree_sequence_t *self, hid_t file_id)
         {"/trees/nodes/time", &self->num_nodes, 1},
         {"/trees/records/left", &self->trees.num_records, 1},
         {"/trees/records/children", &self->num_child_nodes, 1},
+        {"/contigs/offset", &self->contigs.num_records, 0},
     };
     size_t num_fields = sizeof(fields) / sizeof(struct _dimension_read);
     size_t j;
@@ -1006,6 +1609,15 @@ tree_sequence_read_hdf5_dimensions(tree_sequence_t *self, hid_t file_id)
     if (exists) {
         fields[1].included = 1;
     }
+    /* The contigs group is only present in joined tree sequences */
+    exists = H5Lexists(file_id, "/contigs", H5P_DEFAULT);
+    if (exists < 0) {
+        goto out;
+    }
+    self->contigs.num_records = 0;
+    if (exists) {
+        fields[num_fields - 1].included = 1;
+    }
     for (j = 0; j < num_fields; j++) {
         if (fields[j].included) {
             dataset_id = H5Dopen(file_id, fields[j].name, H5P_DEFAULT);
@@ -1045,50 +1657,387 @@ out:
     return ret;
 }
 
+/* Computes the sample size and sequence length from the core columns,
+ * which are always read when a tree sequence is loaded.
+ */
 static int
-tree_sequence_read_hdf5_data(tree_sequence_t *self, hid_t file_id)
+tree_sequence_init_core_columns(tree_sequence_t *self)
+{
+    int ret = MSP_ERR_FILE_FORMAT;
+    size_t j;
+
+    if (self->trees.num_breakpoints < 2) {
+        goto out;
+    }
+    self->sample_size = UINT32_MAX;
+    for (j = 0; j < self->trees.num_records; j++) {
+        self->sample_size = GSL_MIN(self->sample_size,
+                self->trees.records.node[j]);
+    }
+    self->sequence_length = self->trees.breakpoints[
+        self->trees.num_breakpoints - 1];
+    ret = 0;
+out:
+    return ret;
+}
+
+/* Updates the children vectors once the records have been read from file,
+ * and checks the values that the file format cannot guarantee.
+ */
+static int
+tree_sequence_init_record_columns(tree_sequence_t *self)
+{
+    int ret = MSP_ERR_FILE_FORMAT;
+    size_t j, offset;
+
+    offset = 0;
+    for (j = 0; j < self->trees.num_records; j++) {
+        if (self->trees.records.num_children[j]
+                > self->num_child_nodes - offset) {
+            goto out;
+        }
+        self->trees.records.children[j] =
+            &self->trees.records.children_mem[offset];
+        offset += self->trees.records.num_children[j];
+    }
+    for (j = 0; j < self->contigs.num_records; j++) {
+        if (self->contigs.offset[j] >= self->sequence_length
+                || self->contigs.node_offset[j] < self->sample_size
+                || self->contigs.node_offset[j] > self->num_nodes
+                || (j == 0 && self->contigs.offset[j] != 0)
+                || (j > 0 && (self->contigs.offset[j]
+                        <= self->contigs.offset[j - 1]
+                    || self->contigs.node_offset[j]
+                        < self->contigs.node_offset[j - 1]))) {
+            goto out;
+        }
+    }
+    ret = 0;
+out:
+    return ret;
+}
+
+/* Allocates the memory for the specified groups of columns of a tree
+ * sequence being loaded from an HDF5 file. Columns that are already
+ * allocated are left alone, so that a failed lazy read can be retried.
+ */
+static int
+tree_sequence_alloc_columns(tree_sequence_t *self, int columns)
+{
+    int ret = MSP_ERR_NO_MEMORY;
+    size_t j, num_records;
+
+    num_records = self->trees.num_records;
+    if (columns & MSP_COLUMNS_CORE) {
+        if (self->trees.breakpoints == NULL) {
+            self->trees.breakpoints = malloc(
+                    self->trees.num_breakpoints * sizeof(double));
+        }
+        if (self->trees.records.node == NULL) {
+            self->trees.records.node = malloc(num_records * sizeof(uint32_t));
+        }
+        if (self->trees.breakpoints == NULL
+                || self->trees.records.node == NULL) {
+            goto out;
+        }
+    }
+    if ((columns & MSP_COLUMNS_NODES) && self->trees.nodes.time == NULL) {
+        self->trees.nodes.time = malloc(self->num_nodes * sizeof(double));
+        self->trees.nodes.population = malloc(self->num_nodes * sizeof(uint32_t));
+        if (self->trees.nodes.time == NULL
+                || self->trees.nodes.population == NULL) {
+            goto out;
+        }
+        /* Set the optional fields to their unset values. */
+        for (j = 0; j < self->num_nodes; j++) {
+            self->trees.nodes.population[j] = MSP_NULL_POPULATION_ID;
+            self->trees.nodes.time[j] = 0.0;
+        }
+    }
+    if ((columns & MSP_COLUMNS_RECORDS) && self->trees.records.left == NULL) {
+        self->trees.records.left = malloc(num_records * sizeof(uint32_t));
+        self->trees.records.right = malloc(num_records * sizeof(uint32_t));
+        self->trees.records.num_children = malloc(num_records * sizeof(uint32_t));
+        self->trees.records.children_mem = malloc(
+                self->num_child_nodes * sizeof(uint32_t));
+        self->trees.records.children = malloc(num_records * sizeof(uint32_t *));
+        self->trees.indexes.insertion_order = malloc(
+                num_records * sizeof(uint32_t));
+        self->trees.indexes.removal_order = malloc(
+                num_records * sizeof(uint32_t));
+        if (self->trees.records.left == NULL
+                || self->trees.records.right == NULL
+                || self->trees.records.num_children == NULL
+                || self->trees.records.children_mem == NULL
+                || self->trees.records.children == NULL
+                || self->trees.indexes.insertion_order == NULL
+                || self->trees.indexes.removal_order == NULL) {
+            goto out;
+        }
+        if (self->contigs.num_records > 0) {
+            self->contigs.offset = malloc(self->contigs.num_records * sizeof(double));
+            self->contigs.node_offset = malloc(
+                    self->contigs.num_records * sizeof(uint32_t));
+            if (self->contigs.offset == NULL || self->contigs.node_offset == NULL) {
+                goto out;
+            }
+        }
+    }
+    if ((columns & MSP_COLUMNS_MUTATIONS) && self->mutations.num_records > 0
+            && self->mutations.node == NULL) {
+        self->mutations.node = malloc(self->mutations.num_records * sizeof(uint32_t));
+        self->mutations.position = malloc(
+                self->mutations.num_records * sizeof(double));
+        if (self->mutations.node == NULL || self->mutations.position == NULL) {
+            goto out;
+        }
+    }
+    if ((columns & MSP_COLUMNS_PROVENANCE) && self->provenance_strings == NULL) {
+        /* Avoid the potential portability issues with malloc(0) here. The
+         * strings are zeroed so that a failed read can be freed safely. */
+        self->provenance_strings = calloc(1 + self->num_provenance_strings,
+                sizeof(char *));
+        if (self->provenance_strings == NULL) {
+            goto out;
+        }
+    }
+    ret = 0;
+out:
+    return ret;
+}
+
+#ifdef MSP_HDF5_DIRECT_CHUNKS
+
+/* Appends the chunks that a column of size items is split into to the
+ * chunks array, growing it as required.
+ */
+static int
+tree_sequence_append_hdf5_chunks(codec_chunk_t **chunks, size_t *num_chunks,
+        size_t *max_chunks, void *data, size_t item_size, size_t size)
+{
+    int ret = 0;
+    size_t j, n, chunk_items;
+    codec_chunk_t *tmp, *chunk;
+
+    chunk_items = GSL_MIN(size, MSP_HDF5_CHUNK_ITEMS);
+    n = (size + chunk_items - 1) / chunk_items;
+    if (*num_chunks + n > *max_chunks) {
+        *max_chunks = GSL_MAX(2 * *max_chunks, *num_chunks + n);
+        tmp = realloc(*chunks, *max_chunks * sizeof(codec_chunk_t));
+        if (tmp == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        *chunks = tmp;
+    }
+    for (j = 0; j < n; j++) {
+        chunk = *chunks + *num_chunks + j;
+        memset(chunk, 0, sizeof(codec_chunk_t));
+        chunk->data = (char *) data + j * chunk_items * item_size;
+        chunk->item_size = item_size;
+        chunk->chunk_items = chunk_items;
+        chunk->num_items = GSL_MIN(chunk_items, size - j * chunk_items);
+        chunk->level = 9;
+    }
+    *num_chunks += n;
+out:
+    return ret;
+}
+
+/* Reads the raw chunks of a dataset of size items of the specified type
+ * into the chunks array, so that they can be decoded afterwards. This is
+ * only possible if the dataset was written using exactly the filters that
+ * the codec implements and is stored in the native byte order; if not,
+ * nothing is read and direct is set to false.
+ */
+static int
+tree_sequence_read_hdf5_chunks(hid_t dataset_id, hid_t type, size_t size,
+        void *dest, codec_chunk_t **chunks, size_t *num_chunks,
+        size_t *max_chunks, bool *direct)
 {
-    herr_t status;
     int ret = MSP_ERR_HDF5;
+    herr_t status;
+    htri_t equal;
+    hid_t plist_id = -1;
+    hid_t file_type, dataspace_id;
+    H5Z_filter_t filter;
+    H5Z_filter_t filters[] = {H5Z_FILTER_SHUFFLE, H5Z_FILTER_DEFLATE,
+        H5Z_FILTER_FLETCHER32};
+    unsigned int filter_flags, cd_values[8];
+    size_t j, num_cd_values, first_chunk;
+    hsize_t dims[1], chunk_dims[1], offset[1], chunk_size;
+    uint32_t filter_mask;
+    codec_chunk_t *chunk;
+
+    *direct = false;
+    first_chunk = *num_chunks;
+    plist_id = H5Dget_create_plist(dataset_id);
+    if (plist_id < 0) {
+        goto out;
+    }
+    if (H5Pget_layout(plist_id) != H5D_CHUNKED
+            || H5Pget_nfilters(plist_id) != 3
+            || H5Pget_chunk(plist_id, 1, chunk_dims) != 1) {
+        ret = 0;
+        goto out;
+    }
+    for (j = 0; j < 3; j++) {
+        num_cd_values = sizeof(cd_values) / sizeof(unsigned int);
+        filter = H5Pget_filter2(plist_id, (unsigned int) j, &filter_flags,
+                &num_cd_values, cd_values, 0, NULL, NULL);
+        if (filter != filters[j]) {
+            ret = 0;
+            goto out;
+        }
+    }
+    file_type = H5Dget_type(dataset_id);
+    if (file_type < 0) {
+        goto out;
+    }
+    equal = H5Tequal(file_type, type);
+    status = H5Tclose(file_type);
+    if (equal < 0 || status < 0) {
+        goto out;
+    }
+    if (!equal) {
+        ret = 0;
+        goto out;
+    }
+    dataspace_id = H5Dget_space(dataset_id);
+    if (dataspace_id < 0) {
+        goto out;
+    }
+    if (H5Sget_simple_extent_ndims(dataspace_id) != 1) {
+        ret = MSP_ERR_FILE_FORMAT;
+        H5Sclose(dataspace_id);
+        goto out;
+    }
+    H5Sget_simple_extent_dims(dataspace_id, dims, NULL);
+    status = H5Sclose(dataspace_id);
+    if (status < 0) {
+        goto out;
+    }
+    if (dims[0] != size) {
+        ret = MSP_ERR_FILE_FORMAT;
+        goto out;
+    }
+    if (chunk_dims[0] != GSL_MIN(size, MSP_HDF5_CHUNK_ITEMS)) {
+        ret = 0;
+        goto out;
+    }
+    ret = tree_sequence_append_hdf5_chunks(chunks, num_chunks, max_chunks,
+            dest, H5Tget_size(type), size);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = MSP_ERR_HDF5;
+    for (j = first_chunk; j < *num_chunks; j++) {
+        chunk = *chunks + j;
+        offset[0] = (hsize_t) ((j - first_chunk) * chunk->chunk_items);
+        status = H5Dget_chunk_storage_size(dataset_id, offset, &chunk_size);
+        if (status < 0) {
+            goto out;
+        }
+        chunk->encoded = malloc((size_t) chunk_size);
+        if (chunk->encoded == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        chunk->encoded_size = (size_t) chunk_size;
+        status = H5Dread_chunk(dataset_id, H5P_DEFAULT, offset, &filter_mask,
+                chunk->encoded);
+        if (status < 0) {
+            goto out;
+        }
+        if (filter_mask != 0) {
+            /* HDF5 skipped a filter when writing this chunk, so it is not
+             * encoded in the way we expect. */
+            ret = 0;
+            goto out;
+        }
+    }
+    *direct = true;
+    ret = 0;
+out:
+    if (!*direct) {
+        /* Drop any chunks we have appended so the caller can fall back
+         * to reading the dataset through HDF5. */
+        for (j = first_chunk; j < *num_chunks; j++) {
+            codec_chunk_free(*chunks + j);
+        }
+        *num_chunks = first_chunk;
+    }
+    if (plist_id >= 0) {
+        status = H5Pclose(plist_id);
+        if (status < 0 && ret == 0) {
+            ret = MSP_ERR_HDF5;
+        }
+    }
+    return ret;
+}
+
+#endif
+
+/* Reads the specified groups of columns from an HDF5 file, and sets up
+ * the state derived from them.
+ */
+static int
+tree_sequence_read_hdf5_columns(tree_sequence_t *self, hid_t file_id,
+        int columns)
+{
+    herr_t status;
+    int ret;
     hid_t dataset_id;
     struct _hdf5_field_read {
         const char *name;
         hid_t type;
+        int group;
         int empty;
         int required;
+        size_t size;
         void *dest;
     };
     struct _hdf5_field_read fields[] = {
-        {"/provenance", 0, 0, 0, self->provenance_strings},
-        {"/mutations/node", H5T_NATIVE_UINT32, 0, 1,
-            self->mutations.node},
-        {"/mutations/position", H5T_NATIVE_DOUBLE, 0, 1,
-            self->mutations.position},
-        {"/trees/nodes/population", H5T_NATIVE_UINT32, 0, 1,
-            self->trees.nodes.population},
-        {"/trees/nodes/time", H5T_NATIVE_DOUBLE, 0, 1,
-            self->trees.nodes.time},
-        {"/trees/breakpoints", H5T_NATIVE_DOUBLE, 0, 1,
-            self->trees.breakpoints},
-        {"/trees/records/left", H5T_NATIVE_UINT32, 0, 1,
-            self->trees.records.left},
-        {"/trees/records/right", H5T_NATIVE_UINT32, 0, 1,
-            self->trees.records.right},
-        {"/trees/records/node", H5T_NATIVE_UINT32, 0, 1,
-            self->trees.records.node},
-        {"/trees/records/num_children", H5T_NATIVE_UINT32, 0, 1,
-            self->trees.records.num_children},
-        {"/trees/records/children", H5T_NATIVE_UINT32, 0, 1,
-            self->trees.records.children_mem},
-        {"/trees/indexes/insertion_order", H5T_NATIVE_UINT32, 0, 1,
-            self->trees.indexes.insertion_order},
-        {"/trees/indexes/removal_order", H5T_NATIVE_UINT32, 0, 1,
-            self->trees.indexes.removal_order},
+        {"/provenance", 0, MSP_COLUMNS_PROVENANCE, 0, 0,
+            self->num_provenance_strings, self->provenance_strings},
+        {"/mutations/node", H5T_NATIVE_UINT32, MSP_COLUMNS_MUTATIONS, 0, 1,
+            self->mutations.num_records, self->mutations.node},
+        {"/mutations/position", H5T_NATIVE_DOUBLE, MSP_COLUMNS_MUTATIONS, 0, 1,
+            self->mutations.num_records, self->mutations.position},
+        {"/trees/nodes/population", H5T_NATIVE_UINT32, MSP_COLUMNS_NODES, 0, 1,
+            self->num_nodes, self->trees.nodes.population},
+        {"/trees/nodes/time", H5T_NATIVE_DOUBLE, MSP_COLUMNS_NODES, 0, 1,
+            self->num_nodes, self->trees.nodes.time},
+        {"/trees/breakpoints", H5T_NATIVE_DOUBLE, MSP_COLUMNS_CORE, 0, 1,
+            self->trees.num_breakpoints, self->trees.breakpoints},
+        {"/trees/records/left", H5T_NATIVE_UINT32, MSP_COLUMNS_RECORDS, 0, 1,
+            self->trees.num_records, self->trees.records.left},
+        {"/trees/records/right", H5T_NATIVE_UINT32, MSP_COLUMNS_RECORDS, 0, 1,
+            self->trees.num_records, self->trees.records.right},
+        {"/trees/records/node", H5T_NATIVE_UINT32, MSP_COLUMNS_CORE, 0, 1,
+            self->trees.num_records, self->trees.records.node},
+        {"/trees/records/num_children", H5T_NATIVE_UINT32, MSP_COLUMNS_RECORDS,
+            0, 1, self->trees.num_records, self->trees.records.num_children},
+        {"/trees/records/children", H5T_NATIVE_UINT32, MSP_COLUMNS_RECORDS,
+            0, 1, self->num_child_nodes, self->trees.records.children_mem},
+        {"/trees/indexes/insertion_order", H5T_NATIVE_UINT32, MSP_COLUMNS_RECORDS,
+            0, 1, self->trees.num_records, self->trees.indexes.insertion_order},
+        {"/trees/indexes/removal_order", H5T_NATIVE_UINT32, MSP_COLUMNS_RECORDS,
+            0, 1, self->trees.num_records, self->trees.indexes.removal_order},
+        {"/contigs/offset", H5T_NATIVE_DOUBLE, MSP_COLUMNS_RECORDS, 0, 1,
+            self->contigs.num_records, self->contigs.offset},
+        {"/contigs/node_offset", H5T_NATIVE_UINT32, MSP_COLUMNS_RECORDS, 0, 1,
+            self->contigs.num_records, self->contigs.node_offset},
     };
     size_t num_fields = sizeof(fields) / sizeof(struct _hdf5_field_read);
-    size_t j, offset;
+    size_t j;
     hid_t vlen_str;
+    bool direct;
+    codec_chunk_t *chunks = NULL;
+    size_t num_chunks = 0;
+    size_t max_chunks = 0;
 
+    ret = MSP_ERR_HDF5;
     vlen_str = H5Tcopy(H5T_C_S1);
     if (vlen_str < 0) {
         goto out;
@@ -1109,7 +2058,15 @@ tree_sequence_read_hdf5_data(tree_sequence_t *self, hid_t file_id)
         fields[1].empty = 1;
         fields[2].empty = 1;
     }
+    if (self->contigs.num_records == 0) {
+        fields[num_fields - 2].empty = 1;
+        fields[num_fields - 1].empty = 1;
+    }
     for (j = 0; j < num_fields; j++) {
+        /* Skip any fields in groups we have not been asked for */
+        if (!(fields[j].group & columns)) {
+            continue;
+        }
         /* Skip any non-required fields that are missing. */
         if (!fields[j].required
                 && H5Lexists(file_id, fields[j].name, H5P_DEFAULT) <= 0) {
@@ -1124,39 +2081,556 @@ tree_sequence_read_hdf5_data(tree_sequence_t *self, hid_t file_id)
         if (dataset_id < 0) {
             goto out;
         }
-        status = H5Dread(dataset_id, fields[j].type, H5S_ALL,
-                H5S_ALL, H5P_DEFAULT, fields[j].dest);
-        if (status < 0) {
+        direct = false;
+#ifdef MSP_HDF5_DIRECT_CHUNKS
+        if (fields[j].type != vlen_str && fields[j].size > 0) {
+            /* Compressed chunks are decoded in parallel once all the
+             * fields have been read. */
+            ret = tree_sequence_read_hdf5_chunks(dataset_id, fields[j].type,
+                    fields[j].size, fields[j].dest, &chunks, &num_chunks,
+                    &max_chunks, &direct);
+            if (ret != 0) {
+                goto out;
+            }
+            ret = MSP_ERR_HDF5;
+        }
+#endif
+        if (!direct) {
+            status = H5Dread(dataset_id, fields[j].type, H5S_ALL,
+                    H5S_ALL, H5P_DEFAULT, fields[j].dest);
+            if (status < 0) {
+                goto out;
+            }
+        }
+        status = H5Dclose(dataset_id);
+        if (status < 0) {
+            goto out;
+        }
+    }
+    status = H5Tclose(vlen_str);
+    if (status < 0) {
+        goto out;
+    }
+    ret = codec_run(chunks, num_chunks, codec_decode_chunk,
+            codec_get_num_threads());
+    if (ret != 0) {
+        goto out;
+    }
+    if (columns & MSP_COLUMNS_CORE) {
+        ret = tree_sequence_init_core_columns(self);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    if (columns & MSP_COLUMNS_RECORDS) {
+        ret = tree_sequence_init_record_columns(self);
+        if (ret != 0) {
+            goto out;
+        }
+        ret = tree_sequence_check(self);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    if (columns & MSP_COLUMNS_MUTATIONS) {
+        ret = tree_sequence_init_tree_mutations(self);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    ret = 0;
+out:
+    for (j = 0; j < num_chunks; j++) {
+        codec_chunk_free(&chunks[j]);
+    }
+    if (chunks != NULL) {
+        free(chunks);
+    }
+    return ret;
+}
+
+/* Reads the specified groups of columns of a lazily loaded tree sequence
+ * from its file, if they have not been read already. Reading the records
+ * also reads the nodes, since the records cannot be checked without the
+ * node times.
+ */
+int WARN_UNUSED
+tree_sequence_load_columns(tree_sequence_t *self, int columns)
+{
+    int ret = 0;
+    herr_t status;
+    hid_t file_id = -1;
+
+    if (columns & MSP_COLUMNS_RECORDS) {
+        columns |= MSP_COLUMNS_NODES;
+    }
+    columns &= self->lazy_columns;
+    if (columns == 0) {
+        goto out;
+    }
+    file_id = H5Fopen(self->lazy_filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id < 0) {
+        ret = MSP_ERR_HDF5;
+        goto out;
+    }
+    ret = tree_sequence_alloc_columns(self, columns);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = tree_sequence_read_hdf5_columns(self, file_id, columns);
+    if (ret != 0) {
+        goto out;
+    }
+    self->lazy_columns &= ~columns;
+out:
+    if (file_id >= 0) {
+        status = H5Fclose(file_id);
+        if (status < 0) {
+            ret = MSP_ERR_HDF5;
+        }
+    }
+    return ret;
+}
+
+/* Returns the groups of columns that are held in memory, which is all of
+ * them unless the tree sequence was loaded with MSP_LOAD_LAZY. */
+int
+tree_sequence_get_loaded_columns(tree_sequence_t *self)
+{
+    return MSP_COLUMNS_ALL & ~self->lazy_columns;
+}
+
+/* Native columnar file format. The file consists of a fixed size header
+ * followed by the columns of the tree sequence, each starting on a
+ * MSP_NATIVE_ALIGNMENT byte boundary so that a mapping of the file can be
+ * used in place. Values are stored in the byte order of the machine
+ * that wrote the file, and the header records this order so that files
+ * from a machine of the other endianness are rejected. Integer columns
+ * may instead be varint encoded, in which case they are decoded into
+ * memory when loaded.
+ */
+
+#define MSP_NATIVE_MAGIC "\211MSPCOL\n"
+#define MSP_NATIVE_MAGIC_SIZE 8
+#define MSP_NATIVE_ALIGNMENT 4096
+#define MSP_NATIVE_BYTE_ORDER 0x01020304
+
+#define MSP_NATIVE_ENCODING_RAW 0
+#define MSP_NATIVE_ENCODING_VARINT 1
+
+enum {
+    MSP_NATIVE_NODES_TIME,
+    MSP_NATIVE_NODES_POPULATION,
+    MSP_NATIVE_BREAKPOINTS,
+    MSP_NATIVE_RECORDS_LEFT,
+    MSP_NATIVE_RECORDS_RIGHT,
+    MSP_NATIVE_RECORDS_NODE,
+    MSP_NATIVE_RECORDS_NUM_CHILDREN,
+    MSP_NATIVE_RECORDS_CHILDREN,
+    MSP_NATIVE_INSERTION_ORDER,
+    MSP_NATIVE_REMOVAL_ORDER,
+    MSP_NATIVE_MUTATIONS_NODE,
+    MSP_NATIVE_MUTATIONS_POSITION,
+    MSP_NATIVE_CONTIGS_OFFSET,
+    MSP_NATIVE_CONTIGS_NODE_OFFSET,
+    MSP_NATIVE_PROVENANCE,
+    MSP_NATIVE_NUM_COLUMNS
+};
+
+typedef struct {
+    char magic[MSP_NATIVE_MAGIC_SIZE];
+    uint32_t version[2];
+    uint32_t byte_order;
+    uint32_t num_columns;
+    uint64_t num_nodes;
+    uint64_t num_records;
+    uint64_t num_breakpoints;
+    uint64_t num_child_nodes;
+    uint64_t num_mutations;
+    uint64_t num_contigs;
+    uint64_t num_provenance_strings;
+    struct {
+        uint64_t offset;
+        uint64_t size;
+    } columns[MSP_NATIVE_NUM_COLUMNS];
+    /* Added in version 1.1; this is the zero padding before the first
+     * column in older files, so all of their columns are raw. */
+    uint32_t encoding[MSP_NATIVE_NUM_COLUMNS];
+} native_header_t;
+
+static uint64_t
+native_align(uint64_t offset)
+{
+    return (offset + MSP_NATIVE_ALIGNMENT - 1)
+        & ~((uint64_t) MSP_NATIVE_ALIGNMENT - 1);
+}
+
+/* Fills in the number of items and the size of each item in the columns
+ * described by the specified header. The provenance column is a sequence
+ * of NUL terminated strings, and so its number of items is not known
+ * until the strings have been read.
+ */
+static void
+native_column_dimensions(native_header_t *header, uint64_t *num_items,
+        size_t *item_size)
+{
+    size_t j;
+
+    for (j = 0; j < MSP_NATIVE_NUM_COLUMNS; j++) {
+        item_size[j] = sizeof(uint32_t);
+        num_items[j] = header->num_records;
+    }
+    num_items[MSP_NATIVE_NODES_TIME] = header->num_nodes;
+    item_size[MSP_NATIVE_NODES_TIME] = sizeof(double);
+    num_items[MSP_NATIVE_NODES_POPULATION] = header->num_nodes;
+    num_items[MSP_NATIVE_BREAKPOINTS] = header->num_breakpoints;
+    item_size[MSP_NATIVE_BREAKPOINTS] = sizeof(double);
+    num_items[MSP_NATIVE_RECORDS_CHILDREN] = header->num_child_nodes;
+    num_items[MSP_NATIVE_MUTATIONS_NODE] = header->num_mutations;
+    num_items[MSP_NATIVE_MUTATIONS_POSITION] = header->num_mutations;
+    item_size[MSP_NATIVE_MUTATIONS_POSITION] = sizeof(double);
+    num_items[MSP_NATIVE_CONTIGS_OFFSET] = header->num_contigs;
+    item_size[MSP_NATIVE_CONTIGS_OFFSET] = sizeof(double);
+    num_items[MSP_NATIVE_CONTIGS_NODE_OFFSET] = header->num_contigs;
+    num_items[MSP_NATIVE_PROVENANCE] = header->columns[MSP_NATIVE_PROVENANCE].size;
+    item_size[MSP_NATIVE_PROVENANCE] = 1;
+}
+
+static int
+native_write_padding(FILE *file, uint64_t size)
+{
+    static const char zeros[MSP_NATIVE_ALIGNMENT];
+    size_t n;
+
+    while (size > 0) {
+        n = (size_t) GSL_MIN(size, MSP_NATIVE_ALIGNMENT);
+        if (fwrite(zeros, 1, n, file) != n) {
+            return MSP_ERR_IO;
+        }
+        size -= n;
+    }
+    return 0;
+}
+
+static int
+tree_sequence_dump_native(tree_sequence_t *self, const char *filename,
+        int flags)
+{
+    int ret = MSP_ERR_IO;
+    FILE *file = NULL;
+    native_header_t header;
+    const void *columns[MSP_NATIVE_NUM_COLUMNS];
+    unsigned char *encoded[MSP_NATIVE_NUM_COLUMNS];
+    uint64_t num_items[MSP_NATIVE_NUM_COLUMNS];
+    size_t item_size[MSP_NATIVE_NUM_COLUMNS];
+    size_t encoded_size[MSP_NATIVE_NUM_COLUMNS];
+    int varint_columns[] = {MSP_NATIVE_RECORDS_LEFT, MSP_NATIVE_RECORDS_RIGHT,
+        MSP_NATIVE_RECORDS_NODE, MSP_NATIVE_RECORDS_NUM_CHILDREN,
+        MSP_NATIVE_RECORDS_CHILDREN};
+    uint64_t offset, size;
+    size_t j, k;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MSP_NATIVE_MAGIC, MSP_NATIVE_MAGIC_SIZE);
+    header.version[0] = MSP_NATIVE_FORMAT_VERSION_MAJOR;
+    header.version[1] = MSP_NATIVE_FORMAT_VERSION_MINOR;
+    header.byte_order = MSP_NATIVE_BYTE_ORDER;
+    header.num_columns = MSP_NATIVE_NUM_COLUMNS;
+    header.num_nodes = self->num_nodes;
+    header.num_records = self->trees.num_records;
+    header.num_breakpoints = self->trees.num_breakpoints;
+    header.num_child_nodes = self->num_child_nodes;
+    header.num_mutations = self->mutations.num_records;
+    header.num_contigs = self->contigs.num_records;
+    header.num_provenance_strings = self->num_provenance_strings;
+    size = 0;
+    for (k = 0; k < self->num_provenance_strings; k++) {
+        size += strlen(self->provenance_strings[k]) + 1;
+    }
+    header.columns[MSP_NATIVE_PROVENANCE].size = size;
+
+    columns[MSP_NATIVE_NODES_TIME] = self->trees.nodes.time;
+    columns[MSP_NATIVE_NODES_POPULATION] = self->trees.nodes.population;
+    columns[MSP_NATIVE_BREAKPOINTS] = self->trees.breakpoints;
+    columns[MSP_NATIVE_RECORDS_LEFT] = self->trees.records.left;
+    columns[MSP_NATIVE_RECORDS_RIGHT] = self->trees.records.right;
+    columns[MSP_NATIVE_RECORDS_NODE] = self->trees.records.node;
+    columns[MSP_NATIVE_RECORDS_NUM_CHILDREN] = self->trees.records.num_children;
+    columns[MSP_NATIVE_RECORDS_CHILDREN] = self->trees.records.children_mem;
+    columns[MSP_NATIVE_INSERTION_ORDER] = self->trees.indexes.insertion_order;
+    columns[MSP_NATIVE_REMOVAL_ORDER] = self->trees.indexes.removal_order;
+    columns[MSP_NATIVE_MUTATIONS_NODE] = self->mutations.node;
+    columns[MSP_NATIVE_MUTATIONS_POSITION] = self->mutations.position;
+    columns[MSP_NATIVE_CONTIGS_OFFSET] = self->contigs.offset;
+    columns[MSP_NATIVE_CONTIGS_NODE_OFFSET] = self->contigs.node_offset;
+    columns[MSP_NATIVE_PROVENANCE] = NULL;
+
+    native_column_dimensions(&header, num_items, item_size);
+    memset(encoded, 0, sizeof(encoded));
+    if (flags & MSP_VARINT_ENCODING) {
+        for (k = 0; k < sizeof(varint_columns) / sizeof(int); k++) {
+            j = (size_t) varint_columns[k];
+            encoded[j] = malloc(codec_varint_bound((size_t) num_items[j]) + 1);
+            if (encoded[j] == NULL) {
+                ret = MSP_ERR_NO_MEMORY;
+                goto out;
+            }
+            encoded_size[j] = codec_varint_encode(columns[j],
+                    (size_t) num_items[j], encoded[j]);
+            header.encoding[j] = MSP_NATIVE_ENCODING_VARINT;
+        }
+    }
+    offset = native_align(sizeof(header));
+    for (j = 0; j < MSP_NATIVE_NUM_COLUMNS; j++) {
+        header.columns[j].offset = offset;
+        header.columns[j].size = num_items[j] * item_size[j];
+        if (encoded[j] != NULL) {
+            header.columns[j].size = encoded_size[j];
+            columns[j] = encoded[j];
+        }
+        offset = native_align(offset + header.columns[j].size);
+    }
+
+    file = fopen(filename, "wb");
+    if (file == NULL) {
+        goto out;
+    }
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        goto out;
+    }
+    offset = sizeof(header);
+    for (j = 0; j < MSP_NATIVE_NUM_COLUMNS; j++) {
+        ret = native_write_padding(file, header.columns[j].offset - offset);
+        if (ret != 0) {
+            goto out;
+        }
+        ret = MSP_ERR_IO;
+        size = header.columns[j].size;
+        if (j == MSP_NATIVE_PROVENANCE) {
+            for (k = 0; k < self->num_provenance_strings; k++) {
+                if (fputs(self->provenance_strings[k], file) == EOF
+                        || fputc('\0', file) == EOF) {
+                    goto out;
+                }
+            }
+        } else if (size > 0) {
+            if (fwrite(columns[j], (size_t) size, 1, file) != 1) {
+                goto out;
+            }
+        }
+        offset = header.columns[j].offset + size;
+    }
+    ret = native_write_padding(file, native_align(offset) - offset);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = MSP_ERR_IO;
+    if (fclose(file) != 0) {
+        file = NULL;
+        goto out;
+    }
+    file = NULL;
+    ret = 0;
+out:
+    if (file != NULL) {
+        fclose(file);
+    }
+    for (j = 0; j < MSP_NATIVE_NUM_COLUMNS; j++) {
+        if (encoded[j] != NULL) {
+            free(encoded[j]);
+        }
+    }
+    return ret;
+}
+
+/* Returns true if the specified file starts with the native format magic.
+ */
+static bool
+native_is_native_file(const char *filename)
+{
+    bool ret = false;
+    char magic[MSP_NATIVE_MAGIC_SIZE];
+    FILE *file = fopen(filename, "rb");
+
+    if (file != NULL) {
+        ret = fread(magic, MSP_NATIVE_MAGIC_SIZE, 1, file) == 1
+            && memcmp(magic, MSP_NATIVE_MAGIC, MSP_NATIVE_MAGIC_SIZE) == 0;
+        fclose(file);
+    }
+    return ret;
+}
+
+/* Maps the specified native format file into memory and points the
+ * columns of the tree sequence into the mapping. Only the varint encoded
+ * columns, children pointers, provenance string pointers and per-tree
+ * mutations are allocated.
+ */
+static int
+tree_sequence_load_native(tree_sequence_t *self, const char *filename)
+{
+    int ret = MSP_ERR_IO;
+    int fd;
+    struct stat st;
+    void *addr;
+    char *base, *provenance;
+    native_header_t header;
+    void *columns[MSP_NATIVE_NUM_COLUMNS];
+    uint32_t *decoded[MSP_NATIVE_NUM_COLUMNS];
+    uint64_t num_items[MSP_NATIVE_NUM_COLUMNS];
+    size_t item_size[MSP_NATIVE_NUM_COLUMNS];
+    uint64_t file_size, offset, size;
+    size_t j, k;
+
+    memset(decoded, 0, sizeof(decoded));
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        goto out;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        goto out;
+    }
+    file_size = (uint64_t) st.st_size;
+    if (file_size < sizeof(header) || file_size > SIZE_MAX) {
+        close(fd);
+        ret = MSP_ERR_FILE_FORMAT;
+        goto out;
+    }
+    /* A private writable mapping shares the page cache with every other
+     * process mapping the file, but any writes are local to us. */
+    addr = mmap(NULL, (size_t) file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+            fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        goto out;
+    }
+    self->mmap_addr = addr;
+    self->mmap_size = (size_t) file_size;
+    base = addr;
+
+    ret = MSP_ERR_FILE_FORMAT;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, MSP_NATIVE_MAGIC, MSP_NATIVE_MAGIC_SIZE) != 0
+            || header.byte_order != MSP_NATIVE_BYTE_ORDER) {
+        goto out;
+    }
+    if (header.version[0] < MSP_NATIVE_FORMAT_VERSION_MAJOR) {
+        ret = MSP_ERR_FILE_VERSION_TOO_OLD;
+        goto out;
+    }
+    if (header.version[0] > MSP_NATIVE_FORMAT_VERSION_MAJOR) {
+        ret = MSP_ERR_FILE_VERSION_TOO_NEW;
+        goto out;
+    }
+    if (header.num_columns != MSP_NATIVE_NUM_COLUMNS) {
+        goto out;
+    }
+    native_column_dimensions(&header, num_items, item_size);
+    for (j = 0; j < MSP_NATIVE_NUM_COLUMNS; j++) {
+        offset = header.columns[j].offset;
+        size = header.columns[j].size;
+        if (offset % MSP_NATIVE_ALIGNMENT != 0 || offset > file_size
+                || size > file_size - offset) {
+            goto out;
+        }
+        columns[j] = size == 0 ? NULL : base + offset;
+        if (header.encoding[j] == MSP_NATIVE_ENCODING_RAW) {
+            if (num_items[j] > size / item_size[j]
+                    || num_items[j] * item_size[j] != size) {
+                goto out;
+            }
+        } else if (header.encoding[j] == MSP_NATIVE_ENCODING_VARINT
+                && item_size[j] == sizeof(uint32_t)
+                && j != MSP_NATIVE_PROVENANCE) {
+            /* Every value takes at least one byte */
+            if (num_items[j] > size) {
+                goto out;
+            }
+            if (num_items[j] > 0) {
+                decoded[j] = malloc((size_t) num_items[j] * sizeof(uint32_t));
+                if (decoded[j] == NULL) {
+                    ret = MSP_ERR_NO_MEMORY;
+                    goto out;
+                }
+                ret = codec_varint_decode(columns[j], (size_t) size,
+                        decoded[j], (size_t) num_items[j]);
+                if (ret != 0) {
+                    goto out;
+                }
+                ret = MSP_ERR_FILE_FORMAT;
+            }
+            columns[j] = decoded[j];
+        } else {
+            goto out;
+        }
+    }
+    self->num_nodes = (size_t) header.num_nodes;
+    self->trees.num_records = (size_t) header.num_records;
+    self->trees.num_breakpoints = (size_t) header.num_breakpoints;
+    self->num_child_nodes = (size_t) header.num_child_nodes;
+    self->mutations.num_records = (size_t) header.num_mutations;
+    self->contigs.num_records = (size_t) header.num_contigs;
+
+    self->trees.nodes.time = columns[MSP_NATIVE_NODES_TIME];
+    self->trees.nodes.population = columns[MSP_NATIVE_NODES_POPULATION];
+    self->trees.breakpoints = columns[MSP_NATIVE_BREAKPOINTS];
+    self->trees.records.left = columns[MSP_NATIVE_RECORDS_LEFT];
+    self->trees.records.right = columns[MSP_NATIVE_RECORDS_RIGHT];
+    self->trees.records.node = columns[MSP_NATIVE_RECORDS_NODE];
+    self->trees.records.num_children = columns[MSP_NATIVE_RECORDS_NUM_CHILDREN];
+    self->trees.records.children_mem = columns[MSP_NATIVE_RECORDS_CHILDREN];
+    self->trees.indexes.insertion_order = columns[MSP_NATIVE_INSERTION_ORDER];
+    self->trees.indexes.removal_order = columns[MSP_NATIVE_REMOVAL_ORDER];
+    self->mutations.node = columns[MSP_NATIVE_MUTATIONS_NODE];
+    self->mutations.position = columns[MSP_NATIVE_MUTATIONS_POSITION];
+    self->contigs.offset = columns[MSP_NATIVE_CONTIGS_OFFSET];
+    self->contigs.node_offset = columns[MSP_NATIVE_CONTIGS_NODE_OFFSET];
+    /* The decoded columns are now freed along with the tree sequence */
+    memset(decoded, 0, sizeof(decoded));
+
+    ret = MSP_ERR_NO_MEMORY;
+    self->trees.records.children = malloc(
+            (1 + self->trees.num_records) * sizeof(uint32_t *));
+    self->provenance_strings = malloc(
+            (1 + header.num_provenance_strings) * sizeof(char *));
+    if (self->trees.records.children == NULL
+            || self->provenance_strings == NULL) {
+        goto out;
+    }
+    /* The provenance strings are NUL terminated and packed end to end. */
+    ret = MSP_ERR_FILE_FORMAT;
+    provenance = columns[MSP_NATIVE_PROVENANCE];
+    size = header.columns[MSP_NATIVE_PROVENANCE].size;
+    offset = 0;
+    for (k = 0; k < header.num_provenance_strings; k++) {
+        if (offset >= size) {
             goto out;
         }
-        status = H5Dclose(dataset_id);
-        if (status < 0) {
+        self->provenance_strings[k] = provenance + offset;
+        offset += strnlen(provenance + offset, (size_t) (size - offset)) + 1;
+        if (offset > size) {
             goto out;
         }
+        self->num_provenance_strings++;
     }
-    status = H5Tclose(vlen_str);
-    if (status < 0) {
+    if (offset != size) {
         goto out;
     }
-    /* Now update the children vectors and find sample size */
-    self->sample_size = UINT32_MAX;
-    offset = 0;
-    for (j = 0; j < self->trees.num_records; j++) {
-        assert(offset < self->num_child_nodes);
-        self->trees.records.children[j] =
-            &self->trees.records.children_mem[offset];
-        offset += self->trees.records.num_children[j];
-        self->sample_size = GSL_MIN(self->sample_size,
-                self->trees.records.node[j]);
+    ret = tree_sequence_init_core_columns(self);
+    if (ret != 0) {
+        goto out;
     }
-    self->sequence_length = self->trees.breakpoints[
-        self->trees.num_breakpoints - 1];
-    ret = tree_sequence_init_tree_mutations(self);
+    ret = tree_sequence_init_record_columns(self);
     if (ret != 0) {
         goto out;
     }
-    ret = 0;
+    ret = tree_sequence_init_tree_mutations(self);
 out:
+    for (j = 0; j < MSP_NATIVE_NUM_COLUMNS; j++) {
+        if (decoded[j] != NULL) {
+            free(decoded[j]);
+        }
+    }
     return ret;
 }
 
@@ -1166,8 +2640,21 @@ tree_sequence_load(tree_sequence_t *self, const char *filename, int flags)
     int ret = MSP_ERR_GENERIC;
     herr_t status;
     hid_t file_id = -1;
+    int columns;
 
     memset(self, 0, sizeof(tree_sequence_t));
+    if ((flags & MSP_NATIVE_FORMAT) || native_is_native_file(filename)) {
+        ret = tree_sequence_load_native(self, filename);
+        if (ret == 0) {
+            ret = tree_sequence_check(self);
+        }
+        if (ret != 0) {
+            /* Release the mapping now, so that nothing is left to free. */
+            tree_sequence_free(self);
+            memset(self, 0, sizeof(tree_sequence_t));
+        }
+        goto out;
+    }
     file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
     if (file_id < 0) {
         ret = MSP_ERR_HDF5;
@@ -1181,15 +2668,24 @@ tree_sequence_load(tree_sequence_t *self, const char *filename, int flags)
     if (ret != 0) {
         goto out;
     }
-    ret = tree_sequence_alloc(self);
-    if (ret != 0) {
-        goto out;
+    columns = MSP_COLUMNS_CORE | MSP_COLUMNS_ALL;
+    if (flags & MSP_LOAD_LAZY) {
+        /* Only read the columns that the sample size and sequence length
+         * depend on, and remember where to find the rest. */
+        columns = MSP_COLUMNS_CORE;
+        self->lazy_filename = malloc(strlen(filename) + 1);
+        if (self->lazy_filename == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        strcpy(self->lazy_filename, filename);
+        self->lazy_columns = MSP_COLUMNS_ALL;
     }
-    ret = tree_sequence_read_hdf5_data(self, file_id);
+    ret = tree_sequence_alloc_columns(self, columns);
     if (ret != 0) {
         goto out;
     }
-    ret = tree_sequence_check(self);
+    ret = tree_sequence_read_hdf5_columns(self, file_id, columns);
 out:
     if (file_id >= 0) {
         status = H5Fclose(file_id);
@@ -1206,54 +2702,61 @@ tree_sequence_write_hdf5_data(tree_sequence_t *self, hid_t file_id, int flags)
     herr_t ret = -1;
     herr_t status;
     hid_t group_id, dataset_id, dataspace_id, plist_id;
-    hsize_t dims[1];
+    hsize_t dims[1], chunk_dims[1];
     struct _hdf5_field_write {
         const char *name;
         hid_t storage_type;
         hid_t memory_type;
         size_t size;
         void *source;
+        bool direct;
     };
     struct _hdf5_field_write fields[] = {
         {"/provenance",
             0, 0, /* We must set this afterwards */
-            self->num_provenance_strings, self->provenance_strings},
+            self->num_provenance_strings, self->provenance_strings, false},
         {"/trees/nodes/population",
             H5T_STD_U32LE, H5T_NATIVE_UINT32,
-            self->num_nodes, self->trees.nodes.population},
+            self->num_nodes, self->trees.nodes.population, false},
         {"/trees/nodes/time",
             H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE,
-            self->num_nodes, self->trees.nodes.time},
+            self->num_nodes, self->trees.nodes.time, false},
         {"/trees/records/left",
             H5T_STD_U32LE, H5T_NATIVE_UINT32,
-            self->trees.num_records, self->trees.records.left},
+            self->trees.num_records, self->trees.records.left, false},
         {"/trees/records/right",
             H5T_STD_U32LE, H5T_NATIVE_UINT32,
-            self->trees.num_records, self->trees.records.right},
+            self->trees.num_records, self->trees.records.right, false},
         {"/trees/records/node",
             H5T_STD_U32LE, H5T_NATIVE_UINT32,
-            self->trees.num_records, self->trees.records.node},
+            self->trees.num_records, self->trees.records.node, false},
         {"/trees/records/num_children",
             H5T_STD_U32LE, H5T_NATIVE_UINT32,
-            self->trees.num_records, self->trees.records.num_children},
+            self->trees.num_records, self->trees.records.num_children, false},
         {"/trees/records/children",
             H5T_STD_U32LE, H5T_NATIVE_UINT32,
-            self->num_child_nodes, self->trees.records.children_mem},
+            self->num_child_nodes, self->trees.records.children_mem, false},
         {"/trees/indexes/insertion_order",
             H5T_STD_U32LE, H5T_NATIVE_UINT32,
-            self->trees.num_records, self->trees.indexes.insertion_order},
+            self->trees.num_records, self->trees.indexes.insertion_order, false},
         {"/trees/indexes/removal_order",
             H5T_STD_U32LE, H5T_NATIVE_UINT32,
-            self->trees.num_records, self->trees.indexes.removal_order},
+            self->trees.num_records, self->trees.indexes.removal_order, false},
         {"/trees/breakpoints",
             H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE,
-            self->trees.num_breakpoints, self->trees.breakpoints},
+            self->trees.num_breakpoints, self->trees.breakpoints, false},
         {"/mutations/node",
             H5T_STD_U32LE, H5T_NATIVE_UINT32,
-            self->mutations.num_records, self->mutations.node},
+            self->mutations.num_records, self->mutations.node, false},
         {"/mutations/position",
             H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE,
-            self->mutations.num_records, self->mutations.position},
+            self->mutations.num_records, self->mutations.position, false},
+        {"/contigs/offset",
+            H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE,
+            self->contigs.num_records, self->contigs.offset, false},
+        {"/contigs/node_offset",
+            H5T_STD_U32LE, H5T_NATIVE_UINT32,
+            self->contigs.num_records, self->contigs.node_offset, false},
     };
     size_t num_fields = sizeof(fields) / sizeof(struct _hdf5_field_write);
     struct _hdf5_group_write {
@@ -1266,9 +2769,18 @@ tree_sequence_write_hdf5_data(tree_sequence_t *self, hid_t file_id, int flags)
         {"/trees/nodes", 1},
         {"/trees/records", 1},
         {"/trees/indexes", 1},
+        {"/contigs", 1},
     };
     size_t num_groups = sizeof(groups) / sizeof(struct _hdf5_group_write);
     size_t j;
+    codec_chunk_t *chunks = NULL;
+    size_t num_chunks = 0;
+    size_t max_chunks = 0;
+#ifdef MSP_HDF5_DIRECT_CHUNKS
+    size_t k, chunk;
+    hsize_t offset[1];
+    htri_t equal;
+#endif
     /* We need to use separate types for storage and memory here because
      * we seem to get a memory leak in HDF5 otherwise.*/
     hid_t filetype_str = -1;
@@ -1293,10 +2805,43 @@ tree_sequence_write_hdf5_data(tree_sequence_t *self, hid_t file_id, int flags)
     fields[0].storage_type = filetype_str;
     fields[0].memory_type = memtype_str;
 
+#ifdef MSP_HDF5_DIRECT_CHUNKS
+    if (flags & MSP_ZLIB_COMPRESSION) {
+        /* Encode the chunks of all the numeric columns up front, in
+         * parallel. We can only write them directly if the storage type
+         * is the same as the memory type. */
+        for (j = 1; j < num_fields; j++) {
+            equal = H5Tequal(fields[j].storage_type, fields[j].memory_type);
+            if (equal < 0) {
+                goto out;
+            }
+            fields[j].direct = equal && fields[j].size > 0;
+            if (fields[j].direct) {
+                status = tree_sequence_append_hdf5_chunks(&chunks, &num_chunks,
+                        &max_chunks, fields[j].source,
+                        H5Tget_size(fields[j].memory_type), fields[j].size);
+                if (status != 0) {
+                    goto out;
+                }
+            }
+        }
+        status = codec_run(chunks, num_chunks, codec_encode_chunk,
+                codec_get_num_threads());
+        if (status != 0) {
+            goto out;
+        }
+    }
+    chunk = 0;
+#endif
+
     /* We only create the mutations group if it's non-empty */
     if (self->mutations.num_records == 0) {
         groups[0].included = 0;
     }
+    /* The contigs group only exists for joined tree sequences */
+    if (self->contigs.num_records == 0) {
+        groups[5].included = 0;
+    }
     /* Create the groups */
     for (j = 0; j < num_groups; j++) {
         if (groups[j].included) {
@@ -1324,14 +2869,20 @@ tree_sequence_write_hdf5_data(tree_sequence_t *self, hid_t file_id, int flags)
                 goto out;
             }
             /* Set the chunk size to the full size of the dataset since we
-             * always read the full thing.
+             * always read the full thing. Columns we encode ourselves are
+             * split into smaller chunks so they can be encoded in parallel.
              */
-            status = H5Pset_chunk(plist_id, 1, dims);
+            chunk_dims[0] = dims[0];
+            if (fields[j].direct) {
+                chunk_dims[0] = GSL_MIN(dims[0], MSP_HDF5_CHUNK_ITEMS);
+            }
+            status = H5Pset_chunk(plist_id, 1, chunk_dims);
             if (status < 0) {
                 goto out;
             }
             if (fields[j].memory_type != H5T_NATIVE_DOUBLE &&
-                    fields[j].memory_type != memtype_str) {
+                    fields[j].memory_type != memtype_str &&
+                    !fields[j].direct) {
                 /* For integer types, use the scale offset compression */
                 status = H5Pset_scaleoffset(plist_id, H5Z_SO_INT,
                          H5Z_SO_INT_MINBITS_DEFAULT);
@@ -1362,7 +2913,19 @@ tree_sequence_write_hdf5_data(tree_sequence_t *self, hid_t file_id, int flags)
             if (dataset_id < 0) {
                 goto out;
             }
-            if (fields[j].size > 0) {
+            if (fields[j].direct) {
+#ifdef MSP_HDF5_DIRECT_CHUNKS
+                for (k = 0; k * chunk_dims[0] < dims[0]; k++) {
+                    offset[0] = k * chunk_dims[0];
+                    status = H5Dwrite_chunk(dataset_id, H5P_DEFAULT, 0, offset,
+                            chunks[chunk].encoded_size, chunks[chunk].encoded);
+                    if (status < 0) {
+                        goto out;
+                    }
+                    chunk++;
+                }
+#endif
+            } else if (fields[j].size > 0) {
                 /* Don't write zero sized datasets to work-around problems
                  * with older versions of hdf5. */
                 status = H5Dwrite(dataset_id, fields[j].memory_type, H5S_ALL,
@@ -1387,6 +2950,12 @@ tree_sequence_write_hdf5_data(tree_sequence_t *self, hid_t file_id, int flags)
     }
     ret = 0;
 out:
+    for (j = 0; j < num_chunks; j++) {
+        codec_chunk_free(&chunks[j]);
+    }
+    if (chunks != NULL) {
+        free(chunks);
+    }
     if (filetype_str != -1) {
         status = H5Tclose(filetype_str);
         if (status < 0) {
@@ -1469,10 +3038,29 @@ tree_sequence_write_hdf5_metadata(tree_sequence_t *self, hid_t file_id)
 int WARN_UNUSED
 tree_sequence_dump(tree_sequence_t *self, const char *filename, int flags)
 {
-    int ret = MSP_ERR_HDF5;
+    int ret;
     herr_t status;
     hid_t file_id = -1;
 
+    ret = tree_sequence_load_columns(self, MSP_COLUMNS_ALL);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = MSP_ERR_HDF5;
+    if (flags & MSP_NATIVE_FORMAT) {
+        if (flags & MSP_ZLIB_COMPRESSION) {
+            ret = MSP_ERR_BAD_PARAM_VALUE;
+        } else {
+            ret = tree_sequence_dump_native(self, filename, flags);
+        }
+        goto out;
+    }
+    /* HDF5 files keep plain integer columns that any HDF5 reader can
+     * interpret; their scale-offset filter already bit packs them. */
+    if (flags & MSP_VARINT_ENCODING) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
     file_id = H5Fcreate(filename, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
     if (file_id < 0) {
         goto out;
@@ -1523,6 +3111,10 @@ tree_sequence_get_sample(tree_sequence_t *self, uint32_t u, sample_t *sample)
         ret = MSP_ERR_OUT_OF_BOUNDS;
         goto out;
     }
+    ret = tree_sequence_load_columns(self, MSP_COLUMNS_NODES);
+    if (ret != 0) {
+        goto out;
+    }
     sample->population_id = self->trees.nodes.population[u];
     sample->time = self->trees.nodes.time[u];
 out:
@@ -1542,6 +3134,10 @@ tree_sequence_get_pairwise_diversity(tree_sequence_t *self,
         ret = MSP_ERR_BAD_PARAM_VALUE;
         goto out;
     }
+    ret = tree_sequence_load_columns(self, MSP_COLUMNS_MUTATIONS);
+    if (ret != 0) {
+        goto out;
+    }
     tree = malloc(sizeof(sparse_tree_t));
     if (tree == NULL) {
         ret = MSP_ERR_NO_MEMORY;
@@ -1612,6 +3208,10 @@ tree_sequence_get_coalescence_record(tree_sequence_t *self, size_t index,
         ret = MSP_ERR_OUT_OF_BOUNDS;
         goto out;
     }
+    ret = tree_sequence_load_columns(self, MSP_COLUMNS_RECORDS);
+    if (ret != 0) {
+        goto out;
+    }
     switch (order) {
         case MSP_ORDER_TIME:
             j = index;
@@ -1660,8 +3260,37 @@ out:
 int WARN_UNUSED
 tree_sequence_get_mutations(tree_sequence_t *self, mutation_t **mutations)
 {
+    int ret = tree_sequence_load_columns(self, MSP_COLUMNS_MUTATIONS);
+
+    if (ret != 0) {
+        goto out;
+    }
     *mutations = self->mutations.tree_mutations_mem;
-    return 0;
+out:
+    return ret;
+}
+
+size_t
+tree_sequence_get_num_contigs(tree_sequence_t *self)
+{
+    return self->contigs.num_records;
+}
+
+/* Returns the offset table for a joined tree sequence. The arrays have
+ * tree_sequence_get_num_contigs entries, and are NULL if there are none. */
+int WARN_UNUSED
+tree_sequence_get_contigs(tree_sequence_t *self, double **offset,
+        uint32_t **node_offset)
+{
+    int ret = tree_sequence_load_columns(self, MSP_COLUMNS_RECORDS);
+
+    if (ret != 0) {
+        goto out;
+    }
+    *offset = self->contigs.offset;
+    *node_offset = self->contigs.node_offset;
+out:
+    return ret;
 }
 
 int WARN_UNUSED
@@ -1674,6 +3303,11 @@ tree_sequence_set_samples(tree_sequence_t *self, size_t sample_size,
     if (sample_size != self->sample_size) {
         goto out;
     }
+    ret = tree_sequence_load_columns(self, MSP_COLUMNS_NODES);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = MSP_ERR_BAD_SAMPLES;
     for (j = 0; j < self->sample_size; j++) {
         self->trees.nodes.population[j] = samples[j].population_id;
         if (samples[j].time < 0) {
@@ -1699,16 +3333,14 @@ tree_sequence_set_mutations(tree_sequence_t *self, size_t num_mutations,
         ret = MSP_ERR_REFCOUNT_NONZERO;
         goto out;
     }
+    /* Mutations that have not been read yet are simply replaced */
+    self->lazy_columns &= ~MSP_COLUMNS_MUTATIONS;
     if (self->mutations.num_records > 0) {
         /* any mutations that were there previously are overwritten. */
-        if (self->mutations.node != NULL) {
-            free(self->mutations.node);
-            self->mutations.node = NULL;
-        }
-        if (self->mutations.position != NULL) {
-            free(self->mutations.position);
-            self->mutations.position = NULL;
-        }
+        tree_sequence_free_column(self, self->mutations.node);
+        self->mutations.node = NULL;
+        tree_sequence_free_column(self, self->mutations.position);
+        self->mutations.position = NULL;
         if (self->mutations.tree_mutations_mem != NULL) {
             free(self->mutations.tree_mutations_mem);
             self->mutations.tree_mutations_mem = NULL;
@@ -1837,8 +3469,7 @@ tree_sequence_simplify(tree_sequence_t *self, uint32_t *samples,
     active_record_t *active_records = NULL;
     coalescence_record_t *output_records = NULL;
     mutation_t *output_mutations = NULL;
-    uint32_t *I = self->trees.indexes.insertion_order;
-    uint32_t *O = self->trees.indexes.removal_order;
+    uint32_t *I, *O;
     size_t M = self->trees.num_records;
     size_t j, k, h, next_avl_node, mapped_children_mem_offset, num_output_records,
            num_output_mutations, max_num_child_nodes, max_num_records;
@@ -1858,6 +3489,12 @@ tree_sequence_simplify(tree_sequence_t *self, uint32_t *samples,
         ret = MSP_ERR_BAD_PARAM_VALUE;
         goto out;
     }
+    ret = tree_sequence_load_columns(self, MSP_COLUMNS_ALL);
+    if (ret != 0) {
+        goto out;
+    }
+    I = self->trees.indexes.insertion_order;
+    O = self->trees.indexes.removal_order;
     parent = malloc(self->num_nodes * sizeof(uint32_t));
     children = malloc(self->num_nodes * sizeof(uint32_t *));
     num_children = malloc(self->num_nodes * sizeof(uint32_t));
@@ -2177,6 +3814,10 @@ tree_diff_iterator_alloc(tree_diff_iterator_t *self,
 
     assert(tree_sequence != NULL);
     memset(self, 0, sizeof(tree_diff_iterator_t));
+    ret = tree_sequence_load_columns(tree_sequence, MSP_COLUMNS_RECORDS);
+    if (ret != 0) {
+        goto out;
+    }
     self->sample_size = tree_sequence_get_sample_size(tree_sequence);
     self->num_nodes = tree_sequence_get_num_nodes(tree_sequence);
     self->num_records = tree_sequence_get_num_coalescence_records(tree_sequence);
@@ -2342,6 +3983,12 @@ sparse_tree_alloc(sparse_tree_t *self, tree_sequence_t *tree_sequence, int flags
         ret = MSP_ERR_BAD_PARAM_VALUE;
         goto out;
     }
+    /* The mutations are only read when they are first asked for. */
+    ret = tree_sequence_load_columns(tree_sequence, MSP_COLUMNS_RECORDS);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = MSP_ERR_NO_MEMORY;
     num_nodes = tree_sequence->num_nodes;
     sample_size = tree_sequence->sample_size;
     self->num_nodes = (uint32_t) num_nodes;
@@ -2824,9 +4471,24 @@ int WARN_UNUSED
 sparse_tree_get_mutations(sparse_tree_t *self, size_t *num_mutations,
         mutation_t **mutations)
 {
+    int ret = 0;
+    tree_sequence_t *s = self->tree_sequence;
+
+    if (s->lazy_columns & MSP_COLUMNS_MUTATIONS) {
+        ret = tree_sequence_load_columns(s, MSP_COLUMNS_MUTATIONS);
+        if (ret != 0) {
+            goto out;
+        }
+        if (s->mutations.num_records > 0
+                && self->index < tree_sequence_get_num_trees(s)) {
+            self->mutations = s->mutations.tree_mutations[self->index];
+            self->num_mutations = s->mutations.num_tree_mutations[self->index];
+        }
+    }
     *mutations = self->mutations;
     *num_mutations = self->num_mutations;
-    return 0;
+out:
+    return ret;
 }
 
 static void
@@ -3080,7 +4742,7 @@ sparse_tree_advance(sparse_tree_t *self, int direction,
     self->index = (uint32_t) ((int) self->index + direction);
     *out_index = (size_t) out;
     *in_index = (size_t) in;
-    if (s->mutations.num_records > 0) {
+    if (s->mutations.num_records > 0 && s->mutations.tree_mutations != NULL) {
         self->mutations = s->mutations.tree_mutations[self->index];
         self->num_mutations = s->mutations.num_tree_mutations[self->index];
     }
@@ -3178,3 +4840,275 @@ sparse_tree_prev(sparse_tree_t *self)
     }
     return ret;
 }
+
+/* Builds the snapshots of the records in every interval'th tree by
+ * sweeping once along the sequence. The interval is chosen so that the
+ * snapshots take about as much space as the records themselves: a tree
+ * has fewer than sample_size records, and about num_records / num_trees
+ * records change between adjacent trees, so restoring a snapshot costs
+ * about as much as advancing through the trees up to the next one.
+ *
+ * Seeking builds the snapshots when they are first needed, which writes to
+ * the tree sequence. Callers that seek from several threads at once must
+ * build them first, in the same way as the columns of a lazily loaded tree
+ * sequence must be loaded first.
+ */
+int WARN_UNUSED
+tree_sequence_build_snapshots(tree_sequence_t *self)
+{
+    int ret = MSP_ERR_NO_MEMORY;
+    size_t R = self->trees.num_records;
+    size_t T = tree_sequence_get_num_trees(self);
+    size_t j, k, t, num_active, interval, num_snapshots, size, max_size;
+    uint32_t *left, *right, *I, *O;
+    uint32_t *active = NULL;
+    uint32_t *position = NULL;
+    uint32_t *records = NULL;
+    uint32_t *tmp;
+    size_t *offset = NULL;
+
+    if (self->trees.snapshots.offset != NULL) {
+        ret = 0;
+        goto out;
+    }
+    ret = tree_sequence_load_columns(self, MSP_COLUMNS_RECORDS);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = MSP_ERR_NO_MEMORY;
+    left = self->trees.records.left;
+    right = self->trees.records.right;
+    I = self->trees.indexes.insertion_order;
+    O = self->trees.indexes.removal_order;
+    interval = GSL_MAX(1, (self->sample_size * T) / GSL_MAX(1, R));
+    num_snapshots = (T + interval - 1) / interval;
+    active = malloc((R + 1) * sizeof(uint32_t));
+    position = malloc((R + 1) * sizeof(uint32_t));
+    offset = malloc((num_snapshots + 1) * sizeof(size_t));
+    max_size = R + 1;
+    records = malloc(max_size * sizeof(uint32_t));
+    if (active == NULL || position == NULL || offset == NULL
+            || records == NULL) {
+        goto out;
+    }
+    num_active = 0;
+    size = 0;
+    j = 0;
+    k = 0;
+    for (t = 0; t < T; t++) {
+        /* Records are swapped out of the active set in constant time */
+        while (k < R && right[O[k]] == t) {
+            num_active--;
+            active[position[O[k]]] = active[num_active];
+            position[active[num_active]] = position[O[k]];
+            k++;
+        }
+        while (j < R && left[I[j]] == t) {
+            active[num_active] = I[j];
+            position[I[j]] = (uint32_t) num_active;
+            num_active++;
+            j++;
+        }
+        if (t % interval == 0) {
+            if (size + num_active > max_size) {
+                max_size = GSL_MAX(2 * max_size, size + num_active);
+                tmp = realloc(records, max_size * sizeof(uint32_t));
+                if (tmp == NULL) {
+                    goto out;
+                }
+                records = tmp;
+            }
+            offset[t / interval] = size;
+            memcpy(records + size, active, num_active * sizeof(uint32_t));
+            /* Records are sorted by time, so sorting them by index lets
+             * them be inserted children first. */
+            qsort(records + size, num_active, sizeof(uint32_t), cmp_uint32_t);
+            size += num_active;
+        }
+    }
+    offset[num_snapshots] = size;
+    self->trees.snapshots.interval = interval;
+    self->trees.snapshots.num_snapshots = num_snapshots;
+    self->trees.snapshots.offset = offset;
+    self->trees.snapshots.records = records;
+    offset = NULL;
+    records = NULL;
+    ret = 0;
+out:
+    if (active != NULL) {
+        free(active);
+    }
+    if (position != NULL) {
+        free(position);
+    }
+    if (offset != NULL) {
+        free(offset);
+    }
+    if (records != NULL) {
+        free(records);
+    }
+    return ret;
+}
+
+/* Returns the number of elements of the sorted array that are less than
+ * or equal to the specified value. */
+static size_t
+sparse_tree_count_less_equal(uint32_t *values, uint32_t *order, size_t n,
+        uint32_t value)
+{
+    size_t low = 0;
+    size_t high = n;
+    size_t mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (values[order[mid]] <= value) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/* Sets the tree to the specified snapshot, leaving it in the same state
+ * as if it had been reached by calling sparse_tree_next() repeatedly.
+ */
+static int WARN_UNUSED
+sparse_tree_restore_snapshot(sparse_tree_t *self, size_t snapshot)
+{
+    int ret;
+    tree_sequence_t *s = self->tree_sequence;
+    size_t R = s->trees.num_records;
+    size_t j, index;
+    uint32_t k, c, u;
+
+    ret = sparse_tree_clear(self);
+    if (ret != 0) {
+        goto out;
+    }
+    index = snapshot * s->trees.snapshots.interval;
+    for (j = s->trees.snapshots.offset[snapshot];
+            j < s->trees.snapshots.offset[snapshot + 1]; j++) {
+        k = s->trees.snapshots.records[j];
+        u = s->trees.records.node[k];
+        for (c = 0; c < s->trees.records.num_children[k]; c++) {
+            self->parent[s->trees.records.children[k][c]] = u;
+        }
+        self->num_children[u] = s->trees.records.num_children[k];
+        self->children[u] = s->trees.records.children[k];
+        self->time[u] = s->trees.nodes.time[u];
+        self->population[u] = s->trees.nodes.population[u];
+        if (self->time[u] > self->time[self->root]) {
+            self->root = u;
+        }
+        if (self->flags & MSP_LEAF_COUNTS) {
+            sparse_tree_propagate_leaf_count_gain(self, u);
+        }
+        if (self->flags & MSP_LEAF_LISTS) {
+            sparse_tree_update_leaf_lists(self, u);
+        }
+    }
+    while (self->parent[self->root] != MSP_NULL_NODE) {
+        self->root = self->parent[self->root];
+    }
+    /* All records starting at or before this tree have been inserted, and
+     * all those ending at or before it removed. */
+    self->left_index = sparse_tree_count_less_equal(s->trees.records.left,
+            s->trees.indexes.insertion_order, R, (uint32_t) index);
+    self->right_index = sparse_tree_count_less_equal(s->trees.records.right,
+            s->trees.indexes.removal_order, R, (uint32_t) index);
+    self->direction = MSP_DIR_FORWARD;
+    self->index = index;
+    if (s->mutations.num_records > 0 && s->mutations.tree_mutations != NULL) {
+        self->mutations = s->mutations.tree_mutations[index];
+        self->num_mutations = s->mutations.num_tree_mutations[index];
+    }
+    self->left_breakpoint = (uint32_t) index;
+    self->right_breakpoint = (uint32_t) index + 1;
+    self->left = s->trees.breakpoints[self->left_breakpoint];
+    self->right = s->trees.breakpoints[self->right_breakpoint];
+out:
+    return ret;
+}
+
+/* Positions the tree at the tree with the specified index. If this is
+ * close to the current tree we move there directly, and otherwise start
+ * from the nearest preceding snapshot, building the snapshots first if
+ * necessary. Returns 1 on success, like sparse_tree_first().
+ */
+int WARN_UNUSED
+sparse_tree_seek_index(sparse_tree_t *self, size_t index)
+{
+    int ret = 0;
+    tree_sequence_t *s = self->tree_sequence;
+    size_t num_trees = tree_sequence_get_num_trees(s);
+    size_t interval;
+
+    if (index >= num_trees) {
+        ret = MSP_ERR_OUT_OF_BOUNDS;
+        goto out;
+    }
+    ret = tree_sequence_build_snapshots(s);
+    if (ret != 0) {
+        goto out;
+    }
+    interval = s->trees.snapshots.interval;
+    /* The index is (size_t) -1 if the tree has not been positioned yet */
+    if (self->index < num_trees && self->index <= index
+            && index - self->index < interval) {
+        /* Move forward from the current tree */
+    } else if (self->index < num_trees && self->index > index
+            && self->index - index < index % interval) {
+        /* The current tree is closer than the preceding snapshot */
+        while (self->index > index) {
+            ret = sparse_tree_prev(self);
+            if (ret < 0) {
+                goto out;
+            }
+        }
+    } else {
+        ret = sparse_tree_restore_snapshot(self, index / interval);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    while (self->index < index) {
+        ret = sparse_tree_next(self);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+    ret = 1;
+out:
+    return ret;
+}
+
+/* Positions the tree at the tree covering the specified coordinate. */
+int WARN_UNUSED
+sparse_tree_seek(sparse_tree_t *self, double position)
+{
+    int ret = 0;
+    tree_sequence_t *s = self->tree_sequence;
+    double *breakpoints = s->trees.breakpoints;
+    size_t low = 0;
+    size_t high = tree_sequence_get_num_trees(s);
+    size_t mid;
+
+    if (position < 0 || position >= s->sequence_length) {
+        ret = MSP_ERR_OUT_OF_BOUNDS;
+        goto out;
+    }
+    /* Find the last tree whose left coordinate is <= position */
+    while (high - low > 1) {
+        mid = low + (high - low) / 2;
+        if (breakpoints[mid] <= position) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    ret = sparse_tree_seek_index(self, low);
+out:
+    return ret;
+}
@@ -24,6 +24,7 @@ from __future__ import print_function
 
 import argparse
 import hashlib
+import io
 import os
 import random
 import signal
@@ -125,7 +126,7 @@ class SimulationRunner(object):
             num_replicates=1, migration_matrix=None,
             population_configurations=None, demographic_events=None,
             scaled_mutation_rate=0, print_trees=False,
-            precision=3, random_seeds=None):
+            precision=3, random_seeds=None, num_threads=None):
         self._sample_size = sample_size
         self._num_loci = num_loci
         self._num_replicates = num_replicates
@@ -142,19 +143,22 @@ class SimulationRunner(object):
         sample_size = self._sample_size
         if population_configurations is not None:
             sample_size = None
-        self._simulator = msprime.simulator_factory(
+        self._simulator_args = dict(
             sample_size=sample_size,
             recombination_map=recomb_map,
             population_configurations=population_configurations,
             migration_matrix=migration_matrix,
             demographic_events=demographic_events)
+        self._simulator = msprime.simulator_factory(**self._simulator_args)
         self._precision = precision
         self._print_trees = print_trees
+        self._num_threads = num_threads
         # sort out the random seeds
         ms_seeds = random_seeds
         if random_seeds is None:
             ms_seeds = generate_seeds()
         seed = get_single_seed(ms_seeds)
+        self._seed = seed
         self._random_generator = msprime.RandomGenerator(seed)
         self._ms_random_seeds = ms_seeds
         self._simulator.set_random_generator(self._random_generator)
@@ -178,6 +182,49 @@ class SimulationRunner(object):
         """
         return self._mutation_rate
 
+    def _write_replicate(self, simulator, random_generator, output):
+        """
+        Writes the output for the replicate that has just been simulated
+        by the specified simulator.
+        """
+        tree_sequence = simulator.get_tree_sequence()
+        breakpoints = simulator.get_breakpoints()
+        print(file=output)
+        print("//", file=output)
+        if self._print_trees:
+            iterator = tree_sequence.newick_trees(
+                self._precision, breakpoints, 1)
+            if self._num_loci == 1:
+                for l, ns in iterator:
+                    print(ns, file=output)
+            else:
+                for l, ns in iterator:
+                    # Print these seperately to avoid the cost of creating
+                    # another string.
+                    print("[{0}]".format(int(l)), end="", file=output)
+                    print(ns, file=output)
+        if self._mutation_rate > 0:
+            tree_sequence.generate_mutations(
+                self._mutation_rate, random_generator)
+            hg = msprime.HaplotypeGenerator(tree_sequence)
+            s = tree_sequence.get_num_mutations()
+            print("segsites:", s, file=output)
+            if s != 0:
+                print("positions: ", end="", file=output)
+                positions = [
+                    mutation.position / self._num_loci for mutation in
+                    tree_sequence.mutations()]
+                positions.sort()
+                for position in positions:
+                    print(
+                        "{0:.{1}f}".format(position, self._precision),
+                        end=" ", file=output)
+                print(file=output)
+                for h in hg.haplotypes():
+                    print(h, file=output)
+            else:
+                print(file=output)
+
     def run(self, output):
         """
         Runs the simulations and writes the output to the specified
@@ -186,46 +233,37 @@ class SimulationRunner(object):
         # The first line of ms's output is the command line.
         print(" ".join(sys.argv), file=output)
         print(" ".join(str(s) for s in self._ms_random_seeds), file=output)
-        for j in range(self._num_replicates):
-            self._simulator.run()
-            tree_sequence = self._simulator.get_tree_sequence()
-            breakpoints = self._simulator.get_breakpoints()
-            print(file=output)
-            print("//", file=output)
-            if self._print_trees:
-                iterator = tree_sequence.newick_trees(
-                    self._precision, breakpoints, 1)
-                if self._num_loci == 1:
-                    for l, ns in iterator:
-                        print(ns, file=output)
-                else:
-                    for l, ns in iterator:
-                        # Print these seperately to avoid the cost of creating
-                        # another string.
-                        print("[{0}]".format(int(l)), end="", file=output)
-                        print(ns, file=output)
-            if self._mutation_rate > 0:
-                tree_sequence.generate_mutations(
-                    self._mutation_rate, self._random_generator)
-                hg = msprime.HaplotypeGenerator(tree_sequence)
-                s = tree_sequence.get_num_mutations()
-                print("segsites:", s, file=output)
-                if s != 0:
-                    print("positions: ", end="", file=output)
-                    positions = [
-                        mutation.position / self._num_loci for mutation in
-                        tree_sequence.mutations()]
-                    positions.sort()
-                    for position in positions:
-                        print(
-                            "{0:.{1}f}".format(position, self._precision),
-                            end=" ", file=output)
-                    print(file=output)
-                    for h in hg.haplotypes():
-                        print(h, file=output)
-                else:
-                    print(file=output)
-            self._simulator.reset()
+        if self._num_threads is None:
+            for j in range(self._num_replicates):
+                self._simulator.run()
+                self._write_replicate(
+                    self._simulator, self._random_generator, output)
+                self._simulator.reset()
+        else:
+            workers = []
+            for _ in range(self._num_threads):
+                rng = msprime.RandomGenerator(self._seed, algorithm="philox")
+                workers.append((
+                    msprime.simulator_factory(
+                        random_generator=rng, **self._simulator_args),
+                    rng))
+            iterator = msprime.trees._parallel_replicate_generator(
+                workers, self._num_replicates, self._run_replicate)
+            for replicate_output in iterator:
+                output.write(replicate_output)
+
+    def _run_replicate(self, worker, j):
+        """
+        Simulates the specified replicate using the specified worker's
+        simulator and returns its output as a string.
+        """
+        simulator, random_generator = worker
+        random_generator.set_stream(j)
+        simulator.run()
+        output = io.StringIO() if sys.version_info[0] == 3 else io.BytesIO()
+        self._write_replicate(simulator, random_generator, output)
+        simulator.reset()
+        return output.getvalue()
 
 
 def convert_int(value, parser):
@@ -536,7 +574,8 @@ def create_simulation_runner(parser, arg_list):
         scaled_mutation_rate=mu,
         precision=args.precision,
         print_trees=args.trees,
-        random_seeds=args.random_seeds)
+        random_seeds=args.random_seeds,
+        num_threads=args.threads)
     return runner
 
 
@@ -714,6 +753,13 @@ def get_mspms_parser(error_handler=None):
     group.add_argument(
         "--precision", "-p", type=positive_int, default=3,
         help="Number of values after decimal place to print")
+    group.add_argument(
+        "--threads", type=positive_int, default=None,
+        help=(
+            "Simulate replicates concurrently using the specified number "
+            "of threads. Each replicate uses its own random stream, so the "
+            "output is the same for any number of threads, but differs "
+            "from the output without this option."))
 
     # now for the parser that gets called first
     init_parser = argparse.ArgumentParser(
@@ -28,6 +28,7 @@ import json
 import math
 import random
 import sys
+import threading
 
 try:
     import svgwrite
@@ -713,6 +714,70 @@ def _replicate_generator(
         sim.reset()
 
 
+def _parallel_replicate_generator(workers, num_replicates, func):
+    """
+    Generator function that computes func(worker, j) for each replicate j
+    using a separate thread for each of the specified workers, and yields
+    the results in replicate order. Replicates are started at most two per
+    worker ahead of the consumer, so that a slow consumer does not cause
+    results to accumulate without bound.
+    """
+    condition = threading.Condition()
+    results = {}
+    # Python 2 has no nonlocal, so the shared state is kept in a dict.
+    state = {"next": 0, "consumed": 0, "error": None, "closed": False}
+    window = 2 * len(workers)
+
+    def run(worker):
+        while True:
+            with condition:
+                while (
+                        not state["closed"] and state["error"] is None and
+                        state["next"] - state["consumed"] >= window):
+                    condition.wait()
+                if (
+                        state["closed"] or state["error"] is not None or
+                        state["next"] >= num_replicates):
+                    return
+                j = state["next"]
+                state["next"] += 1
+            try:
+                result = func(worker, j)
+            except Exception as e:
+                with condition:
+                    state["error"] = e
+                    condition.notify_all()
+                return
+            with condition:
+                results[j] = result
+                condition.notify_all()
+
+    threads = [threading.Thread(target=run, args=(w,)) for w in workers]
+    for thread in threads:
+        thread.daemon = True
+        thread.start()
+    try:
+        # Should use range here, but Python 2 makes this awkward...
+        j = 0
+        while j < num_replicates:
+            with condition:
+                while j not in results and state["error"] is None:
+                    condition.wait()
+                if state["error"] is not None:
+                    raise state["error"]
+                result = results.pop(j)
+                state["consumed"] = j + 1
+                condition.notify_all()
+            yield result
+            j += 1
+    finally:
+        with condition:
+            state["closed"] = True
+            condition.notify_all()
+        for thread in threads:
+            thread.join()
+
+
 def simulator_factory(
         sample_size=None,
         Ne=1,
@@ -814,7 +879,8 @@ def simulate(
         model=None,
         record_migrations=False,
         random_seed=None,
-        num_replicates=None):
+        num_replicates=None,
+        num_threads=None):
     """
     Simulates the coalescent with recombination under the specified model
     parameters and returns the resulting :class:`.TreeSequence`.
@@ -877,6 +943,14 @@ def simulate(
         returned. If :obj:`num_replicates` is provided, the specified
         number of replicates is performed, and an iterator over the
         resulting :class:`.TreeSequence` objects returned.
+    :param int num_threads: The number of threads to use when simulating
+        replicates. If this is specified, ``num_replicates`` must also be
+        given, and the replicates are simulated concurrently. Replicate
+        ``j`` is then simulated using stream ``j`` of a counter-based
+        generator keyed by ``random_seed``, so that the results depend
+        only on ``random_seed`` and not on the number of threads.
+        Replicates are returned in order. Defaults to None, in which case
+        replicates are simulated one after another in the calling thread.
     :return: The :class:`.TreeSequence` object representing the results
         of the simulation if no replication is performed, or an
         iterator over the independent replicates simulated if the
@@ -891,9 +965,13 @@ def simulate(
     seed = random_seed
     if random_seed is None:
         seed = _get_random_seed()
-    rng = RandomGenerator(seed)
-    sim = simulator_factory(
-        sample_size=sample_size, random_generator=rng,
+    if num_threads is not None:
+        if num_replicates is None:
+            raise ValueError("num_threads requires num_replicates")
+        if num_threads < 1:
+            raise ValueError("num_threads must be >= 1")
+    simulator_args = dict(
+        sample_size=sample_size,
         Ne=Ne, length=length,
         recombination_rate=recombination_rate,
         recombination_map=recombination_map,
@@ -901,12 +979,36 @@ def simulate(
         migration_matrix=migration_matrix,
         demographic_events=demographic_events,
         samples=samples, model=model, record_migrations=record_migrations)
+    rng = RandomGenerator(seed)
+    sim = simulator_factory(random_generator=rng, **simulator_args)
     # The provenance API is very tentative, and only included now as a
     # pre-alpha feature.
     parameters = {"TODO": "encode simulation parameters"}
     provenance = get_provenance_dict("simulate", parameters)
     mu = 0 if mutation_rate is None else mutation_rate
-    if num_replicates is None:
+    if num_threads is not None:
+        workers = []
+        for _ in range(num_threads):
+            worker_rng = RandomGenerator(seed, algorithm="philox")
+            workers.append((
+                simulator_factory(
+                    random_generator=worker_rng, **simulator_args),
+                worker_rng))
+        provenance_string = json.dumps(provenance)
+
+        def simulate_replicate(worker, j):
+            worker_sim, worker_rng = worker
+            worker_rng.set_stream(j)
+            worker_sim.run()
+            tree_sequence = worker_sim.get_tree_sequence()
+            tree_sequence.generate_mutations(mu, worker_rng)
+            tree_sequence.add_provenance(provenance_string)
+            worker_sim.reset()
+            return tree_sequence
+
+        return _parallel_replicate_generator(
+            workers, num_replicates, simulate_replicate)
+    elif num_replicates is None:
         sim.run()
         tree_sequence = sim.get_tree_sequence()
         tree_sequence.generate_mutations(mu, rng)
@@ -916,19 +1018,23 @@ def simulate(
         return _replicate_generator(sim, rng, mu, num_replicates, provenance)
 
 
-def load(path):
+def load(path, lazy=False):
     """
     Loads a tree sequence from the specified file path. This
-    file must be in the HDF5 file format produced by the
+    file must be in the HDF5 or native file format produced by the
     :meth:`.TreeSequence.dump` method.
 
     :param str path: The file path of the HDF5 file containing the
         tree sequence we wish to load.
+    :param bool lazy: If True, only read the parts of an HDF5 file
+        (the nodes, records, mutations and provenance) when they are
+        first needed. The file must not be changed or removed while the
+        tree sequence is in use.
     :return: The tree sequence object containing the information
         stored in the specified file path.
     :rtype: :class:`msprime.TreeSequence`
     """
-    return TreeSequence.load(path)
+    return TreeSequence.load(path, lazy)
 
 
 def load_txt(records_file, mutations_file=None):
@@ -1034,6 +1140,7 @@ class TreeSimulator(object):
         self._effective_population_size = 1
         self._population_configurations = [PopulationConfiguration()]
         self._migration_matrix = [[0]]
+        self._sparse_migration_matrix = None
         self._demographic_events = []
         self._store_migration_records = False
         # Set default block sizes to 64K objects.
@@ -1098,6 +1205,9 @@ class TreeSimulator(object):
     def get_migration_matrix(self):
         return self._migration_matrix
 
+    def get_sparse_migration_matrix(self):
+        return self._sparse_migration_matrix
+
     def get_num_loci(self):
         return self._recombination_map.get_num_loci()
 
@@ -1154,6 +1264,9 @@ class TreeSimulator(object):
     def get_num_segment_blocks(self):
         return self._ll_sim.get_num_segment_blocks()
 
+    def get_num_transient_allocations(self):
+        return self._ll_sim.get_num_transient_allocations()
+
     def get_num_common_ancestor_events(self):
         return self._ll_sim.get_num_common_ancestor_events()
 
@@ -1218,6 +1331,33 @@ class TreeSimulator(object):
             if len(row) != N:
                 raise ValueError(err)
         self._migration_matrix = migration_matrix
+        self._sparse_migration_matrix = None
+
+    def set_sparse_migration_matrix(self, entries):
+        """
+        Sets the migration matrix to the specified list of (j, k, rate)
+        tuples, where rate is the rate at which lineages move from population
+        j to population k backwards in time. Pairs of populations that are not
+        listed have a migration rate of zero. This avoids storing and scanning
+        all N x N entries for models with many populations, such as
+        stepping-stone models.
+        """
+        err = (
+            "sparse migration matrix must be a list of (j, k, rate) tuples "
+            "where 0 <= j, k < N, j != k and N is the number of populations "
+            "defined in the population_configurations.")
+        N = len(self._population_configurations)
+        if not isinstance(entries, list):
+            raise TypeError(err)
+        for entry in entries:
+            if not isinstance(entry, tuple):
+                raise TypeError(err)
+            if len(entry) != 3:
+                raise ValueError(err)
+            j, k, _ = entry
+            if not (0 <= j < N and 0 <= k < N) or j == k:
+                raise ValueError(err)
+        self._sparse_migration_matrix = entries
 
     def set_population_configurations(self, population_configurations):
         _check_population_configurations(population_configurations)
@@ -1225,6 +1365,7 @@ class TreeSimulator(object):
         # Now set the default migration matrix.
         N = len(self._population_configurations)
         self._migration_matrix = [[0 for j in range(N)] for k in range(N)]
+        self._sparse_migration_matrix = None
 
     def set_demographic_events(self, demographic_events):
         err = (
@@ -1257,12 +1398,19 @@ class TreeSimulator(object):
         # counterparts.
         d = len(self._population_configurations)
         Ne = self.get_effective_population_size()
-        # The migration matrix must be flattened.
-        scaled_migration_matrix = self.get_scaled_migration_matrix()
-        ll_migration_matrix = [0 for j in range(d**2)]
-        for j in range(d):
-            for k in range(d):
-                ll_migration_matrix[j * d + k] = scaled_migration_matrix[j][k]
+        if self._sparse_migration_matrix is not None:
+            migration_args = {"sparse_migration_matrix": [
+                (j, k, 4 * Ne * rate)
+                for j, k, rate in self._sparse_migration_matrix]}
+        else:
+            # The migration matrix must be flattened.
+            scaled_migration_matrix = self.get_scaled_migration_matrix()
+            ll_migration_matrix = [0 for j in range(d**2)]
+            for j in range(d):
+                for k in range(d):
+                    ll_migration_matrix[j * d + k] = (
+                        scaled_migration_matrix[j][k])
+            migration_args = {"migration_matrix": ll_migration_matrix}
         ll_population_configuration = [
             conf.get_ll_representation(Ne)
             for conf in self._population_configurations]
@@ -1275,7 +1423,6 @@ class TreeSimulator(object):
             samples=ll_samples,
             random_generator=self._random_generator,
             num_loci=self._recombination_map.get_num_loci(),
-            migration_matrix=ll_migration_matrix,
             population_configuration=ll_population_configuration,
             demographic_events=ll_demographic_events,
             model=self._model,
@@ -1286,7 +1433,8 @@ class TreeSimulator(object):
             avl_node_block_size=self._avl_node_block_size,
             node_mapping_block_size=self._node_mapping_block_size,
             coalescence_record_block_size=self._coalescence_record_block_size,
-            migration_record_block_size=self._migration_record_block_size)
+            migration_record_block_size=self._migration_record_block_size,
+            **migration_args)
         return ll_sim
 
     def run(self):
@@ -1302,11 +1450,14 @@ class TreeSimulator(object):
     def get_tree_sequence(self):
         """
         Returns a TreeSequence representing the state of the simulation.
+        The coalescence records are handed over to the tree sequence, so
+        the simulation must be reset and run again before another tree
+        sequence can be obtained.
         """
         ll_tree_sequence = _msprime.TreeSequence()
         ll_recomb_map = self._recombination_map.get_ll_recombination_map()
         Ne = self.get_effective_population_size()
-        ll_tree_sequence.create(self._ll_sim, ll_recomb_map, Ne)
+        ll_tree_sequence.create(self._ll_sim, ll_recomb_map, Ne, adopt=True)
         return TreeSequence(ll_tree_sequence)
 
     def reset(self):
@@ -1375,9 +1526,9 @@ class TreeSequence(object):
         return self._ll_tree_sequence
 
     @classmethod
-    def load(cls, path):
+    def load(cls, path, lazy=False):
         ts = _msprime.TreeSequence()
-        ts.load(path)
+        ts.load(path, lazy)
         return TreeSequence(ts)
 
     @classmethod
@@ -1452,7 +1603,9 @@ class TreeSequence(object):
                     j += 1
                     yield bp[j] - bp[j - 1], tree
 
-    def dump(self, path, zlib_compression=False):
+    def dump(
+            self, path, zlib_compression=False, native_format=False,
+            varint_encoding=False):
         """
         Writes the tree sequence to the specified file path.
 
@@ -1460,9 +1613,23 @@ class TreeSequence(object):
         :param bool zlib_compression: If True, use HDF5's native
             compression when storing the data leading to smaller
             file size. When loading, data will be decompressed
-            transparently, but load times will be significantly slower.
-        """
-        self._ll_tree_sequence.dump(path, zlib_compression)
+            transparently, but load times will be slower. Columns are
+            compressed and decompressed using all available cores.
+        :param bool native_format: If True, write the columns of the
+            tree sequence directly to the file rather than using HDF5.
+            Such files are loaded by memory mapping them, which is very
+            fast and allows processes to share a single copy of the
+            data, but they can only be read on machines with the same
+            byte order. Cannot be combined with ``zlib_compression``.
+        :param bool varint_encoding: If True, store the integer columns
+            of the coalescence records as variable length encoded
+            differences between successive values, which are typically
+            much smaller than the raw columns. Requires ``native_format``;
+            HDF5 files keep plain integer columns so that any HDF5 reader
+            can interpret them, and they are already bit packed.
+        """
+        self._ll_tree_sequence.dump(
+            path, zlib_compression, native_format, varint_encoding)
 
     @property
     def sample_size(self):
@@ -19,6 +19,7 @@
 from __future__ import division
 from __future__ import print_function
 
+import os
 import subprocess
 import platform
 
@@ -109,6 +110,10 @@ class DefineMacros(object):
             # Define the library version
             ("MSP_LIBRARY_VERSION_STR", '{}'.format(self._msprime_version)),
         ]
+        # Set MSP_PROFILE in the environment to compile in the simulator
+        # profiling returned by Simulator.get_profile.
+        if os.environ.get("MSP_PROFILE"):
+            l.append(("MSP_PROFILE", None))
         return l[index]
 
 
@@ -120,11 +125,14 @@ _msprime_module = Extension(
         "_msprimemodule.c", d + "msprime.c", d + "fenwick.c", d + "avl.c",
         d + "tree_sequence.c", d + "object_heap.c", d + "newick.c",
         d + "hapgen.c", d + "recomb_map.c", d + "mutgen.c",
-        d + "vargen.c", d + "vcf.c", d + "ld.c"],
+        d + "vargen.c", d + "vcf.c", d + "ld.c", d + "lineage_set.c",
+        d + "rate_tree.c", d + "migration_matrix.c", d + "btree.c",
+        d + "priority_queue.c", d + "scratch.c", d + "rng.c",
+        d + "radix_sort.c", d + "codec.c"],
     # Enable asserts by default.
     undef_macros=["NDEBUG"],
     define_macros=DefineMacros(),
-    libraries=["gsl", "gslcblas", "hdf5"],
+    libraries=["gsl", "gslcblas", "hdf5", "z"],
     include_dirs=[d] + configurator.include_dirs,
     library_dirs=configurator.library_dirs,
 )
@@ -247,6 +247,12 @@ class TestMspmsArgumentParser(unittest.TestCase):
         args = self.parse_args(["40", "20", "--trees"])
         self.assertEqual(args.trees, True)
 
+    def test_threads(self):
+        args = self.parse_args(["40", "20"])
+        self.assertEqual(args.threads, None)
+        args = self.parse_args(["40", "20", "--threads", "4"])
+        self.assertEqual(args.threads, 4)
+
     def test_size_changes(self):
         args = self.parse_args(["40", "20"])
         self.assertEqual(args.size_change, [])
@@ -914,7 +920,7 @@ class TestMspmsOutput(TestCli):
     def verify_output(
             self, sample_size=2, num_loci=1, recombination_rate=0,
             num_replicates=1, mutation_rate=0.0, print_trees=True,
-            precision=3, random_seeds=[1, 2, 3]):
+            precision=3, random_seeds=[1, 2, 3], num_threads=None):
         """
         Runs the UI for the specified parameters, and parses the output
         to ensure it's consistent.
@@ -927,7 +933,7 @@ class TestMspmsOutput(TestCli):
             scaled_recombination_rate=recombination_rate,
             num_replicates=num_replicates, scaled_mutation_rate=mutation_rate,
             print_trees=print_trees, precision=precision,
-            random_seeds=random_seeds)
+            random_seeds=random_seeds, num_threads=num_threads)
         with open(self.temp_file, "w+") as f:
             sr.run(f)
             f.seek(0)
@@ -1048,6 +1054,26 @@ class TestMspmsOutput(TestCli):
                 sample_size=n, num_loci=100, recombination_rate=10,
                 print_trees=True)
 
+    def test_threads(self):
+        for num_threads in [1, 2, 5]:
+            self.verify_output(
+                sample_size=10, mutation_rate=10, num_loci=10,
+                recombination_rate=10, num_replicates=7,
+                num_threads=num_threads)
+
+    def test_threads_deterministic(self):
+        outputs = []
+        for num_threads in [1, 3]:
+            sr = cli.SimulationRunner(
+                sample_size=10, num_loci=10, scaled_recombination_rate=10,
+                num_replicates=10, scaled_mutation_rate=10, print_trees=True,
+                random_seeds=[1, 2, 3], num_threads=num_threads)
+            with open(self.temp_file, "w+") as f:
+                sr.run(f)
+                f.seek(0)
+                outputs.append(f.read())
+        self.assertEqual(outputs[0], outputs[1])
+
     def test_seeds_output(self):
         self.verify_output(random_seeds=None)
         self.verify_output(random_seeds=[2, 3, 4])
@@ -224,7 +224,7 @@ class TestHdf5Format(TestHdf5):
         # Check the basic root attributes
         format_version = root.attrs['format_version']
         self.assertEqual(format_version[0], 3)
-        self.assertEqual(format_version[1], 2)
+        self.assertEqual(format_version[1], 3)
         keys = set(root.keys())
         self.assertLessEqual(keys, set(["mutations", "trees", "provenance"]))
         self.assertIn("trees", keys)
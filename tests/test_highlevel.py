@@ -592,8 +592,9 @@ class TestTreeSimulator(HighLevelTestCase):
         self.assertEqual(sim.get_num_breakpoints(), len(sim.get_breakpoints()))
         self.assertGreater(sim.get_used_memory(), 0)
         self.assertGreater(sim.get_time(), 0)
-        self.assertGreater(sim.get_num_avl_node_blocks(), 0)
+        self.assertEqual(sim.get_num_avl_node_blocks(), 0)
         self.assertGreater(sim.get_num_segment_blocks(), 0)
+        self.assertGreater(sim.get_num_transient_allocations(), 0)
         self.assertGreater(sim.get_num_node_mapping_blocks(), 0)
         self.assertGreater(sim.get_num_coalescence_record_blocks(), 0)
         self.assertGreater(sim.get_max_memory(), 0)
@@ -1709,6 +1710,32 @@ class TestSimulatorFactory(unittest.TestCase):
             hl_matrix[0] = []
             self.assertRaises(ValueError, f, hl_matrix)
 
+    def test_sparse_migration_matrix(self):
+        N = 10
+        pop_configs = [msprime.PopulationConfiguration(2) for _ in range(N)]
+        sim = msprime.simulator_factory(
+            population_configurations=pop_configs)
+        entries = [(j, (j + 1) % N, 0.5) for j in range(N)]
+        sim.set_sparse_migration_matrix(entries)
+        self.assertEqual(sim.get_sparse_migration_matrix(), entries)
+        ll_sim = sim.create_ll_instance()
+        Ne = sim.get_effective_population_size()
+        ll_matrix = [0 for _ in range(N * N)]
+        for j, k, rate in entries:
+            ll_matrix[j * N + k] = 4 * Ne * rate
+        self.assertEqual(ll_sim.get_migration_matrix(), ll_matrix)
+        for bad_type in ["", {}, 234, [None], [[0, 1, 1]]]:
+            self.assertRaises(
+                TypeError, sim.set_sparse_migration_matrix, bad_type)
+        for bad_value in [[(0, 1)], [(0, 0, 1)], [(0, N, 1)], [(-1, 0, 1)]]:
+            self.assertRaises(
+                ValueError, sim.set_sparse_migration_matrix, bad_value)
+        # Setting a dense matrix replaces the sparse one.
+        sim.set_migration_matrix([[0 for _ in range(N)] for _ in range(N)])
+        self.assertIsNone(sim.get_sparse_migration_matrix())
+        ll_sim = sim.create_ll_instance()
+        self.assertEqual(ll_sim.get_migration_matrix(), [0] * (N * N))
+
     def test_default_migration_matrix(self):
         sim = msprime.simulator_factory(10)
         ll_sim = sim.create_ll_instance()
@@ -518,11 +518,24 @@ class TestSimulationState(LowLevelTestCase):
         events += sim.get_num_recombination_events()
         events += sum(sim.get_num_migration_events())
         self.assertGreater(events, 0)
-        self.assertGreater(sim.get_num_avl_node_blocks(), 0)
+        self.assertEqual(sim.get_num_avl_node_blocks(), 0)
         self.assertGreater(sim.get_num_segment_blocks(), 0)
         self.assertGreater(sim.get_num_node_mapping_blocks(), 0)
         self.assertGreater(sim.get_num_coalescence_record_blocks(), 0)
         self.assertGreater(sim.get_num_migration_record_blocks(), 0)
+        self.assertGreater(sim.get_num_transient_allocations(), 0)
+        profile = sim.get_profile()
+        self.assertIsInstance(profile["enabled"], bool)
+        for key, value in profile.items():
+            self.assertGreaterEqual(value, 0)
+        if profile["enabled"]:
+            self.assertGreaterEqual(
+                profile["max_num_ancestors"], sim.get_num_ancestors())
+        self.assertLessEqual(profile["overlap_node_heap_fragmentation"], 1)
+        if sim.get_model() in ["smc", "smc_prime"] and sim.get_num_loci() > 1:
+            self.assertGreater(profile["max_num_overlap_nodes"], 0)
+        else:
+            self.assertEqual(profile["max_num_overlap_nodes"], 0)
         n = sim.get_sample_size()
         m = sim.get_num_loci()
         N = sim.get_num_populations()
@@ -710,11 +723,12 @@ class TestSimulationState(LowLevelTestCase):
             self.assertEqual(sim.get_num_rejected_common_ancestor_events(), 0)
         elif sim.get_model() in ["smc", "smc_prime"]:
             self.assertGreaterEqual(sim.get_num_rejected_common_ancestor_events(), 0)
-        self.assertGreater(sim.get_num_avl_node_blocks(), 0)
+        self.assertEqual(sim.get_num_avl_node_blocks(), 0)
         self.assertGreater(sim.get_num_segment_blocks(), 0)
         self.assertGreater(sim.get_num_node_mapping_blocks(), 0)
         self.assertGreater(sim.get_num_coalescence_record_blocks(), 0)
         self.assertGreater(sim.get_num_migration_record_blocks(), 0)
+        self.assertGreater(sim.get_num_transient_allocations(), 0)
         self.assertGreater(sim.get_used_memory(), 0)
 
         records = sim.get_coalescence_records()
@@ -796,11 +810,12 @@ class TestSimulationState(LowLevelTestCase):
             self.assertEqual(0, sim.get_num_rejected_common_ancestor_events())
             self.assertEqual(0, sim.get_num_recombination_events())
             self.assertEqual(0, sum(sim.get_num_migration_events()))
-            self.assertGreater(sim.get_num_avl_node_blocks(), 0)
+            self.assertEqual(sim.get_num_avl_node_blocks(), 0)
             self.assertGreater(sim.get_num_segment_blocks(), 0)
             self.assertGreater(sim.get_num_node_mapping_blocks(), 0)
             self.assertGreater(sim.get_num_coalescence_record_blocks(), 0)
             self.assertGreater(sim.get_num_migration_record_blocks(), 0)
+            self.assertGreater(sim.get_num_transient_allocations(), 0)
             self.assertEqual(sim.get_sample_size(), n)
             self.assertEqual(sim.get_num_loci(), m)
             self.assertEqual(n, len(sim.get_ancestors()))
@@ -952,6 +967,27 @@ class TestSimulationState(LowLevelTestCase):
         self.verify_simulation(3, 10, 1.0, model="smc")
         self.verify_simulation(4, 10, 2.0, model="smc_prime")
 
+    def test_transient_allocations(self):
+        events = [
+            get_simple_bottleneck_event(time=0.1, proportion=0.5),
+            get_instantaneous_bottleneck_event(time=0.2, strength=1)]
+        # Small simulations fit in the initial scratch space.
+        sim = _msprime.Simulator(
+            get_samples(10), _msprime.RandomGenerator(1), num_loci=10,
+            scaled_recombination_rate=1, demographic_events=events,
+            node_mapping_block_size=1000)
+        for _ in range(3):
+            sim.run()
+            self.assertEqual(sim.get_num_transient_allocations(), 1)
+            sim.reset()
+        # With tiny blocks we must grow the scratch space.
+        sim = _msprime.Simulator(
+            get_samples(100), _msprime.RandomGenerator(1), num_loci=10,
+            scaled_recombination_rate=1, demographic_events=events,
+            node_mapping_block_size=1)
+        sim.run()
+        self.assertGreater(sim.get_num_transient_allocations(), 1)
+
     def test_event_by_event(self):
         n = 10
         m = 100
@@ -1160,6 +1196,36 @@ class TestSimulator(LowLevelTestCase):
         sim = f()
         self.assertFalse(sim.get_store_migration_records())
 
+    def test_sequential(self):
+        def f(sample_size=10, random_seed=1, **kwargs):
+            return _msprime.Simulator(
+                get_samples(sample_size),
+                _msprime.RandomGenerator(random_seed), **kwargs)
+        for bad_type in [[], "False", None, {}, str]:
+            self.assertRaises(TypeError, f, sequential=bad_type)
+        self.assertFalse(f().get_sequential())
+        for model in ["smc", "smc_prime"]:
+            sim = f(
+                model=model, sequential=True, num_loci=1000,
+                scaled_recombination_rate=0.01)
+            self.assertTrue(sim.get_sequential())
+            # The sequential engine cannot stop at a given time.
+            self.assertRaises(_msprime.LibraryError, sim.run, 1.0)
+            self.assertTrue(sim.run())
+            self.assertEqual(sim.get_num_ancestors(), 0)
+            self.assertGreater(sim.get_num_breakpoints(), 0)
+            tree_sequence = _msprime.TreeSequence()
+            tree_sequence.create(sim, uniform_recombination_map(sim))
+            self.assertEqual(
+                tree_sequence.get_num_trees(), sim.get_num_breakpoints() + 1)
+        sim = f(sequential=True)
+        self.assertRaises(_msprime.LibraryError, sim.run)
+        sim = f(
+            model="smc", sequential=True, population_configuration=[
+                get_population_configuration(growth_rate=1.0)],
+            migration_matrix=[0])
+        self.assertRaises(_msprime.LibraryError, sim.run)
+
     def test_bad_samples(self):
         rng = _msprime.RandomGenerator(1)
 
@@ -1327,6 +1393,43 @@ class TestSimulator(LowLevelTestCase):
                 _msprime.RandomGenerator(1),
                 population_configuration=pop_conf)
 
+    def test_sparse_migration_matrix(self):
+        def f(num_populations, sparse_migration_matrix, **kwargs):
+            population_configuration = [
+                get_population_configuration()
+                for j in range(num_populations)]
+            population_configuration[0]["sample_size"] = 2
+            return _msprime.Simulator(
+                get_samples(2), _msprime.RandomGenerator(1),
+                population_configuration=population_configuration,
+                sparse_migration_matrix=sparse_migration_matrix, **kwargs)
+        for bad_type in ["", {}, None, 2, [""], [[]], [None], [(0, 1, "")]]:
+            self.assertRaises(TypeError, f, 2, bad_type)
+        for bad_value in [[(0, 1)], [(0, 1, 1, 1)], [(0, 1, -1)]]:
+            self.assertRaises(ValueError, f, 2, bad_value)
+        for bad_matrix in [[(0, 0, 1)], [(0, 2, 1)], [(0, 1, 1), (0, 1, 1)]]:
+            self.assertRaises(_msprime.InputError, f, 2, bad_matrix)
+        self.assertRaises(
+            ValueError, f, 2, [(0, 1, 1)], migration_matrix=[0, 1, 1, 0])
+        self.assertRaises(
+            ValueError, _msprime.Simulator, get_samples(2),
+            _msprime.RandomGenerator(1), sparse_migration_matrix=[])
+        # A stepping stone model on a ring
+        N = 20
+        entries = [(j, (j + 1) % N, 1.5) for j in range(N)]
+        sim = f(N, entries)
+        matrix = sim.get_migration_matrix()
+        for j in range(N):
+            for k in range(N):
+                rate = 1.5 if k == (j + 1) % N else 0
+                self.assertEqual(matrix[j * N + k], rate)
+        sim.run()
+        num_migration_events = sim.get_num_migration_events()
+        for j in range(N):
+            for k in range(N):
+                if k != (j + 1) % N:
+                    self.assertEqual(num_migration_events[j * N + k], 0)
+
     def test_get_migration_matrix(self):
         for N in range(1, 10):
             population_configuration = [get_population_configuration(2)] + [
@@ -1797,6 +1900,32 @@ class TestTreeSequence(LowLevelTestCase):
         self.assertEqual(
             sim.get_num_coalescence_records(), ts.get_num_records())
 
+    def test_create_adopt(self):
+        sim = _msprime.Simulator(
+            samples=get_samples(10), num_loci=100,
+            scaled_recombination_rate=0.1,
+            random_generator=_msprime.RandomGenerator(10))
+        recomb_map = uniform_recombination_map(sim)
+        self.assertRaises(
+            TypeError, _msprime.TreeSequence().create, sim, recomb_map,
+            adopt="True")
+        sim.run()
+        t1 = _msprime.TreeSequence()
+        t1.create(sim, recomb_map)
+        t2 = _msprime.TreeSequence()
+        t2.create(sim, recomb_map, adopt=True)
+        self.assertEqual(
+            [t1.get_record(j) for j in range(t1.get_num_records())],
+            [t2.get_record(j) for j in range(t2.get_num_records())])
+        # The records now belong to t2, so the simulator has none left.
+        self.assertEqual(sim.get_num_coalescence_records(), 0)
+        t3 = _msprime.TreeSequence()
+        self.assertRaises(_msprime.LibraryError, t3.create, sim, recomb_map)
+        sim.reset()
+        sim.run()
+        t3.create(sim, recomb_map, adopt=True)
+        self.assertGreater(t3.get_num_records(), 0)
+
     def test_file_errors(self):
         ts1 = self.get_tree_sequence()
 
@@ -1862,12 +1991,12 @@ class TestTreeSequence(LowLevelTestCase):
                 # tests are done in test_demography.
                 self.assertEqual(ts.get_sample(j), (0.0, 0))
 
-    def verify_dump_equality(self, ts):
+    def verify_dump_equality(self, ts, **kwargs):
         """
         Verifies that we can dump a copy of the specified tree sequence
         to the specified file, and load an identical copy.
         """
-        ts.dump(self.temp_file)
+        ts.dump(self.temp_file, **kwargs)
         ts2 = _msprime.TreeSequence()
         ts2.load(self.temp_file)
         self.assertEqual(ts.get_sample_size(), ts2.get_sample_size())
@@ -1887,6 +2016,61 @@ class TestTreeSequence(LowLevelTestCase):
         for ts in self.get_example_tree_sequences():
             self.verify_dump_equality(ts)
 
+    def test_lazy_load(self):
+        for ts in self.get_example_tree_sequences():
+            ts.dump(self.temp_file)
+            ts2 = _msprime.TreeSequence()
+            ts2.load(self.temp_file, lazy=True)
+            self.assertEqual(ts2.get_loaded_columns(), 0)
+            self.assertEqual(ts.get_sample_size(), ts2.get_sample_size())
+            self.assertEqual(
+                ts.get_sequence_length(), ts2.get_sequence_length())
+            self.assertEqual(ts.get_num_mutations(), ts2.get_num_mutations())
+            records = [
+                ts2.get_record(j) for j in range(ts2.get_num_records())]
+            self.assertEqual(
+                ts2.get_loaded_columns(),
+                _msprime.COLUMNS_NODES | _msprime.COLUMNS_RECORDS)
+            self.assertEqual(records, [
+                ts.get_record(j) for j in range(ts.get_num_records())])
+            self.assertEqual(ts.get_mutations(), ts2.get_mutations())
+            self.assertEqual(
+                ts.get_provenance_strings(), ts2.get_provenance_strings())
+            self.assertEqual(ts2.get_loaded_columns(), _msprime.COLUMNS_ALL)
+
+    def test_lazy_load_diffs_and_newick(self):
+        for ts in self.get_example_tree_sequences():
+            ts.dump(self.temp_file)
+            ts2 = _msprime.TreeSequence()
+            ts2.load(self.temp_file, lazy=True)
+            self.assertEqual(
+                list(_msprime.TreeDiffIterator(ts2)),
+                list(_msprime.TreeDiffIterator(ts)))
+            ts2 = _msprime.TreeSequence()
+            ts2.load(self.temp_file, lazy=True)
+            self.assertEqual(
+                list(_msprime.NewickConverter(ts2)),
+                list(_msprime.NewickConverter(ts)))
+
+    def test_native_dump_equality(self):
+        for ts in self.get_example_tree_sequences():
+            self.verify_dump_equality(ts, native_format=True)
+            self.assertRaises(
+                _msprime.LibraryError, ts.dump, self.temp_file,
+                zlib_compression=True, native_format=True)
+
+    def test_varint_dump_equality(self):
+        for ts in self.get_example_tree_sequences():
+            self.verify_dump_equality(
+                ts, varint_encoding=True, native_format=True)
+            # Varint encoding is only supported by the native format
+            self.assertRaises(
+                _msprime.LibraryError, ts.dump, self.temp_file,
+                varint_encoding=True)
+            self.assertRaises(
+                _msprime.LibraryError, ts.dump, self.temp_file,
+                varint_encoding=True, zlib_compression=True)
+
     def test_generate_mutations_interface(self):
         ts = _msprime.TreeSequence()
         # This hasn't been initialised, so should fail.
@@ -3085,6 +3269,49 @@ class TestRandomGenerator(unittest.TestCase):
             rng = _msprime.RandomGenerator(s)
             self.assertEqual(rng.get_seed(), s)
 
+    def test_algorithm(self):
+        rng = _msprime.RandomGenerator(1)
+        self.assertNotEqual(rng.get_algorithm(), "philox4x32-10")
+        rng = _msprime.RandomGenerator(1, algorithm="philox")
+        self.assertEqual(rng.get_algorithm(), "philox4x32-10")
+        self.assertEqual(rng.get_seed(), 1)
+        for bad_algorithm in ["", "threefry", "PHILOX"]:
+            self.assertRaises(
+                ValueError, _msprime.RandomGenerator, 1,
+                algorithm=bad_algorithm)
+        self.assertRaises(
+            TypeError, _msprime.RandomGenerator, 1, algorithm=1)
+
+    def test_set_stream(self):
+        rng = _msprime.RandomGenerator(1)
+        self.assertRaises(ValueError, rng.set_stream, 0)
+        rng = _msprime.RandomGenerator(1, algorithm="philox")
+        self.assertRaises(TypeError, rng.set_stream)
+        self.assertRaises(TypeError, rng.set_stream, "x")
+        for bad_value in [-1, 2**32]:
+            self.assertRaises(ValueError, rng.set_stream, bad_value)
+            self.assertRaises(ValueError, rng.set_stream, 0, bad_value)
+        rng.set_stream(0)
+        rng.set_stream(2**32 - 1, 2**32 - 1)
+
+    def test_streams(self):
+        def simulate(rng):
+            sim = _msprime.Simulator(get_samples(10), rng, num_loci=100)
+            sim.run()
+            return sim.get_time()
+
+        rng = _msprime.RandomGenerator(5, algorithm="philox")
+        t1 = simulate(rng)
+        rng.set_stream(0)
+        self.assertEqual(simulate(rng), t1)
+        times = set()
+        for j in range(1, 6):
+            rng.set_stream(j)
+            times.add(simulate(rng))
+        self.assertEqual(len(times), 5)
+        rng.set_stream(3)
+        self.assertIn(simulate(rng), times)
+
 
 class TestDemographyDebugger(unittest.TestCase):
     """
@@ -57,7 +57,8 @@ class TestRejectedCommonAncestorEventCounts(unittest.TestCase):
             sim.run()
             self.assertGreater(sim.get_num_common_ancestor_events(), threshold)
             self.assertGreater(sim.get_num_recombination_events(), threshold)
-            self.assertGreater(sim.get_num_rejected_common_ancestor_events(), 0)
+            # Pairs that can coalesce are sampled directly
+            self.assertEqual(sim.get_num_rejected_common_ancestor_events(), 0)
 
 
 class TestCoalescenceRecords(unittest.TestCase):
@@ -25,10 +25,12 @@ from __future__ import division
 import unittest
 import threading
 import random
+import tempfile
 
 import numpy as np
 
 import msprime
+import _msprime
 
 
 def run_threads(worker, num_threads):
@@ -80,6 +82,56 @@ class TestSimulatorThreads(unittest.TestCase):
             self.assertEqual(results[0], result)
 
 
+class TestParallelReplicates(unittest.TestCase):
+    """
+    Tests for simulating replicates on multiple threads.
+    """
+    def get_replicates(self, num_threads, num_replicates=20, random_seed=5):
+        iterator = msprime.simulate(
+            10, length=10, recombination_rate=0.2, mutation_rate=0.2,
+            random_seed=random_seed, num_replicates=num_replicates,
+            num_threads=num_threads)
+        return [
+            (list(ts.records()), list(ts.mutations())) for ts in iterator]
+
+    def test_thread_count_independence(self):
+        results = self.get_replicates(1)
+        self.assertEqual(len(results), 20)
+        self.assertGreater(len(set(str(r) for r in results)), 1)
+        for num_threads in [2, 3, 8, 30]:
+            self.assertEqual(results, self.get_replicates(num_threads))
+        self.assertNotEqual(
+            results, self.get_replicates(4, random_seed=6))
+
+    def test_zero_replicates(self):
+        self.assertEqual(self.get_replicates(4, num_replicates=0), [])
+
+    def test_early_exit(self):
+        iterator = msprime.simulate(
+            10, random_seed=1, num_replicates=100, num_threads=4)
+        for j, ts in enumerate(iterator):
+            if j == 3:
+                break
+        iterator.close()
+
+    def test_bad_parameters(self):
+        self.assertRaises(
+            ValueError, msprime.simulate, 10, num_threads=2)
+        self.assertRaises(
+            ValueError, msprime.simulate, 10, num_replicates=2,
+            num_threads=0)
+
+    def test_errors_propagated(self):
+        # A bad population ID is only detected when the low-level
+        # simulator is created on the worker thread.
+        iterator = msprime.simulate(
+            population_configurations=[
+                msprime.PopulationConfiguration(5)],
+            demographic_events=[msprime.MassMigration(0.1, 0, 2)],
+            num_replicates=5, num_threads=2)
+        self.assertRaises(_msprime.InputError, list, iterator)
+
+
 class TestLdCalculatorReplicates(unittest.TestCase):
     """
     Tests the LdCalculator object to ensure we get correct results
@@ -115,6 +167,28 @@ class TestLdCalculatorReplicates(unittest.TestCase):
         for j in range(m):
             self.assertTrue(np.allclose(results[j], A[j]))
 
+    def test_get_r2_multiple_instances_fresh_tree_sequence(self):
+        # No tree has sought in the tree sequence before the threads
+        # start, so the snapshots the trees seek from must not be built
+        # by the threads themselves.
+        ts = self.get_tree_sequence()
+        with tempfile.NamedTemporaryFile(prefix="msp_threads_") as f:
+            ts.dump(f.name)
+            fresh_ts = msprime.load(f.name)
+        A = msprime.LdCalculator(ts).get_r2_matrix()
+        m = A.shape[0]
+
+        def worker(thread_index, results):
+            ld_calc = msprime.LdCalculator(fresh_ts)
+            row = np.zeros(m)
+            results[thread_index] = row
+            for j in range(m):
+                row[j] = ld_calc.get_r2(thread_index, j)
+
+        results = run_threads(worker, m)
+        for j in range(m):
+            self.assertTrue(np.allclose(results[j], A[j]))
+
     def test_get_r2_single_instance(self):
         # This is the degenerate case where we have a single LdCalculator
         # instance shared by the threads. We should have only one thread
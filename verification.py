@@ -870,6 +870,14 @@ def main():
     verifier.add_ms_instance(
         "konrad-3", (
         "100 100 -t 2 -I 10 10 10 10 10 10 10 10 10 10 10 0.001 "))
+    # Many demes, where most events are migrations. Population 1 grows, so
+    # its common ancestor events are not drawn from the total event rate.
+    verifier.add_ms_instance(
+        "island-50-pops1", "100 1000 -t 2.0 -I 50 " + "2 " * 50 + "5.0")
+    verifier.add_ms_instance(
+        "island-50-pops2", (
+        "100 1000 -t 2.0 -r 5.0 1000 -I 50 " + "2 " * 50 + "5.0 "
+        "-g 1 5.0 -eN 0.5 0.5"))
 
     # Add some random instances.
     verifier.add_random_instance("random1")